@@ -18,6 +18,8 @@
 
 #include "tbt-parser.h"
 
+#include "tbt-parser/memory-usage.h"
+
 #include "common/check.h"
 #include "common/logging.h"
 
@@ -46,6 +48,10 @@ int main(int argc, const char *argv[]) {
 
     std::string inputFile;
 
+    bool probe = false;
+
+    bool mem = false;
+
     for (int i = 0; i < argc; i++) {
 
         if (std::strcmp(argv[i], "--input-file") == 0) {
@@ -58,6 +64,14 @@ int main(int argc, const char *argv[]) {
             i++;
 
             inputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--probe") == 0) {
+
+            probe = true;
+
+        } else if (std::strcmp(argv[i], "--mem") == 0) {
+
+            mem = true;
         }
     }
 
@@ -69,6 +83,27 @@ int main(int argc, const char *argv[]) {
     LOGI("input file: %s", inputFile.c_str());
 
 
+    if (probe) {
+
+        midi_probe p;
+
+        Status ret = probeMidiFile(inputFile.c_str(), p);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        auto info = midiProbeInfo(p);
+
+        LOGI("%s", info.c_str());
+
+        if (mem) {
+            LOGI("peak RSS: %zu bytes", peakResidentSetBytes());
+        }
+
+        return EXIT_SUCCESS;
+    }
+
     midi_file m;
 
     Status ret = parseMidiFile(inputFile.c_str(), m);
@@ -80,13 +115,24 @@ int main(int argc, const char *argv[]) {
     auto info = midiFileInfo(m);
 
     LOGI("%s", info.c_str());
+
+    if (mem) {
+
+        auto usage = midiMemoryUsageInfo(midiFileMemoryUsage(m));
+
+        LOGI("%s", usage.c_str());
+
+        LOGI("peak RSS: %zu bytes", peakResidentSetBytes());
+    }
     
     return EXIT_SUCCESS;
 }
 
 
 void printUsage() {
-    LOGI("usage: midi-info --input-file XXX");
+    LOGI("usage: midi-info --input-file XXX [--probe] [--mem]");
+    LOGI("--probe (only read header, track names, tempo map, and times, without decoding every event)");
+    LOGI("--mem (also print approximate memory used by the parsed file, and peak RSS)");
     LOGI();
 }
 
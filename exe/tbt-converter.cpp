@@ -18,11 +18,22 @@
 
 #include "tbt-parser.h"
 
+#include "tbt-parser/bulk-io.h"
+#include "tbt-parser/memory-usage.h"
+#include "tbt-parser/note-export.h"
+#include "tbt-parser/preview.h"
 #include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/trace.h"
+#include "tbt-parser/watch.h"
 
+#include "common/file.h"
 #include "common/logging.h"
 
+#include <algorithm> // for sort
+#include <atomic>
+#include <filesystem>
 #include <string>
+#include <thread>
 #include <cstring>
 #include <cstdlib>
 
@@ -30,8 +41,32 @@
 #define TAG "tbt-converter"
 
 
+struct preview_args {
+    bool enabled = false;
+    wav_sample_format format = WAV_PCM16;
+    preview_render_opts opts;
+};
+
+
+struct notes_args {
+    bool enabled = false;
+    note_export_format format = NOTE_EXPORT_CSV;
+};
+
+
+const char *notesExtension(note_export_format format);
+
+
 void printUsage();
 
+void logDiagnostics(const std::string &path, const tbt_diagnostics &diagnostics);
+
+int convertFile(const std::string &inputFile, const std::string &outputFile, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes, bool mem);
+
+int convertDirectory(const std::string &inputDir, const std::string &outputDir, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes, bool mem);
+
+int watchDirectory(const std::string &dir, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes);
+
 
 int main(int argc, const char *argv[]) {
 
@@ -45,9 +80,19 @@ int main(int argc, const char *argv[]) {
 
     std::string inputFile;
     std::string outputFile;
+    std::string inputDir;
+    std::string outputDir;
+    std::string watchDir;
+    std::string traceFile;
 
     midi_convert_opts opts;
 
+    preview_args preview;
+
+    notes_args notes;
+
+    bool mem = false;
+
     for (int i = 0; i < argc; i++) {
 
         if (std::strcmp(argv[i], "--input-file") == 0) {
@@ -72,6 +117,152 @@ int main(int argc, const char *argv[]) {
 
             outputFile = argv[i];
 
+        } else if (std::strcmp(argv[i], "--input-dir") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            inputDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--output-dir") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            outputDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--watch") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            watchDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--trace") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            traceFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--tracks") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            if (parseTrackSelection(argv[i], opts.selected_tracks) != OK) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[i], "--preview") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            if (std::strcmp(argv[i], "0") == 0) {
+
+                preview.enabled = false;
+
+            } else if (std::strcmp(argv[i], "1") == 0) {
+
+                preview.enabled = true;
+
+            } else {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[i], "--preview-format") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            if (std::strcmp(argv[i], "s16") == 0) {
+
+                preview.format = WAV_PCM16;
+
+            } else if (std::strcmp(argv[i], "f32") == 0) {
+
+                preview.format = WAV_FLOAT32;
+
+            } else {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[i], "--preview-seconds") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            preview.opts.max_seconds = std::atof(argv[i]);
+
+            if (!(preview.opts.max_seconds > 0)) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[i], "--notes") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            if (std::strcmp(argv[i], "csv") == 0) {
+
+                notes.enabled = true;
+                notes.format = NOTE_EXPORT_CSV;
+
+            } else if (std::strcmp(argv[i], "col") == 0) {
+
+                notes.enabled = true;
+                notes.format = NOTE_EXPORT_COLUMNAR;
+
+            } else {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[i], "--mem") == 0) {
+
+            mem = true;
+
         } else if (std::strcmp(argv[i], "--emit-controlchange-events") == 0) {
 
             if (i == argc - 1) {
@@ -116,6 +307,28 @@ int main(int argc, const char *argv[]) {
                 return EXIT_FAILURE;
             }
 
+        } else if (std::strcmp(argv[i], "--eliminate-redundant-events") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            if (std::strcmp(argv[i], "0") == 0) {
+
+                opts.eliminate_redundant_events = false;
+
+            } else if (std::strcmp(argv[i], "1") == 0) {
+
+                opts.eliminate_redundant_events = true;
+
+            } else {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
         } else if (std::strcmp(argv[i], "--emit-pitchbend-events") == 0) {
 
             if (i == argc - 1) {
@@ -140,25 +353,81 @@ int main(int argc, const char *argv[]) {
         }
     }
 
-    if (inputFile.empty()) {
-        LOGE("input file is missing (or --input-file is not specified)");
-        return EXIT_FAILURE;
+    if (!watchDir.empty()) {
+
+        if (!inputFile.empty() || !outputFile.empty() || !inputDir.empty() || !outputDir.empty()) {
+            LOGE("--watch cannot be combined with --input-file, --output-file, --input-dir, or --output-dir");
+            return EXIT_FAILURE;
+        }
+
+    } else if (!inputDir.empty()) {
+
+        if (!inputFile.empty() || !outputFile.empty()) {
+            LOGE("--input-dir cannot be combined with --input-file or --output-file");
+            return EXIT_FAILURE;
+        }
+
+        if (outputDir.empty()) {
+            outputDir = inputDir;
+        }
+
+    } else {
+
+        if (inputFile.empty()) {
+            LOGE("input file is missing (or --input-file is not specified)");
+            return EXIT_FAILURE;
+        }
+
+        if (outputFile.empty()) {
+            outputFile = "out.mid";
+        }
+    }
+
+    if (!traceFile.empty()) {
+        LOGI("trace file: %s", traceFile.c_str());
+        traceBegin();
     }
 
-    if (outputFile.empty()) {
-        outputFile = "out.mid";
+    int exitCode;
+
+    if (!watchDir.empty()) {
+        exitCode = watchDirectory(watchDir, opts, preview, notes);
+    } else if (!inputDir.empty()) {
+        exitCode = convertDirectory(inputDir, outputDir, opts, preview, notes, mem);
+    } else {
+        exitCode = convertFile(inputFile, outputFile, opts, preview, notes, mem);
+    }
+
+    if (!traceFile.empty()) {
+
+        Status ret = traceEnd(traceFile.c_str());
+
+        if (ret != OK) {
+            return EXIT_FAILURE;
+        }
     }
 
+    return exitCode;
+}
+
+
+int convertFile(const std::string &inputFile, const std::string &outputFile, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes, bool mem) {
+
     LOGI("input file: %s", inputFile.c_str());
     LOGI("output file: %s", outputFile.c_str());
 
     LOGI("emit control change events: %d", opts.emit_control_change_events);
     LOGI("emit program change events: %d", opts.emit_program_change_events);
     LOGI("emit pitch bend events: %d", opts.emit_pitch_bend_events);
+    LOGI("eliminate redundant events: %d", opts.eliminate_redundant_events);
 
     tbt_file t;
 
-    Status ret = parseTbtFile(inputFile.c_str(), t);
+    tbt_parse_opts parseOpts;
+
+    parseOpts.selected_tracks = opts.selected_tracks;
+
+    Status ret = parseTbtFile(inputFile.c_str(), parseOpts, t);
 
     if (ret != OK) {
         return ret;
@@ -166,9 +435,17 @@ int main(int argc, const char *argv[]) {
 
     LOGI("exporting...");
 
+    tbt_diagnostics diagnostics;
+
+    auto fileOpts = opts;
+
+    fileOpts.diagnostics = &diagnostics;
+
     midi_file m;
 
-    ret = convertToMidi(t, opts, m);
+    ret = convertToMidi(t, fileOpts, m);
+
+    logDiagnostics(inputFile, diagnostics);
 
     if (ret != OK) {
         return ret;
@@ -180,18 +457,360 @@ int main(int argc, const char *argv[]) {
         return ret;
     }
 
+    if (preview.enabled) {
+
+        auto wavFile = std::filesystem::path(outputFile).replace_extension(".wav").string();
+
+        LOGI("rendering preview: %s", wavFile.c_str());
+
+        pcm_buffer pcm;
+
+        ret = renderPreview(m, preview.opts, pcm);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        ret = exportWavFile(pcm, preview.format, wavFile.c_str());
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    if (notes.enabled) {
+
+        auto notesFile = std::filesystem::path(outputFile).replace_extension(notesExtension(notes.format)).string();
+
+        LOGI("exporting notes: %s", notesFile.c_str());
+
+        note_table table;
+
+        ret = buildNoteTable(t, table);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        ret = exportNoteTableFile(table, notes.format, notesFile.c_str());
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    if (mem) {
+
+        auto tbtUsage = tbtMemoryUsageInfo(tbtFileMemoryUsage(t));
+
+        LOGI("%s", tbtUsage.c_str());
+
+        auto midiUsage = midiMemoryUsageInfo(midiFileMemoryUsage(m));
+
+        LOGI("%s", midiUsage.c_str());
+
+        LOGI("peak RSS: %zu bytes", peakResidentSetBytes());
+    }
+
     LOGI("finished!");
 
     return EXIT_SUCCESS;
 }
 
 
+//
+// parse and convert one file in memory, and hand each output (.mid, and optionally .wav and notes) to submit
+//
+// outPath is the path of the .mid file
+//
+template <typename Submit>
+Status convertBytes(const std::string &inputPath, const std::vector<uint8_t> &data, const std::filesystem::path &outPath, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes, note_table &table, Submit &&submit) {
+
+    tbt_parse_opts parseOpts;
+
+    parseOpts.selected_tracks = opts.selected_tracks;
+
+    tbt_file t;
+
+    auto it = data.cbegin();
+
+    auto end = data.cend();
+
+    Status ret = parseTbtBytes(it, end, parseOpts, t);
+
+    if (ret != OK) {
+        LOGE("cannot parse: %s", inputPath.c_str());
+        return ret;
+    }
+
+    tbt_diagnostics diagnostics;
+
+    auto fileOpts = opts;
+
+    fileOpts.diagnostics = &diagnostics;
+
+    midi_file m;
+
+    ret = convertToMidi(t, fileOpts, m);
+
+    logDiagnostics(inputPath, diagnostics);
+
+    if (ret != OK) {
+        LOGE("cannot convert: %s", inputPath.c_str());
+        return ret;
+    }
+
+    std::vector<uint8_t> out;
+
+    ret = exportMidiBytes(m, out);
+
+    if (ret != OK) {
+        LOGE("cannot export: %s", inputPath.c_str());
+        return ret;
+    }
+
+    submit(outPath.string(), std::move(out));
+
+    if (preview.enabled) {
+
+        pcm_buffer pcm;
+
+        ret = renderPreview(m, preview.opts, pcm);
+
+        if (ret != OK) {
+            LOGE("cannot render preview: %s", inputPath.c_str());
+            return ret;
+        }
+
+        std::vector<uint8_t> wav;
+
+        ret = exportWavBytes(pcm, preview.format, wav);
+
+        if (ret != OK) {
+            LOGE("cannot export preview: %s", inputPath.c_str());
+            return ret;
+        }
+
+        submit(std::filesystem::path(outPath).replace_extension(".wav").string(), std::move(wav));
+    }
+
+    if (notes.enabled) {
+
+        ret = buildNoteTable(t, table);
+
+        if (ret != OK) {
+            LOGE("cannot build notes: %s", inputPath.c_str());
+            return ret;
+        }
+
+        std::vector<uint8_t> notesBytes;
+
+        ret = exportNoteTableBytes(table, notes.format, notesBytes);
+
+        if (ret != OK) {
+            LOGE("cannot export notes: %s", inputPath.c_str());
+            return ret;
+        }
+
+        submit(std::filesystem::path(outPath).replace_extension(notesExtension(notes.format)).string(), std::move(notesBytes));
+    }
+
+    return OK;
+}
+
+
+//
+// convert every .tbt file in inputDir to a .mid file in outputDir
+//
+// reading and writing are done with bulk_file_reader and bulk_file_writer,
+// and conversion is done on all cores
+//
+int convertDirectory(const std::string &inputDir, const std::string &outputDir, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes, bool mem) {
+
+    std::vector<std::string> paths;
+
+    std::error_code ec;
+
+    for (const auto &entry : std::filesystem::directory_iterator(inputDir, ec)) {
+
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        if (entry.path().extension() != ".tbt") {
+            continue;
+        }
+
+        paths.push_back(entry.path().string());
+    }
+
+    if (ec) {
+        LOGE("cannot read directory: %s: %s", inputDir.c_str(), ec.message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    LOGI("input dir: %s (%zu files)", inputDir.c_str(), paths.size());
+    LOGI("output dir: %s", outputDir.c_str());
+
+    bulk_io_opts ioOpts;
+
+    bulk_file_reader reader(paths, ioOpts);
+    bulk_file_writer writer(ioOpts);
+
+    LOGI("I/O backend: %s", (reader.backend() == BULK_IO_URING) ? "io_uring" : "threads");
+
+    std::atomic<size_t> failed = 0;
+
+    auto worker = [&]() {
+
+        bulk_read_item item;
+
+        //
+        // reused for every file on this thread
+        //
+        note_table table;
+
+        while (reader.next(item)) {
+
+            trace_span span("file", "path", item.path.c_str());
+
+            if (item.status != OK) {
+                failed++;
+                continue;
+            }
+
+            auto outPath = std::filesystem::path(outputDir) / std::filesystem::path(item.path).filename().replace_extension(".mid");
+
+            Status ret = convertBytes(item.path, item.data, outPath, opts, preview, notes, table, [&](std::string path, std::vector<uint8_t> data) {
+                writer.submit(std::move(path), std::move(data));
+            });
+
+            if (ret != OK) {
+                failed++;
+                continue;
+            }
+        }
+    };
+
+    auto n = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < n; i++) {
+        threads.emplace_back(worker);
+    }
+
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    if (writer.finish() != OK) {
+        LOGE("some files could not be written");
+        return EXIT_FAILURE;
+    }
+
+    if (failed != 0) {
+        LOGE("%zu of %zu files failed", failed.load(), paths.size());
+        return EXIT_FAILURE;
+    }
+
+    if (mem) {
+        LOGI("peak RSS: %zu bytes", peakResidentSetBytes());
+    }
+
+    LOGI("finished!");
+
+    return EXIT_SUCCESS;
+}
+
+
+//
+// reconvert .tbt files in dir whenever they change, until interrupted
+//
+// outputs are written next to the inputs, atomically
+//
+int watchDirectory(const std::string &dir, const midi_convert_opts &opts, const preview_args &preview, const notes_args &notes) {
+
+    directory_watcher watcher;
+
+    Status ret = watcher.open(dir, ".tbt", watch_opts{});
+
+    if (ret != OK) {
+        return EXIT_FAILURE;
+    }
+
+    LOGI("watching dir: %s (%s)", dir.c_str(), (watcher.backend() == WATCH_INOTIFY) ? "inotify" : "polling");
+
+    watcher.run(".mid", [&](const std::string &path) {
+
+        std::vector<uint8_t> data;
+
+        if (openFile(path.c_str(), data) != OK) {
+            return;
+        }
+
+        note_table table;
+
+        auto outPath = std::filesystem::path(path).replace_extension(".mid");
+
+        Status writeStatus = OK;
+
+        Status convertStatus = convertBytes(path, data, outPath, opts, preview, notes, table, [&writeStatus](const std::string &outputPath, const std::vector<uint8_t> &bytes) {
+
+            if (saveFileAtomically(outputPath, bytes) != OK) {
+                LOGE("cannot write: %s", outputPath.c_str());
+                writeStatus = ERR;
+            }
+        });
+
+        if (convertStatus == OK && writeStatus == OK) {
+            LOGI("converted: %s", path.c_str());
+        }
+    });
+
+    return EXIT_SUCCESS;
+}
+
+
+//
+// log each kind of warning once, instead of once per occurrence
+//
+void logDiagnostics(const std::string &path, const tbt_diagnostics &diagnostics) {
+
+    for (const auto &e : diagnostics.entries) {
+
+        if (e.firstTrack == -1) {
+            LOGW("%s: %s: %u time(s), first at space %f", path.c_str(), tbtDiagnosticCodeString(e.code), e.count, e.firstSpace);
+        } else {
+            LOGW("%s: %s: %u time(s), first at space %f in track %d", path.c_str(), tbtDiagnosticCodeString(e.code), e.count, e.firstSpace, e.firstTrack);
+        }
+    }
+}
+
+
+const char *notesExtension(note_export_format format) {
+    return (format == NOTE_EXPORT_CSV) ? ".notes.csv" : ".notes.col";
+}
+
+
 void printUsage() {
     LOGI("usage: tbt-converter --input-file XXX [--output-file YYY (default: out.mid)] [options]");
+    LOGI("       tbt-converter --input-dir XXX [--output-dir YYY (default: XXX)] [options]");
+    LOGI("       tbt-converter --watch XXX [options] (reconvert .tbt files in XXX when they change, writing next to them)");
     LOGI("options:");
     LOGI("--emit-controlchange-events (0|1) (default: 1)");
     LOGI("--emit-programchange-events (0|1) (default: 1)");
     LOGI("--emit-pitchbend-events (0|1) (default: 1)");
+    LOGI("--eliminate-redundant-events (0|1) (default: 0) (drop controller, program, and pitch bend events that do not change anything)");
+    LOGI("--tracks N,M,... (only convert these tracks, numbered from 0)");
+    LOGI("--preview (0|1) (default: 0) (also render a .wav preview next to each .mid file)");
+    LOGI("--preview-format (s16|f32) (default: s16)");
+    LOGI("--preview-seconds N (default: 30)");
+    LOGI("--notes (csv|col) (also export a note table next to each .mid file)");
+    LOGI("--mem (also print approximate memory used by the parsed and converted file, and peak RSS; only peak RSS with --input-dir)");
+    LOGI("--trace ZZZ (write Chrome trace-event JSON to ZZZ, viewable in Perfetto)");
     LOGI();
 }
 
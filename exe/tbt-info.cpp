@@ -18,6 +18,7 @@
 
 #include "tbt-parser.h"
 
+#include "tbt-parser/memory-usage.h"
 #include "tbt-parser/tbt-parser-util.h"
 
 #include "common/logging.h"
@@ -45,6 +46,8 @@ int main(int argc, const char *argv[]) {
 
     std::string inputFile;
 
+    bool mem = false;
+
     for (int i = 0; i < argc; i++) {
 
         if (std::strcmp(argv[i], "--input-file") == 0) {
@@ -57,6 +60,10 @@ int main(int argc, const char *argv[]) {
             i++;
 
             inputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--mem") == 0) {
+
+            mem = true;
         }
     }
 
@@ -94,12 +101,22 @@ int main(int argc, const char *argv[]) {
 
     LOGI("%s", comment.c_str());
 
+    if (mem) {
+
+        auto usage = tbtMemoryUsageInfo(tbtFileMemoryUsage(t));
+
+        LOGI("%s", usage.c_str());
+
+        LOGI("peak RSS: %zu bytes", peakResidentSetBytes());
+    }
+
     return EXIT_SUCCESS;
 }
 
 
 void printUsage() {
-    LOGI("usage: tbt-info --input-file XXX");
+    LOGI("usage: tbt-info --input-file XXX [--mem]");
+    LOGI("--mem (also print approximate memory used by the parsed file, and peak RSS)");
     LOGI();
 }
 
@@ -0,0 +1,229 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+
+#include "tbt-parser/bulk-io.h"
+#include "tbt-parser/pack.h"
+
+#include "common/logging.h"
+
+#include <algorithm> // for sort
+#include <filesystem>
+#include <string>
+#include <utility> // for move
+#include <cstring>
+#include <cstdlib>
+
+
+#define TAG "tbt-pack"
+
+
+void printUsage();
+
+
+int main(int argc, const char *argv[]) {
+
+    LOGI("tbt pack v1.0.0");
+    LOGI("Copyright (C) 2024 by Brenton Bostick");
+
+    if (argc == 1) {
+        printUsage();
+        return EXIT_SUCCESS;
+    }
+
+    std::string inputDir;
+    std::string outputFile;
+    bool convert = false;
+    bool midiOnly = false;
+    tbt_pack_write_opts opts;
+
+    for (int i = 0; i < argc; i++) {
+
+        if (std::strcmp(argv[i], "--input-dir") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            inputDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--output-file") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            outputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--convert") == 0) {
+
+            convert = true;
+
+        } else if (std::strcmp(argv[i], "--midi-only") == 0) {
+
+            convert = true;
+            midiOnly = true;
+
+        } else if (std::strcmp(argv[i], "--metadata") == 0) {
+
+            opts.include_metadata = true;
+        }
+    }
+
+    if (inputDir.empty()) {
+        LOGE("input dir is missing (or --input-dir is not specified)");
+        return EXIT_FAILURE;
+    }
+
+    if (outputFile.empty()) {
+        outputFile = "out.tbtpack";
+    }
+
+    std::vector<std::string> paths;
+
+    std::error_code ec;
+
+    for (const auto &entry : std::filesystem::directory_iterator(inputDir, ec)) {
+
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        auto ext = entry.path().extension();
+
+        //
+        // with --convert, .mid files come from converting, not from the directory
+        //
+        if (ext == ".tbt" || (ext == ".mid" && !convert)) {
+            paths.push_back(entry.path().string());
+        }
+    }
+
+    if (ec) {
+        LOGE("cannot read directory: %s: %s", inputDir.c_str(), ec.message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    LOGI("input dir: %s (%zu files)", inputDir.c_str(), paths.size());
+    LOGI("output file: %s", outputFile.c_str());
+
+    bulk_io_opts ioOpts;
+
+    bulk_file_reader reader(paths, ioOpts);
+
+    std::vector<tbt_pack_input> inputs;
+
+    size_t failed = 0;
+
+    bulk_read_item item;
+
+    while (reader.next(item)) {
+
+        if (item.status != OK) {
+            failed++;
+            continue;
+        }
+
+        auto name = std::filesystem::path(item.path).filename();
+
+        if (name.extension() == ".mid") {
+            inputs.push_back({ name.string(), PACK_MIDI, std::move(item.data) });
+            continue;
+        }
+
+        if (convert) {
+
+            tbt_file t;
+
+            auto it = item.data.cbegin();
+
+            Status ret = parseTbtBytes(it, item.data.cend(), t);
+
+            if (ret != OK) {
+                LOGE("%s: cannot parse", item.path.c_str());
+                failed++;
+                continue;
+            }
+
+            std::vector<uint8_t> midiBytes;
+
+            ret = convertToMidiBytes(t, midi_convert_opts{}, midiBytes);
+
+            if (ret != OK) {
+                LOGE("%s: cannot convert", item.path.c_str());
+                failed++;
+                continue;
+            }
+
+            inputs.push_back({ std::filesystem::path(name).replace_extension(".mid").string(), PACK_MIDI, std::move(midiBytes) });
+        }
+
+        if (!midiOnly) {
+            inputs.push_back({ name.string(), PACK_TBT, std::move(item.data) });
+        }
+    }
+
+    if (failed != 0) {
+        LOGE("%zu of %zu files failed", failed, paths.size());
+        return EXIT_FAILURE;
+    }
+
+    auto entryCount = inputs.size();
+
+    Status ret = writeTbtPackFile(std::move(inputs), opts, outputFile.c_str());
+
+    if (ret != OK) {
+        return EXIT_FAILURE;
+    }
+
+    LOGI("packed %zu entries: %s", entryCount, outputFile.c_str());
+
+    return EXIT_SUCCESS;
+}
+
+
+void printUsage() {
+    LOGI("usage: tbt-pack --input-dir XXX [--output-file YYY (default: out.tbtpack)] [--convert | --midi-only] [--metadata]");
+    LOGI("packs the .tbt and .mid files in XXX into a single file");
+    LOGI("--convert: pack each .tbt file and its converted .mid file (.mid files in XXX are ignored)");
+    LOGI("--midi-only: pack only the converted .mid files");
+    LOGI("--metadata: store the version, track count, and duration of every entry");
+    LOGI();
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -18,11 +18,15 @@
 
 #include "tbt-parser.h"
 
+#include "tbt-parser/memory-usage.h"
 #include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/trace.h"
+#include "tbt-parser/watch.h"
 
 #include "common/file.h"
 #include "common/logging.h"
 
+#include <filesystem>
 #include <string>
 #include <cstring>
 #include <cstdlib>
@@ -33,6 +37,10 @@
 
 void printUsage();
 
+int printFile(const std::string &inputFile, const std::string &outputFile, const std::vector<bool> &selectedTracks, bool mem);
+
+int watchDirectory(const std::string &dir, const std::vector<bool> &selectedTracks);
+
 
 int main(int argc, const char *argv[]) {
 
@@ -46,6 +54,12 @@ int main(int argc, const char *argv[]) {
 
     std::string inputFile;
     std::string outputFile;
+    std::string watchDir;
+    std::string traceFile;
+
+    std::vector<bool> selectedTracks;
+
+    bool mem = false;
 
     for (int i = 0; i < argc; i++) {
 
@@ -70,18 +84,96 @@ int main(int argc, const char *argv[]) {
             i++;
 
             outputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--watch") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            watchDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--trace") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            traceFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--tracks") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            if (parseTrackSelection(argv[i], selectedTracks) != OK) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+        } else if (std::strcmp(argv[i], "--mem") == 0) {
+
+            mem = true;
         }
     }
 
-    if (inputFile.empty()) {
-        LOGE("input file is missing (or --input-file is not specified)");
-        return EXIT_FAILURE;
+    if (!watchDir.empty()) {
+
+        if (!inputFile.empty() || !outputFile.empty()) {
+            LOGE("--watch cannot be combined with --input-file or --output-file");
+            return EXIT_FAILURE;
+        }
+
+    } else {
+
+        if (inputFile.empty()) {
+            LOGE("input file is missing (or --input-file is not specified)");
+            return EXIT_FAILURE;
+        }
+
+        if (outputFile.empty()) {
+            outputFile = "out.txt";
+        }
+    }
+
+    if (!traceFile.empty()) {
+        LOGI("trace file: %s", traceFile.c_str());
+        traceBegin();
+    }
+
+    int exitCode;
+
+    if (!watchDir.empty()) {
+        exitCode = watchDirectory(watchDir, selectedTracks);
+    } else {
+        exitCode = printFile(inputFile, outputFile, selectedTracks, mem);
     }
 
-    if (outputFile.empty()) {
-        outputFile = "out.txt";
+    if (!traceFile.empty()) {
+
+        Status ret = traceEnd(traceFile.c_str());
+
+        if (ret != OK) {
+            return EXIT_FAILURE;
+        }
     }
 
+    return exitCode;
+}
+
+
+int printFile(const std::string &inputFile, const std::string &outputFile, const std::vector<bool> &selectedTracks, bool mem) {
+
     LOGI("input file: %s", inputFile.c_str());
     LOGI("output file: %s", outputFile.c_str());
 
@@ -90,7 +182,11 @@ int main(int argc, const char *argv[]) {
 
     LOGI("parsing...");
 
-    Status ret = parseTbtFile(inputFile.c_str(), t);
+    tbt_parse_opts parseOpts;
+
+    parseOpts.selected_tracks = selectedTracks;
+
+    Status ret = parseTbtFile(inputFile.c_str(), parseOpts, t);
 
     if (ret != OK) {
         return ret;
@@ -98,24 +194,98 @@ int main(int argc, const char *argv[]) {
 
     LOGI("printing...");
 
-    auto tab = tbtFileTablature(t);
+    std::string tab;
+    {
+        trace_span span("tablature");
+
+        tbt_tablature_opts tabOpts;
+
+        tabOpts.selected_tracks = selectedTracks;
+
+        tab = tbtFileTablature(t, tabOpts);
+    }
 
     auto buf = std::vector<uint8_t>(tab.begin(), tab.end());
 
-    ret = saveFile(outputFile.c_str(), buf);
+    {
+        trace_span span("write", "path", outputFile.c_str());
+
+        ret = saveFile(outputFile.c_str(), buf);
+    }
 
     if (ret != OK) {
         return ret;
     }
 
+    if (mem) {
+
+        auto usage = tbtMemoryUsageInfo(tbtFileMemoryUsage(t));
+
+        LOGI("%s", usage.c_str());
+
+        LOGI("peak RSS: %zu bytes", peakResidentSetBytes());
+    }
+
     LOGI("finished!");
 
     return EXIT_SUCCESS;
 }
 
 
+//
+// reprint .tbt files in dir whenever they change, until interrupted
+//
+// .txt files are written next to the inputs, atomically
+//
+int watchDirectory(const std::string &dir, const std::vector<bool> &selectedTracks) {
+
+    directory_watcher watcher;
+
+    Status ret = watcher.open(dir, ".tbt", watch_opts{});
+
+    if (ret != OK) {
+        return EXIT_FAILURE;
+    }
+
+    LOGI("watching dir: %s (%s)", dir.c_str(), (watcher.backend() == WATCH_INOTIFY) ? "inotify" : "polling");
+
+    watcher.run(".txt", [&](const std::string &path) {
+
+        tbt_parse_opts parseOpts;
+
+        parseOpts.selected_tracks = selectedTracks;
+
+        tbt_file t;
+
+        if (parseTbtFile(path.c_str(), parseOpts, t) != OK) {
+            LOGE("cannot parse: %s", path.c_str());
+            return;
+        }
+
+        tbt_tablature_opts tabOpts;
+
+        tabOpts.selected_tracks = selectedTracks;
+
+        auto tab = tbtFileTablature(t, tabOpts);
+
+        auto outPath = std::filesystem::path(path).replace_extension(".txt").string();
+
+        if (saveFileAtomically(outPath, std::vector<uint8_t>(tab.begin(), tab.end())) == OK) {
+            LOGI("printed: %s", path.c_str());
+        }
+    });
+
+    return EXIT_SUCCESS;
+}
+
+
 void printUsage() {
-    LOGI("usage: tbt-printer --input-file XXX [--output-file YYY (default: out.txt)]");
+    LOGI("usage: tbt-printer --input-file XXX [--output-file YYY (default: out.txt)] [options]");
+    LOGI("       tbt-printer --watch XXX [options] (reprint .tbt files in XXX when they change, writing next to them)");
+    LOGI("options:");
+    LOGI("--tracks N,M,... (only print these tracks, numbered from 0)");
+    LOGI("--mem (also print approximate memory used by the parsed file, and peak RSS)");
+    LOGI("--trace ZZZ (write Chrome trace-event JSON to ZZZ, viewable in Perfetto)");
     LOGI();
 }
 
@@ -0,0 +1,182 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/bulk-io.h"
+#include "tbt-parser/pack.h"
+
+#include "common/logging.h"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+
+#define TAG "tbt-unpack"
+
+
+void printUsage();
+
+bool safeEntryName(std::string_view name);
+
+
+int main(int argc, const char *argv[]) {
+
+    LOGI("tbt unpack v1.0.0");
+    LOGI("Copyright (C) 2024 by Brenton Bostick");
+
+    if (argc == 1) {
+        printUsage();
+        return EXIT_SUCCESS;
+    }
+
+    std::string inputFile;
+    std::string outputDir;
+    bool list = false;
+
+    for (int i = 0; i < argc; i++) {
+
+        if (std::strcmp(argv[i], "--input-file") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            inputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--output-dir") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            outputDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--list") == 0) {
+
+            list = true;
+        }
+    }
+
+    if (inputFile.empty()) {
+        LOGE("input file is missing (or --input-file is not specified)");
+        return EXIT_FAILURE;
+    }
+
+    tbt_pack pack;
+
+    Status ret = pack.open(inputFile.c_str());
+
+    if (ret != OK) {
+        return EXIT_FAILURE;
+    }
+
+    LOGI("input file: %s (%zu entries)", inputFile.c_str(), pack.size());
+
+    if (list) {
+
+        auto info = tbtPackInfo(pack);
+
+        LOGI("%s", info.c_str());
+
+        return EXIT_SUCCESS;
+    }
+
+    if (outputDir.empty()) {
+        outputDir = ".";
+    }
+
+    LOGI("output dir: %s", outputDir.c_str());
+
+    bulk_io_opts ioOpts;
+
+    bulk_file_writer writer(ioOpts);
+
+    size_t skipped = 0;
+
+    for (size_t i = 0; i < pack.size(); i++) {
+
+        auto e = pack.entry(i);
+
+        if (!safeEntryName(e.name)) {
+            LOGE("skipping entry with unsafe name: %.*s", static_cast<int>(e.name.size()), e.name.data());
+            skipped++;
+            continue;
+        }
+
+        auto outPath = (std::filesystem::path(outputDir) / std::string(e.name)).string();
+
+        writer.submit(std::move(outPath), std::vector<uint8_t>(e.data.begin(), e.data.end()));
+    }
+
+    if (writer.finish() != OK) {
+        LOGE("some files could not be written");
+        return EXIT_FAILURE;
+    }
+
+    if (skipped != 0) {
+        LOGE("%zu of %zu entries skipped", skipped, pack.size());
+        return EXIT_FAILURE;
+    }
+
+    LOGI("unpacked %zu entries", pack.size());
+
+    return EXIT_SUCCESS;
+}
+
+
+//
+// entries are only written directly into the output dir
+//
+bool safeEntryName(std::string_view name) {
+
+    if (name.empty() || name == "." || name == "..") {
+        return false;
+    }
+
+    return name.find_first_of("/\\:") == std::string_view::npos;
+}
+
+
+void printUsage() {
+    LOGI("usage: tbt-unpack --input-file XXX [--output-dir YYY (default: .)] [--list]");
+    LOGI("writes every entry of the pack XXX as a file in YYY");
+    LOGI("--list: print the entries instead of writing them");
+    LOGI();
+}
+
+
+
+
+
+
+
+
+
+
+
+
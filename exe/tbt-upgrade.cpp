@@ -0,0 +1,259 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser.h"
+
+#include "tbt-parser/tbt-encode.h"
+#include "tbt-parser/watch.h"
+
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <algorithm> // for sort
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+
+#define TAG "tbt-upgrade"
+
+
+void printUsage();
+
+Status upgradeFile(const std::string &inputFile, const std::string &outputFile);
+
+
+int main(int argc, const char *argv[]) {
+
+    LOGI("tbt upgrade v1.0.0");
+    LOGI("Copyright (C) 2024 by Brenton Bostick");
+
+    if (argc == 1) {
+        printUsage();
+        return EXIT_SUCCESS;
+    }
+
+    std::string inputFile;
+    std::string outputFile;
+    std::string inputDir;
+    std::string outputDir;
+
+    for (int i = 0; i < argc; i++) {
+
+        if (std::strcmp(argv[i], "--input-file") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            inputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--output-file") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            outputFile = argv[i];
+
+        } else if (std::strcmp(argv[i], "--input-dir") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            inputDir = argv[i];
+
+        } else if (std::strcmp(argv[i], "--output-dir") == 0) {
+
+            if (i == argc - 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+
+            i++;
+
+            outputDir = argv[i];
+        }
+    }
+
+    if (!inputDir.empty()) {
+
+        if (!inputFile.empty() || !outputFile.empty()) {
+            LOGE("--input-dir cannot be combined with --input-file or --output-file");
+            return EXIT_FAILURE;
+        }
+
+        if (outputDir.empty()) {
+            outputDir = inputDir;
+        }
+
+        std::vector<std::string> paths;
+
+        std::error_code ec;
+
+        for (const auto &entry : std::filesystem::directory_iterator(inputDir, ec)) {
+
+            if (!entry.is_regular_file() || entry.path().extension() != ".tbt") {
+                continue;
+            }
+
+            paths.push_back(entry.path().string());
+        }
+
+        if (ec) {
+            LOGE("cannot read directory: %s: %s", inputDir.c_str(), ec.message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::sort(paths.begin(), paths.end());
+
+        LOGI("input dir: %s (%zu files)", inputDir.c_str(), paths.size());
+        LOGI("output dir: %s", outputDir.c_str());
+
+        size_t failures = 0;
+
+        for (const auto &path : paths) {
+
+            auto outPath = (std::filesystem::path(outputDir) / std::filesystem::path(path).filename()).string();
+
+            if (upgradeFile(path, outPath) != OK) {
+                failures++;
+            }
+        }
+
+        LOGI("upgraded %zu of %zu files", paths.size() - failures, paths.size());
+
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (inputFile.empty()) {
+        LOGE("input file is missing (or --input-file is not specified)");
+        return EXIT_FAILURE;
+    }
+
+    if (outputFile.empty()) {
+        outputFile = "out.tbt";
+    }
+
+    return (upgradeFile(inputFile, outputFile) == OK) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+//
+// nothing is written unless the upgraded file parses again and converts to the same MIDI
+// (apart from the trimmed padding of files before 0x6f)
+//
+Status upgradeFile(const std::string &inputFile, const std::string &outputFile) {
+
+    std::vector<uint8_t> data;
+
+    Status ret = openFile(inputFile.c_str(), data);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    tbt_file t;
+
+    auto it = data.cbegin();
+
+    ret = parseTbtBytes(it, data.cend(), t);
+
+    if (ret != OK) {
+        LOGE("%s: cannot parse", inputFile.c_str());
+        return ret;
+    }
+
+    tbt_file upgraded;
+
+    ret = upgradeTbtFile(t, upgraded);
+
+    if (ret != OK) {
+        LOGE("%s: cannot upgrade", inputFile.c_str());
+        return ret;
+    }
+
+    std::vector<uint8_t> encoded;
+
+    ret = encodeTbtBytes(upgraded, encoded);
+
+    if (ret != OK) {
+        LOGE("%s: cannot encode", inputFile.c_str());
+        return ret;
+    }
+
+    tbt_file reparsed;
+
+    auto encoded_it = encoded.cbegin();
+
+    ret = parseTbtBytes(encoded_it, encoded.cend(), reparsed);
+
+    if (ret != OK) {
+        LOGE("%s: upgraded file does not parse", inputFile.c_str());
+        return ret;
+    }
+
+    ret = verifyUpgradedTbtFile(t, reparsed);
+
+    if (ret != OK) {
+        LOGE("%s: upgraded file does not convert to the same MIDI", inputFile.c_str());
+        return ret;
+    }
+
+    ret = saveFileAtomically(outputFile, encoded);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    LOGI("%s: 0x%02x -> 0x%02x, %zu -> %zu bytes: %s", inputFile.c_str(), tbtFileVersionNumber(t), tbtFileVersionNumber(reparsed), data.size(), encoded.size(), outputFile.c_str());
+
+    return OK;
+}
+
+
+void printUsage() {
+    LOGI("usage: tbt-upgrade --input-file XXX [--output-file YYY (default: out.tbt)]");
+    LOGI("       tbt-upgrade --input-dir XXX [--output-dir YYY (default: XXX, replacing the files)]");
+    LOGI("re-encodes .tbt files as version 0x72, and only writes them if they convert to the same MIDI,");
+    LOGI("except that files before 0x6f are padded to 4000 spaces, and trimming that padding moves the final note offs earlier");
+    LOGI();
+}
+
+
+
+
+
+
+
+
+
+
+
+
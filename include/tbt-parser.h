@@ -23,6 +23,7 @@
 #include <array>
 #include <vector>
 #include <map>
+#include <span>
 #include <variant>
 #include <string>
 #include <cstdint> // for uint8_t
@@ -462,10 +463,24 @@ enum tbt_track_effect : uint8_t {
     TE_PITCH_BEND = 10,
 };
 
+//
+// packed track effect change
+//
+struct tbt_track_effect_change {
+    uint16_t space;
+    tbt_track_effect effect;
+    uint16_t value;
+};
+
 struct maps71 {
     std::map<uint16_t, std::array<uint8_t, 20> > notesMap;
     std::map<uint16_t, std::array<uint8_t, 2> > alternateTimeRegionsMap;
-    std::map<uint16_t, std::map<tbt_track_effect, uint16_t> > trackEffectChangesMap;
+    //
+    // sorted by space, then effect
+    //
+    // there is at most 1 change for each effect at a space
+    //
+    std::vector<tbt_track_effect_change> trackEffectChanges;
 };
 
 struct maps70 {
@@ -555,8 +570,53 @@ struct tbt_file65 { // NOLINT(*-pro-type-member-init)
 using tbt_file = std::variant<tbt_file65, tbt_file68, tbt_file6a, tbt_file6b, tbt_file6e, tbt_file6f, tbt_file70, tbt_file71>;
 
 
+enum tbt_diagnostic_code : uint8_t {
+    DIAG_TEMPO_CHANGE_AT_NON_INTEGRAL_SPACE,
+    DIAG_CONFLICTING_TEMPO_CHANGES,
+    DIAG_REPEAT_CLOSE_AT_NON_INTEGRAL_SPACE,
+    DIAG_REPEAT_OPEN_AT_NON_INTEGRAL_SPACE,
+    DIAG_NO_REPEAT_OPEN,
+    DIAG_REPEAT_OPEN_IGNORED,
+};
+
+struct tbt_diagnostic {
+    tbt_diagnostic_code code;
+    uint32_t count;
+    //
+    // position of the first occurrence
+    //
+    double firstSpace;
+    //
+    // -1 if not specific to a track
+    //
+    int firstTrack;
+};
+
+//
+// Warnings collected during conversion
+//
+// There is one entry per code, in the order that codes first occurred.
+// Pathological files may trigger the same warning thousands of times, so only counts and first positions are kept.
+//
+struct tbt_diagnostics {
+    std::vector<tbt_diagnostic> entries;
+};
+
+
 struct midi_convert_opts {
 
+    //
+    // if not null, warnings are collected here instead of being logged
+    //
+    tbt_diagnostics *diagnostics = nullptr;
+
+    //
+    // only the tempo track and the selected tracks are emitted
+    //
+    // channels are assigned as if every track were emitted
+    //
+    std::vector<bool> selected_tracks;
+
     //
     // Custom Lyric events may be used to trigger callbacks in FluidSynth
     //
@@ -582,6 +642,13 @@ struct midi_convert_opts {
     // emit PitchBendEvents
     //
     bool emit_pitch_bend_events = true;
+
+    //
+    // run eliminateRedundantMidiEvents on the converted midi_file
+    //
+    // repeats copy unchanged controller and program events on every pass, so this mostly helps songs with repeats
+    //
+    bool eliminate_redundant_events = false;
 };
 
 
@@ -649,6 +716,19 @@ struct SysExEvent {
     std::vector<uint8_t> data;
 };
 
+//
+// every field is compared, including deltaTime
+//
+bool operator==(const ProgramChangeEvent &lhs, const ProgramChangeEvent &rhs);
+bool operator==(const PitchBendEvent &lhs, const PitchBendEvent &rhs);
+bool operator==(const NoteOffEvent &lhs, const NoteOffEvent &rhs);
+bool operator==(const NoteOnEvent &lhs, const NoteOnEvent &rhs);
+bool operator==(const ControlChangeEvent &lhs, const ControlChangeEvent &rhs);
+bool operator==(const MetaEvent &lhs, const MetaEvent &rhs);
+bool operator==(const PolyphonicKeyPressureEvent &lhs, const PolyphonicKeyPressureEvent &rhs);
+bool operator==(const ChannelPressureEvent &lhs, const ChannelPressureEvent &rhs);
+bool operator==(const SysExEvent &lhs, const SysExEvent &rhs);
+
 using midi_track_event = std::variant<ProgramChangeEvent, PitchBendEvent, NoteOffEvent, NoteOnEvent,
     ControlChangeEvent, MetaEvent, PolyphonicKeyPressureEvent, ChannelPressureEvent, SysExEvent>;
 
@@ -658,13 +738,122 @@ struct midi_file {
 };
 
 
+//
+// a repeated section, kept as a reference instead of as copies
+//
+// before events[at] is played (or at the end, if at == events.size()),
+// events[start, end) is played count more times
+//
+struct midi_repeat {
+    size_t at;
+    size_t start;
+    size_t end;
+    uint32_t count;
+};
+
+struct midi_program_track {
+    std::vector<midi_track_event> events;
+    
+    //
+    // sorted by at
+    //
+    std::vector<midi_repeat> repeats;
+};
+
+//
+// Same as midi_file, but repeated sections are not copied
+//
+// memory scales with unique content instead of played length
+//
+struct midi_program {
+    midi_header header;
+    std::vector<midi_program_track> tracks;
+};
+
+
+//
+// iterates the events of a track in played order, expanding repeats as it goes
+//
+// the track must outlive the cursor
+//
+class midi_track_cursor {
+public:
+
+    explicit midi_track_cursor(const std::vector<midi_track_event> &events);
+
+    explicit midi_track_cursor(const midi_program_track &track);
+
+    //
+    // returns nullptr at the end
+    //
+    const midi_track_event *next();
+
+    void rewind();
+
+private:
+    std::span<const midi_track_event> events;
+    std::span<const midi_repeat> repeats;
+
+    size_t pos;
+    size_t repeatIndex;
+    size_t sectionPos;
+    uint32_t remaining;
+};
+
+
+//
+// Thread safety
+//
+// All functions below are reentrant: the library has no mutable global state,
+// so different threads may parse, convert, export, and print at the same time.
+//
+// Concurrent calls that share an argument are safe as long as every shared argument is only read,
+// e.g., converting the same tbt_file on many threads at once.
+// A tbt_diagnostics sink is written to during conversion, so each thread needs its own.
+//
+// Warnings are logged through common/logging.h, which is shared by all threads.
+// Pass a tbt_diagnostics sink to keep conversion from logging when running many threads.
+//
+
+struct tbt_parse_opts {
+
+    //
+    // maximum size of each inflated section (metadata and body)
+    //
+    // parsing fails as soon as this is exceeded, so a small malicious file cannot inflate to gigabytes
+    //
+    // the default is far larger than any real file, services accepting untrusted files should lower it
+    //
+    size_t max_inflated_size = 256 * 1024 * 1024;
+
+    //
+    // the notes of tracks that are not selected are skipped over instead of expanded,
+    // and their notesMap is left empty
+    //
+    // before 0x72, tempo changes are stored with the notes, so the notesMap of tracks that are not selected
+    // keeps only their tempo changes
+    //
+    // such a file converts and prints the selected tracks like the full file does,
+    // but it is not a faithful copy of the original
+    //
+    std::vector<bool> selected_tracks;
+};
+
 Status parseTbtFile(const char *path, tbt_file &out);
 
+Status parseTbtFile(const char *path, const tbt_parse_opts &opts, tbt_file &out);
+
 Status parseTbtBytes(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
     tbt_file &out);
 
+Status parseTbtBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_file &out);
+
 uint8_t tbtFileVersionNumber(const tbt_file &t);
 
 std::string tbtFileVersionString(const tbt_file &t);
@@ -673,15 +862,107 @@ std::string tbtFileInfo(const tbt_file &t);
 
 std::string tbtFileComment(const tbt_file &t);
 
+struct tbt_tablature_opts {
+
+    //
+    // only the selected tracks are printed
+    //
+    std::vector<bool> selected_tracks;
+};
+
 std::string tbtFileTablature(const tbt_file &t);
 
+std::string tbtFileTablature(const tbt_file &t, const tbt_tablature_opts &opts);
+
+//
+// Track selection
+//
+// selected_tracks[i] is true if track i is selected
+//
+// empty means all tracks are selected, and tracks past the end are not selected
+//
+bool trackSelected(const std::vector<bool> &selected_tracks, uint8_t track);
+
+//
+// parse a comma-separated list of track numbers, e.g., "0,2,5"
+//
+Status parseTrackSelection(const char *str, std::vector<bool> &selected_tracks);
+
 
 Status convertToMidi(const tbt_file &t, const midi_convert_opts &opts, midi_file &m);
 
+//
+// opts.eliminate_redundant_events is not supported, it needs the whole midi_file
+//
+Status convertToMidiProgram(const tbt_file &t, const midi_convert_opts &opts, midi_program &p);
+
+//
+// number of events of each kind, with repeats expanded
+//
+struct midi_event_counts {
+    uint64_t noteOn = 0;
+    uint64_t noteOff = 0;
+    uint64_t controlChange = 0;
+    uint64_t programChange = 0;
+    uint64_t pitchBend = 0;
+    uint64_t meta = 0;
+};
+
+//
+// converts straight to the bytes of a .mid file, without building a midi_file
+//
+// same bytes as convertToMidi followed by exportMidiBytes
+//
+// opts.eliminate_redundant_events is not supported, it needs the whole midi_file
+//
+Status convertToMidiBytes(const tbt_file &t, const midi_convert_opts &opts, std::vector<uint8_t> &out);
+
+//
+// also counts the events, in the same pass
+//
+Status convertToMidiBytes(const tbt_file &t, const midi_convert_opts &opts, std::vector<uint8_t> &out, midi_event_counts &counts);
+
+void expandMidiProgram(const midi_program &p, midi_file &out);
+
+//
+// drops ControlChange, ProgramChange, and PitchBend events that do not change the state of their channel,
+// and removes changes that are replaced at the same tick before anything could observe them
+//
+// the state of each channel at every note is unchanged, so the audible output is the same
+//
+// channels used by more than one track are left alone
+//
+void eliminateRedundantMidiEvents(midi_file &m);
+
+void addDiagnostic(tbt_diagnostics &d, tbt_diagnostic_code code, double space, int track);
+
+const char *tbtDiagnosticCodeString(tbt_diagnostic_code code);
+
+std::string tbtDiagnosticsInfo(const tbt_diagnostics &d);
+
 Status exportMidiFile(const midi_file &m, const char *path);
 
 Status exportMidiBytes(const midi_file &m, std::vector<uint8_t> &out);
 
+//
+// exact size of the bytes exportMidiBytes writes, computed without writing them
+//
+size_t midiExportSize(const midi_file &m);
+
+//
+// writes straight into out, e.g., a shared memory mapping
+//
+// out.size() must be midiExportSize(m)
+//
+Status exportMidiBytes(const midi_file &m, std::span<uint8_t> out);
+
+//
+// same bytes as exporting the expanded midi_file, without expanding it in memory
+//
+Status exportMidiProgramFile(const midi_program &p, const char *path);
+
+Status exportMidiProgramBytes(const midi_program &p, std::vector<uint8_t> &out);
+
 Status parseMidiFile(const char *path, midi_file &out);
 
 Status parseMidiBytes(
@@ -703,6 +984,48 @@ midi_file_times midiFileTimes(const midi_file &m);
 
 std::string midiFileInfo(const midi_file &m);
 
+struct midi_tempo_change {
+    int32_t tick;
+    uint32_t microsPerBeat;
+};
+
+//
+// what midi-info needs, without decoding every event
+//
+struct midi_probe {
+    midi_header header;
+    std::vector<std::string> trackNames;
+
+    //
+    // sorted by tick, at most one change per tick (later tracks win)
+    //
+    std::vector<midi_tempo_change> tempoMap;
+
+    //
+    // same as midiFileTimes
+    //
+    midi_file_times times;
+};
+
+//
+// walks the event stream in place
+//
+// channel messages are skipped by length, and only track names, tempo changes, and End Of Track are kept
+//
+Status probeMidiFile(const char *path, midi_probe &out);
+
+Status probeMidiBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    midi_probe &out);
+
+std::string midiProbeInfo(const midi_probe &p);
+
+//
+// the same tempo map as probing the exported bytes
+//
+std::vector<midi_tempo_change> midiFileTempoMap(const midi_file &m);
+
 
 
 
@@ -0,0 +1,166 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "common/status.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint> // for uint8_t
+#include <cstddef> // for size_t
+
+
+//
+// Bulk reading and writing of many small files
+//
+// Corpus jobs read and write thousands of files that are only a few KB each,
+// so per-file syscall latency dominates. These keep many file operations in flight
+// while other threads consume completed buffers.
+//
+// On Linux, io_uring is used when the kernel supports it.
+// Otherwise, a pool of threads doing blocking I/O is used.
+//
+
+
+enum bulk_io_backend : uint8_t {
+    BULK_IO_AUTO = 0,
+    BULK_IO_THREADS = 1,
+    BULK_IO_URING = 2,
+};
+
+
+struct bulk_io_opts {
+
+    //
+    // maximum number of files being read or written at once
+    //
+    // for reading, this includes completed buffers that have not been consumed yet
+    //
+    size_t max_in_flight = 256;
+
+    //
+    // number of I/O threads for BULK_IO_THREADS
+    //
+    // 0 means std::thread::hardware_concurrency()
+    //
+    size_t thread_count = 0;
+
+    //
+    // BULK_IO_AUTO uses io_uring if available, and falls back to threads otherwise
+    //
+    // requesting BULK_IO_URING when it is not available also falls back to threads
+    //
+    bulk_io_backend backend = BULK_IO_AUTO;
+};
+
+
+struct bulk_read_item {
+    size_t index;
+    std::string path;
+    Status status;
+    std::vector<uint8_t> data;
+};
+
+
+//
+// Reads paths in the background, and hands out completed buffers in completion order
+//
+// next() may be called from any number of consumer threads
+//
+class bulk_file_reader {
+public:
+
+    bulk_file_reader(std::vector<std::string> paths, const bulk_io_opts &opts);
+
+    ~bulk_file_reader();
+
+    bulk_file_reader(const bulk_file_reader &) = delete;
+    bulk_file_reader &operator=(const bulk_file_reader &) = delete;
+
+    //
+    // blocks until a read has completed
+    //
+    // returns false when every path has been handed out
+    //
+    bool next(bulk_read_item &out);
+
+    bulk_io_backend backend() const;
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> pimpl;
+};
+
+
+//
+// Writes files in the background
+//
+// submit() may be called from any number of producer threads
+//
+class bulk_file_writer {
+public:
+
+    explicit bulk_file_writer(const bulk_io_opts &opts);
+
+    //
+    // calls finish() if it has not been called
+    //
+    ~bulk_file_writer();
+
+    bulk_file_writer(const bulk_file_writer &) = delete;
+    bulk_file_writer &operator=(const bulk_file_writer &) = delete;
+
+    //
+    // blocks while max_in_flight writes are pending
+    //
+    void submit(std::string path, std::vector<uint8_t> data);
+
+    //
+    // waits for all submitted writes
+    //
+    // returns ERR if any write failed
+    //
+    Status finish();
+
+    bulk_io_backend backend() const;
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> pimpl;
+};
+
+
+//
+// returns true if io_uring can be used on this system
+//
+bool bulkIOUringAvailable();
+
+
+
+
+
+
+
+
+
+
+
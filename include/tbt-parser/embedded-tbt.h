@@ -0,0 +1,1299 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include <algorithm> // for lower_bound, min, copy
+#include <array>
+#include <initializer_list>
+#include <span>
+#include <vector>
+#include <cstdint> // for uint8_t, uint16_t, uint32_t
+#include <cstddef> // for size_t
+
+#include "tbt-parser/tbt.h"
+
+
+//
+// Compile-time conversion of embedded tabs
+//
+// Firmware that plays a fixed set of tabs does not need the parser at all. A .tbt that is embedded as a byte array
+// is converted while compiling, and only the MIDI bytes end up in the image:
+//
+//   static constexpr uint8_t SONG_TBT[] = {
+//   #embed "song.tbt"
+//   };
+//
+//   constexpr auto SONG_MID = embeddedMidiArray<SONG_TBT>(); // std::array<uint8_t, N>
+//
+// Everything here is constexpr and only depends on the standard library: no zlib, rational, or common.
+// Because of that, only versions 0x65 through 0x6b are handled. Later versions compress the metadata and body.
+//
+// The bytes are the same as convertToMidi with default options followed by exportMidiBytes.
+//
+// The same functions may also be called at runtime.
+//
+// Constant evaluation is slow: a short tab fits in the default limits, but a full song may need
+// -fconstexpr-ops-limit= (GCC) or -fconstexpr-steps= (Clang). Closing Time needs about 80 million operations with GCC.
+//
+
+
+struct embedded_midi_opts {
+
+    //
+    // emit ControlChangeEvents
+    //
+    bool emit_control_change_events = true;
+
+    //
+    // emit ProgramChangeEvents
+    //
+    bool emit_program_change_events = true;
+
+    //
+    // emit PitchBendEvents
+    //
+    bool emit_pitch_bend_events = true;
+};
+
+
+struct embedded_midi_result {
+
+    //
+    // nullptr if the conversion succeeded
+    //
+    const char *error = nullptr;
+
+    std::vector<uint8_t> bytes;
+};
+
+
+//
+// spaces, i.e., 4000 for versions before 0x6f
+//
+const uint16_t EMBEDDED_SPACE_COUNT = 4000;
+
+const uint32_t EMBEDDED_TICKS_PER_SPACE = 48;
+
+const uint32_t EMBEDDED_MICROS_PER_MINUTE = 60000000;
+
+//
+// a muted note lasts for 1/64 second at 120 bpm, or until the next event
+//
+const uint32_t EMBEDDED_MUTED_TICK_DIFF = 6;
+
+
+//
+// notes of a non-empty space
+//
+// only the first STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4 are used
+//
+struct embedded_space {
+    uint16_t space;
+    std::array<uint8_t, 20> vsqs;
+};
+
+struct embedded_bar_line {
+    uint16_t space;
+    uint8_t value;
+};
+
+struct embedded_track {
+    uint8_t stringCount;
+    uint8_t cleanGuitar;
+    uint8_t volume;
+    uint8_t pan;
+    int8_t midiChannel;
+    std::array<int8_t, 8> tuning;
+    std::vector<embedded_space> spaces;
+};
+
+struct embedded_tbt {
+    uint8_t versionNumber;
+    uint8_t tempo;
+    uint8_t stringsPerTrack;
+    std::vector<embedded_bar_line> barLines;
+    std::vector<embedded_track> tracks;
+};
+
+//
+// a repeat close at space close jumps back to space open, repeats times
+//
+struct embedded_repeat {
+    uint16_t close;
+    uint16_t open;
+    uint8_t repeats;
+};
+
+
+constexpr uint16_t embeddedLE2(uint8_t b0, uint8_t b1) {
+    return static_cast<uint16_t>(b0 | (b1 << 8));
+}
+
+constexpr uint32_t embeddedLE4(std::span<const uint8_t> data, size_t pos) {
+    return static_cast<uint32_t>(data[pos]) |
+        (static_cast<uint32_t>(data[pos + 1]) << 8) |
+        (static_cast<uint32_t>(data[pos + 2]) << 16) |
+        (static_cast<uint32_t>(data[pos + 3]) << 24);
+}
+
+
+//
+// same as zlib crc32, computed a bit at a time
+//
+constexpr uint32_t embeddedCrc32(std::span<const uint8_t> data) {
+
+    uint32_t crc = 0xffffffff;
+
+    for (auto b : data) {
+
+        crc ^= b;
+
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+
+//
+// read delta list chunks at pos until unitCount units are covered, and call f(unit, y) for every unit that is not 0
+//
+// https://bostick.github.io/tabit-file-format/description/tabit-file-format-description.html#a-note-on-iterating-through-deltalists
+//
+template <typename F>
+constexpr const char *embeddedReadDeltaList(
+    std::span<const uint8_t> data,
+    size_t &pos,
+    uint32_t unitCount,
+    F f) {
+
+    uint32_t unit = 0;
+
+    while (unit < unitCount) {
+
+        if (data.size() - pos < 2) {
+            return "out of data";
+        }
+
+        auto count = embeddedLE2(data[pos], data[pos + 1]);
+
+        pos += 2;
+
+        if (count > 0x1000) {
+            return "out of data";
+        }
+
+        if (data.size() - pos < 2 * static_cast<size_t>(count)) {
+            return "out of data";
+        }
+
+        auto end = pos + 2 * static_cast<size_t>(count);
+
+        while (pos < end) {
+
+            uint32_t n;
+            uint8_t y;
+
+            if (data[pos] != 0) {
+
+                n = data[pos];
+                y = data[pos + 1];
+
+                pos += 2;
+
+            } else {
+
+                //
+                // {0, lo}, {hi, y}
+                //
+                if (end - pos < 4 || data[pos + 2] == 0) {
+                    return "unhandled";
+                }
+
+                n = embeddedLE2(data[pos + 1], data[pos + 2]);
+                y = data[pos + 3];
+
+                pos += 4;
+            }
+
+            if (unitCount - unit < n) {
+                return "unhandled";
+            }
+
+            if (y != 0) {
+                for (uint32_t u = unit; u < unit + n; u++) {
+                    f(u, y);
+                }
+            }
+
+            unit += n;
+        }
+    }
+
+    return nullptr;
+}
+
+
+//
+// parse everything that is needed for conversion
+//
+// same checks as parseTbtBytes
+//
+constexpr const char *embeddedParseTbt(
+    std::span<const uint8_t> data,
+    embedded_tbt &out) {
+
+    if (data.size() <= 64) {
+        return "file is too small to be parsed";
+    }
+
+    if (data[0] != 'T' || data[1] != 'B' || data[2] != 'T') {
+        return "file is corrupted. magic bytes do not match";
+    }
+
+    out.versionNumber = data[3];
+
+    if (!(0x65 <= out.versionNumber && out.versionNumber <= 0x6b)) {
+        return "only versions 0x65 through 0x6b can be embedded";
+    }
+
+    if (0x68 <= out.versionNumber) {
+
+        auto compressedMetadataLen = static_cast<int32_t>(embeddedLE4(data, 48));
+
+        if (compressedMetadataLen < 0 || data.size() <= static_cast<size_t>(compressedMetadataLen)) {
+            return "file is corrupted. compressedMetadataLen is out of range";
+        }
+
+        if (embeddedLE4(data, 56) != data.size()) {
+            return "file is corrupted. file byte counts do not match";
+        }
+
+        if (embeddedCrc32(data.subspan(64)) != embeddedLE4(data, 52)) {
+            return "file is corrupted. CRC-32 of rest of file does not match";
+        }
+
+        if (embeddedCrc32(data.first(60)) != embeddedLE4(data, 60)) {
+            return "file is corrupted. CRC-32 of header does not match";
+        }
+    }
+
+    if (data[6] != 3 && data[6] != 4) {
+        return "file is corrupted.";
+    }
+
+    for (size_t i = 40; i < 48; i++) {
+        if (data[i] != 0) {
+            return "file is corrupted.";
+        }
+    }
+
+    out.tempo = data[4];
+
+    if (out.tempo == 0) {
+        return "file is corrupted. tempo is 0";
+    }
+
+    auto trackCount = data[5];
+
+    out.stringsPerTrack = (0x6b <= out.versionNumber) ? 8 : 6;
+
+    //
+    // metadata
+    //
+    // each field is stored for all tracks before the next field
+    //
+    size_t metadataSize;
+    if (0x6b <= out.versionNumber) {
+        metadataSize = 19; // sizeof(tbt_track_metadata6b)
+    } else if (0x6a <= out.versionNumber) {
+        metadataSize = 15; // sizeof(tbt_track_metadata6a)
+    } else {
+        metadataSize = 13; // sizeof(tbt_track_metadata65)
+    }
+
+    size_t pos = 64;
+
+    if (data.size() - pos < metadataSize * trackCount) {
+        return "file is corrupted.";
+    }
+
+    out.tracks = std::vector<embedded_track>(trackCount);
+
+    auto field = [&](auto set) {
+        for (auto &track : out.tracks) {
+            set(track, data[pos++]);
+        }
+    };
+
+    field([](embedded_track &t, uint8_t b) { t.stringCount = b; });
+    field([](embedded_track &t, uint8_t b) { t.cleanGuitar = b; });
+    field([](embedded_track &, uint8_t) {}); // mutedGuitar
+    field([](embedded_track &t, uint8_t b) { t.volume = b; });
+
+    if (0x6b <= out.versionNumber) {
+        field([](embedded_track &t, uint8_t b) { t.pan = b; });
+        field([](embedded_track &, uint8_t) {}); // highestNote
+    } else {
+        for (auto &track : out.tracks) {
+            track.pan = 0x40;
+        }
+    }
+
+    if (0x6a <= out.versionNumber) {
+        field([](embedded_track &, uint8_t) {}); // displayMIDINoteNumbers
+        field([](embedded_track &t, uint8_t b) { t.midiChannel = static_cast<int8_t>(b); });
+    } else {
+        for (auto &track : out.tracks) {
+            track.midiChannel = -1;
+        }
+    }
+
+    field([](embedded_track &, uint8_t) {}); // topLineText
+    field([](embedded_track &, uint8_t) {}); // bottomLineText
+
+    for (auto &track : out.tracks) {
+
+        track.tuning = {};
+
+        for (uint8_t string = 0; string < out.stringsPerTrack; string++) {
+            track.tuning[string] = static_cast<int8_t>(data[pos++]);
+        }
+    }
+
+    field([](embedded_track &, uint8_t) {}); // drums
+
+    for (const auto &track : out.tracks) {
+        if (track.stringCount > out.stringsPerTrack) {
+            return "file is corrupted. too many strings";
+        }
+    }
+
+    //
+    // title, artist, and comment
+    //
+    for (int i = 0; i < 3; i++) {
+
+        if (data.size() - pos < 1 || data.size() - pos - 1 < data[pos]) {
+            return "file is corrupted.";
+        }
+
+        pos += 1 + static_cast<size_t>(data[pos]);
+    }
+
+    //
+    // bar lines
+    //
+    out.barLines.clear();
+
+    const char *err = embeddedReadDeltaList(data, pos, EMBEDDED_SPACE_COUNT, [&](uint32_t unit, uint8_t y) {
+        out.barLines.push_back({ static_cast<uint16_t>(unit), y });
+    });
+
+    if (err) {
+        return err;
+    }
+
+    //
+    // notes
+    //
+    const uint32_t unitsPerSpace = out.stringsPerTrack + out.stringsPerTrack + 4u;
+
+    for (auto &track : out.tracks) {
+
+        err = embeddedReadDeltaList(data, pos, unitsPerSpace * EMBEDDED_SPACE_COUNT, [&](uint32_t unit, uint8_t y) {
+
+            auto space = static_cast<uint16_t>(unit / unitsPerSpace);
+
+            if (track.spaces.empty() || track.spaces.back().space != space) {
+                track.spaces.push_back({ space, {} });
+            }
+
+            track.spaces.back().vsqs[unit % unitsPerSpace] = y;
+        });
+
+        if (err) {
+            return err;
+        }
+    }
+
+    if (pos != data.size()) {
+        return "file is corrupted.";
+    }
+
+    return nullptr;
+}
+
+
+//
+// repeat closes, sorted by space
+//
+// a CLOSE bar line closes the space after it, and also opens the next repeat
+//
+constexpr const char *embeddedComputeRepeats(
+    const embedded_tbt &t,
+    std::vector<embedded_repeat> &out) {
+
+    uint16_t lastOpenSpace = 0;
+
+    for (const auto &barLine : t.barLines) {
+
+        auto change = static_cast<uint8_t>(barLine.value & 0b00001111);
+
+        switch (change) {
+        case CLOSE: {
+
+            auto repeats = static_cast<uint8_t>((barLine.value & 0b11110000) >> 4);
+
+            out.push_back({ static_cast<uint16_t>(barLine.space + 1), lastOpenSpace, repeats });
+
+            lastOpenSpace = static_cast<uint16_t>(barLine.space + 1);
+
+            break;
+        }
+        case OPEN:
+            lastOpenSpace = barLine.space;
+            break;
+        case SINGLE:
+        case DOUBLE:
+            break;
+        default:
+            return "invalid bar line";
+        }
+    }
+
+    return nullptr;
+}
+
+
+//
+// space -> tempo, merged from all tracks
+//
+// if more than 1 track changes tempo at the same space, then the last track wins
+//
+constexpr const char *embeddedComputeTempoMap(
+    const embedded_tbt &t,
+    std::vector<std::array<uint16_t, 2> > &out) {
+
+    const size_t S = t.stringsPerTrack;
+
+    for (const auto &track : t.tracks) {
+
+        for (const auto &s : track.spaces) {
+
+            uint16_t newTempo;
+
+            switch (s.vsqs[S + S + 0]) {
+            case 'T':
+                newTempo = s.vsqs[S + S + 3];
+                break;
+            case 't':
+                newTempo = static_cast<uint16_t>(s.vsqs[S + S + 3] + 250);
+                break;
+            case '\0':
+            case 'I':
+            case 'V':
+            case 'D':
+            case 'U':
+            case 'C':
+            case 'P':
+            case 'R':
+                continue;
+            default:
+                return "invalid trackEffect";
+            }
+
+            if (newTempo == 0) {
+                return "tempo is 0";
+            }
+
+            auto it = std::lower_bound(out.begin(), out.end(), s.space, [](const std::array<uint16_t, 2> &a, uint16_t b) { return a[0] < b; });
+
+            if (it != out.end() && (*it)[0] == s.space) {
+                (*it)[1] = newTempo;
+            } else {
+                out.insert(it, { s.space, newTempo });
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+
+//
+// resolve all of the Automatically Assign -1 values to actual channels
+//
+constexpr const char *embeddedComputeChannels(
+    const embedded_tbt &t,
+    std::vector<uint8_t> &out) {
+
+    //
+    // Channel 9 is for drums and is not generally available
+    //
+    std::vector<uint8_t> availableChannels{ 0, 1, 2, 3, 4, 5, 6, 7, 8, /*9,*/ 10, 11, 12, 13, 14, 15 };
+
+    out = std::vector<uint8_t>(t.tracks.size());
+
+    for (size_t track = 0; track < t.tracks.size(); track++) {
+
+        auto midiChannel = t.tracks[track].midiChannel;
+
+        if (midiChannel == -1) {
+            continue;
+        }
+
+        std::erase(availableChannels, static_cast<uint8_t>(midiChannel));
+
+        out[track] = static_cast<uint8_t>(midiChannel);
+    }
+
+    for (size_t track = 0; track < t.tracks.size(); track++) {
+
+        if (t.tracks[track].midiChannel != -1) {
+            continue;
+        }
+
+        if (availableChannels.empty()) {
+            return "no MIDI channel is available";
+        }
+
+        out[track] = availableChannels[0];
+
+        availableChannels.erase(availableChannels.begin());
+    }
+
+    return nullptr;
+}
+
+
+constexpr void embeddedWriteBE(std::vector<uint8_t> &out, uint32_t value, int byteCount) {
+    for (int i = byteCount - 1; i >= 0; i--) {
+        out.push_back(static_cast<uint8_t>((value >> (8 * i)) & 0xff));
+    }
+}
+
+
+//
+// one MTrk chunk
+//
+// the length is filled in by finish
+//
+struct embedded_track_writer {
+
+    std::vector<uint8_t> &out;
+
+    size_t lengthPos = 0;
+
+    uint32_t lastEventTick = 0;
+
+    constexpr void start() {
+
+        out.insert(out.end(), { 'M', 'T', 'r', 'k' });
+
+        lengthPos = out.size();
+
+        embeddedWriteBE(out, 0, 4);
+
+        lastEventTick = 0;
+    }
+
+    constexpr void event(uint32_t tick, std::initializer_list<uint8_t> bytes) {
+
+        auto delta = tick - lastEventTick;
+
+        //
+        // growing once and then assigning is much cheaper during constant evaluation than pushing every byte
+        //
+        size_t deltaSize = 1;
+
+        if (delta > 0b111111111111111111111) {
+            deltaSize = 4;
+        } else if (delta > 0b11111111111111) {
+            deltaSize = 3;
+        } else if (delta > 0b1111111) {
+            deltaSize = 2;
+        }
+
+        auto pos = out.size();
+
+        out.resize(pos + deltaSize + bytes.size());
+
+        for (size_t i = deltaSize - 1; i > 0; i--) {
+            out[pos++] = static_cast<uint8_t>(((delta >> (7 * i)) & 0b01111111) | 0b10000000);
+        }
+
+        out[pos++] = static_cast<uint8_t>(delta & 0b01111111);
+
+        for (auto b : bytes) {
+            out[pos++] = b;
+        }
+
+        lastEventTick = tick;
+    }
+
+    constexpr void trackName(uint32_t tick, size_t track) {
+
+        const char prefix[] = "tbt-parser MIDI - Track ";
+
+        std::vector<uint8_t> name(prefix, prefix + sizeof(prefix) - 1);
+
+        std::array<uint8_t, 3> digits{};
+        size_t digitCount = 0;
+
+        do {
+            digits[digitCount++] = static_cast<uint8_t>('0' + (track % 10));
+            track /= 10;
+        } while (track != 0);
+
+        while (digitCount != 0) {
+            name.push_back(digits[--digitCount]);
+        }
+
+        event(tick, { 0xff, 0x03, static_cast<uint8_t>(name.size()) }); // Meta, Track Name
+
+        out.insert(out.end(), name.begin(), name.end());
+    }
+
+    constexpr void tempo(uint32_t tick, uint16_t tempoBPM) {
+
+        auto microsPerBeat = EMBEDDED_MICROS_PER_MINUTE / tempoBPM;
+
+        event(tick, {
+            0xff, 0x51, 0x03, // Meta, Set Tempo
+            static_cast<uint8_t>((microsPerBeat >> 16) & 0xff),
+            static_cast<uint8_t>((microsPerBeat >> 8) & 0xff),
+            static_cast<uint8_t>(microsPerBeat & 0xff)
+        });
+    }
+
+    constexpr void finish(uint32_t tick) {
+
+        event(tick, { 0xff, 0x2f, 0x00 }); // Meta, End of Track
+
+        auto length = static_cast<uint32_t>(out.size() - lengthPos - 4);
+
+        for (int i = 0; i < 4; i++) {
+            out[lengthPos + static_cast<size_t>(i)] = static_cast<uint8_t>((length >> (8 * (3 - i))) & 0xff);
+        }
+    }
+};
+
+
+//
+// move i to the first element of v with key not less than value
+//
+// std::lower_bound costs thousands of operations during constant evaluation, and walks mostly move forward,
+// so moving a cursor is much cheaper
+//
+template <typename T, typename Key>
+constexpr void embeddedSeek(
+    const std::vector<T> &v,
+    size_t &i,
+    uint16_t value,
+    Key key) {
+
+    while (i > 0 && key(v[i - 1]) >= value) {
+        i--;
+    }
+
+    while (i < v.size() && key(v[i]) < value) {
+        i++;
+    }
+}
+
+
+constexpr uint16_t embeddedRepeatClose(const embedded_repeat &r) {
+    return r.close;
+}
+
+
+constexpr uint16_t embeddedStopSpace(uint16_t stop) {
+    return stop;
+}
+
+
+//
+// walk spaces 0 through EMBEDDED_SPACE_COUNT, following repeats, and call f(space, tick)
+//
+// same as convertToMidi: after jumping back 3 times, the pass is assumed to repeat exactly, so the remaining passes
+// are copies of the bytes of the last pass, and the walk does not go through them
+//
+// constant evaluation is slow, so f is only called for stops (sorted), repeat closes, jump targets, and the last space
+// f must not have anything to do at other spaces
+//
+// returns the tick of the last space
+//
+template <typename F>
+constexpr uint32_t embeddedWalkSpaces(
+    const std::vector<embedded_repeat> &repeats,
+    const std::vector<uint16_t> &stops,
+    embedded_track_writer &w,
+    F f) {
+
+    struct repeat_state {
+        uint8_t repeats;
+        int jump;
+        size_t dataStart;
+        size_t dataEnd;
+    };
+
+    std::vector<repeat_state> states;
+
+    for (const auto &r : repeats) {
+        states.push_back({ r.repeats, 0, 0, 0 });
+    }
+
+    uint32_t tick = 0;
+
+    size_t closeIndex = 0;
+
+    size_t stopIndex = 0;
+
+    for (uint16_t space = 0; space < EMBEDDED_SPACE_COUNT + 1;) { // space count, + 1 for handling repeats at end
+
+        embeddedSeek(repeats, closeIndex, space, embeddedRepeatClose);
+
+        if (closeIndex < repeats.size() && repeats[closeIndex].close == space) {
+
+            const auto &repeat = repeats[closeIndex];
+
+            auto &r = states[closeIndex];
+
+            if (r.repeats > 0) {
+
+                if (r.jump < 3) {
+
+                    if (r.jump == 1) {
+                        r.dataStart = w.out.size();
+                    } else if (r.jump == 2) {
+                        r.dataEnd = w.out.size();
+                    }
+
+                    r.repeats--;
+
+                    r.jump++;
+
+                    space = repeat.open;
+
+                    continue;
+                }
+
+                auto pos = w.out.size();
+
+                w.out.resize(pos + r.repeats * (r.dataEnd - r.dataStart));
+
+                for (uint8_t i = 0; i < r.repeats; i++) {
+                    for (size_t j = r.dataStart; j < r.dataEnd; j++) {
+                        w.out[pos++] = w.out[j];
+                    }
+                }
+
+                r.repeats = 0;
+            }
+        }
+
+        f(space, tick);
+
+        //
+        // skip to the next space that f or the repeats care about
+        //
+        auto next = static_cast<uint16_t>(space + 1);
+
+        if (next < EMBEDDED_SPACE_COUNT) {
+
+            uint16_t nextStop = EMBEDDED_SPACE_COUNT;
+
+            embeddedSeek(stops, stopIndex, next, embeddedStopSpace);
+
+            if (stopIndex < stops.size()) {
+                nextStop = std::min(nextStop, stops[stopIndex]);
+            }
+
+            embeddedSeek(repeats, closeIndex, next, embeddedRepeatClose);
+
+            if (closeIndex < repeats.size()) {
+                nextStop = std::min(nextStop, repeats[closeIndex].close);
+            }
+
+            next = nextStop;
+        }
+
+        tick += EMBEDDED_TICKS_PER_SPACE * static_cast<uint32_t>(next - space);
+
+        space = next;
+    }
+
+    return tick - EMBEDDED_TICKS_PER_SPACE;
+}
+
+
+constexpr uint16_t embeddedSpaceSpace(const embedded_space &s) {
+    return s.space;
+}
+
+
+constexpr uint16_t embeddedTempoSpace(const std::array<uint16_t, 2> &change) {
+    return change[0];
+}
+
+
+constexpr const char *embeddedWriteTrack(
+    const embedded_tbt &t,
+    size_t track,
+    uint8_t channel,
+    const std::vector<embedded_repeat> &repeats,
+    const embedded_midi_opts &opts,
+    embedded_track_writer &w) {
+
+    const auto &trackMetadata = t.tracks[track];
+
+    const size_t S = t.stringsPerTrack;
+
+    const uint8_t stringCount = trackMetadata.stringCount;
+
+    //
+    // string -> offset needed to obtain midi note
+    //
+    std::array<uint8_t, 8> midiNoteOffsetArray{};
+
+    for (uint8_t string = 0; string < stringCount; string++) {
+
+        auto offset = -0x80 + trackMetadata.tuning[string];
+
+        if (0x6b <= t.versionNumber) {
+            offset += OPEN_STRING_TO_MIDI_NOTE[string];
+        } else {
+            offset += OPEN_STRING_TO_MIDI_NOTE_LE6A[string];
+        }
+
+        midiNoteOffsetArray[string] = static_cast<uint8_t>(offset);
+    }
+
+    bool dontLetRing = ((trackMetadata.cleanGuitar & 0b10000000) == 0b10000000);
+    uint8_t midiProgram = (trackMetadata.cleanGuitar & 0b01111111);
+
+    const auto noteOn = static_cast<uint8_t>(0x90 | channel);
+    const auto noteOff = static_cast<uint8_t>(0x80 | channel);
+    const auto controlChange = static_cast<uint8_t>(0xb0 | channel);
+    const auto programChange = static_cast<uint8_t>(0xc0 | channel);
+
+    w.start();
+
+    w.trackName(0, track + 1);
+
+    if (opts.emit_program_change_events) {
+        w.event(0, { programChange, midiProgram });
+    }
+
+    if (opts.emit_control_change_events) {
+        w.event(0, { controlChange, 0x07, trackMetadata.volume }); // volume
+        w.event(0, { controlChange, 0x0a, trackMetadata.pan }); // pan
+        w.event(0, { controlChange, 0x5b, 0 }); // reverb
+        w.event(0, { controlChange, 0x5d, 0 }); // chorus
+        w.event(0, { controlChange, 0x01, 0 }); // modulation
+        w.event(0, { controlChange, 0x65, 0 }); // RPN Parameter MSB
+        w.event(0, { controlChange, 0x64, 0 }); // RPN Parameter LSB
+        w.event(0, { controlChange, 0x06, 24 }); // Data Entry MSB, semi-tones
+        w.event(0, { controlChange, 0x26, 0 }); // Data Entry LSB, cents
+    }
+
+    if (opts.emit_pitch_bend_events) {
+        w.event(0, { static_cast<uint8_t>(0xe0 | channel), 0x00, 0x40 }); // pitch bend 8192
+    }
+
+    //
+    // string -> what is playing, 0 if nothing
+    //
+    std::array<uint8_t, 8> currentlyPlayingStrings{};
+
+    //
+    // spaces with events, and the spaces after them for Note Offs of Muteds
+    //
+    std::vector<uint16_t> stops;
+
+    for (const auto &s : trackMetadata.spaces) {
+
+        if (stops.empty() || stops.back() != s.space) {
+            stops.push_back(s.space);
+        }
+
+        stops.push_back(static_cast<uint16_t>(s.space + 1));
+    }
+
+    size_t spaceIndex = 0;
+
+    const char *err = nullptr;
+
+    auto tick = embeddedWalkSpaces(repeats, stops, w, [&](uint16_t space, uint32_t roundedTick) {
+
+        if (err) {
+            return;
+        }
+
+        //
+        // Emit Note Offs for any previous Muteds
+        //
+        for (uint8_t string = 0; string < stringCount; string++) {
+
+            if (currentlyPlayingStrings[string] != MUTED) {
+                continue;
+            }
+
+            currentlyPlayingStrings[string] = 0;
+
+            auto mutedTick = std::min(roundedTick - EMBEDDED_TICKS_PER_SPACE + EMBEDDED_MUTED_TICK_DIFF, roundedTick);
+
+            if (roundedTick == 0) {
+                mutedTick = 0;
+            }
+
+            w.event(mutedTick, { noteOff, static_cast<uint8_t>(0x80 + midiNoteOffsetArray[string]), 0 });
+        }
+
+        embeddedSeek(trackMetadata.spaces, spaceIndex, space, embeddedSpaceSpace);
+
+        if (spaceIndex == trackMetadata.spaces.size() || trackMetadata.spaces[spaceIndex].space != space) {
+            return;
+        }
+
+        const auto &vsqs = trackMetadata.spaces[spaceIndex].vsqs;
+
+        //
+        // Compute note offs and note ons, and emit note offs
+        //
+        bool anyEvent = false;
+
+        for (uint8_t string = 0; string < stringCount; string++) {
+
+            auto on = vsqs[string];
+
+            if (on == 0) {
+                continue;
+            }
+
+            if (on < 0x80 && on != MUTED && on != STOPPED) {
+                err = "invalid note";
+                return;
+            }
+
+            anyEvent = true;
+        }
+
+        std::array<uint8_t, 8> offVsqs{};
+
+        for (uint8_t string = 0; string < stringCount; string++) {
+
+            auto on = vsqs[string];
+
+            auto playing = (on >= 0x80 || on == MUTED);
+
+            if (dontLetRing) {
+
+                //
+                // Don't Let Ring
+                //
+                // An event on any string stops all strings
+                //
+                if (anyEvent) {
+                    offVsqs[string] = currentlyPlayingStrings[string];
+                    currentlyPlayingStrings[string] = playing ? on : 0;
+                }
+
+            } else if (on != 0) {
+
+                //
+                // Let Ring
+                //
+                // a string with an event stops what it is playing, and then plays the event (or nothing, if STOPPED)
+                //
+                offVsqs[string] = currentlyPlayingStrings[string];
+                currentlyPlayingStrings[string] = playing ? on : 0;
+            }
+        }
+
+        for (uint8_t string = 0; string < stringCount; string++) {
+
+            auto off = offVsqs[string];
+
+            if (off == 0) {
+                continue;
+            }
+
+            w.event(roundedTick, { noteOff, static_cast<uint8_t>(off + midiNoteOffsetArray[string]), 0 });
+        }
+
+        //
+        // Emit track effects
+        //
+        auto value = vsqs[S + S + 3];
+
+        switch (vsqs[S + S + 0]) {
+        case 'I': // Instrument change
+            if (opts.emit_program_change_events) {
+
+                dontLetRing = ((value & 0b10000000) == 0b10000000);
+                midiProgram =  (value & 0b01111111);
+
+                w.event(roundedTick, { programChange, midiProgram });
+            }
+            break;
+        case 'V': // Volume change
+            if (opts.emit_control_change_events) {
+                w.event(roundedTick, { controlChange, 0x07, value });
+            }
+            break;
+        case 'C': // Chorus change
+            if (opts.emit_control_change_events) {
+                w.event(roundedTick, { controlChange, 0x5d, value });
+            }
+            break;
+        case 'P': // Pan change
+            if (opts.emit_control_change_events) {
+                w.event(roundedTick, { controlChange, 0x0a, value });
+            }
+            break;
+        case 'R': // Reverb change
+            if (opts.emit_control_change_events) {
+                w.event(roundedTick, { controlChange, 0x5b, value });
+            }
+            break;
+        default:
+            //
+            // tempo changes are in the tempo track, and strokes have nothing to emit
+            //
+            break;
+        }
+
+        //
+        // Emit note ons
+        //
+        for (uint8_t string = 0; string < stringCount; string++) {
+
+            auto on = vsqs[string];
+
+            if (!(on >= 0x80 || on == MUTED)) {
+                continue;
+            }
+
+            if (on == MUTED) {
+                on = 0x80; // open string
+            }
+
+            //
+            // velocity is 0x40, not the track volume, same as convertToMidi
+            //
+            w.event(roundedTick, { noteOn, static_cast<uint8_t>(on + midiNoteOffsetArray[string]), 0x40 });
+        }
+    });
+
+    if (err) {
+        return err;
+    }
+
+    //
+    // Emit any final note offs
+    //
+    for (uint8_t string = 0; string < stringCount; string++) {
+
+        auto off = currentlyPlayingStrings[string];
+
+        if (off == 0) {
+            continue;
+        }
+
+        if (off == MUTED) {
+            off = 0x80; // open string
+        }
+
+        w.event(tick, { noteOff, static_cast<uint8_t>(off + midiNoteOffsetArray[string]), 0 });
+    }
+
+    w.finish(tick);
+
+    return nullptr;
+}
+
+
+//
+// convert an uncompressed .tbt to Standard MIDI File bytes
+//
+constexpr embedded_midi_result embeddedTbtToMidi(
+    std::span<const uint8_t> data,
+    const embedded_midi_opts &opts = {}) {
+
+    embedded_midi_result result;
+
+    embedded_tbt t{};
+
+    result.error = embeddedParseTbt(data, t);
+
+    if (result.error) {
+        return result;
+    }
+
+    std::vector<embedded_repeat> repeats;
+
+    result.error = embeddedComputeRepeats(t, repeats);
+
+    if (result.error) {
+        return result;
+    }
+
+    std::vector<std::array<uint16_t, 2> > tempoMap;
+
+    result.error = embeddedComputeTempoMap(t, tempoMap);
+
+    if (result.error) {
+        return result;
+    }
+
+    std::vector<uint8_t> channels;
+
+    result.error = embeddedComputeChannels(t, channels);
+
+    if (result.error) {
+        return result;
+    }
+
+    auto &out = result.bytes;
+
+    //
+    // header
+    //
+    out.insert(out.end(), { 'M', 'T', 'h', 'd' });
+
+    embeddedWriteBE(out, 2 + 2 + 2, 4); // length
+
+    embeddedWriteBE(out, 1, 2); // format
+
+    embeddedWriteBE(out, static_cast<uint32_t>(t.tracks.size() + 1), 2); // track count, + 1 for tempo track
+
+    embeddedWriteBE(out, 0xc0, 2); // division
+
+    //
+    // Track 0
+    //
+    // will be used for tempo changes exclusively
+    //
+    {
+        embedded_track_writer w{ out };
+
+        w.start();
+
+        w.trackName(0, 0);
+
+        w.event(0, {
+            0xff, 0x58, 0x04, // Meta, Time Signature
+            4, // numerator
+            2, // denominator (as 2^d)
+            24, // ticks per metronome click
+            8 // notated 32-notes in MIDI quarter notes
+        });
+
+        w.tempo(0, t.tempo);
+
+        std::vector<uint16_t> stops;
+
+        for (const auto &change : tempoMap) {
+            stops.push_back(change[0]);
+        }
+
+        size_t tempoIndex = 0;
+
+        auto tick = embeddedWalkSpaces(repeats, stops, w, [&](uint16_t space, uint32_t roundedTick) {
+
+            embeddedSeek(tempoMap, tempoIndex, space, embeddedTempoSpace);
+
+            if (tempoIndex < tempoMap.size() && tempoMap[tempoIndex][0] == space) {
+                w.tempo(roundedTick, tempoMap[tempoIndex][1]);
+            }
+        });
+
+        w.finish(tick);
+    }
+
+    //
+    // the actual tracks
+    //
+    for (size_t track = 0; track < t.tracks.size(); track++) {
+
+        embedded_track_writer w{ out };
+
+        result.error = embeddedWriteTrack(t, track, channels[track], repeats, opts, w);
+
+        if (result.error) {
+            return result;
+        }
+    }
+
+    return result;
+}
+
+
+//
+// not constexpr, so calling it during constant evaluation stops compilation, with error in the diagnostic
+//
+inline void embeddedTbtConversionFailed(const char *error) {
+    (void)error;
+}
+
+
+template <const auto &TBT, embedded_midi_opts OPTS = embedded_midi_opts{}>
+consteval size_t embeddedMidiSize() {
+
+    auto result = embeddedTbtToMidi(std::span<const uint8_t>(TBT), OPTS);
+
+    if (result.error) {
+        embeddedTbtConversionFailed(result.error);
+    }
+
+    return result.bytes.size();
+}
+
+
+//
+// TBT is a constexpr byte array with static storage duration
+//
+template <const auto &TBT, embedded_midi_opts OPTS = embedded_midi_opts{}>
+consteval std::array<uint8_t, embeddedMidiSize<TBT, OPTS>()> embeddedMidiArray() {
+
+    auto result = embeddedTbtToMidi(std::span<const uint8_t>(TBT), OPTS);
+
+    std::array<uint8_t, embeddedMidiSize<TBT, OPTS>()> out{};
+
+    std::copy(result.bytes.begin(), result.bytes.end(), out.begin());
+
+    return out;
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,156 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "tbt-parser.h"
+#include "tbt-parser/note-export.h"
+#include "tbt-parser/song-context.h"
+
+#include "common/status.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint> // for uint8_t
+
+
+//
+// Lazy parsing
+//
+// Parsing a tbt_lazy_file inflates the body and finds where each track's notes, alternate time regions,
+// and track effect changes are, but does not expand them.
+// A track is expanded the first time it is asked for, so the cost of parsing is the cost of the tracks
+// that are actually used.
+//
+// Tracks may be materialized from many threads at once. Each track is expanded exactly once,
+// and materializing a track never touches the maps of other tracks.
+//
+
+
+class tbt_lazy_file {
+public:
+
+    tbt_lazy_file();
+
+    ~tbt_lazy_file();
+
+    tbt_lazy_file(tbt_lazy_file &&) noexcept;
+    tbt_lazy_file &operator=(tbt_lazy_file &&) noexcept;
+
+    tbt_lazy_file(const tbt_lazy_file &) = delete;
+    tbt_lazy_file &operator=(const tbt_lazy_file &) = delete;
+
+    //
+    // header, metadata, and bar lines are always present
+    //
+    // the maps of tracks that have not been materialized are empty, and functions taking a tbt_file
+    // cannot tell them from empty tracks, so pass the tbt_lazy_file to the overloads below instead
+    //
+    const tbt_file &file() const;
+
+    uint8_t versionNumber() const;
+
+    uint8_t trackCount() const;
+
+    //
+    // expand the notes, alternate time regions, and track effect changes of track
+    //
+    // does nothing if track is already materialized
+    //
+    Status materializeTrack(uint8_t track) const;
+
+    //
+    // materialize every selected track
+    //
+    Status materializeTracks(const std::vector<bool> &selected_tracks) const;
+
+    bool trackMaterialized(uint8_t track) const;
+
+    struct impl;
+
+    //
+    // for use by the library
+    //
+    impl &internals() const;
+
+private:
+    std::unique_ptr<impl> pimpl;
+
+    friend Status parseTbtBytesLazy(
+        std::vector<uint8_t>::const_iterator &it,
+        const std::vector<uint8_t>::const_iterator &end,
+        const tbt_parse_opts &opts,
+        tbt_lazy_file &out);
+};
+
+
+//
+// opts.selected_tracks is ignored, every track can be materialized later
+//
+Status parseTbtFileLazy(const char *path, const tbt_parse_opts &opts, tbt_lazy_file &out);
+
+Status parseTbtBytesLazy(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_lazy_file &out);
+
+//
+// materializes what converting the selected tracks reads, then converts
+//
+// the tempo map is computed from every track, so the alternate time regions and track effect changes
+// of every track are materialized, and the notes of every track before 0x72, where tempo changes are stored with the notes
+//
+// the result is the same as converting the fully parsed file
+//
+Status convertToMidi(const tbt_lazy_file &t, const midi_convert_opts &opts, midi_file &m);
+
+//
+// materializes the same tracks as convertToMidi
+//
+Status tbtFileTablature(const tbt_lazy_file &t, const tbt_tablature_opts &opts, std::string &out);
+
+//
+// only reads metadata, so nothing is materialized
+//
+std::string tbtFileInfo(const tbt_lazy_file &t);
+
+//
+// materializes every track
+//
+// t must outlive out
+//
+Status analyzeTbtFile(const tbt_lazy_file &t, const tbt_analyze_opts &opts, tbt_song_context &out);
+
+//
+// materializes every track
+//
+Status buildNoteTable(const tbt_lazy_file &t, note_table &out);
+
+
+
+
+
+
+
+
+
+
+
+
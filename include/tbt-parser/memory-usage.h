@@ -0,0 +1,118 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstddef> // for size_t
+
+
+//
+// Approximate heap bytes held by parsed documents
+//
+// Containers are counted by capacity, and map nodes by a typical node size (tree links, value, and allocator overhead).
+// Sizes of the tbt_file and midi_file objects themselves are not included.
+//
+
+
+struct tbt_memory_usage {
+
+    //
+    // title, artist, album, transcribedBy, comment
+    //
+    size_t metadataStrings = 0;
+
+    size_t trackMetadata = 0;
+
+    size_t barLines = 0;
+
+    //
+    // one entry per track
+    //
+    std::vector<size_t> notes;
+
+    size_t alternateTimeRegions = 0;
+
+    size_t trackEffects = 0;
+
+    //
+    // mapsList itself
+    //
+    size_t tracks = 0;
+
+    size_t total() const;
+};
+
+//
+// same order as midi_track_event
+//
+const size_t MIDI_EVENT_TYPE_COUNT = std::variant_size_v<midi_track_event>;
+
+struct midi_memory_usage {
+
+    std::array<size_t, MIDI_EVENT_TYPE_COUNT> eventCounts{};
+
+    //
+    // slots in the track vectors, by event type
+    //
+    std::array<size_t, MIDI_EVENT_TYPE_COUNT> events{};
+
+    //
+    // data of MetaEvents and SysExEvents
+    //
+    size_t metaPayloads = 0;
+
+    size_t sysExPayloads = 0;
+
+    //
+    // unused capacity of the track vectors, and the vector of tracks
+    //
+    size_t tracks = 0;
+
+    size_t total() const;
+};
+
+
+tbt_memory_usage tbtFileMemoryUsage(const tbt_file &t);
+
+midi_memory_usage midiFileMemoryUsage(const midi_file &m);
+
+std::string tbtMemoryUsageInfo(const tbt_memory_usage &usage);
+
+std::string midiMemoryUsageInfo(const midi_memory_usage &usage);
+
+//
+// peak resident set size of this process, or 0 if not available
+//
+size_t peakResidentSetBytes();
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,148 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <span>
+#include <vector>
+#include <cstdint> // for uint8_t, uint32_t, uint64_t
+#include <cstddef> // for size_t
+
+
+//
+// Handing converted MIDI to another process
+//
+// The converter exports straight into a memfd that is sized with midiExportSize, and seals it against writing, growing,
+// and shrinking. The descriptor is passed to the player, e.g., over a Unix socket, together with a small midi_handoff_descriptor.
+// The player maps it read-only, so the bytes are written once and never copied.
+//
+// Because of the seals, the player can trust that the bytes will not change under it.
+//
+// memfd and file seals are Linux-only. Elsewhere, every function returns ERR.
+//
+
+
+//
+// data of one MTrk chunk, after its type and length
+//
+struct midi_handoff_track {
+    uint64_t offset;
+    uint32_t length;
+};
+
+
+struct midi_handoff_descriptor {
+
+    //
+    // size of the SMF bytes
+    //
+    uint64_t size;
+
+    midi_header header;
+
+    std::vector<midi_handoff_track> tracks;
+
+    //
+    // same as midiFileTempoMap
+    //
+    std::vector<midi_tempo_change> tempoMap;
+};
+
+
+//
+// for sending the descriptor to another process
+//
+void encodeMidiHandoffDescriptor(const midi_handoff_descriptor &d, std::vector<uint8_t> &out);
+
+Status decodeMidiHandoffDescriptor(const std::vector<uint8_t> &in, midi_handoff_descriptor &out);
+
+
+//
+// exports m into a new sealed memfd
+//
+// the caller owns fd, and closes it after handing it off
+//
+Status exportMidiHandoff(const midi_file &m, int &fd, midi_handoff_descriptor &out);
+
+
+//
+// sends fd and the encoded descriptor over a connected Unix socket
+//
+Status sendMidiHandoff(int socket, int fd, const midi_handoff_descriptor &d);
+
+//
+// the caller owns fd
+//
+Status receiveMidiHandoff(int socket, int &fd, midi_handoff_descriptor &out);
+
+
+//
+// A read-only mapping of a handed off memfd
+//
+// open() checks that the memfd is sealed against writing and shrinking, and that the descriptor matches it
+//
+class midi_handoff_mapping {
+public:
+
+    midi_handoff_mapping();
+
+    ~midi_handoff_mapping();
+
+    midi_handoff_mapping(const midi_handoff_mapping &) = delete;
+    midi_handoff_mapping &operator=(const midi_handoff_mapping &) = delete;
+
+    //
+    // fd may be closed after open() returns
+    //
+    Status open(int fd, const midi_handoff_descriptor &d);
+
+    //
+    // the whole SMF
+    //
+    std::span<const uint8_t> bytes() const;
+
+    //
+    // the event data of track i
+    //
+    std::span<const uint8_t> track(size_t i) const;
+
+    const midi_handoff_descriptor &descriptor() const;
+
+private:
+    midi_handoff_descriptor desc;
+
+    void *mapped;
+    size_t mappedSize;
+};
+
+
+
+
+
+
+
+
+
+
+
+
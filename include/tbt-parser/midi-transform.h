@@ -0,0 +1,103 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <array>
+#include <cstdint> // for uint8_t, uint16_t
+
+
+//
+// Transforms on converted event streams
+//
+// For practice features that change while the song is playing, e.g., a transpose or tempo slider:
+// nothing is converted again, each transform is one pass over the events.
+//
+// Transposing and scaling the tempo round and clamp, so applying a transform to its own output is lossy.
+// Keep the converted midi_file and apply each new setting from it, into a midi_file that is reused.
+//
+
+
+struct midi_transform {
+
+    //
+    // semitones added to NoteOn and NoteOff pitches, clamped to 0-127
+    //
+    // channel 9 is for drums and is not transposed
+    //
+    int transpose = 0;
+
+    //
+    // 2.0 plays twice as fast
+    //
+    // applied to the payload of every Set Tempo event
+    //
+    double tempo_scale = 1.0;
+
+    //
+    // one bit per channel, before remapping
+    //
+    // note and key pressure events on muted channels are dropped. Controllers and program changes are kept,
+    // so the channel sounds right when it is unmuted.
+    //
+    uint16_t muted_channels = 0;
+
+    //
+    // if not 0, then every channel that is not soloed is muted
+    //
+    uint16_t solo_channels = 0;
+
+    //
+    // applied last
+    //
+    // every entry must be 0-15
+    //
+    std::array<uint8_t, 16> channel_map = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+};
+
+
+//
+// in place
+//
+// delta times of dropped events are moved to the next event, so nothing else moves
+//
+// fails if tempo_scale is not positive or channel_map has an entry above 15, and then m is unchanged
+//
+Status applyMidiTransform(const midi_transform &xf, midi_file &m);
+
+//
+// out is overwritten, and keeps its storage, so applying settings over and over stops allocating
+//
+Status applyMidiTransform(const midi_file &src, const midi_transform &xf, midi_file &out);
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,118 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <vector>
+#include <cstdint> // for uint8_t, uint16_t, int64_t
+#include <cstddef> // for size_t
+
+
+//
+// Note export for analytics
+//
+// One row per note as written in the tablature, built straight from the parsed body:
+// no tablature text or MIDI bytes are produced in between.
+//
+// Rows are in score order: repeats are not expanded, and tick and micros are the position of the note
+// when the song is played without repeats.
+//
+// Columns:
+//   track
+//   space          space in the track
+//   actual_space   space after alternate time regions are applied
+//   tick           192 ticks per beat, same as MIDI conversion
+//   micros         from the tempo map
+//   string
+//   fret           0xff for muted notes
+//   midi_pitch     0xff for muted notes
+//   effect         string effect as stored in the file, e.g., 'h' for hammer-on, 0 for none
+//   duration       in ticks, until the next event that stops the note
+//
+
+
+struct note_table {
+    std::vector<uint8_t> track;
+    std::vector<uint16_t> space;
+    std::vector<double> actual_space;
+    std::vector<int64_t> tick;
+    std::vector<int64_t> micros;
+    std::vector<uint8_t> string;
+    std::vector<uint8_t> fret;
+    std::vector<uint8_t> midi_pitch;
+    std::vector<uint8_t> effect;
+    std::vector<int64_t> duration;
+
+    size_t size() const;
+
+    //
+    // keeps capacity, so a table reused for many songs stops allocating
+    //
+    void clear();
+};
+
+
+enum note_export_format : uint8_t {
+
+    //
+    // header line, then one line per row
+    //
+    NOTE_EXPORT_CSV = 0,
+
+    //
+    // "TBTN", uint32 format version, uint64 row count, uint32 column count,
+    // then for each column: Pascal1 name, uint8 type (0: uint8, 1: uint16, 2: int64, 3: float64), and all values
+    //
+    // little-endian
+    //
+    NOTE_EXPORT_COLUMNAR = 1,
+};
+
+
+class tbt_song_context;
+
+//
+// clears out first
+//
+Status buildNoteTable(const tbt_file &t, note_table &out);
+
+Status buildNoteTable(const tbt_song_context &ctx, note_table &out);
+
+Status exportNoteTableBytes(const note_table &notes, note_export_format format, std::vector<uint8_t> &out);
+
+//
+// written through a fixed-size buffer, so large tables are never copied in memory
+//
+Status exportNoteTableFile(const note_table &notes, note_export_format format, const char *path);
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,212 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint> // for uint8_t, uint64_t
+#include <cstddef> // for size_t
+
+
+//
+// Pack files
+//
+// A pack holds many .tbt and .mid files in a single file, so bulk jobs open and map one file
+// instead of thousands of files that are only a few KB each.
+//
+// Layout, all integers are little-endian:
+//
+// header:
+//   magic "TBTPACK\0"
+//   u32 format version (1)
+//   u32 entry count
+//   u64 offset of name index
+//   u64 offset of hash index
+//   u64 offset of metadata, 0 if there is no metadata
+//   u64 offset of names
+//
+// blobs: the contents of every entry, concatenated
+//
+// name index, sorted by name:
+//   u64 offset of blob, u64 length of blob, u64 content hash, u32 offset of name in names, u16 length of name, u8 kind, u8 reserved
+//
+// hash index, sorted by content hash:
+//   u64 content hash, u32 position in name index, u32 reserved
+//
+// metadata, in name index order:
+//   u8 tbt version number (0 for MIDI), u8 reserved, u16 track count, u32 reserved, u64 duration in microseconds
+//
+// names: the names of every entry, concatenated, to the end of the file
+//
+
+
+enum tbt_pack_entry_kind : uint8_t {
+    PACK_TBT = 1,
+    PACK_MIDI = 2,
+};
+
+
+//
+// FNV-1a, 64-bit
+//
+uint64_t tbtPackHash(std::span<const uint8_t> data);
+
+
+struct tbt_pack_input {
+    //
+    // a file name, e.g., "twinkle.tbt"
+    //
+    // names are unique within a pack
+    //
+    std::string name;
+    tbt_pack_entry_kind kind;
+    std::vector<uint8_t> data;
+};
+
+
+struct tbt_pack_write_opts {
+
+    //
+    // parse or probe every entry, and store its version number, track count, and duration
+    //
+    // tbt entries are converted to find their duration, so this is slow to write, but free to read
+    //
+    bool include_metadata = false;
+};
+
+
+Status writeTbtPackBytes(std::vector<tbt_pack_input> inputs, const tbt_pack_write_opts &opts, std::vector<uint8_t> &out);
+
+Status writeTbtPackFile(std::vector<tbt_pack_input> inputs, const tbt_pack_write_opts &opts, const char *path);
+
+
+struct tbt_pack_metadata {
+
+    //
+    // 0 for MIDI entries
+    //
+    uint8_t versionNumber;
+
+    uint16_t trackCount;
+
+    //
+    // End Of Track of the converted or probed MIDI
+    //
+    // 0 if the entry could not be parsed when the pack was written
+    //
+    uint64_t durationMicros;
+};
+
+
+//
+// views into the pack, valid as long as the pack is open
+//
+struct tbt_pack_entry {
+    std::string_view name;
+    tbt_pack_entry_kind kind;
+    uint64_t hash;
+    std::span<const uint8_t> data;
+};
+
+
+//
+// A pack opened for reading
+//
+// On POSIX systems, the file is mapped read-only, and entries are read straight out of the mapping.
+// Otherwise, the file is read into memory.
+//
+// Every offset and length is checked when the pack is opened, so entries and lookups do not need to check again.
+//
+// After opening, a pack is only read, so it may be shared by any number of threads.
+//
+class tbt_pack {
+public:
+
+    tbt_pack();
+
+    ~tbt_pack();
+
+    tbt_pack(tbt_pack &&) noexcept;
+    tbt_pack &operator=(tbt_pack &&) noexcept;
+
+    tbt_pack(const tbt_pack &) = delete;
+    tbt_pack &operator=(const tbt_pack &) = delete;
+
+    Status open(const char *path);
+
+    Status openBytes(std::vector<uint8_t> data);
+
+    size_t size() const;
+
+    //
+    // entries are in name order
+    //
+    tbt_pack_entry entry(size_t i) const;
+
+    //
+    // binary search of the name index
+    //
+    bool find(std::string_view name, size_t &out) const;
+
+    //
+    // binary search of the hash index
+    //
+    // if more than 1 entry has the same contents, then any of them may be found
+    //
+    bool findHash(uint64_t hash, size_t &out) const;
+
+    bool hasMetadata() const;
+
+    tbt_pack_metadata metadata(size_t i) const;
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> pimpl;
+};
+
+
+//
+// the tbt parser reads from a std::vector, so the entry is copied once into a buffer the size of the entry
+//
+Status parseTbtPackEntry(const tbt_pack &pack, size_t i, const tbt_parse_opts &opts, tbt_file &out);
+
+Status parseMidiPackEntry(const tbt_pack &pack, size_t i, midi_file &out);
+
+std::string tbtPackInfo(const tbt_pack &pack);
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,222 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint> // for int64_t
+
+
+//
+// Real-time playback
+//
+// A playback_engine dispatches the events of a midi_file to a playback_sink on its own
+// high-priority thread, e.g., to drive FluidSynth with emit_custom_lyric_events.
+//
+// A midi_program is played without expanding its repeats in memory.
+//
+// Every event has an absolute deadline computed from the tempo map, so timing errors do not accumulate.
+// Events are dispatched lookahead_micros before their deadline, so sinks that can schedule
+// ahead (e.g., audio callbacks with their own buffer) can place events exactly.
+//
+
+
+//
+// an event with its time in the song
+//
+struct midi_timed_event {
+    int64_t micros;
+    int64_t tick;
+    uint16_t track;
+    const midi_track_event *event;
+};
+
+
+//
+// merge all tracks of m, ordered by time
+//
+// events at the same tick keep their track order
+//
+// the returned events point into m
+//
+Status midiTimedEvents(const midi_file &m, std::vector<midi_timed_event> &out);
+
+
+struct playback_event {
+
+    midi_timed_event timed;
+
+    //
+    // when the event should sound
+    //
+    std::chrono::steady_clock::time_point deadline;
+};
+
+
+class playback_sink {
+public:
+
+    virtual ~playback_sink() = default;
+
+    //
+    // called on the playback thread, lookahead_micros before e.deadline
+    //
+    virtual void onEvent(const playback_event &e) = 0;
+
+    //
+    // called on the playback thread when sounding notes must stop: pause, seek, loop, and stop
+    //
+    virtual void onAllNotesOff() {}
+};
+
+
+struct playback_opts {
+
+    //
+    // dispatch events this long before their deadline
+    //
+    int64_t lookahead_micros = 0;
+
+    //
+    // sleep until this long before a deadline, then spin
+    //
+    // spinning trades CPU for less jitter than the OS timer gives
+    //
+    int64_t spin_micros = 500;
+
+    //
+    // try to give the playback thread real-time priority
+    //
+    // failing to do so is not an error
+    //
+    bool realtime_priority = true;
+
+    //
+    // when reaching loop_end_micros, continue from loop_start_micros
+    //
+    // loop_end_micros < 0 means the end of the song
+    //
+    bool loop = false;
+    int64_t loop_start_micros = 0;
+    int64_t loop_end_micros = -1;
+};
+
+
+//
+// m (or p) and sink must outlive the engine
+//
+// the control functions may be called from any thread
+//
+class playback_engine {
+public:
+
+    playback_engine(const midi_file &m, playback_sink &sink, const playback_opts &opts);
+
+    playback_engine(const midi_program &p, playback_sink &sink, const playback_opts &opts);
+
+    //
+    // calls stop()
+    //
+    ~playback_engine();
+
+    playback_engine(const playback_engine &) = delete;
+    playback_engine &operator=(const playback_engine &) = delete;
+
+    //
+    // starts playing from the current position
+    //
+    Status start();
+
+    void pause();
+
+    void resume();
+
+    //
+    // moves to micros
+    //
+    // ProgramChange, ControlChange, and PitchBend events before micros are dispatched right away,
+    // so the sink is in the same state as if it had played up to micros
+    //
+    void seek(int64_t micros);
+
+    //
+    // stops the playback thread
+    //
+    void stop();
+
+    //
+    // blocks until the end of the song (never, when looping) or stop()
+    //
+    void wait();
+
+    int64_t positionMicros() const;
+
+    int64_t durationMicros() const;
+
+    bool paused() const;
+
+    bool finished() const;
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> pimpl;
+};
+
+
+//
+// Sink that records when each event was dispatched, for measuring timing jitter without audio hardware
+//
+class recording_sink : public playback_sink {
+public:
+
+    struct record {
+        midi_timed_event timed;
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point dispatched;
+    };
+
+    void onEvent(const playback_event &e) override;
+
+    void onAllNotesOff() override;
+
+    //
+    // only read these after playback has stopped or finished
+    //
+    std::vector<record> records;
+
+    size_t allNotesOffCount = 0;
+};
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,100 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <vector>
+#include <cstdint> // for uint32_t
+
+
+//
+// Offline audio preview
+//
+// Renders a converted midi_file to PCM without an external synthesizer, for thumbnail previews.
+// Every note is a plucked voice: a triangle wave that starts bright and decays.
+// Channel volume, pan, and pitch bend are taken from the ControlChange and PitchBend events.
+// Programs are ignored, and channel 9 plays short clicks.
+//
+// Voices are mixed with SSE2 when available, and with scalar code otherwise.
+//
+
+
+enum wav_sample_format : uint8_t {
+    WAV_PCM16 = 0,
+    WAV_FLOAT32 = 1,
+};
+
+
+struct preview_render_opts {
+
+    uint32_t sample_rate = 44100;
+
+    //
+    // rendering stops here, even if notes are still playing
+    //
+    double max_seconds = 30.0;
+
+    //
+    // when all voices are busy, the quietest voice is stolen
+    //
+    uint32_t max_voices = 64;
+
+    //
+    // use SIMD mixing if available
+    //
+    // turning this off is only useful for testing and benchmarking
+    //
+    bool simd = true;
+};
+
+
+//
+// interleaved stereo samples, nominally in [-1, 1]
+//
+struct pcm_buffer {
+    uint32_t sampleRate;
+    std::vector<float> samples;
+};
+
+
+Status renderPreview(const midi_file &m, const preview_render_opts &opts, pcm_buffer &out);
+
+Status exportWavBytes(const pcm_buffer &pcm, wav_sample_format format, std::vector<uint8_t> &out);
+
+Status exportWavFile(const pcm_buffer &pcm, wav_sample_format format, const char *path);
+
+//
+// true if renderPreview() can use SIMD on this platform
+//
+bool previewSimdAvailable();
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,153 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <memory>
+#include <string>
+#include <cstdint> // for uint8_t
+
+
+//
+// Analyze once, render many
+//
+// Info, tablature, and MIDI are all computed from the same per-space walks:
+// bar lines, repeats, tempo changes, channels, and note offsets.
+// A tbt_song_context holds the results of those walks, so a job that needs several outputs
+// from the same file only pays for them once.
+//
+// A tbt_song_context is only read after analysis, so it may be shared by many threads.
+//
+
+
+struct tbt_analyze_opts {
+
+    //
+    // warnings found while analyzing, e.g., a repeat close with no matching open
+    //
+    // if null, then warnings are logged
+    //
+    tbt_diagnostics *diagnostics = nullptr;
+};
+
+
+class tbt_song_context {
+public:
+
+    tbt_song_context();
+
+    ~tbt_song_context();
+
+    tbt_song_context(tbt_song_context &&) noexcept;
+    tbt_song_context &operator=(tbt_song_context &&) noexcept;
+
+    tbt_song_context(const tbt_song_context &) = delete;
+    tbt_song_context &operator=(const tbt_song_context &) = delete;
+
+    //
+    // the analyzed file
+    //
+    // the file is not copied, so it must outlive the context
+    //
+    const tbt_file &file() const;
+
+    uint8_t versionNumber() const;
+
+    struct impl;
+
+    //
+    // for use by the library
+    //
+    const impl &internals() const;
+
+private:
+    std::unique_ptr<impl> pimpl;
+
+    friend Status analyzeTbtFile(const tbt_file &t, const tbt_analyze_opts &opts, tbt_song_context &out);
+};
+
+
+Status analyzeTbtFile(const tbt_file &t, const tbt_analyze_opts &opts, tbt_song_context &out);
+
+std::string tbtFileInfo(const tbt_song_context &ctx);
+
+std::string tbtFileComment(const tbt_song_context &ctx);
+
+std::string tbtFileTablature(const tbt_song_context &ctx, const tbt_tablature_opts &opts);
+
+//
+// opts.diagnostics only receives warnings found while converting,
+// warnings found while analyzing go to tbt_analyze_opts::diagnostics
+//
+Status convertToMidi(const tbt_song_context &ctx, const midi_convert_opts &opts, midi_file &m);
+
+//
+// opts.eliminate_redundant_events is not supported, it needs the whole midi_file
+//
+Status convertToMidiProgram(const tbt_song_context &ctx, const midi_convert_opts &opts, midi_program &p);
+
+//
+// opts.eliminate_redundant_events is not supported, it needs the whole midi_file
+//
+Status convertToMidiBytes(const tbt_song_context &ctx, const midi_convert_opts &opts, std::vector<uint8_t> &out);
+
+Status convertToMidiBytes(const tbt_song_context &ctx, const midi_convert_opts &opts, std::vector<uint8_t> &out, midi_event_counts &counts);
+
+
+struct song_outputs_opts {
+    bool info = true;
+    bool comment = true;
+    bool tablature = true;
+    bool midi = true;
+
+    tbt_tablature_opts tablature_opts;
+
+    //
+    // midi_opts.diagnostics also receives warnings found while analyzing
+    //
+    midi_convert_opts midi_opts;
+};
+
+
+struct song_outputs {
+    std::string info;
+    std::string comment;
+    std::string tablature;
+    midi_file midi;
+};
+
+
+//
+// analyze t once, and produce every requested output from the same analysis
+//
+Status renderSongOutputs(const tbt_file &t, const song_outputs_opts &opts, song_outputs &out);
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,162 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstdint> // for uint8_t, uint16_t
+
+
+//
+// Editable song
+//
+// A tbt_song_model owns a tbt_file that is edited in place, and keeps a MIDI conversion of it.
+//
+// Each edit marks what it affects as dirty:
+//   notes, and track effects other than tempo, only affect their own track
+//   tempo changes also affect the tempo track
+//   bar lines, and inserting or removing spaces, change the repeat structure and the length of the song, so every track is affected
+//
+// convert() then regenerates only the dirty tracks, and only re-analyzes the song
+// when the tempo or the repeat structure changed.
+// After a note edit, the cost of convert() is the cost of converting that one track.
+//
+// Only 0x72 files can be edited.
+//
+
+
+//
+// spaces [begin, end)
+//
+struct tbt_space_range {
+    uint16_t begin;
+    uint16_t end;
+};
+
+
+struct song_dirty_state {
+
+    //
+    // bar lines or spaces changed
+    //
+    bool structure = false;
+
+    //
+    // tempo changed
+    //
+    bool tempo = false;
+
+    //
+    // for each track
+    //
+    std::vector<bool> tracks;
+
+    //
+    // for each track, the smallest range of spaces that contains every edit
+    //
+    // only meaningful if tracks[i] is true
+    //
+    std::vector<tbt_space_range> ranges;
+};
+
+
+class tbt_song_model {
+public:
+
+    tbt_song_model();
+
+    ~tbt_song_model();
+
+    tbt_song_model(tbt_song_model &&) noexcept;
+    tbt_song_model &operator=(tbt_song_model &&) noexcept;
+
+    tbt_song_model(const tbt_song_model &) = delete;
+    tbt_song_model &operator=(const tbt_song_model &) = delete;
+
+    //
+    // takes t, and does a full conversion
+    //
+    // opts.selected_tracks is ignored, every track is converted
+    //
+    Status open(tbt_file t, const midi_convert_opts &opts);
+
+    const tbt_file &file() const;
+
+    //
+    // the conversion as of the last call to convert()
+    //
+    const midi_file &midi() const;
+
+    const song_dirty_state &dirty() const;
+
+    //
+    // event is the same as in notesMap: 0 for nothing, 0x80 + fret for a note, MUTED, or STOPPED
+    //
+    Status setNote(uint8_t track, uint16_t space, uint8_t string, uint8_t event);
+
+    //
+    // barLine is the same as in barLinesMap
+    //
+    Status setBarLine(uint16_t space, std::array<uint8_t, 2> barLine);
+
+    Status removeBarLine(uint16_t space);
+
+    Status setTrackEffect(uint8_t track, uint16_t space, tbt_track_effect effect, uint16_t value);
+
+    Status removeTrackEffect(uint8_t track, uint16_t space, tbt_track_effect effect);
+
+    //
+    // inserts count empty spaces before space, in every track
+    //
+    Status insertSpaces(uint16_t space, uint16_t count);
+
+    //
+    // removes spaces [space, space + count) from every track
+    //
+    // the removed spaces must not be in an alternate time region
+    //
+    Status removeSpaces(uint16_t space, uint16_t count);
+
+    //
+    // regenerates the dirty parts of midi(), and clears dirty()
+    //
+    Status convert();
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> pimpl;
+};
+
+
+
+
+
+
+
+
+
+
+
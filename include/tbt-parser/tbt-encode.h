@@ -0,0 +1,78 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "tbt-parser.h"
+
+#include "common/status.h"
+
+#include <vector>
+#include <cstdint> // for uint8_t
+
+
+//
+// Encoding .tbt files
+//
+// The inverse of parseTbtBytes, for versions 0x70 and later: bar-line records, per-track space counts,
+// zlib-compressed metadata and body, and correct CRCs.
+//
+// Older files are first upgraded to 0x72, the latest version:
+//   spaceCount is exact, instead of 4000 (before 0x6f) or a count that TabIt padded
+//   bar lines become bar-line records
+//   track effects move from the notes to track effect changes
+//   strings of files before 0x6b are put in the modern order, with tunings adjusted to keep the same pitches
+//   metadata added in later versions gets the values that conversion already assumed for older versions
+//
+// Files before 0x6f do not store the length of the song, and are padded to 4000 spaces.
+// That padding is trimmed after the last note or repeat, which moves the final note offs and End Of Track earlier.
+// Nothing else that is played is changed.
+//
+
+
+//
+// t must be version 0x70 or later
+//
+Status encodeTbtBytes(const tbt_file &t, std::vector<uint8_t> &out);
+
+Status upgradeTbtFile(const tbt_file &t, tbt_file &out);
+
+//
+// converts both files with default options and compares every event
+//
+// if original is before 0x6f, then trailing note offs and End Of Track may come earlier in upgraded,
+// but not before the last other event
+//
+// otherwise, every event must be the same
+//
+// logs the first difference
+//
+Status verifyUpgradedTbtFile(const tbt_file &original, const tbt_file &upgraded);
+
+
+
+
+
+
+
+
+
+
+
+
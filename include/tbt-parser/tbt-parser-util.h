@@ -74,6 +74,28 @@ Status zlib_inflate(
     const std::vector<uint8_t>::const_iterator &end,
     std::vector<uint8_t> &acc);
 
+//
+// inflate at most maxSize bytes, and fail as soon as the output would exceed maxSize
+//
+// sizeHint is an estimate of the inflated size, and is reserved in acc up front; acc still grows past it if needed
+//
+Status zlib_inflate(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    size_t maxSize,
+    size_t sizeHint,
+    std::vector<uint8_t> &acc);
+
+//
+// appends to acc
+//
+// level is a zlib compression level, 0-9
+//
+Status zlib_deflate(
+    const std::vector<uint8_t> &data,
+    int level,
+    std::vector<uint8_t> &acc);
+
 Status computeDeltaListCount(const std::vector<uint8_t> &deltaList, uint32_t *acc);
 
 void toDigitsBE(uint16_t value, std::vector<uint8_t> &out);
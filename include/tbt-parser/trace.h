@@ -0,0 +1,83 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "common/status.h"
+
+#include <cstdint> // for int64_t
+
+
+//
+// Recorder for Chrome trace-event JSON, viewable in Perfetto or chrome://tracing
+//
+// Each thread records into its own buffer, so recording a span takes no locks.
+// When tracing is not enabled, a span costs a single atomic load.
+//
+// traceBegin() and traceEnd() must not be called while traced work is running on other threads.
+//
+
+
+void traceBegin();
+
+//
+// stops recording and writes every recorded span to path
+//
+Status traceEnd(const char *path);
+
+bool traceEnabled();
+
+
+//
+// RAII span
+//
+// name and argName must be string literals (or otherwise outlive traceEnd())
+//
+// string args must outlive the span, and are copied (truncated to 63 bytes) when the span ends
+//
+class trace_span {
+public:
+
+    explicit trace_span(const char *name);
+
+    trace_span(const char *name, const char *argName, int64_t argValue);
+
+    trace_span(const char *name, const char *argName, const char *argValue);
+
+    ~trace_span();
+
+    trace_span(const trace_span &) = delete;
+    trace_span &operator=(const trace_span &) = delete;
+
+private:
+    const char *name;
+    const char *argName;
+    int64_t argInt;
+    const char *argStr;
+    int64_t startNs;
+};
+
+
+
+
+
+
+
+
+
+
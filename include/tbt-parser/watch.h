@@ -0,0 +1,121 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "common/status.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint> // for uint8_t
+
+
+//
+// Watching a directory for changed files
+//
+// Editors often save with several writes in a row, or by writing a temporary file and renaming it.
+// Changes to the same file are debounced: a file is reported once no change to it has been seen for debounce_ms.
+//
+// On Linux, inotify is used. Otherwise, the directory is polled for changed modification times and sizes.
+//
+
+
+enum watch_backend : uint8_t {
+    WATCH_INOTIFY = 0,
+    WATCH_POLL = 1,
+};
+
+
+struct watch_opts {
+
+    //
+    // milliseconds without changes before a file is reported
+    //
+    int debounce_ms = 200;
+
+    //
+    // milliseconds between scans for WATCH_POLL
+    //
+    int poll_ms = 500;
+};
+
+
+class directory_watcher {
+public:
+
+    directory_watcher();
+
+    ~directory_watcher();
+
+    directory_watcher(const directory_watcher &) = delete;
+    directory_watcher &operator=(const directory_watcher &) = delete;
+
+    //
+    // only files directly in dir with the given extension (e.g., ".tbt") are reported
+    //
+    Status open(const std::string &dir, const std::string &extension, const watch_opts &opts);
+
+    //
+    // blocks until at least 1 file has changed and settled, and sets out to the changed paths, sorted
+    //
+    // returns false after stop()
+    //
+    bool next(std::vector<std::string> &out);
+
+    //
+    // may be called from any thread, e.g., a signal-handling thread
+    //
+    void stop();
+
+    //
+    // keep outputs up to date until stop()
+    //
+    // first, the files whose output (the same path with outputExtension) is missing or older are processed,
+    // then files are processed again whenever they change
+    //
+    // process is called on all cores at once, with a different path on each call
+    //
+    void run(const std::string &outputExtension, const std::function<void (const std::string &path)> &process);
+
+    watch_backend backend() const;
+
+    struct impl;
+
+private:
+    std::unique_ptr<impl> pimpl;
+};
+
+
+//
+// writes path + ".tmp" and renames it to path, so readers never see a partially written file
+//
+Status saveFileAtomically(const std::string &path, const std::vector<uint8_t> &data);
+
+
+
+
+
+
+
+
+
+
+
@@ -25,77 +25,107 @@
 //
 
 
+//
+// parse the alternate time regions of one track
+//
+// if expand is false, then the regions are only counted, to find where the next track starts
+//
 template <uint8_t VERSION, typename tbt_file_t>
 Status
-parseAlternateTimeRegionsMapList(
+parseAlternateTimeRegionsMap(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
+    uint8_t track,
+    bool expand,
     tbt_file_t &out) {
 
-    for (uint8_t track = 0; track < out.header.trackCount; track++) {
-
-        auto trackSpaceCount = out.metadata.tracks[track].spaceCount;
+    auto trackSpaceCount = out.metadata.tracks[track].spaceCount;
 
-        std::vector<uint8_t> alternateTimeRegionsDeltaListAcc;
-        uint32_t dsqCount = 0;
+    std::vector<uint8_t> alternateTimeRegionsDeltaListAcc;
+    uint32_t dsqCount = 0;
 
-        while (true) {
+    while (true) {
 
-            std::vector<uint8_t> deltaList;
+        std::vector<uint8_t> deltaList;
 
-            Status ret = parseDeltaListChunk(it, end, deltaList);
+        Status ret = parseDeltaListChunk(it, end, deltaList);
 
-            if (ret != OK) {
-                return ret;
-            }
+        if (ret != OK) {
+            return ret;
+        }
 
+        if (expand) {
             alternateTimeRegionsDeltaListAcc.insert(
                 alternateTimeRegionsDeltaListAcc.end(),
                 deltaList.cbegin(),
                 deltaList.cend()
             );
+        }
 
-            ret = computeDeltaListCount(deltaList, &dsqCount);
+        ret = computeDeltaListCount(deltaList, &dsqCount);
 
-            if (ret != OK) {
-                return ret;
-            }
+        if (ret != OK) {
+            return ret;
+        }
 
-            CHECK(dsqCount <= 2 * trackSpaceCount, "unhandled");
+        CHECK(dsqCount <= 2 * trackSpaceCount, "unhandled");
 
-            if (dsqCount == 2 * trackSpaceCount) {
-                break;
-            }
+        if (dsqCount == 2 * trackSpaceCount) {
+            break;
         }
+    }
+
+    if (!expand) {
+        return OK;
+    }
 
-        auto &alternateTimeRegionsMap = out.body.mapsList[track].alternateTimeRegionsMap;
+    auto &alternateTimeRegionsMap = out.body.mapsList[track].alternateTimeRegionsMap;
 
-        Status ret = expandDeltaList<2>(
-            alternateTimeRegionsDeltaListAcc,
-            dsqCount,
-            1,
-            alternateTimeRegionsMap
-        );
+    Status ret = expandDeltaList<2>(
+        alternateTimeRegionsDeltaListAcc,
+        dsqCount,
+        1,
+        alternateTimeRegionsMap
+    );
 
-        if (ret != OK) {
-            return ret;
-        }
+    if (ret != OK) {
+        return ret;
+    }
 
-        rational alternateTimeRegionsCorrection = 0;
-        for (uint16_t space = 0; space < trackSpaceCount; space++) {
+    rational alternateTimeRegionsCorrection = 0;
+    for (uint16_t space = 0; space < trackSpaceCount; space++) {
 
-            const auto &alternateTimeRegionsIt = alternateTimeRegionsMap.find(space);
-            if (alternateTimeRegionsIt != alternateTimeRegionsMap.end()) {
+        const auto &alternateTimeRegionsIt = alternateTimeRegionsMap.find(space);
+        if (alternateTimeRegionsIt != alternateTimeRegionsMap.end()) {
 
-                const auto &alternateTimeRegion = alternateTimeRegionsIt->second;
+            const auto &alternateTimeRegion = alternateTimeRegionsIt->second;
 
-                auto atr = rational{1} - rational{alternateTimeRegion[0], alternateTimeRegion[1]};
+            auto atr = rational{1} - rational{alternateTimeRegion[0], alternateTimeRegion[1]};
 
-                alternateTimeRegionsCorrection += atr;
-            }
+            alternateTimeRegionsCorrection += atr;
         }
+    }
+
+    ASSERT(rational(out.metadata.tracks[track].spaceCount) == rational(out.body.barLinesSpaceCount) + alternateTimeRegionsCorrection);
+
+    return OK;
+}
 
-        ASSERT(rational(out.metadata.tracks[track].spaceCount) == rational(out.body.barLinesSpaceCount) + alternateTimeRegionsCorrection);
+
+template <uint8_t VERSION, typename tbt_file_t>
+Status
+parseAlternateTimeRegionsMapList(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    tbt_file_t &out) {
+
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+
+        Status ret = parseAlternateTimeRegionsMap<VERSION, tbt_file_t>(it, end, track, true, out);
+
+        if (ret != OK) {
+            return ret;
+        }
     }
 
     return OK;
@@ -30,6 +30,7 @@ Status
 parseBody(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
     tbt_file_t &out) {
 
     //
@@ -55,11 +56,11 @@ parseBody(
 
     if constexpr (0x6b <= VERSION) {
 
-        ret = parseNotesMapList<VERSION, tbt_file_t, 8>(it, end, out);
+        ret = parseNotesMapList<VERSION, tbt_file_t, 8>(it, end, opts, out);
 
     } else {
 
-        ret = parseNotesMapList<VERSION, tbt_file_t, 6>(it, end, out);
+        ret = parseNotesMapList<VERSION, tbt_file_t, 6>(it, end, opts, out);
     }
 
     if (ret != OK) {
@@ -96,6 +97,168 @@ parseBody(
 }
 
 
+//
+// parse bar lines, and find where each track's sections are without expanding them
+//
+// offsets in ranges are from begin
+//
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, typename tbt_file_t>
+Status
+parseBodyRanges(
+    const std::vector<uint8_t>::const_iterator &begin,
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    tbt_file_t &out,
+    std::vector<tbt_track_body_ranges> &ranges) {
+
+    Status ret = parseBarLinesMap<VERSION, tbt_file_t>(it, end, out);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    out.body.mapsList.clear();
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+        out.body.mapsList.push_back( {} );
+    }
+
+    ranges = std::vector<tbt_track_body_ranges>(out.header.trackCount);
+
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+
+        ranges[track].notesBegin = static_cast<size_t>(it - begin);
+
+        if constexpr (0x6b <= VERSION) {
+
+            ret = parseNotesMap<VERSION, tbt_file_t, 8>(it, end, track, false, out);
+
+        } else {
+
+            ret = parseNotesMap<VERSION, tbt_file_t, 6>(it, end, track, false, out);
+        }
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        ranges[track].notesEnd = static_cast<size_t>(it - begin);
+    }
+
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+
+        ranges[track].alternateTimeRegionsBegin = static_cast<size_t>(it - begin);
+
+        if constexpr (HASALTERNATETIMEREGIONS) {
+
+            ret = parseAlternateTimeRegionsMap<VERSION, tbt_file_t>(it, end, track, false, out);
+
+            if (ret != OK) {
+                return ret;
+            }
+        }
+
+        ranges[track].alternateTimeRegionsEnd = static_cast<size_t>(it - begin);
+    }
+
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+
+        ranges[track].trackEffectChangesBegin = static_cast<size_t>(it - begin);
+
+        if constexpr (0x71 <= VERSION) {
+
+            ret = parseTrackEffectChanges<VERSION, tbt_file_t>(it, end, track, false, out);
+
+            if (ret != OK) {
+                return ret;
+            }
+        }
+
+        ranges[track].trackEffectChangesEnd = static_cast<size_t>(it - begin);
+    }
+
+    return OK;
+}
+
+
+template <uint8_t VERSION, typename tbt_file_t>
+Status
+parseTrackNotes(
+    const tbt_lazy_body &body,
+    uint8_t track,
+    tbt_file_t &out) {
+
+    const auto &ranges = body.tracks[track];
+
+    auto it = body.bytes.cbegin() + static_cast<std::ptrdiff_t>(ranges.notesBegin);
+
+    auto end = body.bytes.cbegin() + static_cast<std::ptrdiff_t>(ranges.notesEnd);
+
+    Status ret;
+
+    if constexpr (0x6b <= VERSION) {
+
+        ret = parseNotesMap<VERSION, tbt_file_t, 8>(it, end, track, true, out);
+
+    } else {
+
+        ret = parseNotesMap<VERSION, tbt_file_t, 6>(it, end, track, true, out);
+    }
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    ASSERT(it == end);
+
+    return OK;
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, typename tbt_file_t>
+Status
+parseTrackTiming(
+    const tbt_lazy_body &body,
+    uint8_t track,
+    tbt_file_t &out) {
+
+    static_assert(HASALTERNATETIMEREGIONS || 0x71 <= VERSION, "there is no timing to parse");
+
+    const auto &ranges = body.tracks[track];
+
+    if constexpr (HASALTERNATETIMEREGIONS) {
+
+        auto it = body.bytes.cbegin() + static_cast<std::ptrdiff_t>(ranges.alternateTimeRegionsBegin);
+
+        auto end = body.bytes.cbegin() + static_cast<std::ptrdiff_t>(ranges.alternateTimeRegionsEnd);
+
+        Status ret = parseAlternateTimeRegionsMap<VERSION, tbt_file_t>(it, end, track, true, out);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        ASSERT(it == end);
+    }
+
+    if constexpr (0x71 <= VERSION) {
+
+        auto it = body.bytes.cbegin() + static_cast<std::ptrdiff_t>(ranges.trackEffectChangesBegin);
+
+        auto end = body.bytes.cbegin() + static_cast<std::ptrdiff_t>(ranges.trackEffectChangesEnd);
+
+        Status ret = parseTrackEffectChanges<VERSION, tbt_file_t>(it, end, track, true, out);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        ASSERT(it == end);
+    }
+
+    return OK;
+}
+
+
 #undef TAG
 
 
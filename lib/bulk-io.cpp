@@ -0,0 +1,1199 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/bulk-io.h"
+
+#include "tbt-parser/trace.h"
+
+#undef NDEBUG
+
+#include "common/abort.h"
+#include "common/assert.h"
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <algorithm> // for min
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility> // for move
+#include <cstring> // for strerror
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define TBTPARSER_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#define TBTPARSER_HAVE_IO_URING 0
+#endif
+
+
+#define TAG "bulk-io"
+
+
+//
+// size of the first read of a file
+//
+// .tbt and .mid files are typically a few KB, so most files are read with a single read
+//
+const size_t INITIAL_READ_SIZE = 16384;
+
+
+size_t threadCount(const bulk_io_opts &opts) {
+
+    if (opts.thread_count != 0) {
+        return opts.thread_count;
+    }
+
+    auto n = static_cast<size_t>(std::thread::hardware_concurrency());
+
+    if (n == 0) {
+        return 4;
+    }
+
+    return n;
+}
+
+
+#if TBTPARSER_HAVE_IO_URING
+
+//
+// Minimal io_uring ring using the raw syscalls
+//
+// liburing is not a dependency, so only what is needed here is implemented
+//
+struct uring {
+
+    int fd = -1;
+
+    unsigned sqEntries = 0;
+
+    void *sqPtr = nullptr;
+    size_t sqSize = 0;
+
+    void *cqPtr = nullptr;
+    size_t cqSize = 0;
+
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    //
+    // number of sqes filled in but not yet submitted
+    //
+    unsigned toSubmit = 0;
+};
+
+
+void uringTeardown(uring &r) {
+
+    if (r.sqes != nullptr) {
+        munmap(r.sqes, r.sqesSize);
+        r.sqes = nullptr;
+    }
+
+    if (r.cqPtr != nullptr && r.cqPtr != r.sqPtr) {
+        munmap(r.cqPtr, r.cqSize);
+    }
+    r.cqPtr = nullptr;
+
+    if (r.sqPtr != nullptr) {
+        munmap(r.sqPtr, r.sqSize);
+        r.sqPtr = nullptr;
+    }
+
+    if (r.fd != -1) {
+        close(r.fd);
+        r.fd = -1;
+    }
+}
+
+
+//
+// check that every opcode that is used here is supported by the running kernel
+//
+bool uringProbe(int fd) {
+
+    const size_t opCount = 256;
+
+    std::vector<uint8_t> buf(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op));
+
+    auto probe = reinterpret_cast<io_uring_probe *>(buf.data());
+
+    auto res = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, static_cast<unsigned>(opCount));
+
+    if (res < 0) {
+        return false;
+    }
+
+    for (auto op : { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE }) {
+
+        if (probe->last_op < op) {
+            return false;
+        }
+
+        if ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool uringSetup(uring &r, unsigned entries) {
+
+    io_uring_params p{};
+
+    auto res = syscall(__NR_io_uring_setup, entries, &p);
+
+    if (res < 0) {
+        //
+        // ENOSYS on old kernels, EPERM when blocked by seccomp or sysctl
+        //
+        return false;
+    }
+
+    r.fd = static_cast<int>(res);
+
+    if (!uringProbe(r.fd)) {
+        uringTeardown(r);
+        return false;
+    }
+
+    r.sqEntries = p.sq_entries;
+
+    r.sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r.cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    bool singleMmap = ((p.features & IORING_FEAT_SINGLE_MMAP) == IORING_FEAT_SINGLE_MMAP);
+
+    if (singleMmap) {
+        r.sqSize = std::max(r.sqSize, r.cqSize);
+        r.cqSize = r.sqSize;
+    }
+
+    r.sqPtr = mmap(nullptr, r.sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQ_RING);
+
+    if (r.sqPtr == MAP_FAILED) {
+        r.sqPtr = nullptr;
+        uringTeardown(r);
+        return false;
+    }
+
+    if (singleMmap) {
+
+        r.cqPtr = r.sqPtr;
+
+    } else {
+
+        r.cqPtr = mmap(nullptr, r.cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_CQ_RING);
+
+        if (r.cqPtr == MAP_FAILED) {
+            r.cqPtr = nullptr;
+            uringTeardown(r);
+            return false;
+        }
+    }
+
+    r.sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+    auto sqes = mmap(nullptr, r.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        uringTeardown(r);
+        return false;
+    }
+
+    r.sqes = static_cast<io_uring_sqe *>(sqes);
+
+    auto sq = static_cast<char *>(r.sqPtr);
+
+    r.sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    r.sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    r.sqMask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    r.sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+
+    auto cq = static_cast<char *>(r.cqPtr);
+
+    r.cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    r.cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    r.cqMask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    r.cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    return true;
+}
+
+
+//
+// callers never have more operations outstanding than sqEntries, so there is always room
+//
+io_uring_sqe *uringGetSqe(uring &r) {
+
+    auto head = std::atomic_ref<unsigned>(*r.sqHead).load(std::memory_order_acquire);
+    auto tail = *r.sqTail + r.toSubmit;
+
+    ASSERT(tail - head < r.sqEntries);
+
+    auto index = tail & *r.sqMask;
+
+    auto sqe = &r.sqes[index];
+
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+
+    r.sqArray[index] = index;
+
+    r.toSubmit++;
+
+    return sqe;
+}
+
+
+//
+// submit any pending sqes, and wait for at least waitCount completions
+//
+bool uringSubmitAndWait(uring &r, unsigned waitCount) {
+
+    std::atomic_ref<unsigned>(*r.sqTail).store(*r.sqTail + r.toSubmit, std::memory_order_release);
+
+    auto toSubmit = r.toSubmit;
+
+    r.toSubmit = 0;
+
+    while (true) {
+
+        unsigned flags = (waitCount > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+        auto res = syscall(__NR_io_uring_enter, r.fd, toSubmit, waitCount, flags, nullptr, 0);
+
+        if (res >= 0) {
+
+            ASSERT(static_cast<unsigned>(res) <= toSubmit);
+
+            toSubmit -= static_cast<unsigned>(res);
+
+            if (toSubmit == 0) {
+                return true;
+            }
+
+            //
+            // partial submission, keep going
+            //
+            continue;
+        }
+
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            continue;
+        }
+
+        LOGE("io_uring_enter failed: %s", std::strerror(errno));
+
+        return false;
+    }
+}
+
+
+template <typename F>
+void uringForEachCqe(uring &r, F f) {
+
+    auto head = *r.cqHead;
+
+    auto tail = std::atomic_ref<unsigned>(*r.cqTail).load(std::memory_order_acquire);
+
+    while (head != tail) {
+
+        const auto &cqe = r.cqes[head & *r.cqMask];
+
+        f(cqe.user_data, cqe.res);
+
+        head++;
+    }
+
+    std::atomic_ref<unsigned>(*r.cqHead).store(head, std::memory_order_release);
+}
+
+
+void prepOpen(io_uring_sqe *sqe, const char *path, int flags, uint64_t userData) {
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(path);
+    sqe->len = 0644; // mode
+    sqe->open_flags = static_cast<uint32_t>(flags);
+    sqe->user_data = userData;
+}
+
+void prepRead(io_uring_sqe *sqe, int fd, uint8_t *buf, size_t len, size_t offset, uint64_t userData) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->off = offset;
+    sqe->user_data = userData;
+}
+
+void prepWrite(io_uring_sqe *sqe, int fd, const uint8_t *buf, size_t len, size_t offset, uint64_t userData) {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->off = offset;
+    sqe->user_data = userData;
+}
+
+void prepClose(io_uring_sqe *sqe, int fd, uint64_t userData) {
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+}
+
+#endif // TBTPARSER_HAVE_IO_URING
+
+
+bool bulkIOUringAvailable() {
+
+#if TBTPARSER_HAVE_IO_URING
+
+    uring r;
+
+    if (!uringSetup(r, 2)) {
+        return false;
+    }
+
+    uringTeardown(r);
+
+    return true;
+
+#else
+
+    return false;
+
+#endif // TBTPARSER_HAVE_IO_URING
+}
+
+
+//
+// reader
+//
+
+
+struct bulk_file_reader::impl {
+
+    std::vector<std::string> paths;
+
+    bulk_io_opts opts;
+
+    bulk_io_backend backend;
+
+    std::mutex mutex;
+
+    //
+    // signaled when an item is ready, or all items are done
+    //
+    std::condition_variable readyCV;
+
+    //
+    // signaled when an item is consumed, or stopping
+    //
+    std::condition_variable spaceCV;
+
+    std::deque<bulk_read_item> ready;
+
+    //
+    // items that have been started but not yet consumed
+    //
+    size_t outstanding = 0;
+
+    size_t consumed = 0;
+
+    bool stopping = false;
+
+    std::atomic<size_t> nextIndex = 0;
+
+    std::vector<std::thread> threads;
+
+#if TBTPARSER_HAVE_IO_URING
+    uring ring;
+#endif // TBTPARSER_HAVE_IO_URING
+
+    //
+    // wait until there is room for another item
+    //
+    // returns false if stopping
+    //
+    bool acquire() {
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        spaceCV.wait(lock, [&] { return stopping || outstanding < opts.max_in_flight; });
+
+        if (stopping) {
+            return false;
+        }
+
+        outstanding++;
+
+        return true;
+    }
+
+    //
+    // non-blocking version of acquire()
+    //
+    bool tryAcquire() {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (stopping || outstanding == opts.max_in_flight) {
+            return false;
+        }
+
+        outstanding++;
+
+        return true;
+    }
+
+    void publish(bulk_read_item &&item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            ready.push_back(std::move(item));
+        }
+
+        readyCV.notify_one();
+    }
+
+    void threadsWorker() {
+
+        while (true) {
+
+            auto i = nextIndex.fetch_add(1);
+
+            if (i >= paths.size()) {
+                return;
+            }
+
+            if (!acquire()) {
+                return;
+            }
+
+            bulk_read_item item{ i, paths[i], OK, {} };
+
+            {
+                trace_span span("read", "path", item.path.c_str());
+
+                item.status = openFile(item.path.c_str(), item.data);
+            }
+
+            publish(std::move(item));
+        }
+    }
+
+#if TBTPARSER_HAVE_IO_URING
+
+    enum slot_state : uint8_t {
+        SLOT_FREE,
+        SLOT_OPENING,
+        SLOT_READING,
+        SLOT_CLOSING,
+    };
+
+    struct slot {
+        slot_state state = SLOT_FREE;
+        int fd = -1;
+        size_t size = 0;
+        bulk_read_item item;
+    };
+
+    void uringWorker() {
+
+        std::vector<slot> slots(std::min<size_t>(ring.sqEntries, opts.max_in_flight));
+
+        size_t inRing = 0;
+
+        while (true) {
+
+            //
+            // start as many new reads as there is room for
+            //
+            for (size_t s = 0; s < slots.size(); s++) {
+
+                auto &sl = slots[s];
+
+                if (sl.state != SLOT_FREE) {
+                    continue;
+                }
+
+                if (nextIndex.load() >= paths.size()) {
+                    break;
+                }
+
+                //
+                // only block for room if there is nothing in the ring to wait on
+                //
+                bool acquired = (inRing == 0) ? acquire() : tryAcquire();
+
+                if (!acquired) {
+                    break;
+                }
+
+                auto i = nextIndex.fetch_add(1);
+
+                sl.item = bulk_read_item{ i, paths[i], OK, {} };
+                sl.size = 0;
+                sl.fd = -1;
+                sl.state = SLOT_OPENING;
+
+                prepOpen(uringGetSqe(ring), sl.item.path.c_str(), O_RDONLY | O_CLOEXEC, s);
+
+                inRing++;
+            }
+
+            if (inRing == 0) {
+
+                //
+                // nothing started and nothing in the ring, so either done or stopping
+                //
+                return;
+            }
+
+            if (!uringSubmitAndWait(ring, 1)) {
+
+                //
+                // the ring is unusable, so fail the remaining items
+                //
+                // open fds are leaked, but this is not expected to happen
+                //
+                for (auto &sl : slots) {
+                    if (sl.state != SLOT_FREE) {
+                        sl.item.status = ERR;
+                        sl.state = SLOT_FREE;
+                        publish(std::move(sl.item));
+                    }
+                }
+
+                while (true) {
+
+                    auto i = nextIndex.fetch_add(1);
+
+                    if (i >= paths.size()) {
+                        return;
+                    }
+
+                    if (!acquire()) {
+                        return;
+                    }
+
+                    publish(bulk_read_item{ i, paths[i], ERR, {} });
+                }
+            }
+
+            uringForEachCqe(ring, [&](uint64_t userData, int32_t res) {
+
+                auto &sl = slots[userData];
+
+                switch (sl.state) {
+                case SLOT_OPENING: {
+
+                    if (res < 0) {
+
+                        LOGE("cannot open file: %s: %s", sl.item.path.c_str(), std::strerror(-res));
+
+                        sl.item.status = ERR;
+                        sl.state = SLOT_FREE;
+
+                        inRing--;
+
+                        publish(std::move(sl.item));
+
+                        break;
+                    }
+
+                    sl.fd = res;
+
+                    sl.item.data.resize(INITIAL_READ_SIZE);
+
+                    sl.state = SLOT_READING;
+
+                    prepRead(uringGetSqe(ring), sl.fd, sl.item.data.data(), sl.item.data.size(), 0, userData);
+
+                    break;
+                }
+                case SLOT_READING: {
+
+                    if (res < 0) {
+
+                        LOGE("cannot read file: %s: %s", sl.item.path.c_str(), std::strerror(-res));
+
+                        sl.item.status = ERR;
+                        sl.state = SLOT_CLOSING;
+
+                        prepClose(uringGetSqe(ring), sl.fd, userData);
+
+                        break;
+                    }
+
+                    if (res == 0) {
+
+                        //
+                        // EOF
+                        //
+                        sl.item.data.resize(sl.size);
+                        sl.state = SLOT_CLOSING;
+
+                        prepClose(uringGetSqe(ring), sl.fd, userData);
+
+                        break;
+                    }
+
+                    sl.size += static_cast<size_t>(res);
+
+                    if (sl.size == sl.item.data.size()) {
+                        sl.item.data.resize(2 * sl.size);
+                    }
+
+                    prepRead(uringGetSqe(ring), sl.fd, sl.item.data.data() + sl.size, sl.item.data.size() - sl.size, sl.size, userData);
+
+                    break;
+                }
+                case SLOT_CLOSING: {
+
+                    //
+                    // errors from close are ignored for reads
+                    //
+
+                    sl.state = SLOT_FREE;
+
+                    inRing--;
+
+                    publish(std::move(sl.item));
+
+                    break;
+                }
+                default:
+                    ABORT("invalid slot state: %d", sl.state);
+                }
+            });
+        }
+    }
+
+#endif // TBTPARSER_HAVE_IO_URING
+};
+
+
+bulk_file_reader::bulk_file_reader(std::vector<std::string> paths, const bulk_io_opts &opts) : pimpl(std::make_unique<impl>()) {
+
+    pimpl->paths = std::move(paths);
+    pimpl->opts = opts;
+
+    if (pimpl->opts.max_in_flight == 0) {
+        pimpl->opts.max_in_flight = 1;
+    }
+
+    pimpl->backend = BULK_IO_THREADS;
+
+#if TBTPARSER_HAVE_IO_URING
+
+    if (opts.backend != BULK_IO_THREADS) {
+
+        auto entries = static_cast<unsigned>(std::min<size_t>(pimpl->opts.max_in_flight, 4096));
+
+        if (uringSetup(pimpl->ring, entries)) {
+            pimpl->backend = BULK_IO_URING;
+        }
+    }
+
+    if (pimpl->backend == BULK_IO_URING) {
+
+        pimpl->threads.emplace_back(&impl::uringWorker, pimpl.get());
+
+        return;
+    }
+
+#endif // TBTPARSER_HAVE_IO_URING
+
+    auto n = std::min(threadCount(pimpl->opts), pimpl->opts.max_in_flight);
+
+    for (size_t i = 0; i < n; i++) {
+        pimpl->threads.emplace_back(&impl::threadsWorker, pimpl.get());
+    }
+}
+
+
+bulk_file_reader::~bulk_file_reader() {
+
+    {
+        std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+        pimpl->stopping = true;
+    }
+
+    pimpl->spaceCV.notify_all();
+
+    for (auto &t : pimpl->threads) {
+        t.join();
+    }
+
+#if TBTPARSER_HAVE_IO_URING
+    uringTeardown(pimpl->ring);
+#endif // TBTPARSER_HAVE_IO_URING
+}
+
+
+bool bulk_file_reader::next(bulk_read_item &out) {
+
+    std::unique_lock<std::mutex> lock(pimpl->mutex);
+
+    pimpl->readyCV.wait(lock, [&] { return !pimpl->ready.empty() || pimpl->consumed == pimpl->paths.size(); });
+
+    if (pimpl->ready.empty()) {
+
+        //
+        // everything has been consumed, so wake up any other consumers
+        //
+        lock.unlock();
+
+        pimpl->readyCV.notify_all();
+
+        return false;
+    }
+
+    out = std::move(pimpl->ready.front());
+
+    pimpl->ready.pop_front();
+
+    pimpl->consumed++;
+
+    pimpl->outstanding--;
+
+    bool done = (pimpl->consumed == pimpl->paths.size());
+
+    lock.unlock();
+
+    pimpl->spaceCV.notify_one();
+
+    if (done) {
+        pimpl->readyCV.notify_all();
+    }
+
+    return true;
+}
+
+
+bulk_io_backend bulk_file_reader::backend() const {
+    return pimpl->backend;
+}
+
+
+//
+// writer
+//
+
+
+struct bulk_write_request {
+    std::string path;
+    std::vector<uint8_t> data;
+};
+
+
+struct bulk_file_writer::impl {
+
+    bulk_io_opts opts;
+
+    bulk_io_backend backend;
+
+    std::mutex mutex;
+
+    //
+    // signaled when a request is queued, or finishing
+    //
+    std::condition_variable queueCV;
+
+    //
+    // signaled when a request completes
+    //
+    std::condition_variable spaceCV;
+
+    std::deque<bulk_write_request> queue;
+
+    //
+    // requests that have been submitted but not yet completed
+    //
+    size_t outstanding = 0;
+
+    bool finishing = false;
+
+    bool finished = false;
+
+    bool anyFailed = false;
+
+    std::vector<std::thread> threads;
+
+#if TBTPARSER_HAVE_IO_URING
+    uring ring;
+#endif // TBTPARSER_HAVE_IO_URING
+
+    //
+    // returns false when finishing and nothing is left
+    //
+    bool take(bulk_write_request &out, bool block) {
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (block) {
+            queueCV.wait(lock, [&] { return finishing || !queue.empty(); });
+        }
+
+        if (queue.empty()) {
+            return false;
+        }
+
+        out = std::move(queue.front());
+
+        queue.pop_front();
+
+        return true;
+    }
+
+    void complete(Status status) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (status != OK) {
+                anyFailed = true;
+            }
+
+            outstanding--;
+        }
+
+        spaceCV.notify_one();
+    }
+
+    void threadsWorker() {
+
+        bulk_write_request req;
+
+        while (take(req, true)) {
+
+            auto status = saveFile(req.path.c_str(), req.data);
+
+            complete(status);
+        }
+    }
+
+#if TBTPARSER_HAVE_IO_URING
+
+    enum slot_state : uint8_t {
+        SLOT_FREE,
+        SLOT_OPENING,
+        SLOT_WRITING,
+        SLOT_CLOSING,
+    };
+
+    struct slot {
+        slot_state state = SLOT_FREE;
+        int fd = -1;
+        size_t written = 0;
+        Status status = OK;
+        bulk_write_request req;
+    };
+
+    void uringWorker() {
+
+        std::vector<slot> slots(std::min<size_t>(ring.sqEntries, opts.max_in_flight));
+
+        size_t inRing = 0;
+
+        bool ringFailed = false;
+
+        while (true) {
+
+            for (size_t s = 0; s < slots.size(); s++) {
+
+                auto &sl = slots[s];
+
+                if (sl.state != SLOT_FREE) {
+                    continue;
+                }
+
+                //
+                // only block for new requests if there is nothing in the ring to wait on
+                //
+                if (!take(sl.req, (inRing == 0))) {
+                    break;
+                }
+
+                if (ringFailed) {
+                    complete(ERR);
+                    continue;
+                }
+
+                sl.fd = -1;
+                sl.written = 0;
+                sl.status = OK;
+                sl.state = SLOT_OPENING;
+
+                prepOpen(uringGetSqe(ring), sl.req.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, s);
+
+                inRing++;
+            }
+
+            if (inRing == 0) {
+
+                //
+                // take() returned false while blocking, so finishing and nothing is left
+                //
+                return;
+            }
+
+            if (!uringSubmitAndWait(ring, 1)) {
+
+                for (auto &sl : slots) {
+                    if (sl.state != SLOT_FREE) {
+                        sl.state = SLOT_FREE;
+                        complete(ERR);
+                    }
+                }
+
+                inRing = 0;
+
+                ringFailed = true;
+
+                continue;
+            }
+
+            uringForEachCqe(ring, [&](uint64_t userData, int32_t res) {
+
+                auto &sl = slots[userData];
+
+                switch (sl.state) {
+                case SLOT_OPENING: {
+
+                    if (res < 0) {
+
+                        LOGE("cannot open file for writing: %s: %s", sl.req.path.c_str(), std::strerror(-res));
+
+                        sl.state = SLOT_FREE;
+
+                        inRing--;
+
+                        complete(ERR);
+
+                        break;
+                    }
+
+                    sl.fd = res;
+
+                    if (sl.req.data.empty()) {
+
+                        sl.state = SLOT_CLOSING;
+
+                        prepClose(uringGetSqe(ring), sl.fd, userData);
+
+                        break;
+                    }
+
+                    sl.state = SLOT_WRITING;
+
+                    prepWrite(uringGetSqe(ring), sl.fd, sl.req.data.data(), sl.req.data.size(), 0, userData);
+
+                    break;
+                }
+                case SLOT_WRITING: {
+
+                    if (res <= 0) {
+
+                        LOGE("cannot write file: %s: %s", sl.req.path.c_str(), (res < 0) ? std::strerror(-res) : "no progress");
+
+                        sl.status = ERR;
+                        sl.state = SLOT_CLOSING;
+
+                        prepClose(uringGetSqe(ring), sl.fd, userData);
+
+                        break;
+                    }
+
+                    sl.written += static_cast<size_t>(res);
+
+                    if (sl.written == sl.req.data.size()) {
+
+                        sl.state = SLOT_CLOSING;
+
+                        prepClose(uringGetSqe(ring), sl.fd, userData);
+
+                        break;
+                    }
+
+                    prepWrite(uringGetSqe(ring), sl.fd, sl.req.data.data() + sl.written, sl.req.data.size() - sl.written, sl.written, userData);
+
+                    break;
+                }
+                case SLOT_CLOSING: {
+
+                    if (res < 0) {
+
+                        LOGE("cannot close file: %s: %s", sl.req.path.c_str(), std::strerror(-res));
+
+                        sl.status = ERR;
+                    }
+
+                    sl.state = SLOT_FREE;
+
+                    sl.req.data.clear();
+                    sl.req.data.shrink_to_fit();
+
+                    inRing--;
+
+                    complete(sl.status);
+
+                    break;
+                }
+                default:
+                    ABORT("invalid slot state: %d", sl.state);
+                }
+            });
+        }
+    }
+
+#endif // TBTPARSER_HAVE_IO_URING
+};
+
+
+bulk_file_writer::bulk_file_writer(const bulk_io_opts &opts) : pimpl(std::make_unique<impl>()) {
+
+    pimpl->opts = opts;
+
+    if (pimpl->opts.max_in_flight == 0) {
+        pimpl->opts.max_in_flight = 1;
+    }
+
+    pimpl->backend = BULK_IO_THREADS;
+
+#if TBTPARSER_HAVE_IO_URING
+
+    if (opts.backend != BULK_IO_THREADS) {
+
+        auto entries = static_cast<unsigned>(std::min<size_t>(pimpl->opts.max_in_flight, 4096));
+
+        if (uringSetup(pimpl->ring, entries)) {
+            pimpl->backend = BULK_IO_URING;
+        }
+    }
+
+    if (pimpl->backend == BULK_IO_URING) {
+
+        pimpl->threads.emplace_back(&impl::uringWorker, pimpl.get());
+
+        return;
+    }
+
+#endif // TBTPARSER_HAVE_IO_URING
+
+    auto n = std::min(threadCount(pimpl->opts), pimpl->opts.max_in_flight);
+
+    for (size_t i = 0; i < n; i++) {
+        pimpl->threads.emplace_back(&impl::threadsWorker, pimpl.get());
+    }
+}
+
+
+bulk_file_writer::~bulk_file_writer() {
+
+    finish();
+
+#if TBTPARSER_HAVE_IO_URING
+    uringTeardown(pimpl->ring);
+#endif // TBTPARSER_HAVE_IO_URING
+}
+
+
+void bulk_file_writer::submit(std::string path, std::vector<uint8_t> data) {
+
+    {
+        std::unique_lock<std::mutex> lock(pimpl->mutex);
+
+        ASSERT(!pimpl->finishing);
+
+        pimpl->spaceCV.wait(lock, [&] { return pimpl->outstanding < pimpl->opts.max_in_flight; });
+
+        pimpl->outstanding++;
+
+        pimpl->queue.push_back({ std::move(path), std::move(data) });
+    }
+
+    pimpl->queueCV.notify_one();
+}
+
+
+Status bulk_file_writer::finish() {
+
+    {
+        std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+        if (pimpl->finished) {
+            return pimpl->anyFailed ? ERR : OK;
+        }
+
+        pimpl->finishing = true;
+    }
+
+    pimpl->queueCV.notify_all();
+
+    for (auto &t : pimpl->threads) {
+        t.join();
+    }
+
+    pimpl->threads.clear();
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    ASSERT(pimpl->outstanding == 0);
+
+    pimpl->finished = true;
+
+    return pimpl->anyFailed ? ERR : OK;
+}
+
+
+bulk_io_backend bulk_file_writer::backend() const {
+    return pimpl->backend;
+}
+
+
+
+
+
+
+
+
+
+
+
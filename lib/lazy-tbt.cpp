@@ -0,0 +1,318 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/lazy-tbt.h"
+
+#include "tbt-parser/note-export.h"
+#include "tbt-parser/song-context.h"
+#include "tbt-parser/tbt.h"
+#include "tbt-parser/trace.h"
+
+#undef NDEBUG
+
+#include "common/assert.h"
+#include "common/check.h"
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <cstring> // for strrchr, strcmp
+#include <variant> // for visit
+
+
+#include "lazy-tbt.inl"
+
+
+#define TAG "lazy-tbt"
+
+
+tbt_lazy_file::tbt_lazy_file() = default;
+
+tbt_lazy_file::~tbt_lazy_file() = default;
+
+tbt_lazy_file::tbt_lazy_file(tbt_lazy_file &&) noexcept = default;
+
+tbt_lazy_file &tbt_lazy_file::operator=(tbt_lazy_file &&) noexcept = default;
+
+const tbt_file &tbt_lazy_file::file() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->file;
+}
+
+uint8_t tbt_lazy_file::versionNumber() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->versionNumber;
+}
+
+uint8_t tbt_lazy_file::trackCount() const {
+
+    ASSERT(pimpl);
+
+    return static_cast<uint8_t>(pimpl->body.tracks.size());
+}
+
+tbt_lazy_file::impl &tbt_lazy_file::internals() const {
+
+    ASSERT(pimpl);
+
+    return *pimpl;
+}
+
+
+Status materializeTrackNotes(tbt_lazy_file::impl &p, uint8_t track) {
+
+    auto &lazyTrack = p.tracks[track];
+
+    std::call_once(lazyTrack.notesOnce, [&p, &lazyTrack, track]() {
+
+        lazyTrack.notesStatus = parseLazyTrackNotes(p, track);
+
+        lazyTrack.notesDone.store(lazyTrack.notesStatus == OK, std::memory_order_release);
+    });
+
+    return lazyTrack.notesStatus;
+}
+
+
+Status materializeTrackTiming(tbt_lazy_file::impl &p, uint8_t track) {
+
+    auto &lazyTrack = p.tracks[track];
+
+    std::call_once(lazyTrack.timingOnce, [&p, &lazyTrack, track]() {
+
+        lazyTrack.timingStatus = parseLazyTrackTiming(p, track);
+
+        lazyTrack.timingDone.store(lazyTrack.timingStatus == OK, std::memory_order_release);
+    });
+
+    return lazyTrack.timingStatus;
+}
+
+
+Status tbt_lazy_file::materializeTrack(uint8_t track) const {
+
+    ASSERT(pimpl);
+
+    CHECK(track < trackCount(), "invalid track: %d", track);
+
+    Status ret = materializeTrackNotes(*pimpl, track);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return materializeTrackTiming(*pimpl, track);
+}
+
+
+Status tbt_lazy_file::materializeTracks(const std::vector<bool> &selected_tracks) const {
+
+    for (uint8_t track = 0; track < trackCount(); track++) {
+
+        if (!trackSelected(selected_tracks, track)) {
+            continue;
+        }
+
+        Status ret = materializeTrack(track);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    return OK;
+}
+
+
+bool tbt_lazy_file::trackMaterialized(uint8_t track) const {
+
+    ASSERT(pimpl);
+
+    if (track >= trackCount()) {
+        return false;
+    }
+
+    const auto &lazyTrack = pimpl->tracks[track];
+
+    return lazyTrack.notesDone.load(std::memory_order_acquire) && lazyTrack.timingDone.load(std::memory_order_acquire);
+}
+
+
+Status
+parseTbtBytesLazy(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_lazy_file &out) {
+
+    auto pimpl = std::make_unique<tbt_lazy_file::impl>();
+
+    auto &p = *pimpl;
+
+    Status ret = parseTbtBytes(it, end, opts, &p.body, p.file);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    p.versionNumber = tbtFileVersionNumber(p.file);
+
+    p.hasAlternateTimeRegions = std::visit([](const auto &t) {
+        return (t.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK;
+    }, p.file);
+
+    p.tracks = std::make_unique<tbt_lazy_track[]>(p.body.tracks.size());
+
+    out.pimpl = std::move(pimpl);
+
+    return OK;
+}
+
+
+Status
+parseTbtFileLazy(
+    const char *path,
+    const tbt_parse_opts &opts,
+    tbt_lazy_file &out) {
+
+    const char *dot = std::strrchr(path, '.');
+    if (!(dot && std::strcmp(dot, ".tbt") == 0)) {
+        LOGW("tbt file does not end with .tbt: %s", path);
+    }
+
+    Status ret;
+
+    std::vector<uint8_t> buf;
+
+    {
+        trace_span span("read", "path", path);
+
+        ret = openFile(path, buf);
+    }
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    auto buf_it = buf.cbegin();
+
+    auto buf_end = buf.cend();
+
+    return parseTbtBytesLazy(buf_it, buf_end, opts, out);
+}
+
+
+//
+// the tempo map is computed from every track, so the timing of every track is materialized,
+// and the notes of every track before 0x72
+//
+Status materializeForSelection(const tbt_lazy_file &t, const std::vector<bool> &selected_tracks) {
+
+    auto &p = t.internals();
+
+    for (uint8_t track = 0; track < t.trackCount(); track++) {
+
+        Status ret = materializeTrackTiming(p, track);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        if (p.versionNumber == 0x72 && !trackSelected(selected_tracks, track)) {
+            continue;
+        }
+
+        ret = materializeTrackNotes(p, track);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    return OK;
+}
+
+
+Status convertToMidi(const tbt_lazy_file &t, const midi_convert_opts &opts, midi_file &m) {
+
+    Status ret = materializeForSelection(t, opts.selected_tracks);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return convertToMidi(t.file(), opts, m);
+}
+
+
+Status tbtFileTablature(const tbt_lazy_file &t, const tbt_tablature_opts &opts, std::string &out) {
+
+    Status ret = materializeForSelection(t, opts.selected_tracks);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    out = tbtFileTablature(t.file(), opts);
+
+    return OK;
+}
+
+
+std::string tbtFileInfo(const tbt_lazy_file &t) {
+    return tbtFileInfo(t.file());
+}
+
+
+Status analyzeTbtFile(const tbt_lazy_file &t, const tbt_analyze_opts &opts, tbt_song_context &out) {
+
+    Status ret = t.materializeTracks({});
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return analyzeTbtFile(t.file(), opts, out);
+}
+
+
+Status buildNoteTable(const tbt_lazy_file &t, note_table &out) {
+
+    Status ret = t.materializeTracks({});
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return buildNoteTable(t.file(), out);
+}
+
+
+
+
+
+
+
+
+
+
+
+
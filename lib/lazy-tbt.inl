@@ -0,0 +1,103 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/lazy-tbt.h"
+
+#include <atomic>
+#include <cstddef> // for size_t
+#include <mutex> // for once_flag
+
+
+//
+// where one track's sections are in the inflated body, as offsets from the start of the body
+//
+struct tbt_track_body_ranges {
+    size_t notesBegin;
+    size_t notesEnd;
+    size_t alternateTimeRegionsBegin;
+    size_t alternateTimeRegionsEnd;
+    size_t trackEffectChangesBegin;
+    size_t trackEffectChangesEnd;
+};
+
+
+struct tbt_lazy_body {
+
+    //
+    // inflated body, or the rest of the file before 0x6e
+    //
+    std::vector<uint8_t> bytes;
+
+    std::vector<tbt_track_body_ranges> tracks;
+};
+
+
+struct tbt_lazy_track {
+
+    std::once_flag notesOnce;
+    Status notesStatus;
+    std::atomic<bool> notesDone;
+
+    //
+    // alternate time regions and track effect changes
+    //
+    std::once_flag timingOnce;
+    Status timingStatus;
+    std::atomic<bool> timingDone;
+};
+
+
+struct tbt_lazy_file::impl {
+
+    tbt_file file;
+
+    uint8_t versionNumber;
+
+    bool hasAlternateTimeRegions;
+
+    tbt_lazy_body body;
+
+    std::unique_ptr<tbt_lazy_track[]> tracks;
+};
+
+
+//
+// if lazy is not null, then the body is only scanned and is kept in lazy
+//
+Status parseTbtBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_lazy_body *lazy,
+    tbt_file &out);
+
+Status parseLazyTrackNotes(tbt_lazy_file::impl &p, uint8_t track);
+
+Status parseLazyTrackTiming(tbt_lazy_file::impl &p, uint8_t track);
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,304 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/memory-usage.h"
+
+#include <map>
+#include <variant> // for visit
+#include <cinttypes>
+#include <cstdio> // for snprintf
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h> // for GetProcessMemoryInfo
+#else
+#include <sys/resource.h> // for getrusage
+#endif
+
+
+#define TAG "memory-usage"
+
+
+//
+// malloc rounds to 16 bytes, with a word of overhead
+//
+size_t allocationBytes(size_t n) {
+
+    if (n == 0) {
+        return 0;
+    }
+
+    return (n + sizeof(size_t) + 15) & ~static_cast<size_t>(15);
+}
+
+
+template <typename T>
+size_t vectorBytes(const std::vector<T> &v) {
+    return allocationBytes(v.capacity() * sizeof(T));
+}
+
+
+//
+// left, right, parent, color, then the value
+//
+template <typename K, typename V>
+size_t mapBytes(const std::map<K, V> &m) {
+    return m.size() * allocationBytes(4 * sizeof(void *) + sizeof(typename std::map<K, V>::value_type));
+}
+
+
+template <typename tbt_file_t>
+void
+TtbtFileMemoryUsage(
+    const tbt_file_t &t,
+    tbt_memory_usage &out) {
+
+    const auto &metadata = t.metadata;
+
+    out.metadataStrings += vectorBytes(metadata.title);
+    out.metadataStrings += vectorBytes(metadata.artist);
+    out.metadataStrings += vectorBytes(metadata.comment);
+
+    if constexpr (requires { metadata.album; metadata.transcribedBy; }) {
+        out.metadataStrings += vectorBytes(metadata.album);
+        out.metadataStrings += vectorBytes(metadata.transcribedBy);
+    }
+
+    out.trackMetadata = vectorBytes(metadata.tracks);
+
+    out.barLines = mapBytes(t.body.barLinesMap);
+
+    out.tracks = vectorBytes(t.body.mapsList);
+
+    for (const auto &maps : t.body.mapsList) {
+
+        out.notes.push_back(mapBytes(maps.notesMap));
+
+        if constexpr (requires { maps.alternateTimeRegionsMap; }) {
+            out.alternateTimeRegions += mapBytes(maps.alternateTimeRegionsMap);
+        }
+
+        if constexpr (requires { maps.trackEffectChanges; }) {
+            out.trackEffects += vectorBytes(maps.trackEffectChanges);
+        }
+    }
+}
+
+
+tbt_memory_usage tbtFileMemoryUsage(const tbt_file &t) {
+
+    tbt_memory_usage usage;
+
+    std::visit([&](const auto &tXX) { TtbtFileMemoryUsage(tXX, usage); }, t);
+
+    return usage;
+}
+
+
+size_t tbt_memory_usage::total() const {
+
+    size_t acc = metadataStrings + trackMetadata + barLines + alternateTimeRegions + trackEffects + tracks;
+
+    for (auto n : notes) {
+        acc += n;
+    }
+
+    return acc;
+}
+
+
+midi_memory_usage midiFileMemoryUsage(const midi_file &m) {
+
+    midi_memory_usage usage;
+
+    usage.tracks = vectorBytes(m.tracks);
+
+    for (const auto &track : m.tracks) {
+
+        usage.tracks += allocationBytes((track.capacity() - track.size()) * sizeof(midi_track_event));
+
+        for (const auto &e : track) {
+
+            usage.eventCounts[e.index()]++;
+
+            usage.events[e.index()] += sizeof(midi_track_event);
+
+            if (auto metaEvent = std::get_if<MetaEvent>(&e)) {
+                usage.metaPayloads += vectorBytes(metaEvent->data);
+            } else if (auto sysExEvent = std::get_if<SysExEvent>(&e)) {
+                usage.sysExPayloads += vectorBytes(sysExEvent->data);
+            }
+        }
+    }
+
+    return usage;
+}
+
+
+size_t midi_memory_usage::total() const {
+
+    size_t acc = metaPayloads + sysExPayloads + tracks;
+
+    for (auto n : events) {
+        acc += n;
+    }
+
+    return acc;
+}
+
+
+const char *MIDI_EVENT_TYPE_NAMES[MIDI_EVENT_TYPE_COUNT] = {
+    "Program Change",
+    "Pitch Bend",
+    "Note Off",
+    "Note On",
+    "Control Change",
+    "Meta",
+    "Polyphonic Key Pressure",
+    "Channel Pressure",
+    "SysEx",
+};
+
+
+std::string tbtMemoryUsageInfo(const tbt_memory_usage &usage) {
+
+    std::string acc;
+
+    char buf[100];
+
+    std::snprintf(buf, sizeof(buf), "tbt memory (bytes):\n");
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Metadata Strings: %zu\n", usage.metadataStrings);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Track Metadata: %zu\n", usage.trackMetadata);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Bar Lines: %zu\n", usage.barLines);
+    acc += buf;
+
+    for (size_t track = 0; track < usage.notes.size(); track++) {
+
+        std::snprintf(buf, sizeof(buf), "Notes (track %zu): %zu\n", track, usage.notes[track]);
+        acc += buf;
+    }
+
+    std::snprintf(buf, sizeof(buf), "Alternate Time Regions: %zu\n", usage.alternateTimeRegions);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Track Effects: %zu\n", usage.trackEffects);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Tracks: %zu\n", usage.tracks);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Total: %zu\n", usage.total());
+    acc += buf;
+
+    return acc;
+}
+
+
+std::string midiMemoryUsageInfo(const midi_memory_usage &usage) {
+
+    std::string acc;
+
+    char buf[100];
+
+    std::snprintf(buf, sizeof(buf), "midi memory (bytes):\n");
+    acc += buf;
+
+    for (size_t i = 0; i < MIDI_EVENT_TYPE_COUNT; i++) {
+
+        if (usage.eventCounts[i] == 0) {
+            continue;
+        }
+
+        std::snprintf(buf, sizeof(buf), "%s Events: %zu (%zu events)\n", MIDI_EVENT_TYPE_NAMES[i], usage.events[i], usage.eventCounts[i]);
+        acc += buf;
+    }
+
+    std::snprintf(buf, sizeof(buf), "Meta Payloads: %zu\n", usage.metaPayloads);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "SysEx Payloads: %zu\n", usage.sysExPayloads);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Tracks: %zu\n", usage.tracks);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Total: %zu\n", usage.total());
+    acc += buf;
+
+    return acc;
+}
+
+
+size_t peakResidentSetBytes() {
+
+#if defined(_WIN32)
+
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+
+    return counters.PeakWorkingSetSize;
+
+#else
+
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+#if defined(__APPLE__)
+
+    //
+    // bytes on macOS
+    //
+    return static_cast<size_t>(usage.ru_maxrss);
+
+#else
+
+    //
+    // kilobytes on Linux
+    //
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+
+#endif // defined(__APPLE__)
+
+#endif // defined(_WIN32)
+}
+
+
+
+
+
+
+
+
+
+
+
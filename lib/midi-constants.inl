@@ -0,0 +1,73 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+
+//
+// MIDI constants shared by the files that read or write MIDI events
+//
+
+
+//
+// meta events
+//
+const uint8_t M_TRACKNAME = 0x03;
+const uint8_t M_LYRIC = 0x05;
+const uint8_t M_ENDOFTRACK = 0x2f;
+const uint8_t M_SETTEMPO = 0x51;
+const uint8_t M_TIMESIGNATURE = 0x58;
+
+
+//
+// controller messages
+//
+const uint8_t C_BANKSELECT_MSB = 0x00;
+const uint8_t C_MODULATION = 0x01;
+const uint8_t C_DATAENTRY_MSB = 0x06;
+const uint8_t C_VOLUME = 0x07;
+const uint8_t C_PAN = 0x0a;
+const uint8_t C_BANKSELECT_LSB = 0x20;
+const uint8_t C_DATAENTRY_LSB = 0x26;
+const uint8_t C_REVERB = 0x5b;
+const uint8_t C_CHORUS = 0x5d;
+const uint8_t C_DATAINCREMENT = 0x60;
+const uint8_t C_DATADECREMENT = 0x61;
+const uint8_t C_NRPNPARAM_LSB = 0x62;
+const uint8_t C_NRPNPARAM_MSB = 0x63;
+const uint8_t C_RPNPARAM_LSB = 0x64;
+const uint8_t C_RPNPARAM_MSB = 0x65;
+
+
+//
+// channel mode messages, from All Sound Off up
+//
+const uint8_t C_ALLSOUNDOFF = 0x78;
+const uint8_t C_RESETALLCONTROLLERS = 0x79;
+const uint8_t C_ALLNOTESOFF = 0x7b;
+
+
+
+
+
+
+
+
+
+
+
+
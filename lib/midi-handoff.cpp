@@ -0,0 +1,503 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/midi-handoff.h"
+
+#include "tbt-parser/tbt-parser-util.h"
+
+#undef NDEBUG
+
+#include "common/assert.h"
+#include "common/check.h"
+#include "common/logging.h"
+
+#include <algorithm> // for equal
+#include <cinttypes>
+#include <cstring> // for memcpy, strerror
+#include <iterator> // for begin, end
+
+#if defined(__linux__)
+#define TBTPARSER_HAVE_MEMFD 1
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#define TBTPARSER_HAVE_MEMFD 0
+#endif
+
+
+#define TAG "midi-handoff"
+
+
+const uint8_t HANDOFF_MAGIC[4] = { 'T', 'B', 'T', 'H' };
+
+//
+// a descriptor is a few bytes per track and per tempo change, so anything larger is corrupted
+//
+const uint32_t HANDOFF_MAX_DESCRIPTOR_SIZE = 16 * 1024 * 1024;
+
+
+void writeHandoffLE(uint64_t value, int n, std::vector<uint8_t> &out) {
+    for (int i = 0; i < n; i++) {
+        out.push_back(static_cast<uint8_t>((value >> (8 * i)) & 0xff));
+    }
+}
+
+
+uint64_t readHandoffLE(std::vector<uint8_t>::const_iterator &it, int n) {
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++) {
+        value |= static_cast<uint64_t>(*it++) << (8 * i);
+    }
+    return value;
+}
+
+
+void encodeMidiHandoffDescriptor(const midi_handoff_descriptor &d, std::vector<uint8_t> &out) {
+
+    out.clear();
+
+    out.insert(out.end(), std::begin(HANDOFF_MAGIC), std::end(HANDOFF_MAGIC));
+
+    writeHandoffLE(d.size, 8, out);
+    writeHandoffLE(d.header.format, 2, out);
+    writeHandoffLE(d.header.trackCount, 2, out);
+    writeHandoffLE(d.header.division, 2, out);
+
+    writeHandoffLE(d.tracks.size(), 4, out);
+
+    for (const auto &track : d.tracks) {
+        writeHandoffLE(track.offset, 8, out);
+        writeHandoffLE(track.length, 4, out);
+    }
+
+    writeHandoffLE(d.tempoMap.size(), 4, out);
+
+    for (const auto &change : d.tempoMap) {
+        writeHandoffLE(static_cast<uint32_t>(change.tick), 4, out);
+        writeHandoffLE(change.microsPerBeat, 4, out);
+    }
+}
+
+
+Status decodeMidiHandoffDescriptor(const std::vector<uint8_t> &in, midi_handoff_descriptor &out) {
+
+    auto it = in.cbegin();
+    auto end = in.cend();
+
+    CHECK(4 + 8 + 2 + 2 + 2 + 4 <= (end - it), "descriptor is corrupted. out of data");
+
+    CHECK(std::equal(std::begin(HANDOFF_MAGIC), std::end(HANDOFF_MAGIC), it), "not a handoff descriptor");
+
+    it += 4;
+
+    out.size = readHandoffLE(it, 8);
+    out.header.format = static_cast<uint16_t>(readHandoffLE(it, 2));
+    out.header.trackCount = static_cast<uint16_t>(readHandoffLE(it, 2));
+    out.header.division = static_cast<uint16_t>(readHandoffLE(it, 2));
+
+    auto trackCount = readHandoffLE(it, 4);
+
+    CHECK(trackCount * (8 + 4) + 4 <= static_cast<uint64_t>(end - it), "descriptor is corrupted. out of data");
+
+    out.tracks.clear();
+    out.tracks.reserve(trackCount);
+
+    for (uint64_t i = 0; i < trackCount; i++) {
+
+        midi_handoff_track track;
+
+        track.offset = readHandoffLE(it, 8);
+        track.length = static_cast<uint32_t>(readHandoffLE(it, 4));
+
+        out.tracks.push_back(track);
+    }
+
+    auto tempoCount = readHandoffLE(it, 4);
+
+    CHECK(tempoCount * (4 + 4) == static_cast<uint64_t>(end - it), "descriptor is corrupted. wrong size");
+
+    out.tempoMap.clear();
+    out.tempoMap.reserve(tempoCount);
+
+    for (uint64_t i = 0; i < tempoCount; i++) {
+
+        midi_tempo_change change;
+
+        change.tick = static_cast<int32_t>(readHandoffLE(it, 4));
+        change.microsPerBeat = static_cast<uint32_t>(readHandoffLE(it, 4));
+
+        out.tempoMap.push_back(change);
+    }
+
+    return OK;
+}
+
+
+#if TBTPARSER_HAVE_MEMFD
+
+//
+// walk the MTrk chunks that exportMidiBytes wrote
+//
+void findHandoffTracks(const uint8_t *data, size_t size, std::vector<midi_handoff_track> &out) {
+
+    out.clear();
+
+    size_t pos = 4 + 4 + 2 + 2 + 2;
+
+    while (pos + 8 <= size) {
+
+        uint32_t length = (static_cast<uint32_t>(data[pos + 4]) << 24) |
+            (static_cast<uint32_t>(data[pos + 5]) << 16) |
+            (static_cast<uint32_t>(data[pos + 6]) << 8) |
+            static_cast<uint32_t>(data[pos + 7]);
+
+        out.push_back(midi_handoff_track{ pos + 8, length });
+
+        pos += 8 + length;
+    }
+
+    ASSERT(pos == size);
+}
+
+
+Status exportMidiHandoff(const midi_file &m, int &fd, midi_handoff_descriptor &out) {
+
+    auto size = midiExportSize(m);
+
+    int memfd = memfd_create("tbt-midi", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (memfd == -1) {
+        LOGE("cannot create memfd: %s", std::strerror(errno));
+        return ERR;
+    }
+
+    if (ftruncate(memfd, static_cast<off_t>(size)) == -1) {
+        LOGE("cannot size memfd: %s", std::strerror(errno));
+        close(memfd);
+        return ERR;
+    }
+
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+    if (mapped == MAP_FAILED) {
+        LOGE("cannot map memfd: %s", std::strerror(errno));
+        close(memfd);
+        return ERR;
+    }
+
+    auto data = static_cast<uint8_t *>(mapped);
+
+    Status ret = exportMidiBytes(m, std::span<uint8_t>(data, size));
+
+    if (ret == OK) {
+
+        out.size = size;
+        out.header = m.header;
+
+        findHandoffTracks(data, size, out.tracks);
+
+        out.tempoMap = midiFileTempoMap(m);
+    }
+
+    //
+    // F_SEAL_WRITE fails while a writable shared mapping exists
+    //
+    munmap(mapped, size);
+
+    if (ret != OK) {
+        close(memfd);
+        return ret;
+    }
+
+    if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        LOGE("cannot seal memfd: %s", std::strerror(errno));
+        close(memfd);
+        return ERR;
+    }
+
+    fd = memfd;
+
+    return OK;
+}
+
+
+//
+// the descriptor is sent as its u32 length followed by its bytes, and fd travels with the length
+//
+Status sendMidiHandoff(int socket, int fd, const midi_handoff_descriptor &d) {
+
+    std::vector<uint8_t> encoded;
+
+    encodeMidiHandoffDescriptor(d, encoded);
+
+    std::vector<uint8_t> length;
+
+    writeHandoffLE(encoded.size(), 4, length);
+
+    iovec iov{ length.data(), length.size() };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    auto n = sendmsg(socket, &msg, MSG_NOSIGNAL);
+
+    CHECK(n == static_cast<ssize_t>(length.size()), "cannot send handoff: %s", std::strerror(errno));
+
+    size_t sent = 0;
+
+    while (sent < encoded.size()) {
+
+        n = send(socket, encoded.data() + sent, encoded.size() - sent, MSG_NOSIGNAL);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        CHECK(n > 0, "cannot send handoff descriptor: %s", std::strerror(errno));
+
+        sent += static_cast<size_t>(n);
+    }
+
+    return OK;
+}
+
+
+Status receiveMidiHandoff(int socket, int &fd, midi_handoff_descriptor &out) {
+
+    std::vector<uint8_t> length(4);
+
+    iovec iov{ length.data(), length.size() };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+
+    CHECK(n == static_cast<ssize_t>(length.size()), "cannot receive handoff: %s", (n == -1) ? std::strerror(errno) : "short read");
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+
+    CHECK(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)), "handoff has no file descriptor");
+
+    int received;
+
+    std::memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+
+    auto length_it = length.cbegin();
+
+    auto encodedSize = static_cast<uint32_t>(readHandoffLE(length_it, 4));
+
+    if (encodedSize > HANDOFF_MAX_DESCRIPTOR_SIZE) {
+        LOGE("handoff descriptor is too large: %" PRIu32, encodedSize);
+        close(received);
+        return ERR;
+    }
+
+    std::vector<uint8_t> encoded(encodedSize);
+
+    size_t got = 0;
+
+    while (got < encoded.size()) {
+
+        n = recv(socket, encoded.data() + got, encoded.size() - got, 0);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            LOGE("cannot receive handoff descriptor: %s", (n == -1) ? std::strerror(errno) : "connection closed");
+            close(received);
+            return ERR;
+        }
+
+        got += static_cast<size_t>(n);
+    }
+
+    Status ret = decodeMidiHandoffDescriptor(encoded, out);
+
+    if (ret != OK) {
+        close(received);
+        return ret;
+    }
+
+    fd = received;
+
+    return OK;
+}
+
+
+midi_handoff_mapping::midi_handoff_mapping() : desc(), mapped(nullptr), mappedSize(0) {}
+
+
+midi_handoff_mapping::~midi_handoff_mapping() {
+    if (mapped) {
+        munmap(mapped, mappedSize);
+    }
+}
+
+
+Status midi_handoff_mapping::open(int fd, const midi_handoff_descriptor &d) {
+
+    CHECK(mapped == nullptr, "already open");
+
+    auto seals = fcntl(fd, F_GET_SEALS);
+
+    CHECK(seals != -1, "cannot get seals: %s", std::strerror(errno));
+
+    CHECK((seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) == (F_SEAL_WRITE | F_SEAL_SHRINK), "memfd is not sealed");
+
+    struct stat st;
+
+    CHECK(fstat(fd, &st) == 0, "cannot stat memfd: %s", std::strerror(errno));
+
+    CHECK(static_cast<uint64_t>(st.st_size) == d.size, "memfd size does not match descriptor. expected: %" PRIu64 ", actual: %" PRIu64, d.size, static_cast<uint64_t>(st.st_size));
+
+    CHECK(d.size >= 4 + 4 + 2 + 2 + 2, "memfd is too small: %" PRIu64, d.size);
+
+    for (const auto &track : d.tracks) {
+        CHECK(track.offset <= d.size && track.length <= d.size - track.offset, "track is outside of memfd");
+    }
+
+    auto size = static_cast<size_t>(d.size);
+
+    void *m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    CHECK(m != MAP_FAILED, "cannot map memfd: %s", std::strerror(errno));
+
+    mapped = m;
+    mappedSize = size;
+    desc = d;
+
+    return OK;
+}
+
+#else
+
+
+Status exportMidiHandoff(const midi_file &m, int &fd, midi_handoff_descriptor &out) {
+
+    (void)m;
+    (void)fd;
+    (void)out;
+
+    LOGE("memfd handoff is only supported on Linux");
+
+    return ERR;
+}
+
+
+Status sendMidiHandoff(int socket, int fd, const midi_handoff_descriptor &d) {
+
+    (void)socket;
+    (void)fd;
+    (void)d;
+
+    LOGE("memfd handoff is only supported on Linux");
+
+    return ERR;
+}
+
+
+Status receiveMidiHandoff(int socket, int &fd, midi_handoff_descriptor &out) {
+
+    (void)socket;
+    (void)fd;
+    (void)out;
+
+    LOGE("memfd handoff is only supported on Linux");
+
+    return ERR;
+}
+
+
+midi_handoff_mapping::midi_handoff_mapping() : desc(), mapped(nullptr), mappedSize(0) {}
+
+
+midi_handoff_mapping::~midi_handoff_mapping() {}
+
+
+Status midi_handoff_mapping::open(int fd, const midi_handoff_descriptor &d) {
+
+    (void)fd;
+    (void)d;
+
+    LOGE("memfd handoff is only supported on Linux");
+
+    return ERR;
+}
+
+#endif // TBTPARSER_HAVE_MEMFD
+
+
+std::span<const uint8_t> midi_handoff_mapping::bytes() const {
+
+    ASSERT(mapped);
+
+    return { static_cast<const uint8_t *>(mapped), mappedSize };
+}
+
+
+std::span<const uint8_t> midi_handoff_mapping::track(size_t i) const {
+
+    ASSERT(mapped);
+
+    ASSERT(i < desc.tracks.size());
+
+    const auto &t = desc.tracks[i];
+
+    return bytes().subspan(static_cast<size_t>(t.offset), t.length);
+}
+
+
+const midi_handoff_descriptor &midi_handoff_mapping::descriptor() const {
+    return desc;
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,325 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+
+#include "tbt-parser/trace.h"
+
+#include <array>
+#include <limits>
+#include <variant> // for get_if, visit
+
+
+#include "midi-constants.inl"
+
+
+#define TAG "midi-optimize"
+
+
+//
+// controllers that change state
+//
+// everything else is an action (data entry, increment, decrement), selects the parameter for one,
+// or is a channel mode message, and is always kept
+//
+bool isStateController(uint8_t controller) {
+
+    switch (controller) {
+    case C_DATAENTRY_MSB:
+    case C_DATAENTRY_LSB:
+    case C_DATAINCREMENT:
+    case C_DATADECREMENT:
+    case C_NRPNPARAM_LSB:
+    case C_NRPNPARAM_MSB:
+    case C_RPNPARAM_LSB:
+    case C_RPNPARAM_MSB:
+        return false;
+    default:
+        return controller < C_ALLSOUNDOFF;
+    }
+}
+
+
+//
+// state keys: 0-127 for controllers, then program and pitch bend
+//
+const size_t KEY_PROGRAM = 128;
+const size_t KEY_PITCHBEND = 129;
+const size_t KEY_COUNT = 130;
+
+const int32_t UNKNOWN = std::numeric_limits<int32_t>::min();
+
+const size_t NONE = SIZE_MAX;
+
+
+struct channel_state {
+
+    std::array<int32_t, KEY_COUNT> values;
+
+    //
+    // the last kept event for each key, and the value before it
+    //
+    // if another change to the same key comes at the same tick with nothing in between that could observe it,
+    // then the earlier change is removed
+    //
+    std::array<size_t, KEY_COUNT> lastIndex;
+    std::array<int64_t, KEY_COUNT> lastTick;
+    std::array<uint32_t, KEY_COUNT> lastObservers;
+    std::array<int32_t, KEY_COUNT> lastPrevious;
+
+    //
+    // count of events that could observe the state, e.g., notes
+    //
+    uint32_t observers = 0;
+
+    channel_state() {
+        values.fill(UNKNOWN);
+        lastIndex.fill(NONE);
+    }
+
+    void forget(size_t key) {
+        values[key] = UNKNOWN;
+        lastIndex[key] = NONE;
+    }
+
+    //
+    // returns true if the event is kept
+    //
+    bool change(size_t key, int32_t value, size_t index, int64_t tick, std::vector<bool> &removed) {
+
+        if (lastIndex[key] != NONE && lastTick[key] == tick && lastObservers[key] == observers) {
+
+            removed[lastIndex[key]] = true;
+
+            values[key] = lastPrevious[key];
+
+            lastIndex[key] = NONE;
+        }
+
+        if (values[key] == value) {
+
+            removed[index] = true;
+
+            return false;
+        }
+
+        lastPrevious[key] = values[key];
+        lastIndex[key] = index;
+        lastTick[key] = tick;
+        lastObservers[key] = observers;
+
+        values[key] = value;
+
+        return true;
+    }
+};
+
+
+int32_t &deltaTimeOf(midi_track_event &e) {
+    return std::visit([](auto &ev) -> int32_t & { return ev.deltaTime; }, e);
+}
+
+
+//
+// returns -1 for events that are not on a channel
+//
+int channelOf(const midi_track_event &e) {
+    return std::visit([](const auto &ev) -> int {
+        using T = std::decay_t<decltype(ev)>;
+        if constexpr (std::is_same_v<T, MetaEvent> || std::is_same_v<T, SysExEvent>) {
+            return -1;
+        } else {
+            return ev.channel;
+        }
+    }, e);
+}
+
+
+void
+eliminateRedundantTrackEvents(
+    std::vector<midi_track_event> &track,
+    const std::array<bool, 16> &sharedChannels) {
+
+    std::array<channel_state, 16> states;
+
+    std::vector<bool> removed(track.size(), false);
+
+    int64_t tick = 0;
+
+    for (size_t i = 0; i < track.size(); i++) {
+
+        auto &e = track[i];
+
+        tick += deltaTimeOf(e);
+
+        auto channel = channelOf(e);
+
+        if (channel == -1) {
+            continue;
+        }
+
+        auto &s = states[static_cast<size_t>(channel)];
+
+        //
+        // the order of events from different tracks on the same channel is not known, so leave them alone
+        //
+        if (sharedChannels[static_cast<size_t>(channel)]) {
+            continue;
+        }
+
+        if (auto cc = std::get_if<ControlChangeEvent>(&e)) {
+
+            if (isStateController(cc->controller)) {
+
+                if (s.change(cc->controller, cc->value, i, tick, removed)) {
+
+                    if (cc->controller == C_BANKSELECT_MSB || cc->controller == C_BANKSELECT_LSB) {
+
+                        //
+                        // the same program in another bank is a different sound
+                        //
+                        s.forget(KEY_PROGRAM);
+                    }
+                }
+
+                continue;
+            }
+
+            s.observers++;
+
+            if (cc->controller == C_RESETALLCONTROLLERS) {
+
+                for (size_t key = 0; key < 128; key++) {
+                    s.forget(key);
+                }
+
+                s.forget(KEY_PITCHBEND);
+
+            } else if (!(cc->controller < C_ALLSOUNDOFF)) {
+
+                //
+                // other channel mode messages do not change controllers
+                //
+
+            } else {
+
+                //
+                // data entry may change the pitch bend range
+                //
+                s.forget(KEY_PITCHBEND);
+            }
+
+        } else if (auto program = std::get_if<ProgramChangeEvent>(&e)) {
+
+            if (s.change(KEY_PROGRAM, program->midiProgram, i, tick, removed)) {
+
+                //
+                // a bank select after this must not be merged with one before it
+                //
+                s.lastIndex[C_BANKSELECT_MSB] = NONE;
+                s.lastIndex[C_BANKSELECT_LSB] = NONE;
+            }
+
+        } else if (auto pitchBend = std::get_if<PitchBendEvent>(&e)) {
+
+            s.change(KEY_PITCHBEND, pitchBend->pitchBend, i, tick, removed);
+
+        } else {
+
+            //
+            // notes and pressure
+            //
+            s.observers++;
+        }
+    }
+
+    //
+    // compact, moving the delta times of removed events to the next kept event
+    //
+    size_t kept = 0;
+
+    int32_t carry = 0;
+
+    for (size_t i = 0; i < track.size(); i++) {
+
+        if (removed[i]) {
+            carry += deltaTimeOf(track[i]);
+            continue;
+        }
+
+        deltaTimeOf(track[i]) += carry;
+
+        carry = 0;
+
+        if (kept != i) {
+            track[kept] = std::move(track[i]);
+        }
+
+        kept++;
+    }
+
+    track.resize(kept);
+}
+
+
+void eliminateRedundantMidiEvents(midi_file &m) {
+
+    trace_span span("eliminate redundant events");
+
+    std::array<int, 16> channelTracks;
+
+    channelTracks.fill(-1);
+
+    std::array<bool, 16> sharedChannels{};
+
+    for (size_t t = 0; t < m.tracks.size(); t++) {
+
+        for (const auto &e : m.tracks[t]) {
+
+            auto channel = channelOf(e);
+
+            if (channel == -1) {
+                continue;
+            }
+
+            auto &owner = channelTracks[static_cast<size_t>(channel)];
+
+            if (owner == -1) {
+                owner = static_cast<int>(t);
+            } else if (owner != static_cast<int>(t)) {
+                sharedChannels[static_cast<size_t>(channel)] = true;
+            }
+        }
+    }
+
+    for (auto &track : m.tracks) {
+        eliminateRedundantTrackEvents(track, sharedChannels);
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,235 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/midi-transform.h"
+
+#include "tbt-parser/trace.h"
+
+#undef NDEBUG
+
+#include "common/assert.h"
+#include "common/check.h"
+
+#include <algorithm> // for clamp
+#include <cmath> // for llround
+#include <variant> // for visit
+
+
+#include "midi-constants.inl"
+
+
+#define TAG "midi-transform"
+
+
+const uint8_t TRANSFORM_DRUM_CHANNEL = 9;
+
+
+//
+// returns false if the event is dropped
+//
+bool transformEvent(const midi_transform &xf, uint16_t mutedChannels, midi_track_event &e) {
+
+    return std::visit([&](auto &ev) -> bool {
+
+        using T = std::decay_t<decltype(ev)>;
+
+        if constexpr (std::is_same_v<T, MetaEvent>) {
+
+            if (ev.type == M_SETTEMPO && ev.data.size() == 3 && xf.tempo_scale != 1.0) {
+
+                auto microsPerBeat = static_cast<double>((ev.data[0] << 16) | (ev.data[1] << 8) | ev.data[2]);
+
+                auto scaled = std::clamp(std::llround(microsPerBeat / xf.tempo_scale), 1LL, 0xffffffLL);
+
+                ev.data[0] = static_cast<uint8_t>((scaled >> 16) & 0xff);
+                ev.data[1] = static_cast<uint8_t>((scaled >> 8) & 0xff);
+                ev.data[2] = static_cast<uint8_t>(scaled & 0xff);
+            }
+
+            return true;
+
+        } else if constexpr (std::is_same_v<T, SysExEvent>) {
+
+            return true;
+
+        } else {
+
+            if constexpr (std::is_same_v<T, NoteOnEvent> || std::is_same_v<T, NoteOffEvent> || std::is_same_v<T, PolyphonicKeyPressureEvent>) {
+
+                if ((mutedChannels >> ev.channel) & 1) {
+                    return false;
+                }
+            }
+
+            if constexpr (std::is_same_v<T, NoteOnEvent> || std::is_same_v<T, NoteOffEvent>) {
+
+                if (ev.channel != TRANSFORM_DRUM_CHANNEL) {
+                    ev.midiNote = static_cast<uint8_t>(std::clamp(ev.midiNote + xf.transpose, 0, 127));
+                }
+            }
+
+            ev.channel = xf.channel_map[ev.channel & 0x0f];
+
+            return true;
+        }
+
+    }, e);
+}
+
+
+//
+// src and dst may be the same track
+//
+void
+transformTrack(
+    const midi_transform &xf,
+    uint16_t mutedChannels,
+    const std::vector<midi_track_event> &src,
+    std::vector<midi_track_event> &dst) {
+
+    const bool inPlace = (&src == &dst);
+
+    if (!inPlace) {
+        //
+        // assigning over existing events reuses their storage, e.g., the data of MetaEvents
+        //
+        dst.resize(src.size());
+    }
+
+    size_t kept = 0;
+
+    int32_t carry = 0;
+
+    for (size_t i = 0; i < src.size(); i++) {
+
+        if (inPlace) {
+            if (kept != i) {
+                dst[kept] = std::move(dst[i]);
+            }
+        } else {
+            dst[kept] = src[i];
+        }
+
+        auto &e = dst[kept];
+
+        auto &deltaTime = std::visit([](auto &ev) -> int32_t & { return ev.deltaTime; }, e);
+
+        deltaTime += carry;
+
+        if (!transformEvent(xf, mutedChannels, e)) {
+            carry = deltaTime;
+            continue;
+        }
+
+        carry = 0;
+
+        kept++;
+    }
+
+    //
+    // nothing is left to carry the time of the last dropped events, but tracks end with End of Track,
+    // which is never dropped
+    //
+    ASSERT(carry == 0 || kept == 0);
+
+    dst.resize(kept);
+}
+
+
+uint16_t mutedChannelsOf(const midi_transform &xf) {
+
+    if (xf.solo_channels != 0) {
+        return static_cast<uint16_t>(xf.muted_channels | ~xf.solo_channels);
+    }
+
+    return xf.muted_channels;
+}
+
+
+Status checkMidiTransform(const midi_transform &xf) {
+
+    CHECK(xf.tempo_scale > 0.0, "invalid tempo scale: %f", xf.tempo_scale);
+
+    //
+    // the channel is ORed into the status byte when exporting, so a larger channel changes the kind of event
+    //
+    for (size_t channel = 0; channel < xf.channel_map.size(); channel++) {
+        CHECK(xf.channel_map[channel] <= 15, "invalid channel map: %zu -> %d", channel, xf.channel_map[channel]);
+    }
+
+    return OK;
+}
+
+
+Status applyMidiTransform(const midi_transform &xf, midi_file &m) {
+
+    trace_span span("apply midi transform");
+
+    Status ret = checkMidiTransform(xf);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    auto mutedChannels = mutedChannelsOf(xf);
+
+    for (auto &track : m.tracks) {
+        transformTrack(xf, mutedChannels, track, track);
+    }
+
+    return OK;
+}
+
+
+Status applyMidiTransform(const midi_file &src, const midi_transform &xf, midi_file &out) {
+
+    trace_span span("apply midi transform");
+
+    Status ret = checkMidiTransform(xf);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    ASSERT(&src != &out);
+
+    auto mutedChannels = mutedChannelsOf(xf);
+
+    out.header = src.header;
+
+    out.tracks.resize(src.tracks.size());
+
+    for (size_t i = 0; i < src.tracks.size(); i++) {
+        transformTrack(xf, mutedChannels, src.tracks[i], out.tracks[i]);
+    }
+
+    return OK;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
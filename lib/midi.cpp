@@ -16,8 +16,10 @@
 // WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 // CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include "tbt-parser/song-context.h"
 #include "tbt-parser/tbt-parser-util.h"
 #include "tbt-parser/tbt.h"
+#include "tbt-parser/trace.h"
 
 #include "rational/rational.h"
 
@@ -29,8 +31,10 @@
 #include "common/file.h"
 #include "common/logging.h"
 
-#include <algorithm> // for remove
+#include <algorithm> // for remove, equal, copy_n
 #include <set>
+#include <initializer_list>
+#include <span>
 #include <variant> // for get_if
 #include <iterator>
 #include <cinttypes>
@@ -40,6 +44,10 @@
 
 
 #include "last-found.inl"
+#include "midi-constants.inl"
+#include "song-context.inl"
+#include "space-cursor.inl"
+#include "string-lanes.inl"
 
 
 #define TAG "midi"
@@ -52,30 +60,22 @@ const rational MICROS_PER_SECOND = 1000000;
 const rational MICROS_PER_MINUTE = (MICROS_PER_SECOND * 60);
 const rational MICROS_PER_64TH = (MICROS_PER_SECOND / 64);
 
-
 //
-// meta events
+// muted notes assume a tempo of 120 bpm
+//
+// keeping track of correct tempo is too costly
 //
-const uint8_t M_TRACKNAME = 0x03;
-const uint8_t M_LYRIC = 0x05;
-const uint8_t M_ENDOFTRACK = 0x2f;
-const uint8_t M_SETTEMPO = 0x51;
-const uint8_t M_TIMESIGNATURE = 0x58;
+const rational MUTED_MICROS_PER_BEAT = (MICROS_PER_MINUTE.to_uint32() / 120);
 
+//
+// convert MicrosPerBeat -> MicrosPerTick
+//
+const rational MUTED_MICROS_PER_TICK = (MUTED_MICROS_PER_BEAT / TBT_TICKS_PER_BEAT);
 
 //
-// controller messages
+// a muted note lasts for 1/64 second, or until the next event
 //
-const uint8_t C_BANKSELECT_MSB = 0x00;
-const uint8_t C_MODULATION = 0x01;
-const uint8_t C_DATAENTRY_MSB = 0x06;
-const uint8_t C_VOLUME = 0x07;
-const uint8_t C_PAN = 0x0a;
-const uint8_t C_DATAENTRY_LSB = 0x26;
-const uint8_t C_REVERB = 0x5b;
-const uint8_t C_CHORUS = 0x5d;
-const uint8_t C_RPNPARAM_LSB = 0x64;
-const uint8_t C_RPNPARAM_MSB = 0x65;
+const rational MUTED_TICK_DIFF = (MICROS_PER_64TH / MUTED_MICROS_PER_TICK).round();
 
 
 //
@@ -85,627 +85,740 @@ const std::string S_MTHD = "MThd";
 const std::string S_MTRK = "MTrk";
 
 
-//
-// resolve all of the Automatically Assign -1 values to actual channels
-//
-template <uint8_t VERSION, typename tbt_file_t>
-void
-computeChannelMap(
-    const tbt_file_t &t,
-    std::map<uint8_t, uint8_t> &channelMap) {
 
-    channelMap.clear();
 
-    //
-    // Channel 9 is for drums and is not generally available
-    //
-    std::vector<uint8_t> availableChannels{ 0, 1, 2, 3, 4, 5, 6, 7, 8, /*9,*/ 10, 11, 12, 13, 14, 15 };
+void addDiagnostic(tbt_diagnostics &d, tbt_diagnostic_code code, double space, int track) {
 
-    //
-    // first just treat any assigned channels as unavailable
-    //
-    if constexpr (0x6a <= VERSION) {
-        
-        for (uint8_t track = 0; track < t.header.trackCount; track++) {
+    for (auto &e : d.entries) {
+        if (e.code == code) {
+            e.count++;
+            return;
+        }
+    }
 
-            if (t.metadata.tracks[track].midiChannel == -1) {
-                continue;
-            }
+    d.entries.push_back({ code, 1, space, track });
+}
 
-            //
-            // https://en.wikipedia.org/wiki/Erase%E2%80%93remove_idiom
-            //
-            availableChannels.erase(
-                std::remove(
-                    availableChannels.begin(),
-                    availableChannels.end(),
-                    t.metadata.tracks[track].midiChannel
-                ),
-                availableChannels.end()
-            );
-
-            channelMap[track] = static_cast<uint8_t>(t.metadata.tracks[track].midiChannel);
-        }
+
+const char *tbtDiagnosticCodeString(tbt_diagnostic_code code) {
+    switch (code) {
+    case DIAG_TEMPO_CHANGE_AT_NON_INTEGRAL_SPACE:
+        return "tempo change at non-integral space";
+    case DIAG_CONFLICTING_TEMPO_CHANGES:
+        return "conflicting tempo changes";
+    case DIAG_REPEAT_CLOSE_AT_NON_INTEGRAL_SPACE:
+        return "repeat CLOSE at non-integral space";
+    case DIAG_REPEAT_OPEN_AT_NON_INTEGRAL_SPACE:
+        return "repeat OPEN at non-integral space";
+    case DIAG_NO_REPEAT_OPEN:
+        return "there was no repeat open";
+    case DIAG_REPEAT_OPEN_IGNORED:
+        return "repeat open is ignored";
+    default:
+        ABORT("invalid code: %d", code);
     }
+}
 
-    //
-    // availableChannels now holds generally available channels
-    //
 
-    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+std::string tbtDiagnosticsInfo(const tbt_diagnostics &d) {
 
-        if constexpr (0x6a <= VERSION) {
-            if (t.metadata.tracks[track].midiChannel != -1) {
-                continue;
-            }
-        }
+    std::string acc;
 
-        //
-        // Take first available channel
-        //
+    char buf[256];
 
-        ASSERT(!availableChannels.empty());
-        
-        auto firstAvailableChannel = availableChannels[0];
-        availableChannels.erase(availableChannels.cbegin() + 0);
+    for (const auto &e : d.entries) {
+
+        if (e.firstTrack == -1) {
+            snprintf(buf, sizeof(buf), "%s: %" PRIu32 " time(s), first at space %f\n", tbtDiagnosticCodeString(e.code), e.count, e.firstSpace);
+        } else {
+            snprintf(buf, sizeof(buf), "%s: %" PRIu32 " time(s), first at space %f in track %d\n", tbtDiagnosticCodeString(e.code), e.count, e.firstSpace, e.firstTrack);
+        }
 
-        channelMap[track] = firstAvailableChannel;
+        acc += buf;
     }
 
-    //
-    // it's ok to have available channels left over
-    //
-//    if (!availableChannels.empty()) {
-//        LOGE("availableChannels is not empty");
-//        return TBT_ERR;
-//    }
+    return acc;
 }
 
 
-void
-insertTempoMap_atActualSpace(
-    uint16_t newTempo,
-    const rational &actualSpace,
-    std::map<uint16_t, std::map<rational, uint16_t> > &tempoMap) {
 
-    auto flooredActualSpace = actualSpace.floor();
+struct repeat_open_struct { // NOLINT(*-pro-type-member-init)
+    rational actualSpace;
+    uint16_t space;
+};
 
-    auto flooredActualSpaceI = flooredActualSpace.to_uint16();
 
-    auto spaceDiff = (actualSpace - flooredActualSpace);
 
-    ASSERT(spaceDiff.is_nonnegative());
 
-    if (spaceDiff.is_positive()) {
-        LOGW("tempo change at non-integral space: %f", actualSpace.to_double());
-    }
+bool operator==(const ProgramChangeEvent &lhs, const ProgramChangeEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiProgram == rhs.midiProgram;
+}
 
-    const auto &tempoMapIt = tempoMap.find(flooredActualSpaceI);
-    if (tempoMapIt != tempoMap.end()) {
+bool operator==(const PitchBendEvent &lhs, const PitchBendEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.pitchBend == rhs.pitchBend;
+}
 
-        auto &m = tempoMapIt->second;
+bool operator==(const NoteOffEvent &lhs, const NoteOffEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiNote == rhs.midiNote && lhs.velocity == rhs.velocity;
+}
 
-        const auto mIt = m.find(actualSpace);
-        if (mIt != m.end()) {
+bool operator==(const NoteOnEvent &lhs, const NoteOnEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiNote == rhs.midiNote && lhs.velocity == rhs.velocity;
+}
 
-            auto &tempo = mIt->second;
+bool operator==(const ControlChangeEvent &lhs, const ControlChangeEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.controller == rhs.controller && lhs.value == rhs.value;
+}
 
-            if (tempo != newTempo) {
-                LOGW("actualSpace %f has conflicting tempo changes: %d, %d", actualSpace.to_double(), tempo, newTempo);
-            }
+bool operator==(const MetaEvent &lhs, const MetaEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.type == rhs.type && lhs.data == rhs.data;
+}
 
-            tempo = newTempo;
+bool operator==(const PolyphonicKeyPressureEvent &lhs, const PolyphonicKeyPressureEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiNote == rhs.midiNote && lhs.pressure == rhs.pressure;
+}
 
-        } else {
+bool operator==(const ChannelPressureEvent &lhs, const ChannelPressureEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.pressure == rhs.pressure;
+}
 
-            m[actualSpace] = newTempo;
-        }
+bool operator==(const SysExEvent &lhs, const SysExEvent &rhs) {
+    return lhs.deltaTime == rhs.deltaTime && lhs.data == rhs.data;
+}
 
-    } else {
 
-        std::map<rational, uint16_t> m;
+//
+// where exported bytes go
+//
+// midi_export_counter only counts, so the exact size is known before anything is written
+//
+// midi_export_region writes into memory that was sized with midiExportSize, e.g., a shared memory mapping,
+// and drops anything past the end
+//
+struct midi_export_counter {
+    size_t size = 0;
+};
+
+struct midi_export_region {
+    uint8_t *pos;
+    uint8_t *end;
+    bool overflow = false;
+};
 
-        m[actualSpace] = newTempo;
 
-        tempoMap[flooredActualSpaceI] = m;
-    }
+void exportBytes(std::vector<uint8_t> &out, std::initializer_list<uint8_t> bytes) {
+    out.insert(out.end(), bytes);
 }
 
+void exportBytes(midi_export_counter &out, std::initializer_list<uint8_t> bytes) {
+    out.size += bytes.size();
+}
 
-template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, typename tbt_file_t, uint8_t STRINGS_PER_TRACK>
-void
-computeTempoMap(
-    const tbt_file_t &t,
-    std::map<uint16_t, std::map<rational, uint16_t> > &tempoMap) {
+void exportBytes(midi_export_region &out, std::initializer_list<uint8_t> bytes) {
 
-    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+    if (static_cast<size_t>(out.end - out.pos) < bytes.size()) {
+        out.overflow = true;
+        return;
+    }
 
-        uint16_t trackSpaceCount;
-        if constexpr (0x70 <= VERSION) {
-            //
-            // stored as 32-bit int, so must be cast
-            //
-            trackSpaceCount = static_cast<uint16_t>(t.metadata.tracks[track].spaceCount);
-        } else if constexpr (VERSION == 0x6f) {
-            trackSpaceCount = t.header.spaceCount;
-        } else {
-            trackSpaceCount = 4000;
-        }
+    std::copy(bytes.begin(), bytes.end(), out.pos);
 
-        const auto &maps = t.body.mapsList[track];
+    out.pos += bytes.size();
+}
 
-        rational actualSpace = 0;
 
-        for (uint16_t space = 0; space < trackSpaceCount;) {
+void exportData(std::vector<uint8_t> &out, const std::vector<uint8_t> &data) {
+    out.insert(out.end(), data.cbegin(), data.cend());
+}
 
-            if constexpr (VERSION == 0x72) {
+void exportData(midi_export_counter &out, const std::vector<uint8_t> &data) {
+    out.size += data.size();
+}
 
-                const auto &it = maps.trackEffectChangesMap.find(space);
-                if (it != maps.trackEffectChangesMap.end()) {
-                    
-                    const auto &changes = it->second;
+void exportData(midi_export_region &out, const std::vector<uint8_t> &data) {
 
-                    for (const auto &p : changes) {
+    if (static_cast<size_t>(out.end - out.pos) < data.size()) {
+        out.overflow = true;
+        return;
+    }
 
-                        auto effect = p.first;
+    std::copy(data.cbegin(), data.cend(), out.pos);
 
-                        if (effect == TE_TEMPO) {
+    out.pos += data.size();
+}
 
-                            auto newTempo = p.second;
 
-                            insertTempoMap_atActualSpace(newTempo, actualSpace, tempoMap);
+void exportVLQ(std::vector<uint8_t> &out, int32_t value) {
+    toVLQ(value, out);
+}
 
-                            break;
-                        }
-                    }
-                }
+void exportVLQ(midi_export_counter &out, int32_t value) {
 
-            } else {
+    ASSERT(value >= 0);
+    ASSERT(value <= 0x0fffffff);
 
-                const auto &it = maps.notesMap.find(space);
-                if (it != maps.notesMap.end()) {
+    if (value <= 0b1111111) {
+        out.size += 1;
+    } else if (value <= 0b11111111111111) {
+        out.size += 2;
+    } else if (value <= 0b111111111111111111111) {
+        out.size += 3;
+    } else {
+        out.size += 4;
+    }
+}
 
-                    const auto &vsqs = it->second;
+void exportVLQ(midi_export_region &out, int32_t value) {
 
-                    const auto &trackEffect = vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 0];
+    ASSERT(value >= 0);
+    ASSERT(value <= 0x0fffffff);
 
-                    switch (trackEffect) {
-                    case 'T': {
+    auto v = static_cast<uint32_t>(value);
 
-                        auto newTempo = static_cast<uint16_t>(vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 3]);
+    if (v <= 0b1111111) {
+        exportBytes(out, { static_cast<uint8_t>(v) });
+    } else if (v <= 0b11111111111111) {
+        exportBytes(out, { static_cast<uint8_t>((v >> 7) | 0b10000000), static_cast<uint8_t>(v & 0b01111111) });
+    } else if (v <= 0b111111111111111111111) {
+        exportBytes(out, { static_cast<uint8_t>((v >> 14) | 0b10000000), static_cast<uint8_t>(((v >> 7) & 0b01111111) | 0b10000000), static_cast<uint8_t>(v & 0b01111111) });
+    } else {
+        exportBytes(out, { static_cast<uint8_t>((v >> 21) | 0b10000000), static_cast<uint8_t>(((v >> 14) & 0b01111111) | 0b10000000), static_cast<uint8_t>(((v >> 7) & 0b01111111) | 0b10000000), static_cast<uint8_t>(v & 0b01111111) });
+    }
+}
 
-                        insertTempoMap_atActualSpace(newTempo, actualSpace, tempoMap);
 
-                        break;
-                    }
-                    case 't': {
+template <typename Out>
+struct EventExportVisitor {
+    
+    Out &tmp;
 
-                        auto newTempo = static_cast<uint16_t>(vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 3] + 250);
+    void operator()(const ProgramChangeEvent &e) {
 
-                        insertTempoMap_atActualSpace(newTempo, actualSpace, tempoMap);
+        exportVLQ(tmp, e.deltaTime); // delta time
 
-                        break;
-                    }
-                    case '\0':
-                    case 'I':
-                    case 'V':
-                    case 'D':
-                    case 'U':
-                    case 'C':
-                    case 'P':
-                    case 'R': {
-                        //
-                        // skip
-                        //
-                        break;
-                    }
-                    default:
-                        ABORT("invalid trackEffect: %c (%d)", trackEffect, trackEffect);
-                    }
-                }
-            }
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0xc0 | e.channel), // program change
+            e.midiProgram
+        });
+    }
 
-            //
-            // Compute actual space
-            //
-            {
-                if constexpr (HASALTERNATETIMEREGIONS) {
+    void operator()(const PitchBendEvent &e) {
 
-                    const auto &alternateTimeRegionsIt = maps.alternateTimeRegionsMap.find(space);
-                    if (alternateTimeRegionsIt != maps.alternateTimeRegionsMap.end()) {
+        uint8_t pitchBendLSB = (e.pitchBend & 0b01111111);
+        uint8_t pitchBendMSB = ((e.pitchBend >> 7) & 0b01111111);
 
-                        const auto &alternateTimeRegion = alternateTimeRegionsIt->second;
+        exportVLQ(tmp, e.deltaTime); // delta time
 
-                        auto atr = rational{ alternateTimeRegion[0], alternateTimeRegion[1] };
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0xe0 | e.channel), // pitch bend
+            pitchBendLSB,
+            pitchBendMSB
+        });
+    }
 
-                        space++;
+    void operator()(const NoteOffEvent &e) {
 
-                        actualSpace += atr;
+        exportVLQ(tmp, e.deltaTime); // delta time
 
-                    } else {
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0x80 | e.channel), // note off
+            e.midiNote,
+            e.velocity
+        });
+    }
 
-                        space++;
+    void operator()(const NoteOnEvent &e) {
 
-                        ++actualSpace;
-                    }
+        exportVLQ(tmp, e.deltaTime); // delta time
 
-                } else {
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0x90 | e.channel), // note on
+            e.midiNote,
+            e.velocity
+        });
+    }
 
-                    space++;
+    void operator()(const ControlChangeEvent &e) {
 
-                    actualSpace = space;
-                }
-            }
-        }
+        exportVLQ(tmp, e.deltaTime); // delta time
 
-    } // for track
-}
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0xb0 | e.channel),
+            e.controller,
+            e.value
+        });
+    }
 
+    void operator()(const MetaEvent &e) {
 
-struct repeat_close_struct {
-    uint16_t open;
-    uint8_t repeats;
-    size_t dataStart;
-    size_t dataEnd;
-    int jump;
-};
+        exportVLQ(tmp, e.deltaTime); // delta time
 
+        exportBytes(tmp, {
+            0xff, // Meta
+            e.type
+        });
 
-struct repeat_open_struct { // NOLINT(*-pro-type-member-init)
-    rational actualSpace;
-    uint16_t space;
-};
+        exportVLQ(tmp, static_cast<int32_t>(e.data.size())); // len
 
+        exportData(tmp, e.data);
+    }
 
-template <uint8_t VERSION, typename tbt_file_t>
-void
-computeRepeats(
-    const tbt_file_t &t,
-    uint16_t barLinesSpaceCount,
-    std::vector<std::set<uint16_t> > &openSpaceSets,
-    std::vector<std::map<uint16_t, repeat_close_struct> > &repeatCloseMaps) {
+    void operator()(const PolyphonicKeyPressureEvent &e) {
 
-    //
-    // Setup repeats
-    //
+        exportVLQ(tmp, e.deltaTime); // delta time
+
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0xa0 | e.channel),
+            e.midiNote,
+            e.pressure
+        });
+    }
 
-    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+    void operator()(const ChannelPressureEvent &e) {
 
-        repeatCloseMaps.push_back( {} );
+        exportVLQ(tmp, e.deltaTime); // delta time
 
-        openSpaceSets.push_back( {} );
+        exportBytes(tmp, {
+            static_cast<uint8_t>(0xd0 | e.channel),
+            e.pressure
+        });
     }
 
-    uint16_t lastOpenSpace = 0;
+    void operator()(const SysExEvent &e) {
+        (void)e;
+    }
+};
 
-    bool currentlyOpen = false;
-    bool savedClose = false;
-    uint8_t savedRepeats = 0;
 
-    for (uint16_t space = 0; space < barLinesSpaceCount;) {
+void writeBE2(uint16_t value, uint8_t *out) {
+    out[0] = static_cast<uint8_t>((value >> 8) & 0xff);
+    out[1] = static_cast<uint8_t>(value & 0xff);
+}
 
-        //
-        // Setup repeats:
-        // setup repeatCloseMap and openSpaceSet
-        //
-        if constexpr (0x70 <= VERSION) {
 
-            const auto &barLinesMapIt = t.body.barLinesMap.find(space);
-            if (barLinesMapIt != t.body.barLinesMap.end()) {
+void writeBE4(uint32_t value, uint8_t *out) {
+    out[0] = static_cast<uint8_t>((value >> 24) & 0xff);
+    out[1] = static_cast<uint8_t>((value >> 16) & 0xff);
+    out[2] = static_cast<uint8_t>((value >> 8) & 0xff);
+    out[3] = static_cast<uint8_t>(value & 0xff);
+}
 
-                //
-                // typical bar line is at spaces: 0, 16, 32, etc.
-                //
-                auto barLine = barLinesMapIt->second;
 
-                if (savedClose) {
+//
+// where the second and third passes through a repeated section started
+//
+struct repeat_section_struct { // NOLINT(*-pro-type-member-init)
+    size_t dataStart;
+    size_t dataEnd;
 
-                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+    //
+    // number of midi_repeats emitted when dataStart and dataEnd were set
+    //
+    size_t repeatCountAtStart;
+    size_t repeatCountAtEnd;
+};
 
-                        if (openSpaceSets[track].find(lastOpenSpace) == openSpaceSets[track].end()) {
-                        
-                            LOGW("there was no repeat open at %d", lastOpenSpace);
-                            
-                            openSpaceSets[track].insert(lastOpenSpace);
-                        }
 
-                        repeatCloseMaps[track][space] = { lastOpenSpace, savedRepeats, 0, 0, 0 };
-                    }
+//
+// the last pass through a repeated section has been emitted, and is the same as events [r.dataStart, r.dataEnd)
+//
+// emit the remaining count passes
+//
+void
+emitRepeatedSection(
+    const repeat_section_struct &r,
+    uint8_t count,
+    bool keepRepeats,
+    std::vector<midi_track_event> &tmp,
+    std::vector<midi_repeat> &repeats) {
 
-                    savedClose = false;
+    using tmp_diff_t = std::iterator_traits<std::vector<midi_track_event>::iterator>::difference_type;
 
-                    lastOpenSpace = space;
-                }
+    auto sectionSize = r.dataEnd - r.dataStart;
+    auto sectionStart = tmp.cbegin() + static_cast<tmp_diff_t>(r.dataStart);
 
-                if ((barLine[0] & CLOSEREPEAT_MASK_GE70) == CLOSEREPEAT_MASK_GE70) {
+    //
+    // verify all events are correct
+    //
 
-                    //
-                    // save for next bar line
-                    //
+    auto lastJumpStart = tmp.cend() - static_cast<tmp_diff_t>(sectionSize);
 
-                    savedClose = true;
-                    savedRepeats = barLine[1];
+    for (size_t i = 0; i < sectionSize; i++) {
+        midi_track_event a = *(lastJumpStart + static_cast<tmp_diff_t>(i));
+        midi_track_event b = *(sectionStart + static_cast<tmp_diff_t>(i));
+        ASSERT(a == b);
+    }
 
-                    currentlyOpen = false;
-                }
+    //
+    // any repeats inside of the section would also need to be repeated
+    //
+    auto innerBegin = r.repeatCountAtStart;
+    auto innerEnd = r.repeatCountAtEnd;
 
-                if ((barLine[0] & OPENREPEAT_MASK_GE70) == OPENREPEAT_MASK_GE70) {
+    if (keepRepeats && innerBegin == innerEnd) {
 
-                    if (currentlyOpen) {
+        repeats.push_back(midi_repeat{
+            tmp.size(),
+            r.dataStart,
+            r.dataEnd,
+            count
+        });
 
-                        LOGW("repeat open at space %d is ignored", lastOpenSpace);
+        return;
+    }
 
-                    } else {
+    auto sectionEnd = tmp.cbegin() + static_cast<tmp_diff_t>(r.dataEnd);
 
-                        currentlyOpen = true;
-                    }
+    auto section = std::vector<midi_track_event>(sectionStart, sectionEnd);
 
-                    lastOpenSpace = space;
+    tmp.reserve(tmp.size() + count * sectionSize);
 
-                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
-                        openSpaceSets[track].insert(lastOpenSpace);
-                    }
-                }
-            }
+    for (size_t i = 0; i < count; i++) {
 
-        } else {
+        auto base = tmp.size();
 
-            const auto &barLinesMapIt = t.body.barLinesMap.find(space);
-            if (barLinesMapIt != t.body.barLinesMap.end()) {
+        tmp.insert(tmp.end(), section.cbegin(), section.cend());
 
-                //
-                // typical CLOSE, SINGLE, DOUBLE is at spaces: 15, 31, etc.
-                // typical OPEN is at spaces: 0, 16, 32, etc.
-                //
-                auto barLine = barLinesMapIt->second;
+        for (size_t j = innerBegin; j < innerEnd; j++) {
 
-                auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
+            //
+            // the section that inner refers to is still valid, only where it is played moves
+            //
+            auto inner = repeats[j];
 
-                switch (change) {
-                case CLOSE: {
-                    
-                    auto repeats = static_cast<uint8_t>((barLine[0] & 0b11110000) >> 4);
+            inner.at = inner.at - r.dataStart + base;
 
-                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
-                        
-                        if (openSpaceSets[track].find(lastOpenSpace) == openSpaceSets[track].end()) {
-                        
-                            LOGW("there was no repeat open at %d", lastOpenSpace);
-                            
-                            openSpaceSets[track].insert(lastOpenSpace);
-                        }
-                        
-                        repeatCloseMaps[track][space + 1] = { lastOpenSpace, repeats, 0, 0, 0 };
-                    }
+            repeats.push_back(inner);
+        }
+    }
+}
 
-                    lastOpenSpace = space + 1;
 
-                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
-                        openSpaceSets[track].insert(lastOpenSpace);
-                    }
+//
+// where converted events go
+//
+// TconvertToMidi is a template on the sink, so every event goes straight to its output,
+// without virtual calls or a std::vector<midi_track_event> in between
+//
+// a sink has:
+//   header(h)
+//   startTrack()
+//   event(e), for every type of event that is converted
+//   markSectionStart(close), when the second pass through the section that is closed at space close starts
+//   markSectionEnd(close), when the third pass starts
+//   repeatSection(close, count), when the third pass has ended, and the remaining count passes are the same as it
+//   finishTrack()
+//
+// the space of a repeat close is unique within a track
+//
 
-                    currentlyOpen = false;
 
-                    break;
-                }
-                case OPEN: {
+//
+// appends to a midi_program
+//
+// if keepRepeats is false, then repeated sections are copied, so the tracks can be moved to a midi_file
+//
+struct midi_program_sink {
 
-                    if (currentlyOpen) {
+    midi_program &out;
 
-                        LOGW("repeat open at space %d is ignored", lastOpenSpace);
+    bool keepRepeats;
 
-                    } else {
+    std::map<uint16_t, repeat_section_struct> sections;
 
-                        currentlyOpen = true;
-                    }
+    void header(const midi_header &h) {
+        out.header = h;
+    }
 
-                    lastOpenSpace = space;
+    void startTrack() {
 
-                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
-                        openSpaceSets[track].insert(lastOpenSpace);
-                    }
+        out.tracks.emplace_back();
 
-                    break;
-                }
-                case SINGLE:
-                case DOUBLE:
-                    //
-                    // nothing to do
-                    //
-                    break;
-                default:
-                    ABORT("invalid change: %d", change);
-                }
-            }
-        }
+        sections.clear();
+    }
 
-        space++;
+    template <typename Event>
+    void event(Event &&e) {
+        out.tracks.back().events.emplace_back(std::forward<Event>(e));
+    }
 
-    } // for space
+    void markSectionStart(uint16_t close) {
 
-    if constexpr (0x70 <= VERSION) {
+        const auto &track = out.tracks.back();
 
-        //
-        // and make sure to handle close repeat at very end of song
-        //
-        if (savedClose) {
+        auto &section = sections[close];
 
-            for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+        section.dataStart = track.events.size();
 
-                if (openSpaceSets[track].find(lastOpenSpace) == openSpaceSets[track].end()) {
+        section.repeatCountAtStart = track.repeats.size();
+    }
 
-                    LOGW("there was no repeat open at %d", lastOpenSpace);
+    void markSectionEnd(uint16_t close) {
 
-                    openSpaceSets[track].insert(lastOpenSpace);
-                }
+        const auto &track = out.tracks.back();
 
-                repeatCloseMaps[track][barLinesSpaceCount] = { lastOpenSpace, savedRepeats, 0, 0, 0 };
-            }
+        auto &section = sections[close];
 
-            savedClose = false;
-        }
+        section.dataEnd = track.events.size();
+
+        section.repeatCountAtEnd = track.repeats.size();
     }
-}
 
+    void repeatSection(uint16_t close, uint8_t count) {
 
-template <uint8_t VERSION, typename tbt_file_t, uint8_t STRINGS_PER_TRACK>
-void
-computeMidiNoteOffsetArrays(
-    const tbt_file_t &t,
-    std::vector<std::array<uint8_t, STRINGS_PER_TRACK> > &midiNoteOffsetArrays) {
+        auto &track = out.tracks.back();
 
-    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+        emitRepeatedSection(sections.at(close), count, keepRepeats, track.events, track.repeats);
+    }
 
-        const auto &trackMetadata = t.metadata.tracks[track];
+    void finishTrack() {}
+};
+
+
+//
+// encodes the bytes of a .mid file as events arrive
+//
+// repeated sections are copied as bytes
+//
+struct midi_bytes_sink {
 
-        std::array<uint8_t, STRINGS_PER_TRACK> midiNoteOffsetArray; // NOLINT(*-pro-type-member-init)
+    std::vector<uint8_t> &out;
 
-        for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+    size_t lengthPos = 0;
 
-            auto offset = -0x80;
+    std::map<uint16_t, repeat_section_struct> sections;
 
-            offset += trackMetadata.tuning[string];
+    void header(const midi_header &h) {
 
-            if constexpr (0x6e <= VERSION) {
-                offset += trackMetadata.transposeHalfSteps;
-            }
+        out.insert(out.end(), S_MTHD.cbegin(), S_MTHD.cend()); // type
 
-            if constexpr (0x6b <= VERSION) {
-                offset += OPEN_STRING_TO_MIDI_NOTE[string];
-            } else {
-                offset += OPEN_STRING_TO_MIDI_NOTE_LE6A[string];
-            }
+        toDigitsBE(static_cast<uint32_t>(2 + 2 + 2), out); // length
 
-            midiNoteOffsetArray[string] = static_cast<uint8_t>(offset);
-        }
+        toDigitsBE(h.format, out); // format
+
+        toDigitsBE(h.trackCount, out); // track count
 
-        midiNoteOffsetArrays.push_back(midiNoteOffsetArray);
+        toDigitsBE(h.division, out); // division
     }
-}
 
+    void startTrack() {
 
-bool operator==(const ProgramChangeEvent &lhs, const ProgramChangeEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiProgram == rhs.midiProgram;
-}
+        out.insert(out.end(), S_MTRK.cbegin(), S_MTRK.cend()); // type
 
-bool operator==(const PitchBendEvent &lhs, const PitchBendEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.pitchBend == rhs.pitchBend;
-}
+        lengthPos = out.size();
 
-bool operator==(const NoteOffEvent &lhs, const NoteOffEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiNote == rhs.midiNote && lhs.velocity == rhs.velocity;
-}
+        toDigitsBE(static_cast<uint32_t>(0), out); // length placeholder
 
-bool operator==(const NoteOnEvent &lhs, const NoteOnEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiNote == rhs.midiNote && lhs.velocity == rhs.velocity;
-}
+        sections.clear();
+    }
 
-bool operator==(const ControlChangeEvent &lhs, const ControlChangeEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.controller == rhs.controller && lhs.value == rhs.value;
-}
+    template <typename Event>
+    void event(const Event &e) {
+        EventExportVisitor<std::vector<uint8_t> >{ out }(e);
+    }
 
-bool operator==(const MetaEvent &lhs, const MetaEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.type == rhs.type && lhs.data == rhs.data;
-}
+    void markSectionStart(uint16_t close) {
+        sections[close].dataStart = out.size();
+    }
 
-bool operator==(const PolyphonicKeyPressureEvent &lhs, const PolyphonicKeyPressureEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.midiNote == rhs.midiNote && lhs.pressure == rhs.pressure;
-}
+    void markSectionEnd(uint16_t close) {
+        sections[close].dataEnd = out.size();
+    }
 
-bool operator==(const ChannelPressureEvent &lhs, const ChannelPressureEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.channel == rhs.channel && lhs.pressure == rhs.pressure;
-}
+    void repeatSection(uint16_t close, uint8_t count) {
 
-bool operator==(const SysExEvent &lhs, const SysExEvent &rhs) {
-    return lhs.deltaTime == rhs.deltaTime && lhs.data == rhs.data;
-}
+        const auto &section = sections.at(close);
 
+        auto sectionSize = section.dataEnd - section.dataStart;
 
-template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, uint8_t STRINGS_PER_TRACK, typename tbt_file_t>
-Status
-TconvertToMidi(
-    const tbt_file_t &t,
-    const midi_convert_opts &opts,
-    midi_file &out) {
+        //
+        // verify the last pass is the same as the section
+        //
+        ASSERT(std::equal(out.cend() - static_cast<std::ptrdiff_t>(sectionSize), out.cend(), out.cbegin() + static_cast<std::ptrdiff_t>(section.dataStart)));
 
-    uint16_t barLinesSpaceCount;
-    if constexpr (0x70 <= VERSION) {
-        barLinesSpaceCount = t.body.barLinesSpaceCount;
-    } else if constexpr (VERSION == 0x6f) {
-        barLinesSpaceCount = t.header.spaceCount;
-    } else {
-        barLinesSpaceCount = 4000;
+        auto pos = out.size();
+
+        out.resize(pos + count * sectionSize);
+
+        for (size_t i = 0; i < count; i++) {
+            std::copy_n(out.cbegin() + static_cast<std::ptrdiff_t>(section.dataStart), sectionSize, out.begin() + static_cast<std::ptrdiff_t>(pos + i * sectionSize));
+        }
     }
 
-    //
-    // compute tempo map
-    //
-    // flooredActualSpace -> ( actualSpace -> tempo )
-    //
-    // there can be more than one tempo change mapped to the same flooredActualSpace
-    // so this needs to be a map of actualSpace -> tempo
-    //
-    // pre-computed
-    //
-    std::map<uint16_t, std::map<rational, uint16_t> > tempoMap;
+    void finishTrack() {
+        writeBE4(static_cast<uint32_t>(out.size() - lengthPos - 4), out.data() + lengthPos); // length
+    }
+};
 
-    computeTempoMap<VERSION, HASALTERNATETIMEREGIONS, tbt_file_t, STRINGS_PER_TRACK>(t, tempoMap);
 
-    //
-    // compute channel map
-    //
-    // pre-computed
-    //
-    std::map<uint8_t, uint8_t> channelMap;
+//
+// counts events by kind
+//
+struct midi_count_sink {
 
-    computeChannelMap<VERSION>(t, channelMap);
+    midi_event_counts &out;
 
     //
-    // for each track:
-    //   set of spaces that repeat opens occur
+    // counts when the second and third passes started
     //
-    // pre-computed
-    //
-    std::vector<std::set<uint16_t> > openSpaceSets;
+    std::map<uint16_t, std::array<midi_event_counts, 2> > sections;
 
-    //
-    // for each track, including tempo track:
-    //   actual space of close -> repeat_close_struct
-    //
-    // pre-computed
-    //
-    std::vector<std::map<uint16_t, repeat_close_struct> > repeatCloseMaps;
+    void header(const midi_header &h) {
+        (void)h;
+    }
+
+    void startTrack() {
+        sections.clear();
+    }
 
-    computeRepeats<VERSION, tbt_file_t>(t, barLinesSpaceCount, openSpaceSets, repeatCloseMaps);
+    void event(const ProgramChangeEvent &e) {
+        (void)e;
+        out.programChange++;
+    }
 
-    //
-    // for each track:
-    //   string -> offset needed to obtain midi note
-    //
-    // pre-computed
-    //
-    std::vector<std::array<uint8_t, STRINGS_PER_TRACK> > midiNoteOffsetArrays;
+    void event(const PitchBendEvent &e) {
+        (void)e;
+        out.pitchBend++;
+    }
 
-    computeMidiNoteOffsetArrays<VERSION, tbt_file_t, STRINGS_PER_TRACK>(t, midiNoteOffsetArrays);
+    void event(const NoteOffEvent &e) {
+        (void)e;
+        out.noteOff++;
+    }
 
+    void event(const NoteOnEvent &e) {
+        (void)e;
+        out.noteOn++;
+    }
 
-    out.header = {
-        1, // format
-        static_cast<uint16_t>(t.header.trackCount + 1), // track count, + 1 for tempo track
-        TBT_TICKS_PER_BEAT.to_uint16() // division
-    };
+    void event(const ControlChangeEvent &e) {
+        (void)e;
+        out.controlChange++;
+    }
+
+    void event(const MetaEvent &e) {
+        (void)e;
+        out.meta++;
+    }
+
+    void markSectionStart(uint16_t close) {
+        sections[close][0] = out;
+    }
+
+    void markSectionEnd(uint16_t close) {
+        sections[close][1] = out;
+    }
+
+    void repeatSection(uint16_t close, uint8_t count) {
+
+        const auto &[start, end] = sections.at(close);
+
+        out.noteOn += count * (end.noteOn - start.noteOn);
+        out.noteOff += count * (end.noteOff - start.noteOff);
+        out.controlChange += count * (end.controlChange - start.controlChange);
+        out.programChange += count * (end.programChange - start.programChange);
+        out.pitchBend += count * (end.pitchBend - start.pitchBend);
+        out.meta += count * (end.meta - start.meta);
+    }
+
+    void finishTrack() {}
+};
+
+
+//
+// sends everything to 2 sinks, so both outputs come from a single pass
+//
+template <typename first_t, typename second_t>
+struct midi_sink_pair {
+
+    first_t &first;
+
+    second_t &second;
+
+    void header(const midi_header &h) {
+        first.header(h);
+        second.header(h);
+    }
+
+    void startTrack() {
+        first.startTrack();
+        second.startTrack();
+    }
 
+    template <typename Event>
+    void event(const Event &e) {
+        first.event(e);
+        second.event(e);
+    }
+
+    void markSectionStart(uint16_t close) {
+        first.markSectionStart(close);
+        second.markSectionStart(close);
+    }
+
+    void markSectionEnd(uint16_t close) {
+        first.markSectionEnd(close);
+        second.markSectionEnd(close);
+    }
+
+    void repeatSection(uint16_t close, uint8_t count) {
+        first.repeatSection(close, count);
+        second.repeatSection(close, count);
+    }
+
+    void finishTrack() {
+        first.finishTrack();
+        second.finishTrack();
+    }
+};
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, uint8_t STRINGS_PER_TRACK, typename tbt_file_t, typename sink_t>
+Status
+TconvertToMidi(
+    const tbt_file_t &t,
+    const tbt_song_context::impl &ctx,
+    const midi_convert_opts &opts,
+    bool emitTempoTrack,
+    sink_t &sink) {
 
-    std::vector<midi_track_event> tmp;
+    const auto barLinesSpaceCount = ctx.barLinesSpaceCount;
 
-    uint32_t tickCount;
+    const auto &tempoMap = ctx.tempoMap;
+
+    const auto &channelMap = ctx.channelMap;
+
+    const auto &midiNoteOffsetArrays = ctx.midiNoteOffsetArrays;
+
+    uint16_t selectedTrackCount = 0;
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+        if (trackSelected(opts.selected_tracks, track)) {
+            selectedTrackCount++;
+        }
+    }
+
+    sink.header(midi_header{
+        1, // format
+        static_cast<uint16_t>(selectedTrackCount + 1), // track count, + 1 for tempo track
+        TBT_TICKS_PER_BEAT.to_uint16() // division
+    });
+
+    //
+    // only known if the tempo track is emitted
+    //
+    uint32_t tickCount = 0;
 
     //
     // Track 0
     //
     // will be used for tempo changes exclusively
     //
-    {
+    if (emitTempoTrack) {
+        trace_span span("tempo track events");
+
+        sink.startTrack();
+
         //
         // Emit events for tempo track
         //
@@ -722,7 +835,7 @@ TconvertToMidi(
 
         std::vector<uint8_t> trackNameData{ str.cbegin(), str.cend() };
 
-        tmp.push_back(MetaEvent{
+        sink.event(MetaEvent{
             diff.to_int32(), // delta time
             M_TRACKNAME,
             trackNameData
@@ -739,7 +852,7 @@ TconvertToMidi(
             8 // notated 32-notes in MIDI quarter notes
         };
 
-        tmp.push_back(MetaEvent{
+        sink.event(MetaEvent{
             diff.to_int32(), // delta time
             M_TIMESIGNATURE,
             timeSignatureData
@@ -772,7 +885,7 @@ TconvertToMidi(
 
             toDigitsBEOnly3(microsPerBeat, tempoChangeData); // only last 3 bytes of microsPerBeatBytes
 
-            tmp.push_back(MetaEvent{
+            sink.event(MetaEvent{
                 diff.to_int32(), // delta time
                 M_SETTEMPO,
                 tempoChangeData
@@ -788,7 +901,7 @@ TconvertToMidi(
 
                 auto lyricData = std::vector<uint8_t>{lyricStr.cbegin(), lyricStr.cend()};
 
-                tmp.push_back(MetaEvent{
+                sink.event(MetaEvent{
                     diff.to_int32(), // delta time
                     M_LYRIC,
                     lyricData
@@ -798,7 +911,12 @@ TconvertToMidi(
             }
         }
 
-        auto &repeatCloseMap = repeatCloseMaps[0];
+        //
+        // copied, because it is modified while rendering
+        //
+        auto repeatCloseMap = ctx.repeatCloseMaps[0];
+
+        space_cursor tempoMapCursor(tempoMap);
 
         for (uint16_t space = 0; space < barLinesSpaceCount + 1;) { // space count, + 1 for handling repeats at end
 
@@ -833,13 +951,13 @@ TconvertToMidi(
 
                             } else if (r.jump == 1) {
 
-                                r.dataStart = tmp.size();
+                                sink.markSectionStart(repeatCloseMapIt->first);
 
                             } else {
 
                                 ASSERT(r.jump == 2);
 
-                                r.dataEnd = tmp.size();
+                                sink.markSectionEnd(repeatCloseMapIt->first);
                             }
 
                             r.repeats--;
@@ -850,37 +968,11 @@ TconvertToMidi(
                         }
 
                         //
-                        // make copies of the events instead of jumping to the repeat open
-                        //
-                        // have now reached a fix-point, so this is correct
-                        //
-
-                        using tmp_diff_t = std::iterator_traits<std::vector<midi_track_event>::iterator>::difference_type;
-
-                        auto sectionSize = r.dataEnd - r.dataStart;
-                        auto sectionStart = tmp.cbegin() + static_cast<tmp_diff_t>(r.dataStart);
-
+                        // have now reached a fix-point, so the rest of the repeats are exactly the same
                         //
-                        // verify all events are correct
+                        // either copy the events, or reference them
                         //
-
-                        auto lastJumpStart = tmp.cend() - static_cast<tmp_diff_t>(sectionSize);
-
-                        for (size_t i = 0; i < sectionSize; i++) {
-                            midi_track_event a = *(lastJumpStart + static_cast<tmp_diff_t>(i));
-                            midi_track_event b = *(sectionStart + static_cast<tmp_diff_t>(i));
-                            ASSERT(a == b);
-                        }
-
-                        auto sectionEnd = tmp.cbegin() + static_cast<tmp_diff_t>(r.dataEnd);
-
-                        auto section = std::vector<midi_track_event>(sectionStart, sectionEnd);
-
-                        tmp.reserve(tmp.size() + r.repeats * sectionSize);
-
-                        for (size_t i = 0; i < r.repeats; i++) {
-                            tmp.insert(tmp.end(), section.cbegin(), section.cend());
-                        }
+                        sink.repeatSection(repeatCloseMapIt->first, r.repeats);
 
                         r.repeats = 0;
                     }
@@ -891,84 +983,78 @@ TconvertToMidi(
             // Emit tempo changes
             //
             {
-                const auto &tempoMapIt = tempoMap.find(space);
-                if (tempoMapIt != tempoMap.end()) {
-
-                    //
-                    // map of tempo changes at this floored space
-                    //
-                    const auto &m = tempoMapIt->second;
+                //
+                // tempo changes at this floored space
+                //
+                for (const auto &change : tempoMapCursor.at(space)) {
 
-                    for (const auto &mIt : m) {
+                    auto actualSpace = change.actualSpace;
+                    auto tempoBPM = change.tempo;
 
-                        auto actualSpace = mIt.first;
-                        auto tempoBPM = mIt.second;
+                    auto spaceDiff = (actualSpace - space);
 
-                        auto spaceDiff = (actualSpace - space);
+                    ASSERT(spaceDiff.is_nonnegative());
 
-                        ASSERT(spaceDiff.is_nonnegative());
+                    //
+                    // convert BeatsPerMinute -> MicrosPerBeat
+                    //
+                    // TabIt uses floor(), but using round() is more accurate
+                    //
+                    // auto microsPerBeat = (MICROS_PER_MINUTE / tempoBPM).round();
+                    auto microsPerBeat = (MICROS_PER_MINUTE.to_uint32() / tempoBPM);
 
+                    {
                         //
-                        // convert BeatsPerMinute -> MicrosPerBeat
+                        // save tick
                         //
-                        // TabIt uses floor(), but using round() is more accurate
+                        auto oldTick = tick;
+
+                        auto oldRoundedTick = roundedTick;
+
                         //
-                        // auto microsPerBeat = (MICROS_PER_MINUTE / tempoBPM).round();
-                        auto microsPerBeat = (MICROS_PER_MINUTE.to_uint32() / tempoBPM);
+                        // increment by spaceDiff
+                        //
+                        tick += spaceDiff * TBT_TICKS_PER_SPACE;
 
-                        {
-                            //
-                            // save tick
-                            //
-                            auto oldTick = tick;
+                        roundedTick = tick.round();
 
-                            auto oldRoundedTick = roundedTick;
+                        diff = (roundedTick - lastEventTick);
 
-                            //
-                            // increment by spaceDiff
-                            //
-                            tick += spaceDiff * TBT_TICKS_PER_SPACE;
+                        std::vector<uint8_t> tempoChangeData;
 
-                            roundedTick = tick.round();
+                        toDigitsBEOnly3(microsPerBeat, tempoChangeData); // only last 3 bytes of microsPerBeatBytes
+
+                        sink.event(MetaEvent{
+                            diff.to_int32(), // delta time
+                            M_SETTEMPO,
+                            tempoChangeData
+                        });
+
+                        lastEventTick = roundedTick;
+                        
+                        if (opts.emit_custom_lyric_events) {
 
                             diff = (roundedTick - lastEventTick);
 
-                            std::vector<uint8_t> tempoChangeData;
+                            auto lyricStr = std::string("space ") + std::to_string(actualSpace.floor().to_uint32()) + " tempo " + std::to_string(tempoBPM);
 
-                            toDigitsBEOnly3(microsPerBeat, tempoChangeData); // only last 3 bytes of microsPerBeatBytes
+                            auto lyricData = std::vector<uint8_t>{lyricStr.cbegin(), lyricStr.cend()};
 
-                            tmp.push_back(MetaEvent{
+                            sink.event(MetaEvent{
                                 diff.to_int32(), // delta time
-                                M_SETTEMPO,
-                                tempoChangeData
+                                M_LYRIC,
+                                lyricData
                             });
 
                             lastEventTick = roundedTick;
-                            
-                            if (opts.emit_custom_lyric_events) {
-
-                                diff = (roundedTick - lastEventTick);
-
-                                auto lyricStr = std::string("space ") + std::to_string(actualSpace.floor().to_uint32()) + " tempo " + std::to_string(tempoBPM);
-
-                                auto lyricData = std::vector<uint8_t>{lyricStr.cbegin(), lyricStr.cend()};
-
-                                tmp.push_back(MetaEvent{
-                                    diff.to_int32(), // delta time
-                                    M_LYRIC,
-                                    lyricData
-                                });
-
-                                lastEventTick = roundedTick;
-                            }
+                        }
 
-                            //
-                            // restore tick
-                            //
-                            tick = oldTick;
+                        //
+                        // restore tick
+                        //
+                        tick = oldTick;
 
-                            roundedTick = oldRoundedTick;
-                        }
+                        roundedTick = oldRoundedTick;
                     }
                 }
             }
@@ -998,7 +1084,7 @@ TconvertToMidi(
 
         std::vector<uint8_t> endOfTrackData;
 
-        tmp.push_back(MetaEvent{
+        sink.event(MetaEvent{
             diff.to_int32(), // delta time
             M_ENDOFTRACK,
             endOfTrackData
@@ -1006,7 +1092,7 @@ TconvertToMidi(
 
         lastEventTick = roundedTick;
 
-        out.tracks.push_back(tmp);
+        sink.finishTrack();
 
         tickCount = tick.to_uint32();
 
@@ -1017,7 +1103,13 @@ TconvertToMidi(
     //
     for (uint8_t track = 0; track < t.header.trackCount; track++) {
 
-        const uint8_t channel = channelMap[track];
+        if (!trackSelected(opts.selected_tracks, track)) {
+            continue;
+        }
+
+        trace_span span("track events", "track", track);
+
+        const uint8_t channel = channelMap.at(track);
 
         const auto &midiNoteOffsetArray = midiNoteOffsetArrays[track];
 
@@ -1091,7 +1183,9 @@ TconvertToMidi(
 
         rational lastEventTick = 0;
 
-        std::array<uint8_t, STRINGS_PER_TRACK> currentlyPlayingStrings{};
+        string_lanes currentlyPlayingStrings = 0;
+
+        const auto stringLanes = stringLanesOf(trackMetadata.stringCount);
 
 
         //
@@ -1099,7 +1193,7 @@ TconvertToMidi(
         //
 
 
-        tmp.clear();
+        sink.startTrack();
 
         auto diff = (roundedTick - lastEventTick);
 
@@ -1107,7 +1201,7 @@ TconvertToMidi(
 
         std::vector<uint8_t> data{str.cbegin(), str.cend()};
 
-        tmp.push_back(MetaEvent{
+        sink.event(MetaEvent{
             diff.to_int32(), // delta time
             M_TRACKNAME,
             data
@@ -1127,7 +1221,7 @@ TconvertToMidi(
 
                 diff = (roundedTick - lastEventTick);
 
-                tmp.push_back(ControlChangeEvent{
+                sink.event(ControlChangeEvent{
                     diff.to_int32(), // delta time
                     channel,
                     C_BANKSELECT_MSB,
@@ -1142,7 +1236,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ProgramChangeEvent{
+            sink.event(ProgramChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 midiProgram
@@ -1155,7 +1249,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_VOLUME,
@@ -1166,7 +1260,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_PAN,
@@ -1177,7 +1271,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_REVERB,
@@ -1188,7 +1282,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_CHORUS,
@@ -1199,7 +1293,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_MODULATION,
@@ -1215,7 +1309,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_RPNPARAM_MSB,
@@ -1226,7 +1320,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_RPNPARAM_LSB,
@@ -1237,7 +1331,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_DATAENTRY_MSB,
@@ -1248,7 +1342,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(ControlChangeEvent{
+            sink.event(ControlChangeEvent{
                 diff.to_int32(), // delta time
                 channel,
                 C_DATAENTRY_LSB,
@@ -1262,7 +1356,7 @@ TconvertToMidi(
 
             diff = (roundedTick - lastEventTick);
 
-            tmp.push_back(PitchBendEvent{
+            sink.event(PitchBendEvent{
                 diff.to_int32(), // delta time
                 channel,
                 pitchBend
@@ -1290,12 +1384,17 @@ TconvertToMidi(
         //
         std::map<uint16_t, repeat_open_struct> repeatOpenMap;
 
-        auto &openSpaceSet = openSpaceSets[track + 1];
+        //
+        // copied, because they are consumed while rendering
+        //
+        auto openSpaceSet = ctx.openSpaceSets[track + 1];
 
-        auto &repeatCloseMap = repeatCloseMaps[track + 1];
+        auto repeatCloseMap = ctx.repeatCloseMaps[track + 1];
 
         const auto &maps = t.body.mapsList[track];
 
+        space_cursor trackEffectChangesCursor(trackEffectChangesOf<VERSION>(maps));
+
         for (uint16_t space = 0; space < trackSpaceCount + 1;) { // space count, + 1 for handling repeats at end
 
             //
@@ -1329,7 +1428,11 @@ TconvertToMidi(
 
                             if (spaceDiff.is_positive()) {
 
-                                LOGW("repeat CLOSE at non-integral space: %f", actualSpace.to_double());
+                                if (opts.diagnostics) {
+                                    addDiagnostic(*opts.diagnostics, DIAG_REPEAT_CLOSE_AT_NON_INTEGRAL_SPACE, actualSpace.to_double(), track);
+                                } else {
+                                    LOGW("repeat CLOSE at non-integral space: %f", actualSpace.to_double());
+                                }
 
                                 //
                                 // overshot the repeat close
@@ -1359,7 +1462,11 @@ TconvertToMidi(
 
                             if (spaceDiff.is_positive()) {
 
-                                LOGW("repeat OPEN at non-integral space: %f", actualSpace.to_double());
+                                if (opts.diagnostics) {
+                                    addDiagnostic(*opts.diagnostics, DIAG_REPEAT_OPEN_AT_NON_INTEGRAL_SPACE, actualSpace.to_double(), track);
+                                } else {
+                                    LOGW("repeat OPEN at non-integral space: %f", actualSpace.to_double());
+                                }
 
                                 //
                                 // undershot the repeat open
@@ -1376,13 +1483,13 @@ TconvertToMidi(
 
                             } else if (r.jump == 1) {
 
-                                r.dataStart = tmp.size();
+                                sink.markSectionStart(repeatCloseMapIt->first);
 
                             } else {
 
                                 ASSERT(r.jump == 2);
 
-                                r.dataEnd = tmp.size();
+                                sink.markSectionEnd(repeatCloseMapIt->first);
                             }
 
                             r.repeats--;
@@ -1393,37 +1500,11 @@ TconvertToMidi(
                         }
 
                         //
-                        // make copies of the events instead of jumping to the repeat open
+                        // have now reached a fix-point, so the rest of the repeats are exactly the same
                         //
-                        // have now reached a fix-point, so this is correct
+                        // either copy the events, or reference them
                         //
-
-                        using tmp_diff_t = std::iterator_traits<std::vector<midi_track_event>::iterator>::difference_type;
-
-                        auto sectionSize = r.dataEnd - r.dataStart;
-                        auto sectionStart = tmp.cbegin() + static_cast<tmp_diff_t>(r.dataStart);
-
-                        //
-                        // verify all events are correct
-                        //
-
-                        auto lastJumpStart = tmp.cend() - static_cast<tmp_diff_t>(sectionSize);
-                        
-                        for (size_t i = 0; i < sectionSize; i++) {
-                            midi_track_event a = *(lastJumpStart + static_cast<tmp_diff_t>(i));
-                            midi_track_event b = *(sectionStart + static_cast<tmp_diff_t>(i));
-                            ASSERT(a == b);
-                        }
-
-                        auto sectionEnd = tmp.cbegin() + static_cast<tmp_diff_t>(r.dataEnd);
-
-                        auto section = std::vector<midi_track_event>(sectionStart, sectionEnd);
-
-                        tmp.reserve(tmp.size() + r.repeats * sectionSize);
-
-                        for (size_t i = 0; i < r.repeats; i++) {
-                            tmp.insert(tmp.end(), section.cbegin(), section.cend());
-                        }
+                        sink.repeatSection(repeatCloseMapIt->first, r.repeats);
 
                         r.repeats = 0;
                     }
@@ -1449,38 +1530,19 @@ TconvertToMidi(
             //
             // Emit Note Offs for any previous Muteds
             //
-            for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+            auto mutedLanes = equalLanes(currentlyPlayingStrings, MUTED) & stringLanes;
 
-                uint8_t current = currentlyPlayingStrings[string];
+            currentlyPlayingStrings &= ~laneMask(mutedLanes);
 
-                if (current != MUTED) {
-                    continue;
-                }
+            for (auto mutedBits = laneBits(mutedLanes); mutedBits != 0;) {
 
-                currentlyPlayingStrings[string] = 0;
+                auto string = popString(mutedBits);
 
                 auto off = 0x80; // open string
 
                 auto midiNote = static_cast<uint8_t>(off + midiNoteOffsetArray[string]);
 
-                //
-                // assume tempo of 120 bpm
-                //
-                // keeping track of correct tempo is too costly
-                //
-                static const auto microsPerBeat = (MICROS_PER_MINUTE.to_uint32() / 120);
-
-                //
-                // convert MicrosPerBeat -> MicrosPerTick
-                //
-                static const auto microsPerTick = rational(microsPerBeat) / TBT_TICKS_PER_BEAT;
-
-                //
-                // a muted note lasts for 1/64 second, or until the next event
-                //
-                static const auto mutedTickDiff = (MICROS_PER_64TH / microsPerTick).round();
-
-                auto mutedTick = previousRoundedTick + mutedTickDiff;
+                auto mutedTick = previousRoundedTick + MUTED_TICK_DIFF;
 
                 if (roundedTick < mutedTick) {
                     mutedTick = roundedTick;
@@ -1488,7 +1550,7 @@ TconvertToMidi(
 
                 diff = (mutedTick - lastEventTick);
 
-                tmp.push_back(NoteOffEvent{
+                sink.event(NoteOffEvent{
                     diff.to_int32(), // delta time
                     channel,
                     midiNote,
@@ -1506,15 +1568,26 @@ TconvertToMidi(
             //
             if (notesMapIt != maps.notesMap.end()) {
 
-                bool anyStringsTurningOff = false;
-
                 const auto &onVsqs = notesMapIt->second;
 
-                std::array<uint8_t, STRINGS_PER_TRACK> offVsqs{};
+                auto onLanes = loadLanes<STRINGS_PER_TRACK>(onVsqs.data());
+
+                //
+                // There may be string effects, but no note events
+                // This will still be in the notesMap, but should not affect notes
+                // i.e., simply checking for something in notesMap is not sufficient
+                //
+                auto eventLanes = nonzeroLanes(onLanes) & stringLanes;
+
+                auto playingLanes = (highLanes(onLanes) | equalLanes(onLanes, MUTED)) & stringLanes;
 
                 //
-                // Compute note offs and note ons
+                // every other event is STOPPED
                 //
+                ASSERT((eventLanes & ~playingLanes) == (equalLanes(onLanes, STOPPED) & stringLanes));
+
+                string_lanes offVsqs = 0;
+
                 if (dontLetRing) {
 
                     //
@@ -1522,50 +1595,11 @@ TconvertToMidi(
                     //
                     // An event on any string stops all strings
                     //
+                    if (eventLanes != 0) {
 
-                    //
-                    // There may be string effects, but no note events
-                    // This will still be in the notesMap, but should not affect notes because of dontLetRing
-                    // i.e., simply checking for something in notesMap is not sufficient
-                    //
-                    // so check all the strings for note events
-                    //
-                    bool anyEvents = false;
-                    for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
-
-                        auto event = onVsqs[string];
-
-                        if (event != 0) {
-                            anyEvents = true;
-                            break;
-                        }
-                    }
-                    
-                    if (anyEvents) {
-                        
                         offVsqs = currentlyPlayingStrings;
 
-                        anyStringsTurningOff = true;
-
-                        for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
-
-                            auto on = onVsqs[string];
-
-                            if (on == 0) {
-
-                                currentlyPlayingStrings[string] = 0;
-
-                            } else if (0x80 <= on || on == MUTED) {
-
-                                currentlyPlayingStrings[string] = on;
-
-                            } else {
-
-                                ASSERT(on == STOPPED);
-
-                                currentlyPlayingStrings[string] = 0;
-                            }
-                        }
+                        currentlyPlayingStrings = (onLanes & laneMask(playingLanes));
                     }
 
                 } else {
@@ -1575,84 +1609,36 @@ TconvertToMidi(
                     //
                     // All strings are independent
                     //
+                    // a string with an event stops what it is playing, and then plays the event (or nothing, if STOPPED)
+                    //
+                    offVsqs = (currentlyPlayingStrings & laneMask(eventLanes));
 
-                    for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
-
-                        auto on = onVsqs[string];
-
-                        if (on == 0) {
-
-                            //
-                            // nothing to do
-                            //
-                            continue;
-                        }
-
-                        auto current = currentlyPlayingStrings[string];
-
-                        if (current == 0) {
-
-                            if (0x80 <= on || on == MUTED) {
-
-                                currentlyPlayingStrings[string] = on;
-
-                            } else {
-
-                                ASSERT(on == STOPPED);
-
-                                //
-                                // current is already 0
-                                //
-                            }
-
-                        } else {
-
-                            offVsqs[string] = current;
-
-                            anyStringsTurningOff = true;
-
-                            if (0x80 <= on || on == MUTED) {
-
-                                currentlyPlayingStrings[string] = on;
-
-                            } else {
-
-                                ASSERT(on == STOPPED);
-
-                                currentlyPlayingStrings[string] = 0;
-                            }
-                        }
-                    }
+                    currentlyPlayingStrings = (currentlyPlayingStrings & ~laneMask(eventLanes)) | (onLanes & laneMask(playingLanes));
                 }
 
                 //
                 // Emit note offs
                 //
-                if (anyStringsTurningOff) {
-
-                    for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+                for (auto offBits = laneBits(nonzeroLanes(offVsqs)); offBits != 0;) {
 
-                        auto off = offVsqs[string];
+                    auto string = popString(offBits);
 
-                        if (off == 0) {
-                            continue;
-                        }
+                    auto off = laneAt(offVsqs, string);
 
-                        ASSERT(off >= 0x80);
+                    ASSERT(off >= 0x80);
 
-                        auto midiNote = static_cast<uint8_t>(off + midiNoteOffsetArray[string]);
+                    auto midiNote = static_cast<uint8_t>(off + midiNoteOffsetArray[string]);
 
-                        diff = (roundedTick - lastEventTick);
+                    diff = (roundedTick - lastEventTick);
 
-                        tmp.push_back(NoteOffEvent{
-                            diff.to_int32(), // delta time
-                            channel,
-                            midiNote,
-                            0 // velocity
-                        });
+                    sink.event(NoteOffEvent{
+                        diff.to_int32(), // delta time
+                        channel,
+                        midiNote,
+                        0 // velocity
+                    });
 
-                        lastEventTick = roundedTick;
-                    }
+                    lastEventTick = roundedTick;
                 }
             }
 
@@ -1661,203 +1647,197 @@ TconvertToMidi(
             //
             if constexpr (VERSION == 0x72) {
 
-                const auto &trackEffectChangesIt = maps.trackEffectChangesMap.find(space);
-                if (trackEffectChangesIt != maps.trackEffectChangesMap.end()) {
-
-                    const auto &changes = trackEffectChangesIt->second;
+                for (const auto &change : trackEffectChangesCursor.at(space)) {
 
-                    for (const auto &p : changes) {
+                    auto effect = change.effect;
+                    auto value = change.value;
 
-                        auto effect = p.first;
-                        auto value = p.second;
+                    switch(effect) {
+                    case TE_INSTRUMENT: {
 
-                        switch(effect) {
-                        case TE_INSTRUMENT: {
+                        if (opts.emit_control_change_events) {
 
-                            if (opts.emit_control_change_events) {
+                            auto newInstrument = value;
 
-                                auto newInstrument = value;
+                            bool midiBankFlag;
 
-                                bool midiBankFlag;
+                            midiBankFlag = ((newInstrument & 0b1000000000000000) == 0b1000000000000000);
+                            midiBank     = ((newInstrument & 0b0111111100000000) >> 8);
+                            dontLetRing  = ((newInstrument & 0b0000000010000000) == 0b0000000010000000);
+                            midiProgram  =  (newInstrument & 0b0000000001111111);
+                            
+                            if (midiBankFlag) {
 
-                                midiBankFlag = ((newInstrument & 0b1000000000000000) == 0b1000000000000000);
-                                midiBank     = ((newInstrument & 0b0111111100000000) >> 8);
-                                dontLetRing  = ((newInstrument & 0b0000000010000000) == 0b0000000010000000);
-                                midiProgram  =  (newInstrument & 0b0000000001111111);
+                                //
+                                // Bank Select MSB and Bank Select LSB are special and do not really mean MSB/LSB
+                                // TabIt only sends MSB
+                                //
+                                uint8_t midiBankMSB = midiBank;
                                 
-                                if (midiBankFlag) {
-
-                                    //
-                                    // Bank Select MSB and Bank Select LSB are special and do not really mean MSB/LSB
-                                    // TabIt only sends MSB
-                                    //
-                                    uint8_t midiBankMSB = midiBank;
-                                    
-                                    diff = (roundedTick - lastEventTick);
-
-                                    tmp.push_back(ControlChangeEvent{
-                                        diff.to_int32(), // delta time
-                                        channel,
-                                        C_BANKSELECT_MSB,
-                                        midiBankMSB
-                                    });
-
-                                    lastEventTick = roundedTick;
-                                }
-                            }
-
-                            if (opts.emit_program_change_events) {
-
                                 diff = (roundedTick - lastEventTick);
 
-                                tmp.push_back(ProgramChangeEvent{
+                                sink.event(ControlChangeEvent{
                                     diff.to_int32(), // delta time
                                     channel,
-                                    midiProgram
+                                    C_BANKSELECT_MSB,
+                                    midiBankMSB
                                 });
 
                                 lastEventTick = roundedTick;
                             }
+                        }
+
+                        if (opts.emit_program_change_events) {
+
+                            diff = (roundedTick - lastEventTick);
+
+                            sink.event(ProgramChangeEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                midiProgram
+                            });
 
-                            break;
+                            lastEventTick = roundedTick;
                         }
-                        case TE_VOLUME: {
 
-                            if (opts.emit_control_change_events) {
+                        break;
+                    }
+                    case TE_VOLUME: {
 
-                                auto newVolume = static_cast<uint8_t>(value);
+                        if (opts.emit_control_change_events) {
 
-                                diff = (roundedTick - lastEventTick);
+                            auto newVolume = static_cast<uint8_t>(value);
 
-                                tmp.push_back(ControlChangeEvent{
-                                    diff.to_int32(), // delta time
-                                    channel,
-                                    C_VOLUME,
-                                    newVolume
-                                });
+                            diff = (roundedTick - lastEventTick);
 
-                                lastEventTick = roundedTick;
-                            }
+                            sink.event(ControlChangeEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                C_VOLUME,
+                                newVolume
+                            });
 
-                            break;
+                            lastEventTick = roundedTick;
                         }
-                        // NOLINTNEXTLINE(bugprone-branch-clone)
-                        case TE_TEMPO:
-                            //
-                            // already handled
-                            //
-                            break;
-                        case TE_STROKE_DOWN:
-                        case TE_STROKE_UP:
-                            //
-                            // nothing to do
-                            //
-                            break;
-                        case TE_PAN: {
 
-                            if (opts.emit_control_change_events) {
+                        break;
+                    }
+                    // NOLINTNEXTLINE(bugprone-branch-clone)
+                    case TE_TEMPO:
+                        //
+                        // already handled
+                        //
+                        break;
+                    case TE_STROKE_DOWN:
+                    case TE_STROKE_UP:
+                        //
+                        // nothing to do
+                        //
+                        break;
+                    case TE_PAN: {
 
-                                auto newPan = static_cast<uint8_t>(value);
+                        if (opts.emit_control_change_events) {
 
-                                diff = (roundedTick - lastEventTick);
+                            auto newPan = static_cast<uint8_t>(value);
 
-                                tmp.push_back(ControlChangeEvent{
-                                    diff.to_int32(), // delta time
-                                    channel,
-                                    C_PAN,
-                                    newPan
-                                });
+                            diff = (roundedTick - lastEventTick);
 
-                                lastEventTick = roundedTick;
-                            }
+                            sink.event(ControlChangeEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                C_PAN,
+                                newPan
+                            });
 
-                            break;
+                            lastEventTick = roundedTick;
                         }
-                        case TE_CHORUS: {
 
-                            if (opts.emit_control_change_events) {
+                        break;
+                    }
+                    case TE_CHORUS: {
 
-                                auto newChorus = static_cast<uint8_t>(value);
+                        if (opts.emit_control_change_events) {
 
-                                diff = (roundedTick - lastEventTick);
+                            auto newChorus = static_cast<uint8_t>(value);
 
-                                tmp.push_back(ControlChangeEvent{
-                                    diff.to_int32(), // delta time
-                                    channel,
-                                    C_CHORUS,
-                                    newChorus
-                                });
+                            diff = (roundedTick - lastEventTick);
 
-                                lastEventTick = roundedTick;
-                            }
+                            sink.event(ControlChangeEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                C_CHORUS,
+                                newChorus
+                            });
 
-                            break;
+                            lastEventTick = roundedTick;
                         }
-                        case TE_REVERB: {
 
-                            if (opts.emit_control_change_events) {
+                        break;
+                    }
+                    case TE_REVERB: {
 
-                                auto newReverb = static_cast<uint8_t>(value);
+                        if (opts.emit_control_change_events) {
 
-                                diff = (roundedTick - lastEventTick);
+                            auto newReverb = static_cast<uint8_t>(value);
 
-                                tmp.push_back(ControlChangeEvent{
-                                    diff.to_int32(), // delta time
-                                    channel,
-                                    C_REVERB,
-                                    newReverb
-                                });
+                            diff = (roundedTick - lastEventTick);
 
-                                lastEventTick = roundedTick;
-                            }
+                            sink.event(ControlChangeEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                C_REVERB,
+                                newReverb
+                            });
 
-                            break;
+                            lastEventTick = roundedTick;
                         }
-                        case TE_MODULATION: {
 
-                            if (opts.emit_control_change_events) {
+                        break;
+                    }
+                    case TE_MODULATION: {
 
-                                auto newModulation = static_cast<uint8_t>(value);
+                        if (opts.emit_control_change_events) {
 
-                                diff = (roundedTick - lastEventTick);
+                            auto newModulation = static_cast<uint8_t>(value);
 
-                                tmp.push_back(ControlChangeEvent{
-                                    diff.to_int32(), // delta time
-                                    channel,
-                                    C_MODULATION,
-                                    newModulation
-                                });
+                            diff = (roundedTick - lastEventTick);
 
-                                lastEventTick = roundedTick;
-                            }
+                            sink.event(ControlChangeEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                C_MODULATION,
+                                newModulation
+                            });
 
-                            break;
+                            lastEventTick = roundedTick;
                         }
-                        case TE_PITCH_BEND: {
 
-                            if (opts.emit_pitch_bend_events) {
+                        break;
+                    }
+                    case TE_PITCH_BEND: {
 
-                                //
-                                // convert from (-2400, 2400) to (0b0000000000000000 to 0b0011111111111111) i.e. (0 to 16383)
-                                //
-                                auto newPitchBend = (((rational(static_cast<int16_t>(value)) + 2400) * 0b0011111111111111) / (2 * 2400)).round().to_int16();
+                        if (opts.emit_pitch_bend_events) {
 
-                                diff = (roundedTick - lastEventTick);
+                            //
+                            // convert from (-2400, 2400) to (0b0000000000000000 to 0b0011111111111111) i.e. (0 to 16383)
+                            //
+                            auto newPitchBend = (((rational(static_cast<int16_t>(value)) + 2400) * 0b0011111111111111) / (2 * 2400)).round().to_int16();
 
-                                tmp.push_back(PitchBendEvent{
-                                    diff.to_int32(), // delta time
-                                    channel,
-                                    newPitchBend
-                                });
+                            diff = (roundedTick - lastEventTick);
 
-                                lastEventTick = roundedTick;
-                            }
+                            sink.event(PitchBendEvent{
+                                diff.to_int32(), // delta time
+                                channel,
+                                newPitchBend
+                            });
 
-                            break;
-                        }
-                        default:
-                            ABORT("invalid effect: %d", effect);
+                            lastEventTick = roundedTick;
                         }
+
+                        break;
+                    }
+                    default:
+                        ABORT("invalid effect: %d", effect);
                     }
                 }
 
@@ -1886,7 +1866,7 @@ TconvertToMidi(
 
                             diff = (roundedTick - lastEventTick);
 
-                            tmp.push_back(ProgramChangeEvent{
+                            sink.event(ProgramChangeEvent{
                                 diff.to_int32(), // delta time
                                 channel,
                                 midiProgram
@@ -1905,7 +1885,7 @@ TconvertToMidi(
 
                             diff = (roundedTick - lastEventTick);
 
-                            tmp.push_back(ControlChangeEvent{
+                            sink.event(ControlChangeEvent{
                                 diff.to_int32(), // delta time
                                 channel,
                                 C_VOLUME,
@@ -1938,7 +1918,7 @@ TconvertToMidi(
 
                             diff = (roundedTick - lastEventTick);
 
-                            tmp.push_back(ControlChangeEvent{
+                            sink.event(ControlChangeEvent{
                                 diff.to_int32(), // delta time
                                 channel,
                                 C_CHORUS,
@@ -1958,7 +1938,7 @@ TconvertToMidi(
 
                             diff = (roundedTick - lastEventTick);
 
-                            tmp.push_back(ControlChangeEvent{
+                            sink.event(ControlChangeEvent{
                                 diff.to_int32(), // delta time
                                 channel,
                                 C_PAN,
@@ -1978,7 +1958,7 @@ TconvertToMidi(
 
                             diff = (roundedTick - lastEventTick);
 
-                            tmp.push_back(ControlChangeEvent{
+                            sink.event(ControlChangeEvent{
                                 diff.to_int32(), // delta time
                                 channel,
                                 C_REVERB,
@@ -2002,15 +1982,16 @@ TconvertToMidi(
             if (notesMapIt != maps.notesMap.end()) {
 
                 const auto &onVsqs = notesMapIt->second;
-                
-                for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
 
-                    auto on = onVsqs[string];
+                auto onLanes = loadLanes<STRINGS_PER_TRACK>(onVsqs.data());
 
-                    if (on == 0 ||
-                        on == STOPPED) {
-                        continue;
-                    }
+                auto playingLanes = (highLanes(onLanes) | equalLanes(onLanes, MUTED)) & stringLanes;
+
+                for (auto onBits = laneBits(playingLanes); onBits != 0;) {
+
+                    auto string = popString(onBits);
+
+                    auto on = laneAt(onLanes, string);
 
                     if (on == MUTED) {
                         on = 0x80; // open string
@@ -2030,7 +2011,7 @@ TconvertToMidi(
                     // Complaint about this on Reddit:
                     // https://old.reddit.com/r/tabit/comments/z6e9yo/community_version_of_tabit/j07cfhw/
                     //
-                    tmp.push_back(NoteOnEvent{
+                    sink.event(NoteOnEvent{
                         diff.to_int32(), // delta time
                         channel,
                         midiNote,
@@ -2113,8 +2094,10 @@ TconvertToMidi(
         
         --actualSpace;
 
-        ASSERT(tick == tickCount);
-        ASSERT(roundedTick == tickCount);
+        if (emitTempoTrack) {
+            ASSERT(tick == tickCount);
+            ASSERT(roundedTick == tickCount);
+        }
         ASSERT(actualSpace == barLinesSpaceCount);
         for (const auto &repeatCloseMapIt : repeatCloseMap) {
             const auto &r = repeatCloseMapIt.second;
@@ -2128,13 +2111,11 @@ TconvertToMidi(
         {
             auto offVsqs = currentlyPlayingStrings;
 
-            for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+            for (auto offBits = laneBits(nonzeroLanes(offVsqs) & stringLanes); offBits != 0;) {
 
-                auto off = offVsqs[string];
+                auto string = popString(offBits);
 
-                if (off == 0) {
-                    continue;
-                }
+                auto off = laneAt(offVsqs, string);
 
                 ASSERT(off >= 0x80);
 
@@ -2142,7 +2123,7 @@ TconvertToMidi(
 
                 diff = (roundedTick - lastEventTick);
 
-                tmp.push_back(NoteOffEvent{
+                sink.event(NoteOffEvent{
                     diff.to_int32(), // delta time
                     channel,
                     midiNote,
@@ -2157,7 +2138,7 @@ TconvertToMidi(
 
         std::vector<uint8_t> endOfTrackData;
 
-        tmp.push_back(MetaEvent{
+        sink.event(MetaEvent{
             diff.to_int32(), // delta time
             M_ENDOFTRACK,
             endOfTrackData
@@ -2165,7 +2146,7 @@ TconvertToMidi(
 
         lastEventTick = roundedTick;
 
-        out.tracks.push_back(tmp);
+        sink.finishTrack();
 
     } // for track
     
@@ -2173,98 +2154,104 @@ TconvertToMidi(
 }
 
 
+template <typename sink_t>
 Status
-convertToMidi(
-    const tbt_file &t,
+convertToMidiSink(
+    const tbt_song_context &songContext,
     const midi_convert_opts &opts,
-    midi_file &out) {
+    bool emitTempoTrack,
+    sink_t &sink) {
+
+    const auto &ctx = songContext.internals();
 
-    auto versionNumber = tbtFileVersionNumber(t);
+    const auto &t = *ctx.file;
+
+    auto versionNumber = ctx.versionNumber;
 
     switch (versionNumber) {
     case 0x72: {
 
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
         
         if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            return TconvertToMidi<0x72, true, 8>(t71, opts, out);
+            return TconvertToMidi<0x72, true, 8>(t71, ctx, opts, emitTempoTrack, sink);
         } else {
-            return TconvertToMidi<0x72, false, 8>(t71, opts, out);
+            return TconvertToMidi<0x72, false, 8>(t71, ctx, opts, emitTempoTrack, sink);
         }
     }
     case 0x71: {
         
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
         
         if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            return TconvertToMidi<0x71, true, 8>(t71, opts, out);
+            return TconvertToMidi<0x71, true, 8>(t71, ctx, opts, emitTempoTrack, sink);
         } else {
-            return TconvertToMidi<0x71, false, 8>(t71, opts, out);
+            return TconvertToMidi<0x71, false, 8>(t71, ctx, opts, emitTempoTrack, sink);
         }
     }
     case 0x70: {
         
-        auto t70 = std::get<tbt_file70>(t);
+        const auto &t70 = std::get<tbt_file70>(t);
         
         if ((t70.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            return TconvertToMidi<0x70, true, 8>(t70, opts, out);
+            return TconvertToMidi<0x70, true, 8>(t70, ctx, opts, emitTempoTrack, sink);
         } else {
-            return TconvertToMidi<0x70, false, 8>(t70, opts, out);
+            return TconvertToMidi<0x70, false, 8>(t70, ctx, opts, emitTempoTrack, sink);
         }
     }
     case 0x6f: {
         
-        auto t6f = std::get<tbt_file6f>(t);
+        const auto &t6f = std::get<tbt_file6f>(t);
         
-        return TconvertToMidi<0x6f, false, 8>(t6f, opts, out);
+        return TconvertToMidi<0x6f, false, 8>(t6f, ctx, opts, emitTempoTrack, sink);
     }
     case 0x6e: {
         
-        auto t6e = std::get<tbt_file6e>(t);
+        const auto &t6e = std::get<tbt_file6e>(t);
         
-        return TconvertToMidi<0x6e, false, 8>(t6e, opts, out);
+        return TconvertToMidi<0x6e, false, 8>(t6e, ctx, opts, emitTempoTrack, sink);
     }
     case 0x6b: {
         
-        auto t6b = std::get<tbt_file6b>(t);
+        const auto &t6b = std::get<tbt_file6b>(t);
         
-        return TconvertToMidi<0x6b, false, 8>(t6b, opts, out);
+        return TconvertToMidi<0x6b, false, 8>(t6b, ctx, opts, emitTempoTrack, sink);
     }
     case 0x6a: {
         
-        auto t6a = std::get<tbt_file6a>(t);
+        const auto &t6a = std::get<tbt_file6a>(t);
         
-        return TconvertToMidi<0x6a, false, 6>(t6a, opts, out);
+        return TconvertToMidi<0x6a, false, 6>(t6a, ctx, opts, emitTempoTrack, sink);
     }
     case 0x69: {
         
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
         
-        return TconvertToMidi<0x69, false, 6>(t68, opts, out);
+        return TconvertToMidi<0x69, false, 6>(t68, ctx, opts, emitTempoTrack, sink);
     }
     case 0x68: {
         
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
         
-        return TconvertToMidi<0x68, false, 6>(t68, opts, out);
+        return TconvertToMidi<0x68, false, 6>(t68, ctx, opts, emitTempoTrack, sink);
     }
     case 0x67: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
-        return TconvertToMidi<0x67, false, 6>(t65, opts, out);
+        return TconvertToMidi<0x67, false, 6>(t65, ctx, opts, emitTempoTrack, sink);
     }
     case 0x66: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
-        return TconvertToMidi<0x66, false, 6>(t65, opts, out);
+        return TconvertToMidi<0x66, false, 6>(t65, ctx, opts, emitTempoTrack, sink);
     }
     case 0x65: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
-        return TconvertToMidi<0x65, false, 6>(t65, opts, out);
+        return TconvertToMidi<0x65, false, 6>(t65, ctx, opts, emitTempoTrack, sink);
     }
     default:
         ABORT("invalid versionNumber: 0x%02x", versionNumber);
@@ -2272,148 +2259,108 @@ convertToMidi(
 }
 
 
-struct EventExportVisitor {
-    
-    std::vector<uint8_t> &tmp;
+Status
+convertToMidiProgramOrFile(
+    const tbt_song_context &songContext,
+    const midi_convert_opts &opts,
+    bool keepRepeats,
+    bool emitTempoTrack,
+    midi_program &out) {
 
-    void operator()(const ProgramChangeEvent &e) {
+    midi_program_sink sink{ out, keepRepeats, {} };
 
-        toVLQ(e.deltaTime, tmp); // delta time
+    return convertToMidiSink(songContext, opts, emitTempoTrack, sink);
+}
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0xc0 | e.channel), // program change
-            e.midiProgram
-        });
-    }
 
-    void operator()(const PitchBendEvent &e) {
+void
+moveMidiProgramToFile(
+    midi_program &p,
+    midi_file &out) {
 
-        uint8_t pitchBendLSB = (e.pitchBend & 0b01111111);
-        uint8_t pitchBendMSB = ((e.pitchBend >> 7) & 0b01111111);
+    out.header = p.header;
 
-        toVLQ(e.deltaTime, tmp); // delta time
+    out.tracks.clear();
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0xe0 | e.channel), // pitch bend
-            pitchBendLSB,
-            pitchBendMSB
-        });
-    }
+    out.tracks.reserve(p.tracks.size());
 
-    void operator()(const NoteOffEvent &e) {
+    for (auto &track : p.tracks) {
 
-        toVLQ(e.deltaTime, tmp); // delta time
+        ASSERT(track.repeats.empty());
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0x80 | e.channel), // note off
-            e.midiNote,
-            e.velocity
-        });
+        out.tracks.push_back(std::move(track.events));
     }
+}
 
-    void operator()(const NoteOnEvent &e) {
 
-        toVLQ(e.deltaTime, tmp); // delta time
+Status
+convertToMidi(
+    const tbt_song_context &ctx,
+    const midi_convert_opts &opts,
+    midi_file &out) {
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0x90 | e.channel), // note on
-            e.midiNote,
-            e.velocity
-        });
-    }
+    trace_span span("convert");
 
-    void operator()(const ControlChangeEvent &e) {
+    midi_program p;
 
-        toVLQ(e.deltaTime, tmp); // delta time
+    Status ret = convertToMidiProgramOrFile(ctx, opts, false, true, p);
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0xb0 | e.channel),
-            e.controller,
-            e.value
-        });
+    if (ret != OK) {
+        return ret;
     }
 
-    void operator()(const MetaEvent &e) {
-
-        toVLQ(e.deltaTime, tmp); // delta time
-
-        tmp.insert(tmp.end(), {
-            0xff, // Meta
-            e.type
-        });
-
-        toVLQ(static_cast<int32_t>(e.data.size()), tmp); // len
+    moveMidiProgramToFile(p, out);
 
-        tmp.insert(tmp.end(), e.data.cbegin(), e.data.cend());
+    if (opts.eliminate_redundant_events) {
+        eliminateRedundantMidiEvents(out);
     }
 
-    void operator()(const PolyphonicKeyPressureEvent &e) {
-
-        toVLQ(e.deltaTime, tmp); // delta time
+    return OK;
+}
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0xa0 | e.channel),
-            e.midiNote,
-            e.pressure
-        });
-    }
 
-    void operator()(const ChannelPressureEvent &e) {
+Status
+convertToMidiProgram(
+    const tbt_song_context &ctx,
+    const midi_convert_opts &opts,
+    midi_program &out) {
 
-        toVLQ(e.deltaTime, tmp); // delta time
+    trace_span span("convert");
 
-        tmp.insert(tmp.end(), {
-            static_cast<uint8_t>(0xd0 | e.channel),
-            e.pressure
-        });
-    }
+    CHECK(!opts.eliminate_redundant_events, "eliminate_redundant_events is not supported when converting to a program");
 
-    void operator()(const SysExEvent &e) {
-        (void)e;
-    }
-};
+    return convertToMidiProgramOrFile(ctx, opts, true, true, out);
+}
 
 
 Status
-exportMidiBytes(
-    const midi_file &m,
-    std::vector<uint8_t> &out) {
-
-    out.clear();
-
-    //
-    // header
-    //
-    {
-        out.insert(out.end(), S_MTHD.cbegin(), S_MTHD.cend()); // type
+convertToMidi(
+    const tbt_file &t,
+    const midi_convert_opts &opts,
+    midi_file &out) {
 
-        toDigitsBE(static_cast<uint32_t>(2 + 2 + 2), out); // length
+    trace_span span("convert");
 
-        toDigitsBE(m.header.format, out); // format
+    tbt_song_context ctx;
 
-        toDigitsBE(m.header.trackCount, out); // track count
+    Status ret = analyzeTbtFile(t, tbt_analyze_opts{ opts.diagnostics }, ctx);
 
-        toDigitsBE(m.header.division, out); // division
+    if (ret != OK) {
+        return ret;
     }
 
-    //
-    // tracks
-    //
-    for (const auto &track : m.tracks) {
-
-        std::vector<uint8_t> tmp;
-
-        EventExportVisitor eventExportVisitor{ tmp };
+    midi_program p;
 
-        for (const auto &event : track) {
-            std::visit(eventExportVisitor, event);
-        }
+    ret = convertToMidiProgramOrFile(ctx, opts, false, true, p);
 
-        out.insert(out.end(), S_MTRK.cbegin(), S_MTRK.cend()); // type
+    if (ret != OK) {
+        return ret;
+    }
 
-        toDigitsBE(static_cast<uint32_t>(tmp.size()), out); // length
+    moveMidiProgramToFile(p, out);
 
-        out.insert(out.end(), tmp.cbegin(), tmp.cend()); // data
+    if (opts.eliminate_redundant_events) {
+        eliminateRedundantMidiEvents(out);
     }
 
     return OK;
@@ -2421,932 +2368,1737 @@ exportMidiBytes(
 
 
 Status
-exportMidiFile(
-    const midi_file &m,
-    const char *path) {
-
-    std::vector<uint8_t> data;
+convertToMidiProgram(
+    const tbt_file &t,
+    const midi_convert_opts &opts,
+    midi_program &out) {
 
-    Status ret;
+    trace_span span("convert");
 
-    ret = exportMidiBytes(m, data);
+    CHECK(!opts.eliminate_redundant_events, "eliminate_redundant_events is not supported when converting to a program");
 
-    if (ret != OK) {
-        return ret;
-    }
+    tbt_song_context ctx;
 
-    ret = saveFile(path, data);
+    Status ret = analyzeTbtFile(t, tbt_analyze_opts{ opts.diagnostics }, ctx);
 
     if (ret != OK) {
         return ret;
     }
 
-    return OK;
+    return convertToMidiProgramOrFile(ctx, opts, true, true, out);
 }
 
 
 Status
-parseMidiFile(
-    const char *path,
-    midi_file &out) {
-    
-    const char *dot = std::strrchr(path, '.');
-    if (!(dot && std::strcmp(dot, ".mid") == 0)) {
-        LOGW("mid file does not end with .mid: %s", path);
-    }
-
-    Status ret;
-
-    std::vector<uint8_t> buf;
+convertToMidiBytes(
+    const tbt_song_context &ctx,
+    const midi_convert_opts &opts,
+    std::vector<uint8_t> &out) {
 
-    ret = openFile(path, buf);
+    trace_span span("convert");
 
-    if (ret != OK) {
-        return ret;
-    }
+    CHECK(!opts.eliminate_redundant_events, "eliminate_redundant_events is not supported when converting to bytes");
 
-    auto buf_it = buf.cbegin();
+    out.clear();
 
-    auto buf_end = buf.cend();
+    midi_bytes_sink sink{ out, 0, {} };
 
-    return parseMidiBytes(buf_it, buf_end, out);
+    return convertToMidiSink(ctx, opts, true, sink);
 }
 
 
+Status
+convertToMidiBytes(
+    const tbt_song_context &ctx,
+    const midi_convert_opts &opts,
+    std::vector<uint8_t> &out,
+    midi_event_counts &counts) {
 
-struct chunk { // NOLINT(*-pro-type-member-init)
-    std::array<uint8_t, 4> type;
-    std::vector<uint8_t> data;
-};
+    trace_span span("convert");
 
+    CHECK(!opts.eliminate_redundant_events, "eliminate_redundant_events is not supported when converting to bytes");
 
-Status
-parseChunk(
-    std::vector<uint8_t>::const_iterator &it,
-    const std::vector<uint8_t>::const_iterator &end,
-    chunk &out) {
+    out.clear();
 
-    CHECK(4 + 4 <= (end - it), "out of data");
+    counts = {};
 
-    std::memcpy(out.type.data(), &*it, 4);
+    midi_bytes_sink bytesSink{ out, 0, {} };
 
-    it += 4;
+    midi_count_sink countSink{ counts, {} };
 
-    auto len = static_cast<int32_t>(parseBE4(it));
+    midi_sink_pair<midi_bytes_sink, midi_count_sink> sink{ bytesSink, countSink };
 
-    CHECK(len >= 0, "len is negative");
+    return convertToMidiSink(ctx, opts, true, sink);
+}
 
-    if (len == 0) {
-        LOGW("chunk length is 0");
-    }
 
-    auto begin = it;
+Status
+convertToMidiBytes(
+    const tbt_file &t,
+    const midi_convert_opts &opts,
+    std::vector<uint8_t> &out) {
 
-    CHECK(len <= (end - it), "out of data");
+    tbt_song_context ctx;
 
-    it += len;
+    Status ret = analyzeTbtFile(t, tbt_analyze_opts{ opts.diagnostics }, ctx);
 
-    out.data = std::vector<uint8_t>(begin, it);
+    if (ret != OK) {
+        return ret;
+    }
 
-    return OK;
+    return convertToMidiBytes(ctx, opts, out);
 }
 
 
 Status
-parseHeader(
-    std::vector<uint8_t>::const_iterator &it,
-    const std::vector<uint8_t>::const_iterator &end,
-    midi_file &out) {
+convertToMidiBytes(
+    const tbt_file &t,
+    const midi_convert_opts &opts,
+    std::vector<uint8_t> &out,
+    midi_event_counts &counts) {
 
-    chunk c;
+    tbt_song_context ctx;
 
-    Status ret = parseChunk(it, end, c);
+    Status ret = analyzeTbtFile(t, tbt_analyze_opts{ opts.diagnostics }, ctx);
 
     if (ret != OK) {
         return ret;
     }
 
-    CHECK(std::memcmp(c.type.data(), S_MTHD.c_str(), 4) == 0, "expected MThd type");
+    return convertToMidiBytes(ctx, opts, out, counts);
+}
 
-    auto it2 = c.data.cbegin();
 
-    auto end2 = c.data.cend();
+void
+expandMidiProgram(
+    const midi_program &p,
+    midi_file &out) {
 
-    CHECK(2 + 2 + 2 <= (end2 - it2), "out of data");
+    out.header = p.header;
 
-    out.header.format = parseBE2(it2);
+    out.tracks.clear();
 
-    out.header.trackCount = parseBE2(it2);
+    for (const auto &track : p.tracks) {
 
-    out.header.division = parseBE2(it2);
+        std::vector<midi_track_event> events;
 
-    if (out.header.format == 0) {
+        midi_track_cursor cursor(track);
 
-        if (out.header.trackCount != 1) {
-            LOGW("format 0 but trackCount != 1: %d", out.header.trackCount);
+        while (auto e = cursor.next()) {
+            events.push_back(*e);
         }
-    }
 
-    if (it2 != end2) {
-        LOGW("bytes after header: %zu", (end2 - it2));
+        out.tracks.push_back(std::move(events));
     }
-
-    return OK;
 }
 
 
-Status
-parseTrackEvent(
-    std::vector<uint8_t>::const_iterator &it,
-    const std::vector<uint8_t>::const_iterator &end,
-    uint8_t &running,
-    midi_track_event &out) {
+midi_track_cursor::midi_track_cursor(const std::vector<midi_track_event> &events) :
+    events(events), repeats(), pos(0), repeatIndex(0), sectionPos(0), remaining(0) {}
 
-    int32_t deltaTime;
 
-    Status ret = parseVLQ(it, end, deltaTime);
+midi_track_cursor::midi_track_cursor(const midi_program_track &track) :
+    events(track.events), repeats(track.repeats), pos(0), repeatIndex(0), sectionPos(0), remaining(0) {}
 
-    if (ret != OK) {
-        return ret;
-    }
 
-    CHECK(1 <= (end - it), "out of data");
+const midi_track_event *
+midi_track_cursor::next() {
 
-    auto b = *it++;
+    while (true) {
 
-    uint8_t hi;
-    uint8_t lo;
+        if (remaining > 0) {
 
-    if ((b & 0b10000000) == 0b00000000) {
+            //
+            // inside of a repeat
+            //
 
-        //
-        // use running status
-        //
+            const auto &r = repeats[repeatIndex];
 
-        CHECK((running & 0b10000000) == 0b10000000, "running status is not set");
+            if (sectionPos < r.end) {
+                return &events[sectionPos++];
+            }
 
-        hi = (running & 0b11110000);
-        lo = (running & 0b00001111);
+            remaining--;
 
-        //
-        // b is already set
-        //
+            if (remaining > 0) {
+                sectionPos = r.start;
+            } else {
+                repeatIndex++;
+            }
 
-    } else if (b == 0xff) {
+            continue;
+        }
 
-        //
-        // ignore running status
-        //
+        if (repeatIndex < repeats.size() && repeats[repeatIndex].at == pos) {
 
-        hi = (b & 0b11110000);
-        lo = (b & 0b00001111);
+            const auto &r = repeats[repeatIndex];
 
-        CHECK(1 <= (end - it), "out of data");
+            if (r.count == 0 || r.start == r.end) {
+                repeatIndex++;
+                continue;
+            }
 
-        b = *it++;
+            remaining = r.count;
 
-    } else if ((b & 0b11110000) == 0b11110000) {
+            sectionPos = r.start;
 
-        //
-        // cancel running status
-        //
+            continue;
+        }
 
-        running = 0xff;
+        if (pos < events.size()) {
+            return &events[pos++];
+        }
 
-        hi = (b & 0b11110000);
-        lo = (b & 0b00001111);
+        return nullptr;
+    }
+}
 
-        CHECK(1 <= (end - it), "out of data");
 
-        b = *it++;
+void
+midi_track_cursor::rewind() {
+    pos = 0;
+    repeatIndex = 0;
+    sectionPos = 0;
+    remaining = 0;
+}
 
-    } else {
 
-        //
-        // set running status
-        //
+Status
+exportMidiBytes(
+    const midi_file &m,
+    std::vector<uint8_t> &out) {
 
-        running = b;
+    trace_span span("export");
 
-        hi = (b & 0b11110000);
-        lo = (b & 0b00001111);
+    out.clear();
 
-        CHECK(1 <= (end - it), "out of data");
+    //
+    // header
+    //
+    {
+        out.insert(out.end(), S_MTHD.cbegin(), S_MTHD.cend()); // type
 
-        b = *it++;
-    }
+        toDigitsBE(static_cast<uint32_t>(2 + 2 + 2), out); // length
 
-    switch (hi) {
-    case 0x80: {
+        toDigitsBE(m.header.format, out); // format
 
-        auto channel = lo;
+        toDigitsBE(m.header.trackCount, out); // track count
 
-        uint8_t midiNote = (b & 0b01111111);
+        toDigitsBE(m.header.division, out); // division
+    }
 
-        CHECK(1 <= (end - it), "out of data");
+    //
+    // tracks
+    //
+    for (const auto &track : m.tracks) {
 
-        b = *it++;
+        std::vector<uint8_t> tmp;
 
-        uint8_t velocity = (b & 0b01111111);
+        EventExportVisitor<std::vector<uint8_t> > eventExportVisitor{ tmp };
 
-        out = NoteOffEvent{deltaTime, channel, midiNote, velocity};
+        for (const auto &event : track) {
+            std::visit(eventExportVisitor, event);
+        }
 
-        return OK;
+        out.insert(out.end(), S_MTRK.cbegin(), S_MTRK.cend()); // type
+
+        toDigitsBE(static_cast<uint32_t>(tmp.size()), out); // length
+
+        out.insert(out.end(), tmp.cbegin(), tmp.cend()); // data
     }
-    case 0x90: {
 
-        auto channel = lo;
+    return OK;
+}
 
-        uint8_t midiNote = (b & 0b01111111);
-        
-        CHECK(1 <= (end - it), "out of data");
 
-        b = *it++;
+size_t midiExportSize(const midi_file &m) {
 
-        uint8_t velocity = (b & 0b01111111);
+    midi_export_counter counter;
 
-        out = NoteOnEvent{deltaTime, channel, midiNote, velocity};
+    counter.size += 4 + 4 + 2 + 2 + 2; // MThd
 
-        return OK;
-    }
-    case 0xa0: {
+    EventExportVisitor<midi_export_counter> eventExportVisitor{ counter };
 
-        auto channel = lo;
+    for (const auto &track : m.tracks) {
 
-        uint8_t midiNote = (b & 0b01111111);
-        
-        CHECK(1 <= (end - it), "out of data");
+        counter.size += 4 + 4; // MTrk type and length
 
-        b = *it++;
+        for (const auto &event : track) {
+            std::visit(eventExportVisitor, event);
+        }
+    }
 
-        uint8_t pressure = (b & 0b01111111);
+    return counter.size;
+}
 
-        out = PolyphonicKeyPressureEvent{deltaTime, channel, midiNote, pressure};
 
-        return OK;
-    }
-    case 0xb0: {
+Status
+exportMidiBytes(
+    const midi_file &m,
+    std::span<uint8_t> out) {
 
-        auto channel = lo;
+    trace_span span("export");
 
-        auto controller = b;
+    midi_export_region region{ out.data(), out.data() + out.size() };
 
-        CHECK(1 <= (end - it), "out of data");
+    //
+    // header
+    //
+    {
+        CHECK(4 + 4 + 2 + 2 + 2 <= out.size(), "region is too small");
 
-        b = *it++;
+        std::copy(S_MTHD.cbegin(), S_MTHD.cend(), region.pos); // type
 
-        uint8_t value = (b & 0b01111111);
+        writeBE4(2 + 2 + 2, region.pos + 4); // length
 
-        out = ControlChangeEvent{deltaTime, channel, controller, value};
+        writeBE2(m.header.format, region.pos + 8); // format
 
-        return OK;
+        writeBE2(m.header.trackCount, region.pos + 10); // track count
+
+        writeBE2(m.header.division, region.pos + 12); // division
+
+        region.pos += 4 + 4 + 2 + 2 + 2;
     }
-    case 0xc0: {
 
-        auto channel = lo;
+    //
+    // tracks
+    //
+    // events are written straight to the region, and the length is filled in afterward
+    //
+    EventExportVisitor<midi_export_region> eventExportVisitor{ region };
 
-        uint8_t midiProgram = (b & 0b01111111);
+    for (const auto &track : m.tracks) {
 
-        out = ProgramChangeEvent{deltaTime, channel, midiProgram};
+        CHECK(4 + 4 <= (region.end - region.pos), "region is too small");
 
-        return OK;
-    }
-    case 0xd0: {
+        std::copy(S_MTRK.cbegin(), S_MTRK.cend(), region.pos); // type
 
-        auto channel = lo;
+        auto lengthPos = region.pos + 4;
 
-        uint8_t pressure = (b & 0b01111111);
+        region.pos += 4 + 4;
 
-        out = ChannelPressureEvent{deltaTime, channel, pressure};
+        auto dataPos = region.pos;
 
-        return OK;
-    }
-    case 0xe0: {
+        for (const auto &event : track) {
+            std::visit(eventExportVisitor, event);
+        }
 
-        auto channel = lo;
+        CHECK(!region.overflow, "region is too small");
 
-        uint8_t pitchBendLSB = (b & 0b01111111);
-        
-        CHECK(1 <= (end - it), "out of data");
+        writeBE4(static_cast<uint32_t>(region.pos - dataPos), lengthPos); // length
+    }
 
-        b = *it++;
+    CHECK(region.pos == region.end, "region is too large: %zu bytes are not used", static_cast<size_t>(region.end - region.pos));
 
-        uint8_t pitchBendMSB = (b & 0b01111111);
+    return OK;
+}
 
-        auto pitchBend = static_cast<int16_t>((pitchBendMSB << 7) | pitchBendLSB);
 
-        out = PitchBendEvent{deltaTime, channel, pitchBend};
+Status
+exportMidiProgramBytes(
+    const midi_program &p,
+    std::vector<uint8_t> &out) {
 
-        return OK;
-    }
-    case 0xf0: {
+    trace_span span("export");
 
-        if (lo == 0x00) {
+    out.clear();
 
-            std::vector<uint8_t> tmp;
+    //
+    // header
+    //
+    {
+        out.insert(out.end(), S_MTHD.cbegin(), S_MTHD.cend()); // type
 
-            tmp.push_back(b);
+        toDigitsBE(static_cast<uint32_t>(2 + 2 + 2), out); // length
 
-            while (true) {
+        toDigitsBE(p.header.format, out); // format
 
-                if (b == 0xf7) {
-                    break;
-                }
+        toDigitsBE(p.header.trackCount, out); // track count
 
-                CHECK(1 <= (end - it), "out of data");
+        toDigitsBE(p.header.division, out); // division
+    }
 
-                b = *it++;
+    //
+    // tracks
+    //
+    // events are written straight to out, and the length is filled in afterward
+    //
+    for (const auto &track : p.tracks) {
 
-                tmp.push_back(b);
-            }
+        out.insert(out.end(), S_MTRK.cbegin(), S_MTRK.cend()); // type
 
-            auto it2 = tmp.cbegin();
-            
-            auto end2 = tmp.cend();
+        auto lengthPos = out.size();
 
-            int32_t len;
+        toDigitsBE(static_cast<uint32_t>(0), out); // length placeholder
 
-            ret = parseVLQ(it2, end2, len);
+        auto dataPos = out.size();
 
-            if (ret != OK) {
-                return ret;
-            }
+        EventExportVisitor<std::vector<uint8_t> > eventExportVisitor{ out };
 
-            if (len != (end2 - it2)) {
+        midi_track_cursor cursor(track);
 
-                LOGW("SysEx event len is not correct");
+        while (auto e = cursor.next()) {
+            std::visit(eventExportVisitor, *e);
+        }
 
-                return ERR;
-            }
+        std::vector<uint8_t> length;
 
-            out = SysExEvent{deltaTime, tmp};
+        toDigitsBE(static_cast<uint32_t>(out.size() - dataPos), length);
 
-            return OK;
+        std::copy(length.cbegin(), length.cend(), out.begin() + static_cast<std::ptrdiff_t>(lengthPos));
+    }
 
-        } else if (lo == 0x0f) {
+    return OK;
+}
 
-            auto type = b;
 
-            int32_t len;
+Status
+exportMidiProgramFile(
+    const midi_program &p,
+    const char *path) {
 
-            ret = parseVLQ(it, end, len);
+    std::vector<uint8_t> data;
 
-            if (ret != OK) {
-                return ret;
-            }
+    Status ret;
 
-            auto begin = it;
+    ret = exportMidiProgramBytes(p, data);
 
-            CHECK(len <= (end - it), "out of data");
+    if (ret != OK) {
+        return ret;
+    }
 
-            it += len;
+    ret = saveFile(path, data);
 
-            std::vector<uint8_t> data(begin, it);
+    if (ret != OK) {
+        return ret;
+    }
 
-            out = MetaEvent{deltaTime, type, data};
+    return OK;
+}
 
-            return OK;
 
-        } else {
+Status
+exportMidiFile(
+    const midi_file &m,
+    const char *path) {
 
-            LOGE("unrecognized event byte: %d (0x%02x)", (hi | lo), (hi | lo));
+    std::vector<uint8_t> data;
 
-            return ERR;
-        }
+    Status ret;
 
+    ret = exportMidiBytes(m, data);
+
+    if (ret != OK) {
+        return ret;
     }
-    default: {
 
-        LOGE("unrecognized event byte: %d (0x%02x)", (hi | lo), (hi | lo));
+    ret = saveFile(path, data);
 
-        return ERR;
-    }
+    if (ret != OK) {
+        return ret;
     }
+
+    return OK;
 }
 
 
 Status
-parseTrack(
-    std::vector<uint8_t>::const_iterator &it,
-    const std::vector<uint8_t>::const_iterator &end,
+parseMidiFile(
+    const char *path,
     midi_file &out) {
+    
+    const char *dot = std::strrchr(path, '.');
+    if (!(dot && std::strcmp(dot, ".mid") == 0)) {
+        LOGW("mid file does not end with .mid: %s", path);
+    }
 
-    uint8_t running = 0xff;
+    Status ret;
 
-    chunk c;
+    std::vector<uint8_t> buf;
 
-    Status ret = parseChunk(it, end, c);
+    ret = openFile(path, buf);
 
     if (ret != OK) {
         return ret;
     }
 
-    CHECK(std::memcmp(c.type.data(), S_MTRK.c_str(), 4) == 0, "expected MTrk type");
+    auto buf_it = buf.cbegin();
 
-    std::vector<midi_track_event> track;
+    auto buf_end = buf.cend();
 
-    auto it2 = c.data.cbegin();
+    return parseMidiBytes(buf_it, buf_end, out);
+}
 
-    auto end2 = c.data.cend();
 
-    while (true) {
 
-        midi_track_event e;
+struct chunk { // NOLINT(*-pro-type-member-init)
+    std::array<uint8_t, 4> type;
+    std::vector<uint8_t> data;
+};
 
-        ret = parseTrackEvent(it2, end2, running, e);
 
-        if (ret != OK) {
-            return ret;
-        }
+Status
+parseChunk(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    chunk &out) {
 
-        track.push_back(e);
+    CHECK(4 + 4 <= (end - it), "out of data");
 
-        if (auto metaEvent = std::get_if<MetaEvent>(&e)) {
+    std::memcpy(out.type.data(), &*it, 4);
 
-            if (metaEvent->type == M_ENDOFTRACK) {
+    it += 4;
 
-                //
-                // FluidSynth ignores bytes after EndOfTrack
-                //
-                // so just warn here
-                //
-                if (it2 != end2) {
-                    LOGW("bytes after EndOfTrack: %zu", (end2 - it2));
-                }
+    auto len = static_cast<int32_t>(parseBE4(it));
 
-                break;
-            }
-        }
+    CHECK(len >= 0, "len is negative");
+
+    if (len == 0) {
+        LOGW("chunk length is 0");
     }
 
-    out.tracks.push_back(track);
+    auto begin = it;
+
+    CHECK(len <= (end - it), "out of data");
+
+    it += len;
+
+    out.data = std::vector<uint8_t>(begin, it);
 
     return OK;
 }
 
 
 Status
-parseMidiBytes(
+parseHeader(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
     midi_file &out) {
 
-    auto len = (end - it);
-
-    CHECK(len != 0, "empty file");
+    chunk c;
 
-    Status ret = parseHeader(it, end, out);
+    Status ret = parseChunk(it, end, c);
 
     if (ret != OK) {
         return ret;
     }
 
-    for (int i = 0; i < out.header.trackCount; i++) {
+    CHECK(std::memcmp(c.type.data(), S_MTHD.c_str(), 4) == 0, "expected MThd type");
 
-        ret = parseTrack(it, end, out);
+    auto it2 = c.data.cbegin();
 
-        if (ret != OK) {
-            return ret;
+    auto end2 = c.data.cend();
+
+    CHECK(2 + 2 + 2 <= (end2 - it2), "out of data");
+
+    out.header.format = parseBE2(it2);
+
+    out.header.trackCount = parseBE2(it2);
+
+    out.header.division = parseBE2(it2);
+
+    if (out.header.format == 0) {
+
+        if (out.header.trackCount != 1) {
+            LOGW("format 0 but trackCount != 1: %d", out.header.trackCount);
         }
     }
 
-    if (it != end) {
-        LOGW("bytes after all tracks: %zu", (end - it));
+    if (it2 != end2) {
+        LOGW("bytes after header: %zu", (end2 - it2));
     }
 
     return OK;
 }
 
 
-struct EventFileTimesTempoMapVisitor {
-    
-    const uint16_t division;
-
-    //
-    // tick -> microsPerTick
-    //
-    std::map<rational, rational> &tempoMap;
+Status
+parseTrackEvent(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    uint8_t &running,
+    midi_track_event &out) {
 
-    uint16_t track;
+    int32_t deltaTime;
 
-    rational runningTick;
+    Status ret = parseVLQ(it, end, deltaTime);
 
-    void operator()(const ProgramChangeEvent &e) {
-        runningTick += e.deltaTime;
+    if (ret != OK) {
+        return ret;
     }
 
-    void operator()(const PitchBendEvent &e) {
-        runningTick += e.deltaTime;
-    }
+    CHECK(1 <= (end - it), "out of data");
 
-    void operator()(const NoteOffEvent &e) {
-        runningTick += e.deltaTime;
-    }
+    auto b = *it++;
 
-    void operator()(const NoteOnEvent &e) {
-        runningTick += e.deltaTime;
-    }
+    uint8_t hi;
+    uint8_t lo;
 
-    void operator()(const ControlChangeEvent &e) {
-        runningTick += e.deltaTime;
-    }
+    if ((b & 0b10000000) == 0b00000000) {
 
-    void operator()(const MetaEvent &e) {
+        //
+        // use running status
+        //
 
-        if (e.type == M_SETTEMPO) {
+        CHECK((running & 0b10000000) == 0b10000000, "running status is not set");
 
-            runningTick += e.deltaTime;
+        hi = (running & 0b11110000);
+        lo = (running & 0b00001111);
 
-            auto it = e.data.cbegin();
+        //
+        // b is already set
+        //
 
-            auto microsPerBeat = parseBE3(it);
+    } else if (b == 0xff) {
 
-            //
-            // convert MicrosPerBeat -> MicrosPerTick
-            //
-            auto newMicrosPerTick = rational(microsPerBeat) / division;
+        //
+        // ignore running status
+        //
 
-            const auto &tempoMapIt = tempoMap.find(runningTick);
-            if (tempoMapIt != tempoMap.end()) {
+        hi = (b & 0b11110000);
+        lo = (b & 0b00001111);
 
-                auto microsPerTick = tempoMapIt->second;
+        CHECK(1 <= (end - it), "out of data");
 
-                if (microsPerTick != newMicrosPerTick) {
+        b = *it++;
 
-                    //
-                    // convert MicrosPerTick -> BeatsPerMinute
-                    //
+    } else if ((b & 0b11110000) == 0b11110000) {
 
-                    auto aBPM = (MICROS_PER_MINUTE / (microsPerTick * division));
+        //
+        // cancel running status
+        //
 
-                    auto bBPM = (MICROS_PER_MINUTE / (newMicrosPerTick * division));
+        running = 0xff;
 
-                    LOGW("track: %d tick %f has conflicting tempo changes: %f, %f", track, runningTick.to_double(), aBPM.to_double(), bBPM.to_double());
-                }
-            }
+        hi = (b & 0b11110000);
+        lo = (b & 0b00001111);
 
-            tempoMap[runningTick] = newMicrosPerTick;
+        CHECK(1 <= (end - it), "out of data");
 
-        } else {
+        b = *it++;
 
-            runningTick += e.deltaTime;
-        }
+    } else {
+
+        //
+        // set running status
+        //
+
+        running = b;
+
+        hi = (b & 0b11110000);
+        lo = (b & 0b00001111);
+
+        CHECK(1 <= (end - it), "out of data");
+
+        b = *it++;
     }
 
-    void operator()(const PolyphonicKeyPressureEvent &e) {
-        runningTick += e.deltaTime;
+    switch (hi) {
+    case 0x80: {
+
+        auto channel = lo;
+
+        uint8_t midiNote = (b & 0b01111111);
+
+        CHECK(1 <= (end - it), "out of data");
+
+        b = *it++;
+
+        uint8_t velocity = (b & 0b01111111);
+
+        out = NoteOffEvent{deltaTime, channel, midiNote, velocity};
+
+        return OK;
     }
+    case 0x90: {
 
-    void operator()(const ChannelPressureEvent &e) {
-        runningTick += e.deltaTime;
+        auto channel = lo;
+
+        uint8_t midiNote = (b & 0b01111111);
+        
+        CHECK(1 <= (end - it), "out of data");
+
+        b = *it++;
+
+        uint8_t velocity = (b & 0b01111111);
+
+        out = NoteOnEvent{deltaTime, channel, midiNote, velocity};
+
+        return OK;
     }
+    case 0xa0: {
 
-    void operator()(const SysExEvent &e) {
-        runningTick += e.deltaTime;
+        auto channel = lo;
+
+        uint8_t midiNote = (b & 0b01111111);
+        
+        CHECK(1 <= (end - it), "out of data");
+
+        b = *it++;
+
+        uint8_t pressure = (b & 0b01111111);
+
+        out = PolyphonicKeyPressureEvent{deltaTime, channel, midiNote, pressure};
+
+        return OK;
     }
-};
+    case 0xb0: {
 
+        auto channel = lo;
 
-struct EventFileTimesLastTicksVisitor {
-    
-    const uint16_t division;
+        auto controller = b;
 
-    rational runningTick;
+        CHECK(1 <= (end - it), "out of data");
 
-    //
-    // important to start < 0, because 0 is a valid tick
-    //
-    rational lastNoteOnTick = -1;
-    rational lastNoteOffTick = -1;
-    rational lastEndOfTrackTick = -1;
-    rational lastTempoChangeTick = -1;
-    rational lastMicrosPerTick = 0;
+        b = *it++;
 
-    void operator()(const ProgramChangeEvent &e) {
-        runningTick += e.deltaTime;
+        uint8_t value = (b & 0b01111111);
+
+        out = ControlChangeEvent{deltaTime, channel, controller, value};
+
+        return OK;
     }
+    case 0xc0: {
 
-    void operator()(const PitchBendEvent &e) {
-        runningTick += e.deltaTime;
+        auto channel = lo;
+
+        uint8_t midiProgram = (b & 0b01111111);
+
+        out = ProgramChangeEvent{deltaTime, channel, midiProgram};
+
+        return OK;
     }
+    case 0xd0: {
 
-    void operator()(const NoteOffEvent &e) {
-        
-        runningTick += e.deltaTime;
+        auto channel = lo;
 
-        if (runningTick > lastNoteOffTick) {
-            lastNoteOffTick = runningTick;
-        }
+        uint8_t pressure = (b & 0b01111111);
+
+        out = ChannelPressureEvent{deltaTime, channel, pressure};
+
+        return OK;
     }
+    case 0xe0: {
+
+        auto channel = lo;
+
+        uint8_t pitchBendLSB = (b & 0b01111111);
+        
+        CHECK(1 <= (end - it), "out of data");
+
+        b = *it++;
+
+        uint8_t pitchBendMSB = (b & 0b01111111);
+
+        auto pitchBend = static_cast<int16_t>((pitchBendMSB << 7) | pitchBendLSB);
+
+        out = PitchBendEvent{deltaTime, channel, pitchBend};
+
+        return OK;
+    }
+    case 0xf0: {
+
+        if (lo == 0x00) {
+
+            std::vector<uint8_t> tmp;
+
+            tmp.push_back(b);
+
+            while (true) {
+
+                if (b == 0xf7) {
+                    break;
+                }
+
+                CHECK(1 <= (end - it), "out of data");
+
+                b = *it++;
+
+                tmp.push_back(b);
+            }
+
+            auto it2 = tmp.cbegin();
+            
+            auto end2 = tmp.cend();
+
+            int32_t len;
+
+            ret = parseVLQ(it2, end2, len);
+
+            if (ret != OK) {
+                return ret;
+            }
+
+            if (len != (end2 - it2)) {
+
+                LOGW("SysEx event len is not correct");
+
+                return ERR;
+            }
+
+            out = SysExEvent{deltaTime, tmp};
+
+            return OK;
+
+        } else if (lo == 0x0f) {
+
+            auto type = b;
+
+            int32_t len;
+
+            ret = parseVLQ(it, end, len);
+
+            if (ret != OK) {
+                return ret;
+            }
+
+            auto begin = it;
+
+            CHECK(len <= (end - it), "out of data");
+
+            it += len;
+
+            std::vector<uint8_t> data(begin, it);
+
+            out = MetaEvent{deltaTime, type, data};
+
+            return OK;
+
+        } else {
+
+            LOGE("unrecognized event byte: %d (0x%02x)", (hi | lo), (hi | lo));
+
+            return ERR;
+        }
+
+    }
+    default: {
+
+        LOGE("unrecognized event byte: %d (0x%02x)", (hi | lo), (hi | lo));
+
+        return ERR;
+    }
+    }
+}
+
+
+Status
+parseTrack(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    midi_file &out) {
+
+    uint8_t running = 0xff;
+
+    chunk c;
+
+    Status ret = parseChunk(it, end, c);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    CHECK(std::memcmp(c.type.data(), S_MTRK.c_str(), 4) == 0, "expected MTrk type");
+
+    std::vector<midi_track_event> track;
+
+    auto it2 = c.data.cbegin();
+
+    auto end2 = c.data.cend();
+
+    while (true) {
+
+        midi_track_event e;
+
+        ret = parseTrackEvent(it2, end2, running, e);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        track.push_back(e);
+
+        if (auto metaEvent = std::get_if<MetaEvent>(&e)) {
+
+            if (metaEvent->type == M_ENDOFTRACK) {
+
+                //
+                // FluidSynth ignores bytes after EndOfTrack
+                //
+                // so just warn here
+                //
+                if (it2 != end2) {
+                    LOGW("bytes after EndOfTrack: %zu", (end2 - it2));
+                }
+
+                break;
+            }
+        }
+    }
+
+    out.tracks.push_back(track);
+
+    return OK;
+}
+
+
+Status
+parseMidiBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    midi_file &out) {
+
+    auto len = (end - it);
+
+    CHECK(len != 0, "empty file");
+
+    Status ret = parseHeader(it, end, out);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    for (int i = 0; i < out.header.trackCount; i++) {
+
+        ret = parseTrack(it, end, out);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    if (it != end) {
+        LOGW("bytes after all tracks: %zu", (end - it));
+    }
+
+    return OK;
+}
+
+
+struct EventFileTimesTempoMapVisitor {
+    
+    const uint16_t division;
+
+    //
+    // tick -> microsPerTick
+    //
+    std::map<rational, rational> &tempoMap;
+
+    uint16_t track;
+
+    rational runningTick;
+
+    void operator()(const ProgramChangeEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const PitchBendEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const NoteOffEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const NoteOnEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const ControlChangeEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const MetaEvent &e) {
+
+        if (e.type == M_SETTEMPO) {
+
+            runningTick += e.deltaTime;
+
+            auto it = e.data.cbegin();
+
+            auto microsPerBeat = parseBE3(it);
+
+            //
+            // convert MicrosPerBeat -> MicrosPerTick
+            //
+            auto newMicrosPerTick = rational(microsPerBeat) / division;
+
+            const auto &tempoMapIt = tempoMap.find(runningTick);
+            if (tempoMapIt != tempoMap.end()) {
+
+                auto microsPerTick = tempoMapIt->second;
+
+                if (microsPerTick != newMicrosPerTick) {
+
+                    //
+                    // convert MicrosPerTick -> BeatsPerMinute
+                    //
+
+                    auto aBPM = (MICROS_PER_MINUTE / (microsPerTick * division));
+
+                    auto bBPM = (MICROS_PER_MINUTE / (newMicrosPerTick * division));
+
+                    LOGW("track: %d tick %f has conflicting tempo changes: %f, %f", track, runningTick.to_double(), aBPM.to_double(), bBPM.to_double());
+                }
+            }
+
+            tempoMap[runningTick] = newMicrosPerTick;
+
+        } else {
+
+            runningTick += e.deltaTime;
+        }
+    }
+
+    void operator()(const PolyphonicKeyPressureEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const ChannelPressureEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const SysExEvent &e) {
+        runningTick += e.deltaTime;
+    }
+};
+
+
+struct EventFileTimesLastTicksVisitor {
+    
+    const uint16_t division;
+
+    rational runningTick;
+
+    //
+    // important to start < 0, because 0 is a valid tick
+    //
+    rational lastNoteOnTick = -1;
+    rational lastNoteOffTick = -1;
+    rational lastEndOfTrackTick = -1;
+    rational lastTempoChangeTick = -1;
+    rational lastMicrosPerTick = 0;
+
+    void operator()(const ProgramChangeEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const PitchBendEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const NoteOffEvent &e) {
+        
+        runningTick += e.deltaTime;
+
+        if (runningTick > lastNoteOffTick) {
+            lastNoteOffTick = runningTick;
+        }
+    }
+
+    void operator()(const NoteOnEvent &e) {
+        
+        runningTick += e.deltaTime;
+
+        if (runningTick > lastNoteOnTick) {
+            lastNoteOnTick = runningTick;
+        }
+    }
+
+    void operator()(const ControlChangeEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const MetaEvent &e) {
+
+        switch (e.type) {
+        case M_SETTEMPO: {
+
+            runningTick += e.deltaTime;
+
+            if (runningTick > lastTempoChangeTick) {
+
+                lastTempoChangeTick = runningTick;
+
+                auto it = e.data.cbegin();
+
+                auto microsPerBeat = parseBE3(it);
+
+                //
+                // convert MicrosPerBeat -> MicrosPerTick
+                //
+                lastMicrosPerTick = rational(microsPerBeat) / division;
+            }
+
+            break;
+        }
+        case M_ENDOFTRACK: {
+
+            runningTick += e.deltaTime;
+
+            if (runningTick > lastEndOfTrackTick) {
+                lastEndOfTrackTick = runningTick;
+            }
+
+            break;
+        }
+        default: {
+
+            runningTick += e.deltaTime;
+            
+            break;
+        }
+        }
+    }
+
+    void operator()(const PolyphonicKeyPressureEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const ChannelPressureEvent &e) {
+        runningTick += e.deltaTime;
+    }
+
+    void operator()(const SysExEvent &e) {
+        runningTick += e.deltaTime;
+    }
+};
+
+
+midi_file_times
+midiFileTimes(const midi_file &m) {
+
+    //
+    // first build tempo map
+    //
+
+    //
+    // tick -> microsPerTick
+    //
+    std::map<rational, rational> tempoMap;
+
+    EventFileTimesTempoMapVisitor eventFileTimesTempoMapVisitor{ m.header.division, tempoMap, 0, 0 };
+
+    for (size_t track = 0; track < m.tracks.size(); track++) {
+
+        const auto &t = m.tracks[track];
+
+        eventFileTimesTempoMapVisitor.track = static_cast<uint16_t>(track);
+        eventFileTimesTempoMapVisitor.runningTick = 0;
+
+        for (const auto &e : t) {
+            std::visit(eventFileTimesTempoMapVisitor, e);
+        }
+    }
+
+
+    EventFileTimesLastTicksVisitor v{ m.header.division, 0 };
+
+    for (const auto &track : m.tracks) {
+
+        v.runningTick = 0;
+
+        for (const auto &e : track) {
+            std::visit(v, e);
+        }
+    }
+
+
+    //
+    // insert actual ticks for these events
+    //
+
+    if (v.lastNoteOnTick != -1) {
+        auto it = last_found(tempoMap, v.lastNoteOnTick);
+        tempoMap[v.lastNoteOnTick] = it->second;
+    }
+
+    if (v.lastNoteOffTick != -1) {
+        auto it = last_found(tempoMap, v.lastNoteOffTick);
+        tempoMap[v.lastNoteOffTick] = it->second;
+    }
+
+    if (v.lastEndOfTrackTick != -1) {
+        auto it = last_found(tempoMap, v.lastEndOfTrackTick);
+        tempoMap[v.lastEndOfTrackTick] = it->second;
+    }
+
+    //
+    // compute actual times for events
+    //
+
+    rational runningMicros = 0;
+    rational lastNoteOnMicros = -1;
+    rational lastNoteOffMicros = -1;
+    rational lastEndOfTrackMicros = -1;
+
+    rational lastTick = 0;
+    rational lastMicrosPerTick = 0;
+    for (const auto &x : tempoMap) {
+
+        auto tick = x.first;
+        auto microsPerTick = x.second;
+
+        runningMicros += ((tick - lastTick) * lastMicrosPerTick);
+
+        if (tick == v.lastNoteOnTick) {
+            lastNoteOnMicros = runningMicros;
+        }
+        if (tick == v.lastNoteOffTick) {
+            lastNoteOffMicros = runningMicros;
+        }
+        if (tick == v.lastEndOfTrackTick) {
+            lastEndOfTrackMicros = runningMicros;
+        }
+
+        lastTick = tick;
+        lastMicrosPerTick = microsPerTick;
+    }
+
+    midi_file_times times = {
+        lastNoteOnMicros.to_double(), lastNoteOffMicros.to_double(), lastEndOfTrackMicros.to_double(),
+        v.lastNoteOnTick.to_int32(), v.lastNoteOffTick.to_int32(), v.lastEndOfTrackTick.to_int32()
+    };
+
+    return times;
+}
+
+
+void
+appendTimesInfo(const midi_file_times &times, std::string &acc) {
+
+    char buf[100];
+
+    std::snprintf(buf, sizeof(buf), "times:                      h:mm:sssss\n");
+    acc += buf;
+
+    if (times.lastNoteOnMicros != -1) {
+
+        double lastNoteOnSec = times.lastNoteOnMicros / 1e6;
+        double lastNoteOnMin = lastNoteOnSec / 60.0;
+        double lastNoteOnHr = lastNoteOnMin / 60.0;
+
+        std::snprintf(buf, sizeof(buf), "       last Note On (wall): %d:%02d:%05.2f\n", static_cast<int>(std::floor(lastNoteOnHr)), static_cast<int>(std::floor(std::fmod(lastNoteOnMin, 60.0))), std::fmod(lastNoteOnSec, 60.0));
+        acc += buf;
+
+    } else {
+
+        std::snprintf(buf, sizeof(buf), "       last Note On (wall): (none)\n");
+        acc += buf;
+    }
+
+    if (times.lastNoteOffMicros != -1) {
+
+        double lastNoteOffSec = times.lastNoteOffMicros / 1e6;
+        double lastNoteOffMin = lastNoteOffSec / 60.0;
+        double lastNoteOffHr = lastNoteOffMin / 60.0;
+        std::snprintf(buf, sizeof(buf), "      last Note Off (wall): %d:%02d:%05.2f\n", static_cast<int>(std::floor(lastNoteOffHr)), static_cast<int>(std::floor(std::fmod(lastNoteOffMin, 60.0))), std::fmod(lastNoteOffSec, 60.0));
+        acc += buf;
+
+    } else {
+
+        std::snprintf(buf, sizeof(buf), "      last Note Off (wall): (none)\n");
+        acc += buf;
+    }
+
+    if (times.lastEndOfTrackMicros != -1) {
+        
+        double lastEndOfTrackSec = times.lastEndOfTrackMicros / 1e6;
+        double lastEndOfTrackMin = lastEndOfTrackSec / 60.0;
+        double lastEndOfTrackHr = lastEndOfTrackMin / 60.0;
+        std::snprintf(buf, sizeof(buf), "  last End Of Track (wall): %d:%02d:%05.2f\n", static_cast<int>(std::floor(lastEndOfTrackHr)), static_cast<int>(std::floor(std::fmod(lastEndOfTrackMin, 60.0))), std::fmod(lastEndOfTrackSec, 60.0));
+        acc += buf;
+
+    } else {
+        std::snprintf(buf, sizeof(buf), "  last End Of Track (wall): (none)\n");
+        acc += buf;
+    }
+
+    std::snprintf(buf, sizeof(buf), "     last Note On (micros): %.17f\n", times.lastNoteOnMicros);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "    last Note Off (micros): %.17f\n", times.lastNoteOffMicros);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "last End Of Track (micros): %.17f\n", times.lastEndOfTrackMicros);
+    acc += buf;
+
+
+    std::snprintf(buf, sizeof(buf), "      last Note On (ticks): %d\n", times.lastNoteOnTick);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "     last Note Off (ticks): %d\n", times.lastNoteOffTick);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), " last End Of Track (ticks): %d\n", times.lastEndOfTrackTick);
+    acc += buf;
+}
+
+
+std::string
+midiFileInfo(const midi_file &m) {
+
+    std::string acc;
+    
+    char buf[100];
+
+    std::snprintf(buf, sizeof(buf), "header:\n");
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Format: %d\n", m.header.format);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Track Count: %d\n", m.header.trackCount);
+    acc += buf;
+
+    std::snprintf(buf, sizeof(buf), "Division: %d\n", m.header.division);
+    acc += buf;
+
+
+    std::snprintf(buf, sizeof(buf), "events:\n");
+    acc += buf;
+
+    for (const auto &track : m.tracks) {
+
+        for (const auto &e : track) {
+            std::visit([&](auto&& e) {
+                using T = std::decay_t<decltype(e)>;
+                if constexpr (std::is_same_v<T, MetaEvent>) {
+                    switch (e.type) {
+                    case M_TRACKNAME: {
+
+                        std::string str{ e.data.cbegin(), e.data.cend() };
+
+                        std::snprintf(buf, sizeof(buf), "Track Name: %s\n", str.c_str());
+                        acc += buf;
+
+                        break;
+                    }
+                    case M_TIMESIGNATURE: {
+
+                        auto numerator = e.data[0];
+                        auto denominator = e.data[1];
+                        auto ticksPerBeat = e.data[2];
+                        auto notated32notesPerBeat = e.data[3];
+
+                        std::snprintf(buf, sizeof(buf), "Time Signature Numerator: %d\n", numerator);
+                        acc += buf;
+
+                        std::snprintf(buf, sizeof(buf), "Time Signature Denominator: %d\n", denominator);
+                        acc += buf;
+
+                        std::snprintf(buf, sizeof(buf), "Time Signature Ticks Per Beat: %d\n", ticksPerBeat);
+                        acc += buf;
+
+                        std::snprintf(buf, sizeof(buf), "Time Signature 32nd notes Per Beat: %d\n", notated32notesPerBeat);
+                        acc += buf;
+
+                        break;
+                    }
+                    }
+                }
+            }, e);
+        }
+    }
+
+    auto times = midiFileTimes(m);
+
+    appendTimesInfo(times, acc);
+
+    return acc;
+}
+
+
+Status
+probeMidiFile(
+    const char *path,
+    midi_probe &out) {
+
+    std::vector<uint8_t> buf;
+
+    Status ret = openFile(path, buf);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    auto buf_it = buf.cbegin();
+
+    auto buf_end = buf.cend();
+
+    return probeMidiBytes(buf_it, buf_end, out);
+}
+
+
+struct probe_ticks {
+    //
+    // important to start < 0, because 0 is a valid tick
+    //
+    int64_t lastNoteOnTick = -1;
+    int64_t lastNoteOffTick = -1;
+    int64_t lastEndOfTrackTick = -1;
+};
+
+
+//
+// same running status rules as parseTrackEvent
+//
+Status
+probeTrack(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    probe_ticks &ticks,
+    midi_probe &out) {
+
+    CHECK(4 + 4 <= (end - it), "out of data");
+
+    CHECK(std::memcmp(&*it, S_MTRK.c_str(), 4) == 0, "expected MTrk type");
+
+    it += 4;
+
+    auto len = static_cast<int32_t>(parseBE4(it));
+
+    CHECK(len >= 0, "len is negative");
+
+    CHECK(len <= (end - it), "out of data");
+
+    auto trackEnd = it + len;
+
+    auto it2 = it;
+
+    it = trackEnd;
+
+    uint8_t running = 0xff;
+
+    int64_t tick = 0;
+
+    while (true) {
+
+        int32_t deltaTime;
+
+        Status ret = parseVLQ(it2, trackEnd, deltaTime);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        tick += deltaTime;
+
+        CHECK(1 <= (trackEnd - it2), "out of data");
+
+        auto b = *it2++;
+
+        uint8_t hi;
+        uint8_t lo;
+
+        if ((b & 0b10000000) == 0b00000000) {
+
+            CHECK((running & 0b10000000) == 0b10000000, "running status is not set");
+
+            hi = (running & 0b11110000);
+            lo = (running & 0b00001111);
+
+            //
+            // b is the first data byte
+            //
+
+        } else {
+
+            if ((b & 0b11110000) == 0b11110000) {
+                if (b != 0xff) {
+                    running = 0xff;
+                }
+            } else {
+                running = b;
+            }
+
+            hi = (b & 0b11110000);
+            lo = (b & 0b00001111);
+
+            CHECK(1 <= (trackEnd - it2), "out of data");
+
+            b = *it2++;
+        }
+
+        switch (hi) {
+        case 0x80:
+        case 0x90:
+        case 0xa0:
+        case 0xb0:
+        case 0xe0: {
+
+            //
+            // second data byte
+            //
+            CHECK(1 <= (trackEnd - it2), "out of data");
+
+            it2++;
+
+            if (hi == 0x80) {
+                ticks.lastNoteOffTick = std::max(ticks.lastNoteOffTick, tick);
+            } else if (hi == 0x90) {
+                ticks.lastNoteOnTick = std::max(ticks.lastNoteOnTick, tick);
+            }
+
+            break;
+        }
+        case 0xc0:
+        case 0xd0: {
+            break;
+        }
+        case 0xf0: {
+
+            if (lo == 0x00) {
+
+                while (b != 0xf7) {
+
+                    CHECK(1 <= (trackEnd - it2), "out of data");
+
+                    b = *it2++;
+                }
+
+                break;
+            }
+
+            CHECK(lo == 0x0f, "unrecognized event byte: %d (0x%02x)", (hi | lo), (hi | lo));
 
-    void operator()(const NoteOnEvent &e) {
-        
-        runningTick += e.deltaTime;
+            auto type = b;
 
-        if (runningTick > lastNoteOnTick) {
-            lastNoteOnTick = runningTick;
-        }
-    }
+            int32_t dataLen;
 
-    void operator()(const ControlChangeEvent &e) {
-        runningTick += e.deltaTime;
-    }
+            ret = parseVLQ(it2, trackEnd, dataLen);
 
-    void operator()(const MetaEvent &e) {
+            if (ret != OK) {
+                return ret;
+            }
 
-        switch (e.type) {
-        case M_SETTEMPO: {
+            CHECK(dataLen <= (trackEnd - it2), "out of data");
 
-            runningTick += e.deltaTime;
+            auto data = it2;
 
-            if (runningTick > lastTempoChangeTick) {
+            it2 += dataLen;
 
-                lastTempoChangeTick = runningTick;
+            switch (type) {
+            case M_TRACKNAME: {
 
-                auto it = e.data.cbegin();
+                out.trackNames.emplace_back(data, it2);
 
-                auto microsPerBeat = parseBE3(it);
+                break;
+            }
+            case M_SETTEMPO: {
 
-                //
-                // convert MicrosPerBeat -> MicrosPerTick
-                //
-                lastMicrosPerTick = rational(microsPerBeat) / division;
+                CHECK(dataLen == 3, "bad tempo length: %d", dataLen);
+
+                out.tempoMap.push_back(midi_tempo_change{ static_cast<int32_t>(tick), parseBE3(data) });
+
+                break;
             }
+            case M_ENDOFTRACK: {
 
-            break;
-        }
-        case M_ENDOFTRACK: {
+                ticks.lastEndOfTrackTick = std::max(ticks.lastEndOfTrackTick, tick);
 
-            runningTick += e.deltaTime;
+                if (it2 != trackEnd) {
+                    LOGW("bytes after EndOfTrack: %zu", (trackEnd - it2));
+                }
 
-            if (runningTick > lastEndOfTrackTick) {
-                lastEndOfTrackTick = runningTick;
+                return OK;
+            }
             }
 
             break;
         }
         default: {
 
-            runningTick += e.deltaTime;
-            
-            break;
+            LOGE("unrecognized event byte: %d (0x%02x)", (hi | lo), (hi | lo));
+
+            return ERR;
         }
         }
     }
+}
 
-    void operator()(const PolyphonicKeyPressureEvent &e) {
-        runningTick += e.deltaTime;
-    }
-
-    void operator()(const ChannelPressureEvent &e) {
-        runningTick += e.deltaTime;
-    }
 
-    void operator()(const SysExEvent &e) {
-        runningTick += e.deltaTime;
-    }
-};
+//
+// keep the last change at each tick, like the map in midiFileTimes
+//
+void normalizeTempoMap(std::vector<midi_tempo_change> &tempoMap) {
 
+    std::stable_sort(tempoMap.begin(), tempoMap.end(), [](const midi_tempo_change &a, const midi_tempo_change &b) { return a.tick < b.tick; });
 
-midi_file_times
-midiFileTimes(const midi_file &m) {
+    auto last = std::unique(tempoMap.rbegin(), tempoMap.rend(), [](const midi_tempo_change &a, const midi_tempo_change &b) { return a.tick == b.tick; });
 
-    //
-    // first build tempo map
-    //
+    tempoMap.erase(tempoMap.begin(), last.base());
+}
 
-    //
-    // tick -> microsPerTick
-    //
-    std::map<rational, rational> tempoMap;
 
-    EventFileTimesTempoMapVisitor eventFileTimesTempoMapVisitor{ m.header.division, tempoMap, 0, 0 };
+std::vector<midi_tempo_change> midiFileTempoMap(const midi_file &m) {
 
-    for (size_t track = 0; track < m.tracks.size(); track++) {
+    std::vector<midi_tempo_change> tempoMap;
 
-        const auto &t = m.tracks[track];
+    for (const auto &track : m.tracks) {
 
-        eventFileTimesTempoMapVisitor.track = static_cast<uint16_t>(track);
-        eventFileTimesTempoMapVisitor.runningTick = 0;
+        int32_t tick = 0;
 
-        for (const auto &e : t) {
-            std::visit(eventFileTimesTempoMapVisitor, e);
-        }
-    }
+        for (const auto &event : track) {
 
+            tick += std::visit([](const auto &e) { return e.deltaTime; }, event);
 
-    EventFileTimesLastTicksVisitor v{ m.header.division, 0 };
+            const auto *meta = std::get_if<MetaEvent>(&event);
 
-    for (const auto &track : m.tracks) {
+            if (meta && meta->type == M_SETTEMPO && meta->data.size() == 3) {
 
-        v.runningTick = 0;
+                auto it = meta->data.cbegin();
 
-        for (const auto &e : track) {
-            std::visit(v, e);
+                tempoMap.push_back(midi_tempo_change{ tick, parseBE3(it) });
+            }
         }
     }
 
+    normalizeTempoMap(tempoMap);
 
-    //
-    // insert actual ticks for these events
-    //
+    return tempoMap;
+}
 
-    if (v.lastNoteOnTick != -1) {
-        auto it = last_found(tempoMap, v.lastNoteOnTick);
-        tempoMap[v.lastNoteOnTick] = it->second;
-    }
 
-    if (v.lastNoteOffTick != -1) {
-        auto it = last_found(tempoMap, v.lastNoteOffTick);
-        tempoMap[v.lastNoteOffTick] = it->second;
+//
+// microseconds are summed as ticks * MicrosPerBeat, and divided by division only at the end
+//
+// like midiFileTimes, ticks before the first tempo change take no time
+//
+double
+probeMicrosAt(
+    const std::vector<midi_tempo_change> &tempoMap,
+    uint16_t division,
+    int64_t tick) {
+
+    if (tick == -1) {
+        return -1;
     }
 
-    if (v.lastEndOfTrackTick != -1) {
-        auto it = last_found(tempoMap, v.lastEndOfTrackTick);
-        tempoMap[v.lastEndOfTrackTick] = it->second;
-    }
+    int64_t acc = 0;
 
-    //
-    // compute actual times for events
-    //
+    int64_t lastTick = 0;
 
-    rational runningMicros = 0;
-    rational lastNoteOnMicros = -1;
-    rational lastNoteOffMicros = -1;
-    rational lastEndOfTrackMicros = -1;
+    int64_t microsPerBeat = 0;
 
-    rational lastTick = 0;
-    rational lastMicrosPerTick = 0;
-    for (const auto &x : tempoMap) {
+    for (const auto &change : tempoMap) {
 
-        auto tick = x.first;
-        auto microsPerTick = x.second;
+        if (change.tick > tick) {
+            break;
+        }
 
-        runningMicros += ((tick - lastTick) * lastMicrosPerTick);
+        acc += (change.tick - lastTick) * microsPerBeat;
 
-        if (tick == v.lastNoteOnTick) {
-            lastNoteOnMicros = runningMicros;
-        }
-        if (tick == v.lastNoteOffTick) {
-            lastNoteOffMicros = runningMicros;
-        }
-        if (tick == v.lastEndOfTrackTick) {
-            lastEndOfTrackMicros = runningMicros;
-        }
+        lastTick = change.tick;
 
-        lastTick = tick;
-        lastMicrosPerTick = microsPerTick;
+        microsPerBeat = change.microsPerBeat;
     }
 
-    midi_file_times times = {
-        lastNoteOnMicros.to_double(), lastNoteOffMicros.to_double(), lastEndOfTrackMicros.to_double(),
-        v.lastNoteOnTick.to_int32(), v.lastNoteOffTick.to_int32(), v.lastEndOfTrackTick.to_int32()
-    };
+    acc += (tick - lastTick) * microsPerBeat;
 
-    return times;
+    return static_cast<double>(acc) / division;
 }
 
 
-std::string
-midiFileInfo(const midi_file &m) {
-
-    std::string acc;
-    
-    char buf[100];
-
-    std::snprintf(buf, sizeof(buf), "header:\n");
-    acc += buf;
+Status
+probeMidiBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    midi_probe &out) {
 
-    std::snprintf(buf, sizeof(buf), "Format: %d\n", m.header.format);
-    acc += buf;
+    out.trackNames.clear();
+    out.tempoMap.clear();
 
-    std::snprintf(buf, sizeof(buf), "Track Count: %d\n", m.header.trackCount);
-    acc += buf;
+    CHECK(4 + 4 + 2 + 2 + 2 <= (end - it), "out of data");
 
-    std::snprintf(buf, sizeof(buf), "Division: %d\n", m.header.division);
-    acc += buf;
+    CHECK(std::memcmp(&*it, S_MTHD.c_str(), 4) == 0, "expected MThd type");
 
+    it += 4;
 
-    std::snprintf(buf, sizeof(buf), "events:\n");
-    acc += buf;
+    auto len = static_cast<int32_t>(parseBE4(it));
 
-    for (const auto &track : m.tracks) {
+    CHECK(len >= 2 + 2 + 2, "bad header length: %d", len);
 
-        for (const auto &e : track) {
-            std::visit([&](auto&& e) {
-                using T = std::decay_t<decltype(e)>;
-                if constexpr (std::is_same_v<T, MetaEvent>) {
-                    switch (e.type) {
-                    case M_TRACKNAME: {
+    CHECK(len <= (end - it), "out of data");
 
-                        std::string str{ e.data.cbegin(), e.data.cend() };
+    auto headerEnd = it + len;
 
-                        std::snprintf(buf, sizeof(buf), "Track Name: %s\n", str.c_str());
-                        acc += buf;
+    out.header.format = parseBE2(it);
 
-                        break;
-                    }
-                    case M_TIMESIGNATURE: {
+    out.header.trackCount = parseBE2(it);
 
-                        auto numerator = e.data[0];
-                        auto denominator = e.data[1];
-                        auto ticksPerBeat = e.data[2];
-                        auto notated32notesPerBeat = e.data[3];
+    out.header.division = parseBE2(it);
 
-                        std::snprintf(buf, sizeof(buf), "Time Signature Numerator: %d\n", numerator);
-                        acc += buf;
+    it = headerEnd;
 
-                        std::snprintf(buf, sizeof(buf), "Time Signature Denominator: %d\n", denominator);
-                        acc += buf;
+    probe_ticks ticks;
 
-                        std::snprintf(buf, sizeof(buf), "Time Signature Ticks Per Beat: %d\n", ticksPerBeat);
-                        acc += buf;
+    for (int i = 0; i < out.header.trackCount; i++) {
 
-                        std::snprintf(buf, sizeof(buf), "Time Signature 32nd notes Per Beat: %d\n", notated32notesPerBeat);
-                        acc += buf;
+        Status ret = probeTrack(it, end, ticks, out);
 
-                        break;
-                    }
-                    }
-                }
-            }, e);
+        if (ret != OK) {
+            return ret;
         }
     }
 
-    auto times = midiFileTimes(m);
-
-    std::snprintf(buf, sizeof(buf), "times:                      h:mm:sssss\n");
-    acc += buf;
-
-    if (times.lastNoteOnMicros != -1) {
-
-        double lastNoteOnSec = times.lastNoteOnMicros / 1e6;
-        double lastNoteOnMin = lastNoteOnSec / 60.0;
-        double lastNoteOnHr = lastNoteOnMin / 60.0;
-
-        std::snprintf(buf, sizeof(buf), "       last Note On (wall): %d:%02d:%05.2f\n", static_cast<int>(std::floor(lastNoteOnHr)), static_cast<int>(std::floor(std::fmod(lastNoteOnMin, 60.0))), std::fmod(lastNoteOnSec, 60.0));
-        acc += buf;
-
-    } else {
-
-        std::snprintf(buf, sizeof(buf), "       last Note On (wall): (none)\n");
-        acc += buf;
-    }
+    normalizeTempoMap(out.tempoMap);
 
-    if (times.lastNoteOffMicros != -1) {
+    out.times = {
+        probeMicrosAt(out.tempoMap, out.header.division, ticks.lastNoteOnTick),
+        probeMicrosAt(out.tempoMap, out.header.division, ticks.lastNoteOffTick),
+        probeMicrosAt(out.tempoMap, out.header.division, ticks.lastEndOfTrackTick),
+        static_cast<int32_t>(ticks.lastNoteOnTick),
+        static_cast<int32_t>(ticks.lastNoteOffTick),
+        static_cast<int32_t>(ticks.lastEndOfTrackTick)
+    };
 
-        double lastNoteOffSec = times.lastNoteOffMicros / 1e6;
-        double lastNoteOffMin = lastNoteOffSec / 60.0;
-        double lastNoteOffHr = lastNoteOffMin / 60.0;
-        std::snprintf(buf, sizeof(buf), "      last Note Off (wall): %d:%02d:%05.2f\n", static_cast<int>(std::floor(lastNoteOffHr)), static_cast<int>(std::floor(std::fmod(lastNoteOffMin, 60.0))), std::fmod(lastNoteOffSec, 60.0));
-        acc += buf;
+    return OK;
+}
 
-    } else {
 
-        std::snprintf(buf, sizeof(buf), "      last Note Off (wall): (none)\n");
-        acc += buf;
-    }
+std::string
+midiProbeInfo(const midi_probe &p) {
 
-    if (times.lastEndOfTrackMicros != -1) {
-        
-        double lastEndOfTrackSec = times.lastEndOfTrackMicros / 1e6;
-        double lastEndOfTrackMin = lastEndOfTrackSec / 60.0;
-        double lastEndOfTrackHr = lastEndOfTrackMin / 60.0;
-        std::snprintf(buf, sizeof(buf), "  last End Of Track (wall): %d:%02d:%05.2f\n", static_cast<int>(std::floor(lastEndOfTrackHr)), static_cast<int>(std::floor(std::fmod(lastEndOfTrackMin, 60.0))), std::fmod(lastEndOfTrackSec, 60.0));
-        acc += buf;
+    std::string acc;
 
-    } else {
-        std::snprintf(buf, sizeof(buf), "  last End Of Track (wall): (none)\n");
-        acc += buf;
-    }
+    char buf[100];
 
-    std::snprintf(buf, sizeof(buf), "     last Note On (micros): %.17f\n", times.lastNoteOnMicros);
+    std::snprintf(buf, sizeof(buf), "header:\n");
     acc += buf;
 
-    std::snprintf(buf, sizeof(buf), "    last Note Off (micros): %.17f\n", times.lastNoteOffMicros);
+    std::snprintf(buf, sizeof(buf), "Format: %d\n", p.header.format);
     acc += buf;
 
-    std::snprintf(buf, sizeof(buf), "last End Of Track (micros): %.17f\n", times.lastEndOfTrackMicros);
+    std::snprintf(buf, sizeof(buf), "Track Count: %d\n", p.header.trackCount);
     acc += buf;
 
-
-    std::snprintf(buf, sizeof(buf), "      last Note On (ticks): %d\n", times.lastNoteOnTick);
+    std::snprintf(buf, sizeof(buf), "Division: %d\n", p.header.division);
     acc += buf;
 
-    std::snprintf(buf, sizeof(buf), "     last Note Off (ticks): %d\n", times.lastNoteOffTick);
-    acc += buf;
 
-    std::snprintf(buf, sizeof(buf), " last End Of Track (ticks): %d\n", times.lastEndOfTrackTick);
+    std::snprintf(buf, sizeof(buf), "events:\n");
     acc += buf;
 
+    for (const auto &name : p.trackNames) {
 
-    return acc;
-}
+        std::snprintf(buf, sizeof(buf), "Track Name: %s\n", name.c_str());
+        acc += buf;
+    }
 
+    std::snprintf(buf, sizeof(buf), "tempo map:\n");
+    acc += buf;
 
+    for (const auto &change : p.tempoMap) {
 
+        std::snprintf(buf, sizeof(buf), "%d: %u (%.2f bpm)\n", change.tick, change.microsPerBeat, (60000000.0 / change.microsPerBeat));
+        acc += buf;
+    }
 
+    appendTimesInfo(p.times, acc);
 
+    return acc;
+}
 
 
 
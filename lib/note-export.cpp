@@ -0,0 +1,760 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/note-export.h"
+
+#include "tbt-parser/song-context.h"
+#include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/tbt.h"
+#include "tbt-parser/trace.h"
+
+#include "rational/rational.h"
+
+#undef NDEBUG
+
+#include "common/abort.h"
+#include "common/assert.h"
+#include "common/check.h"
+#include "common/logging.h"
+
+#include <algorithm> // for min
+#include <array>
+#include <bit> // for endian
+#include <charconv> // for to_chars
+#include <variant> // for get
+#include <type_traits>
+#include <cerrno>
+#include <cmath> // for llround
+#include <cstdio> // for fopen, fwrite
+#include <cstring> // for strerror, strlen
+
+
+#include "song-context.inl"
+#include "space-cursor.inl"
+
+
+#define TAG "note-export"
+
+
+size_t note_table::size() const {
+    return track.size();
+}
+
+
+void note_table::clear() {
+    track.clear();
+    space.clear();
+    actual_space.clear();
+    tick.clear();
+    micros.clear();
+    string.clear();
+    fret.clear();
+    midi_pitch.clear();
+    effect.clear();
+    duration.clear();
+}
+
+
+const rational NOTE_TICKS_PER_SPACE = 48;
+
+const uint8_t NOTE_MUTED = 0xff;
+
+
+//
+// tempo in effect from actualSpace on
+//
+struct tempo_segment {
+    rational actualSpace;
+    double micros;
+    double microsPerSpace;
+};
+
+
+double microsPerSpaceOf(uint16_t tempoBPM) {
+
+    //
+    // same integer MicrosPerBeat as MIDI conversion
+    //
+    auto microsPerBeat = (60000000u / tempoBPM);
+
+    return microsPerBeat / 4.0;
+}
+
+
+template <uint8_t VERSION, typename tbt_file_t>
+void
+computeTempoSegments(
+    const tbt_file_t &t,
+    const std::vector<tempo_change> &tempoMap,
+    std::vector<tempo_segment> &segments) {
+
+    uint16_t tempoBPM;
+    if constexpr (0x6e <= VERSION) {
+        tempoBPM = t.header.tempo2;
+    } else {
+        tempoBPM = t.header.tempo1;
+    }
+
+    segments.push_back({ 0, 0.0, microsPerSpaceOf(tempoBPM) });
+
+    for (const auto &change : tempoMap) {
+
+        const auto &last = segments.back();
+
+        auto micros = last.micros + (change.actualSpace - last.actualSpace).to_double() * last.microsPerSpace;
+
+        segments.push_back({ change.actualSpace, micros, microsPerSpaceOf(change.tempo) });
+    }
+}
+
+
+//
+// segments are visited in order, so the cursor only moves forward within a track
+//
+int64_t
+microsAt(
+    const std::vector<tempo_segment> &segments,
+    size_t &cursor,
+    const rational &actualSpace) {
+
+    if (actualSpace < segments[cursor].actualSpace) {
+        cursor = 0;
+    }
+
+    while (cursor + 1 < segments.size() && !(actualSpace < segments[cursor + 1].actualSpace)) {
+        cursor++;
+    }
+
+    const auto &s = segments[cursor];
+
+    return std::llround(s.micros + (actualSpace - s.actualSpace).to_double() * s.microsPerSpace);
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, uint8_t STRINGS_PER_TRACK, typename tbt_file_t>
+void
+TbuildNoteTable(
+    const tbt_file_t &t,
+    const tbt_song_context::impl &ctx,
+    note_table &out) {
+
+    std::vector<tempo_segment> segments;
+
+    computeTempoSegments<VERSION>(t, ctx.tempoMap, segments);
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        const auto &trackMetadata = t.metadata.tracks[track];
+
+        const auto &maps = t.body.mapsList[track];
+
+        const auto &midiNoteOffsetArray = ctx.midiNoteOffsetArrays[track];
+
+        uint16_t trackSpaceCount;
+        if constexpr (0x70 <= VERSION) {
+            //
+            // stored as 32-bit int, so must be cast
+            //
+            trackSpaceCount = static_cast<uint16_t>(trackMetadata.spaceCount);
+        } else if constexpr (VERSION == 0x6f) {
+            trackSpaceCount = t.header.spaceCount;
+        } else {
+            trackSpaceCount = 4000;
+        }
+
+        //
+        // only 0x72 can change Don't Let Ring during the song
+        //
+        bool dontLetRing = ((trackMetadata.cleanGuitar & 0b10000000) == 0b10000000);
+
+        space_cursor trackEffectChangesCursor(trackEffectChangesOf<VERSION>(maps));
+
+        //
+        // string -> row of the note that is ringing, or SIZE_MAX
+        //
+        std::array<size_t, STRINGS_PER_TRACK> ringing;
+
+        ringing.fill(SIZE_MAX);
+
+        auto stop = [&](uint8_t string, int64_t tick) {
+
+            auto row = ringing[string];
+
+            if (row != SIZE_MAX) {
+                out.duration[row] = tick - out.tick[row];
+                ringing[string] = SIZE_MAX;
+            }
+        };
+
+        size_t segmentCursor = 0;
+
+        rational actualSpace = 0;
+
+        for (uint16_t space = 0; space < trackSpaceCount;) {
+
+            if constexpr (VERSION == 0x72) {
+
+                for (const auto &change : trackEffectChangesCursor.at(space)) {
+
+                    if (change.effect == TE_INSTRUMENT) {
+                        dontLetRing = ((change.value & 0b0000000010000000) == 0b0000000010000000);
+                    }
+                }
+            }
+
+            const auto &notesMapIt = maps.notesMap.find(space);
+
+            if (notesMapIt != maps.notesMap.end()) {
+
+                const auto &vsqs = notesMapIt->second;
+
+                int64_t tick = (actualSpace * NOTE_TICKS_PER_SPACE).round().to_int32();
+
+                if (dontLetRing) {
+
+                    //
+                    // an event on any string stops all strings
+                    //
+                    for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+
+                        if (vsqs[string] != 0) {
+
+                            for (uint8_t s = 0; s < trackMetadata.stringCount; s++) {
+                                stop(s, tick);
+                            }
+
+                            break;
+                        }
+                    }
+                }
+
+                for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+
+                    auto event = vsqs[string];
+
+                    if (event == 0) {
+                        continue;
+                    }
+
+                    stop(string, tick);
+
+                    if (event == STOPPED) {
+                        continue;
+                    }
+
+                    ASSERT(0x80 <= event || event == MUTED);
+
+                    bool muted = (event == MUTED);
+
+                    auto fret = static_cast<uint8_t>(muted ? NOTE_MUTED : (event - 0x80));
+
+                    //
+                    // offsets apply to the event, which is 0x80 + fret
+                    //
+                    auto pitch = static_cast<uint8_t>(muted ? NOTE_MUTED : (event + midiNoteOffsetArray[string]));
+
+                    auto row = out.size();
+
+                    out.track.push_back(track);
+                    out.space.push_back(space);
+                    out.actual_space.push_back(actualSpace.to_double());
+                    out.tick.push_back(tick);
+                    out.micros.push_back(microsAt(segments, segmentCursor, actualSpace));
+                    out.string.push_back(string);
+                    out.fret.push_back(fret);
+                    out.midi_pitch.push_back(pitch);
+                    out.effect.push_back(vsqs[STRINGS_PER_TRACK + string]);
+                    out.duration.push_back(0);
+
+                    //
+                    // muted notes do not ring
+                    //
+                    if (!muted) {
+                        ringing[string] = row;
+                    }
+                }
+            }
+
+            //
+            // Compute actual space
+            //
+            if constexpr (HASALTERNATETIMEREGIONS) {
+
+                const auto &alternateTimeRegionsIt = maps.alternateTimeRegionsMap.find(space);
+                if (alternateTimeRegionsIt != maps.alternateTimeRegionsMap.end()) {
+
+                    const auto &alternateTimeRegion = alternateTimeRegionsIt->second;
+
+                    actualSpace += rational{ alternateTimeRegion[0], alternateTimeRegion[1] };
+
+                } else {
+
+                    ++actualSpace;
+                }
+
+            } else {
+
+                ++actualSpace;
+            }
+
+            space++;
+        }
+
+        int64_t endTick = (actualSpace * NOTE_TICKS_PER_SPACE).round().to_int32();
+
+        for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+            stop(string, endTick);
+        }
+    }
+}
+
+
+Status
+buildNoteTable(
+    const tbt_song_context &songContext,
+    note_table &out) {
+
+    trace_span span("note table");
+
+    out.clear();
+
+    const auto &ctx = songContext.internals();
+
+    const auto &t = *ctx.file;
+
+    auto versionNumber = ctx.versionNumber;
+
+    switch (versionNumber) {
+    case 0x72: {
+
+        const auto &t71 = std::get<tbt_file71>(t);
+        
+        if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            TbuildNoteTable<0x72, true, 8>(t71, ctx, out);
+        } else {
+            TbuildNoteTable<0x72, false, 8>(t71, ctx, out);
+        }
+
+        return OK;
+    }
+    case 0x71: {
+        
+        const auto &t71 = std::get<tbt_file71>(t);
+        
+        if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            TbuildNoteTable<0x71, true, 8>(t71, ctx, out);
+        } else {
+            TbuildNoteTable<0x71, false, 8>(t71, ctx, out);
+        }
+
+        return OK;
+    }
+    case 0x70: {
+        
+        const auto &t70 = std::get<tbt_file70>(t);
+        
+        if ((t70.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            TbuildNoteTable<0x70, true, 8>(t70, ctx, out);
+        } else {
+            TbuildNoteTable<0x70, false, 8>(t70, ctx, out);
+        }
+
+        return OK;
+    }
+    case 0x6f: {
+        
+        const auto &t6f = std::get<tbt_file6f>(t);
+        
+        TbuildNoteTable<0x6f, false, 8>(t6f, ctx, out);
+
+        return OK;
+    }
+    case 0x6e: {
+        
+        const auto &t6e = std::get<tbt_file6e>(t);
+        
+        TbuildNoteTable<0x6e, false, 8>(t6e, ctx, out);
+
+        return OK;
+    }
+    case 0x6b: {
+        
+        const auto &t6b = std::get<tbt_file6b>(t);
+        
+        TbuildNoteTable<0x6b, false, 8>(t6b, ctx, out);
+
+        return OK;
+    }
+    case 0x6a: {
+        
+        const auto &t6a = std::get<tbt_file6a>(t);
+        
+        TbuildNoteTable<0x6a, false, 6>(t6a, ctx, out);
+
+        return OK;
+    }
+    case 0x69: {
+        
+        const auto &t68 = std::get<tbt_file68>(t);
+        
+        TbuildNoteTable<0x69, false, 6>(t68, ctx, out);
+
+        return OK;
+    }
+    case 0x68: {
+        
+        const auto &t68 = std::get<tbt_file68>(t);
+        
+        TbuildNoteTable<0x68, false, 6>(t68, ctx, out);
+
+        return OK;
+    }
+    case 0x67: {
+        
+        const auto &t65 = std::get<tbt_file65>(t);
+        
+        TbuildNoteTable<0x67, false, 6>(t65, ctx, out);
+
+        return OK;
+    }
+    case 0x66: {
+        
+        const auto &t65 = std::get<tbt_file65>(t);
+        
+        TbuildNoteTable<0x66, false, 6>(t65, ctx, out);
+
+        return OK;
+    }
+    case 0x65: {
+        
+        const auto &t65 = std::get<tbt_file65>(t);
+        
+        TbuildNoteTable<0x65, false, 6>(t65, ctx, out);
+
+        return OK;
+    }
+    default:
+        ABORT("invalid versionNumber: 0x%02x", versionNumber);
+    }
+}
+
+
+Status
+buildNoteTable(
+    const tbt_file &t,
+    note_table &out) {
+
+    //
+    // repeat warnings do not matter for notes
+    //
+    tbt_diagnostics diagnostics;
+
+    tbt_song_context ctx;
+
+    Status ret = analyzeTbtFile(t, tbt_analyze_opts{ &diagnostics }, ctx);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return buildNoteTable(ctx, out);
+}
+
+
+//
+// appends to a vector
+//
+struct vector_sink {
+
+    std::vector<uint8_t> &out;
+
+    void write(const void *data, size_t len) {
+
+        auto p = static_cast<const uint8_t *>(data);
+
+        out.insert(out.end(), p, p + len);
+    }
+
+    Status finish() {
+        return OK;
+    }
+};
+
+
+//
+// writes to a file through a fixed-size buffer
+//
+class buffered_file_sink {
+public:
+
+    explicit buffered_file_sink(FILE *file) : file(file), used(0), failed(false) {}
+
+    void write(const void *data, size_t len) {
+
+        auto p = static_cast<const uint8_t *>(data);
+
+        while (len > 0) {
+
+            if (used == buf.size()) {
+                flush();
+            }
+
+            auto n = std::min(len, buf.size() - used);
+
+            std::memcpy(buf.data() + used, p, n);
+
+            used += n;
+            p += n;
+            len -= n;
+        }
+    }
+
+    Status finish() {
+
+        flush();
+
+        return failed ? ERR : OK;
+    }
+
+private:
+
+    void flush() {
+
+        if (used != 0 && std::fwrite(buf.data(), 1, used, file) != used) {
+            failed = true;
+        }
+
+        used = 0;
+    }
+
+    FILE *file;
+    std::array<uint8_t, 64 * 1024> buf;
+    size_t used;
+    bool failed;
+};
+
+
+//
+// every field fits in a fixed-size line, so rows are formatted without allocating
+//
+template <typename Sink>
+void
+writeCsv(
+    const note_table &notes,
+    Sink &sink) {
+
+    const char *header = "track,space,actual_space,tick,micros,string,fret,midi_pitch,effect,duration\n";
+
+    sink.write(header, std::strlen(header));
+
+    std::array<char, 256> line;
+
+    for (size_t i = 0; i < notes.size(); i++) {
+
+        auto *p = line.data();
+        auto *end = line.data() + line.size();
+
+        auto field = [&](auto v, char sep) {
+            p = std::to_chars(p, end, v).ptr;
+            *p++ = sep;
+        };
+
+        field(notes.track[i], ',');
+        field(notes.space[i], ',');
+        field(notes.actual_space[i], ',');
+        field(notes.tick[i], ',');
+        field(notes.micros[i], ',');
+        field(notes.string[i], ',');
+        field(notes.fret[i], ',');
+        field(notes.midi_pitch[i], ',');
+        field(notes.effect[i], ',');
+        field(notes.duration[i], '\n');
+
+        sink.write(line.data(), static_cast<size_t>(p - line.data()));
+    }
+}
+
+
+template <typename Sink, typename T>
+void
+writeLE(Sink &sink, T v) {
+
+    std::array<uint8_t, sizeof(T)> bytes;
+
+    uint64_t u;
+
+    if constexpr (std::is_floating_point_v<T>) {
+        static_assert(sizeof(T) == sizeof(uint64_t));
+        std::memcpy(&u, &v, sizeof(u));
+    } else {
+        u = static_cast<uint64_t>(v);
+    }
+
+    for (size_t i = 0; i < sizeof(T); i++) {
+        bytes[i] = static_cast<uint8_t>(u >> (8 * i));
+    }
+
+    sink.write(bytes.data(), bytes.size());
+}
+
+
+template <typename Sink, typename T>
+void
+writeColumn(
+    Sink &sink,
+    const char *name,
+    uint8_t type,
+    const std::vector<T> &values) {
+
+    auto len = static_cast<uint8_t>(std::strlen(name));
+
+    sink.write(&len, 1);
+    sink.write(name, len);
+    sink.write(&type, 1);
+
+    if constexpr (std::endian::native == std::endian::little) {
+
+        sink.write(values.data(), values.size() * sizeof(T));
+
+    } else {
+
+        for (const auto &v : values) {
+            writeLE(sink, v);
+        }
+    }
+}
+
+
+const uint8_t COLUMN_UINT8 = 0;
+const uint8_t COLUMN_UINT16 = 1;
+const uint8_t COLUMN_INT64 = 2;
+const uint8_t COLUMN_FLOAT64 = 3;
+
+
+template <typename Sink>
+void
+writeColumnar(
+    const note_table &notes,
+    Sink &sink) {
+
+    sink.write("TBTN", 4);
+
+    writeLE(sink, static_cast<uint32_t>(1)); // format version
+    writeLE(sink, static_cast<uint64_t>(notes.size()));
+    writeLE(sink, static_cast<uint32_t>(10)); // column count
+
+    writeColumn(sink, "track", COLUMN_UINT8, notes.track);
+    writeColumn(sink, "space", COLUMN_UINT16, notes.space);
+    writeColumn(sink, "actual_space", COLUMN_FLOAT64, notes.actual_space);
+    writeColumn(sink, "tick", COLUMN_INT64, notes.tick);
+    writeColumn(sink, "micros", COLUMN_INT64, notes.micros);
+    writeColumn(sink, "string", COLUMN_UINT8, notes.string);
+    writeColumn(sink, "fret", COLUMN_UINT8, notes.fret);
+    writeColumn(sink, "midi_pitch", COLUMN_UINT8, notes.midi_pitch);
+    writeColumn(sink, "effect", COLUMN_UINT8, notes.effect);
+    writeColumn(sink, "duration", COLUMN_INT64, notes.duration);
+}
+
+
+template <typename Sink>
+Status
+writeNoteTable(
+    const note_table &notes,
+    note_export_format format,
+    Sink &sink) {
+
+    trace_span span("export notes");
+
+    switch (format) {
+    case NOTE_EXPORT_CSV:
+        writeCsv(notes, sink);
+        break;
+    case NOTE_EXPORT_COLUMNAR:
+        writeColumnar(notes, sink);
+        break;
+    default:
+        LOGE("invalid format: %d", format);
+        return ERR;
+    }
+
+    return sink.finish();
+}
+
+
+Status
+exportNoteTableBytes(
+    const note_table &notes,
+    note_export_format format,
+    std::vector<uint8_t> &out) {
+
+    out.clear();
+
+    //
+    // a CSV row is about 40 bytes, and a columnar row is 36 bytes
+    //
+    out.reserve(128 + 40 * notes.size());
+
+    vector_sink sink{ out };
+
+    return writeNoteTable(notes, format, sink);
+}
+
+
+Status
+exportNoteTableFile(
+    const note_table &notes,
+    note_export_format format,
+    const char *path) {
+
+    FILE *file = std::fopen(path, "wb");
+
+    if (!file) {
+        LOGE("cannot open file for writing: %s: %s", path, std::strerror(errno));
+        return ERR;
+    }
+
+    Status ret;
+
+    {
+        buffered_file_sink sink(file);
+
+        ret = writeNoteTable(notes, format, sink);
+    }
+
+    if (std::fclose(file) != 0) {
+        ret = ERR;
+    }
+
+    if (ret != OK) {
+        LOGE("cannot write file: %s", path);
+    }
+
+    return ret;
+}
+
+
+
+
+
+
+
+
+
+
+
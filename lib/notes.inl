@@ -25,65 +25,145 @@
 //
 
 
+//
+// parse the notes of one track
+//
+// if expand is false, then the notes are only counted, to find where the next track starts
+//
 template <uint8_t VERSION, typename tbt_file_t, size_t STRINGS_PER_TRACK>
 Status
-parseNotesMapList(
+parseNotesMap(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
+    uint8_t track,
+    bool expand,
     tbt_file_t &out) {
 
-    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+    uint16_t trackSpaceCount;
+    if constexpr (0x70 <= VERSION) {
+        //
+        // stored as 32-bit int, so must be cast
+        //
+        trackSpaceCount = static_cast<uint16_t>(out.metadata.tracks[track].spaceCount);
+    } else if constexpr (VERSION == 0x6f) {
+        trackSpaceCount = out.header.spaceCount;
+    } else {
+        trackSpaceCount = 4000;
+    }
 
-        uint16_t trackSpaceCount;
-        if constexpr (0x70 <= VERSION) {
-            //
-            // stored as 32-bit int, so must be cast
-            //
-            trackSpaceCount = static_cast<uint16_t>(out.metadata.tracks[track].spaceCount);
-        } else if constexpr (VERSION == 0x6f) {
-            trackSpaceCount = out.header.spaceCount;
-        } else {
-            trackSpaceCount = 4000;
+    std::vector<uint8_t> notesDeltaListAcc;
+    uint32_t vsqCount = 0;
+
+    while (true) {
+
+        std::vector<uint8_t> deltaList;
+
+        Status ret = parseDeltaListChunk(it, end, deltaList);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        if (expand) {
+            notesDeltaListAcc.insert(notesDeltaListAcc.end(), deltaList.cbegin(), deltaList.cend());
+        }
+
+        ret = computeDeltaListCount(deltaList, &vsqCount);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        CHECK(vsqCount <= (STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4) * trackSpaceCount, "unhandled");
+
+        if (vsqCount == (STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4) * trackSpaceCount) {
+            break;
+        }
+    }
+
+    if (!expand) {
+        return OK;
+    }
+
+    trace_span span("expand notes", "track", track);
+
+    return expandDeltaList<STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4>(
+        notesDeltaListAcc,
+        vsqCount,
+        0,
+        out.body.mapsList[track].notesMap
+    );
+}
+
+
+//
+// keep only the tempo changes of a track, i.e., the track effect and tempo columns of 'T' and 't' effects
+//
+template <size_t STRINGS_PER_TRACK, typename notes_map_t>
+void
+keepTempoChanges(notes_map_t &notesMap) {
+
+    for (auto it = notesMap.begin(); it != notesMap.end();) {
+
+        auto &vsqs = it->second;
+
+        const auto trackEffect = vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 0];
+
+        if (trackEffect != 'T' && trackEffect != 't') {
+            it = notesMap.erase(it);
+            continue;
         }
 
-        std::vector<uint8_t> notesDeltaListAcc;
-        uint32_t vsqCount = 0;
+        const auto tempo = vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 3];
+
+        vsqs = {};
+
+        vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 0] = trackEffect;
+        vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 3] = tempo;
+
+        it++;
+    }
+}
+
+
+template <uint8_t VERSION, typename tbt_file_t, size_t STRINGS_PER_TRACK>
+Status
+parseNotesMapList(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_file_t &out) {
 
-        while (true) {
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
 
-            std::vector<uint8_t> deltaList;
+        if constexpr (0x72 <= VERSION) {
 
-            Status ret = parseDeltaListChunk(it, end, deltaList);
+            //
+            // unselected tracks are only counted, to find where the next track starts
+            //
+            Status ret = parseNotesMap<VERSION, tbt_file_t, STRINGS_PER_TRACK>(it, end, track, trackSelected(opts.selected_tracks, track), out);
 
             if (ret != OK) {
                 return ret;
             }
 
-            notesDeltaListAcc.insert(notesDeltaListAcc.end(), deltaList.cbegin(), deltaList.cend());
+        } else {
 
-            ret = computeDeltaListCount(deltaList, &vsqCount);
+            //
+            // before 0x72, tempo changes are stored with the notes, and the tempo map is computed from every track
+            //
+            // so unselected tracks are expanded, and only their tempo changes are kept
+            //
+            Status ret = parseNotesMap<VERSION, tbt_file_t, STRINGS_PER_TRACK>(it, end, track, true, out);
 
             if (ret != OK) {
                 return ret;
             }
 
-            CHECK(vsqCount <= (STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4) * trackSpaceCount, "unhandled");
-
-            if (vsqCount == (STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4) * trackSpaceCount) {
-                break;
+            if (!trackSelected(opts.selected_tracks, track)) {
+                keepTempoChanges<STRINGS_PER_TRACK>(out.body.mapsList[track].notesMap);
             }
         }
-
-        Status ret = expandDeltaList<STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4>(
-            notesDeltaListAcc,
-            vsqCount,
-            0,
-            out.body.mapsList[track].notesMap
-        );
-
-        if (ret != OK) {
-            return ret;
-        }
     }
 
     return OK;
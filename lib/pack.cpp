@@ -0,0 +1,742 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/pack.h"
+
+#undef NDEBUG
+
+#include "common/abort.h"
+#include "common/assert.h"
+#include "common/check.h"
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <algorithm> // for sort, lower_bound
+#include <cinttypes>
+#include <cstdio> // for snprintf
+#include <cstring> // for memcmp, strerror
+#include <iterator> // for begin, end
+#include <utility> // for move
+#include <variant> // for visit
+
+#if __has_include(<sys/mman.h>)
+#define TBTPARSER_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#define TBTPARSER_HAVE_MMAP 0
+#endif
+
+
+#define TAG "pack"
+
+
+const uint8_t PACK_MAGIC[8] = { 'T', 'B', 'T', 'P', 'A', 'C', 'K', '\0' };
+
+const uint32_t PACK_FORMAT_VERSION = 1;
+
+const size_t PACK_HEADER_SIZE = 48;
+
+const size_t PACK_INDEX_ENTRY_SIZE = 32;
+
+const size_t PACK_HASH_ENTRY_SIZE = 16;
+
+const size_t PACK_METADATA_ENTRY_SIZE = 16;
+
+
+void writePackLE2(uint16_t value, std::vector<uint8_t> &out) {
+    out.push_back(static_cast<uint8_t>(value & 0xff));
+    out.push_back(static_cast<uint8_t>((value >> 8) & 0xff));
+}
+
+
+void writePackLE4(uint32_t value, std::vector<uint8_t> &out) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>((value >> (8 * i)) & 0xff));
+    }
+}
+
+
+void writePackLE8(uint64_t value, std::vector<uint8_t> &out) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back(static_cast<uint8_t>((value >> (8 * i)) & 0xff));
+    }
+}
+
+
+void patchPackLE8(uint64_t value, size_t offset, std::vector<uint8_t> &out) {
+    for (size_t i = 0; i < 8; i++) {
+        out[offset + i] = static_cast<uint8_t>((value >> (8 * i)) & 0xff);
+    }
+}
+
+
+uint16_t readPackLE2(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+
+uint32_t readPackLE4(const uint8_t *p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+
+uint64_t readPackLE8(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+
+uint64_t tbtPackHash(std::span<const uint8_t> data) {
+
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (auto b : data) {
+        hash ^= b;
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+
+//
+// returns 0 for any field that cannot be computed
+//
+tbt_pack_metadata computePackMetadata(const tbt_pack_input &input) {
+
+    tbt_pack_metadata md{};
+
+    auto it = input.data.cbegin();
+
+    switch (input.kind) {
+    case PACK_TBT: {
+
+        tbt_file t;
+
+        Status ret = parseTbtBytes(it, input.data.cend(), t);
+
+        if (ret != OK) {
+            LOGW("%s: cannot parse, metadata is empty", input.name.c_str());
+            return md;
+        }
+
+        md.versionNumber = tbtFileVersionNumber(t);
+
+        md.trackCount = std::visit([](const auto &t) -> uint16_t {
+            return t.header.trackCount;
+        }, t);
+
+        midi_file m;
+
+        //
+        // diagnostics are collected and dropped, warnings were already seen when the file was converted on its own
+        //
+        tbt_diagnostics diagnostics;
+
+        midi_convert_opts opts;
+        opts.diagnostics = &diagnostics;
+
+        ret = convertToMidi(t, opts, m);
+
+        if (ret != OK) {
+            LOGW("%s: cannot convert, duration is 0", input.name.c_str());
+            return md;
+        }
+
+        md.durationMicros = static_cast<uint64_t>(midiFileTimes(m).lastEndOfTrackMicros);
+
+        return md;
+    }
+    case PACK_MIDI: {
+
+        midi_probe probe;
+
+        Status ret = probeMidiBytes(it, input.data.cend(), probe);
+
+        if (ret != OK) {
+            LOGW("%s: cannot probe, metadata is empty", input.name.c_str());
+            return md;
+        }
+
+        md.trackCount = probe.header.trackCount;
+
+        md.durationMicros = static_cast<uint64_t>(probe.times.lastEndOfTrackMicros);
+
+        return md;
+    }
+    default:
+        ABORT("invalid kind: %d", input.kind);
+    }
+}
+
+
+Status writeTbtPackBytes(std::vector<tbt_pack_input> inputs, const tbt_pack_write_opts &opts, std::vector<uint8_t> &out) {
+
+    CHECK(inputs.size() <= UINT32_MAX, "too many entries: %zu", inputs.size());
+
+    std::sort(inputs.begin(), inputs.end(), [](const tbt_pack_input &a, const tbt_pack_input &b) {
+        return a.name < b.name;
+    });
+
+    size_t namesSize = 0;
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+
+        const auto &input = inputs[i];
+
+        CHECK(!input.name.empty(), "empty name");
+
+        CHECK(input.name.size() <= UINT16_MAX, "name is too long: %s", input.name.c_str());
+
+        CHECK(input.kind == PACK_TBT || input.kind == PACK_MIDI, "invalid kind: %d", input.kind);
+
+        CHECK(i == 0 || inputs[i - 1].name != input.name, "duplicate name: %s", input.name.c_str());
+
+        namesSize += input.name.size();
+    }
+
+    CHECK(namesSize <= UINT32_MAX, "names are too long: %zu", namesSize);
+
+    out.clear();
+
+    out.insert(out.end(), std::begin(PACK_MAGIC), std::end(PACK_MAGIC));
+    writePackLE4(PACK_FORMAT_VERSION, out);
+    writePackLE4(static_cast<uint32_t>(inputs.size()), out);
+
+    //
+    // offsets are patched after the sections are written
+    //
+    writePackLE8(0, out);
+    writePackLE8(0, out);
+    writePackLE8(0, out);
+    writePackLE8(0, out);
+
+    ASSERT(out.size() == PACK_HEADER_SIZE);
+
+    std::vector<uint64_t> blobOffsets;
+    blobOffsets.reserve(inputs.size());
+
+    for (const auto &input : inputs) {
+        blobOffsets.push_back(out.size());
+        out.insert(out.end(), input.data.cbegin(), input.data.cend());
+    }
+
+    std::vector<uint64_t> hashes;
+    hashes.reserve(inputs.size());
+
+    for (const auto &input : inputs) {
+        hashes.push_back(tbtPackHash(input.data));
+    }
+
+    auto indexOffset = static_cast<uint64_t>(out.size());
+
+    uint32_t nameOffset = 0;
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+
+        const auto &input = inputs[i];
+
+        writePackLE8(blobOffsets[i], out);
+        writePackLE8(input.data.size(), out);
+        writePackLE8(hashes[i], out);
+        writePackLE4(nameOffset, out);
+        writePackLE2(static_cast<uint16_t>(input.name.size()), out);
+        out.push_back(input.kind);
+        out.push_back(0);
+
+        nameOffset += static_cast<uint32_t>(input.name.size());
+    }
+
+    auto hashOffset = static_cast<uint64_t>(out.size());
+
+    std::vector<uint32_t> byHash(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        byHash[i] = static_cast<uint32_t>(i);
+    }
+
+    std::stable_sort(byHash.begin(), byHash.end(), [&hashes](uint32_t a, uint32_t b) {
+        return hashes[a] < hashes[b];
+    });
+
+    for (auto i : byHash) {
+        writePackLE8(hashes[i], out);
+        writePackLE4(i, out);
+        writePackLE4(0, out);
+    }
+
+    uint64_t metadataOffset = 0;
+
+    if (opts.include_metadata) {
+
+        metadataOffset = out.size();
+
+        for (const auto &input : inputs) {
+
+            auto md = computePackMetadata(input);
+
+            out.push_back(md.versionNumber);
+            out.push_back(0);
+            writePackLE2(md.trackCount, out);
+            writePackLE4(0, out);
+            writePackLE8(md.durationMicros, out);
+        }
+    }
+
+    auto namesOffset = static_cast<uint64_t>(out.size());
+
+    for (const auto &input : inputs) {
+        out.insert(out.end(), input.name.cbegin(), input.name.cend());
+    }
+
+    patchPackLE8(indexOffset, 16, out);
+    patchPackLE8(hashOffset, 24, out);
+    patchPackLE8(metadataOffset, 32, out);
+    patchPackLE8(namesOffset, 40, out);
+
+    return OK;
+}
+
+
+Status writeTbtPackFile(std::vector<tbt_pack_input> inputs, const tbt_pack_write_opts &opts, const char *path) {
+
+    std::vector<uint8_t> data;
+
+    Status ret = writeTbtPackBytes(std::move(inputs), opts, data);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return saveFile(path, data);
+}
+
+
+struct tbt_pack::impl {
+
+    //
+    // holds the pack when it is not mapped
+    //
+    std::vector<uint8_t> buf;
+
+    void *mapped = nullptr;
+    size_t mappedSize = 0;
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+    uint32_t count = 0;
+    uint64_t indexOffset = 0;
+    uint64_t hashOffset = 0;
+    uint64_t metadataOffset = 0;
+    uint64_t namesOffset = 0;
+
+    impl() = default;
+
+    ~impl() {
+#if TBTPARSER_HAVE_MMAP
+        if (mapped) {
+            munmap(mapped, mappedSize);
+        }
+#endif // TBTPARSER_HAVE_MMAP
+    }
+
+    impl(const impl &) = delete;
+    impl &operator=(const impl &) = delete;
+
+    const uint8_t *indexEntry(size_t i) const {
+        return data + indexOffset + i * PACK_INDEX_ENTRY_SIZE;
+    }
+
+    const uint8_t *hashEntry(size_t i) const {
+        return data + hashOffset + i * PACK_HASH_ENTRY_SIZE;
+    }
+
+    std::string_view name(size_t i) const {
+
+        const auto *e = indexEntry(i);
+
+        auto nameOffset = readPackLE4(e + 24);
+        auto nameLength = readPackLE2(e + 28);
+
+        return { reinterpret_cast<const char *>(data + namesOffset + nameOffset), nameLength };
+    }
+
+    Status validate();
+};
+
+
+//
+// true if [offset, offset + length) is within size, without overflowing
+//
+bool packRangeValid(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset <= size && length <= size - offset;
+}
+
+
+Status tbt_pack::impl::validate() {
+
+    CHECK(size >= PACK_HEADER_SIZE, "pack is corrupted. too small: %zu", size);
+
+    CHECK(std::memcmp(data, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0, "not a pack");
+
+    auto formatVersion = readPackLE4(data + 8);
+
+    CHECK(formatVersion == PACK_FORMAT_VERSION, "unsupported pack format version: %" PRIu32, formatVersion);
+
+    count = readPackLE4(data + 12);
+    indexOffset = readPackLE8(data + 16);
+    hashOffset = readPackLE8(data + 24);
+    metadataOffset = readPackLE8(data + 32);
+    namesOffset = readPackLE8(data + 40);
+
+    CHECK(packRangeValid(indexOffset, static_cast<uint64_t>(count) * PACK_INDEX_ENTRY_SIZE, size), "pack is corrupted. invalid name index");
+
+    CHECK(packRangeValid(hashOffset, static_cast<uint64_t>(count) * PACK_HASH_ENTRY_SIZE, size), "pack is corrupted. invalid hash index");
+
+    if (metadataOffset != 0) {
+        CHECK(packRangeValid(metadataOffset, static_cast<uint64_t>(count) * PACK_METADATA_ENTRY_SIZE, size), "pack is corrupted. invalid metadata");
+    }
+
+    CHECK(namesOffset <= size, "pack is corrupted. invalid names");
+
+    auto namesSize = size - namesOffset;
+
+    for (size_t i = 0; i < count; i++) {
+
+        const auto *e = indexEntry(i);
+
+        CHECK(packRangeValid(readPackLE8(e), readPackLE8(e + 8), size), "pack is corrupted. invalid blob of entry %zu", i);
+
+        CHECK(packRangeValid(readPackLE4(e + 24), readPackLE2(e + 28), namesSize), "pack is corrupted. invalid name of entry %zu", i);
+
+        auto kind = e[30];
+
+        CHECK(kind == PACK_TBT || kind == PACK_MIDI, "pack is corrupted. invalid kind of entry %zu: %d", i, kind);
+
+        CHECK(i == 0 || name(i - 1) < name(i), "pack is corrupted. name index is not sorted at entry %zu", i);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+
+        const auto *h = hashEntry(i);
+
+        auto position = readPackLE4(h + 8);
+
+        CHECK(position < count, "pack is corrupted. invalid hash index entry %zu", i);
+
+        CHECK(readPackLE8(h) == readPackLE8(indexEntry(position) + 16), "pack is corrupted. hash index entry %zu does not match", i);
+
+        CHECK(i == 0 || readPackLE8(hashEntry(i - 1)) <= readPackLE8(h), "pack is corrupted. hash index is not sorted at entry %zu", i);
+    }
+
+    return OK;
+}
+
+
+tbt_pack::tbt_pack() = default;
+
+tbt_pack::~tbt_pack() = default;
+
+tbt_pack::tbt_pack(tbt_pack &&) noexcept = default;
+
+tbt_pack &tbt_pack::operator=(tbt_pack &&) noexcept = default;
+
+
+Status tbt_pack::open(const char *path) {
+
+#if TBTPARSER_HAVE_MMAP
+
+    int fd = ::open(path, O_RDONLY);
+
+    if (fd == -1) {
+        LOGE("cannot open: %s: %s", path, std::strerror(errno));
+        return ERR;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1) {
+        LOGE("cannot stat: %s: %s", path, std::strerror(errno));
+        ::close(fd);
+        return ERR;
+    }
+
+    auto p = std::make_unique<impl>();
+
+    p->size = static_cast<size_t>(st.st_size);
+
+    if (p->size != 0) {
+
+        void *mapped = mmap(nullptr, p->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mapped == MAP_FAILED) {
+            LOGE("cannot map: %s: %s", path, std::strerror(errno));
+            ::close(fd);
+            return ERR;
+        }
+
+        p->mapped = mapped;
+        p->mappedSize = p->size;
+        p->data = static_cast<const uint8_t *>(mapped);
+    }
+
+    //
+    // the mapping stays valid after the descriptor is closed
+    //
+    ::close(fd);
+
+    Status ret = p->validate();
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    pimpl = std::move(p);
+
+    return OK;
+
+#else
+
+    std::vector<uint8_t> buf;
+
+    Status ret = openFile(path, buf);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return openBytes(std::move(buf));
+
+#endif // TBTPARSER_HAVE_MMAP
+}
+
+
+Status tbt_pack::openBytes(std::vector<uint8_t> data) {
+
+    auto p = std::make_unique<impl>();
+
+    p->buf = std::move(data);
+    p->data = p->buf.data();
+    p->size = p->buf.size();
+
+    Status ret = p->validate();
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    pimpl = std::move(p);
+
+    return OK;
+}
+
+
+size_t tbt_pack::size() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->count;
+}
+
+
+tbt_pack_entry tbt_pack::entry(size_t i) const {
+
+    ASSERT(pimpl);
+
+    ASSERT(i < pimpl->count);
+
+    const auto *e = pimpl->indexEntry(i);
+
+    auto offset = readPackLE8(e);
+    auto length = readPackLE8(e + 8);
+
+    return {
+        pimpl->name(i),
+        static_cast<tbt_pack_entry_kind>(e[30]),
+        readPackLE8(e + 16),
+        { pimpl->data + offset, static_cast<size_t>(length) }
+    };
+}
+
+
+bool tbt_pack::find(std::string_view name, size_t &out) const {
+
+    ASSERT(pimpl);
+
+    size_t lo = 0;
+    size_t hi = pimpl->count;
+
+    while (lo < hi) {
+
+        auto mid = lo + (hi - lo) / 2;
+
+        auto midName = pimpl->name(mid);
+
+        if (midName < name) {
+            lo = mid + 1;
+        } else if (name < midName) {
+            hi = mid;
+        } else {
+            out = mid;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool tbt_pack::findHash(uint64_t hash, size_t &out) const {
+
+    ASSERT(pimpl);
+
+    size_t lo = 0;
+    size_t hi = pimpl->count;
+
+    while (lo < hi) {
+
+        auto mid = lo + (hi - lo) / 2;
+
+        auto midHash = readPackLE8(pimpl->hashEntry(mid));
+
+        if (midHash < hash) {
+            lo = mid + 1;
+        } else if (hash < midHash) {
+            hi = mid;
+        } else {
+            out = readPackLE4(pimpl->hashEntry(mid) + 8);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool tbt_pack::hasMetadata() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->metadataOffset != 0;
+}
+
+
+tbt_pack_metadata tbt_pack::metadata(size_t i) const {
+
+    ASSERT(pimpl);
+
+    ASSERT(hasMetadata());
+
+    ASSERT(i < pimpl->count);
+
+    const auto *m = pimpl->data + pimpl->metadataOffset + i * PACK_METADATA_ENTRY_SIZE;
+
+    return {
+        m[0],
+        readPackLE2(m + 2),
+        readPackLE8(m + 8)
+    };
+}
+
+
+Status parseTbtPackEntry(const tbt_pack &pack, size_t i, const tbt_parse_opts &opts, tbt_file &out) {
+
+    auto e = pack.entry(i);
+
+    CHECK(e.kind == PACK_TBT, "not a tbt entry: %.*s", static_cast<int>(e.name.size()), e.name.data());
+
+    std::vector<uint8_t> buf(e.data.begin(), e.data.end());
+
+    auto it = buf.cbegin();
+
+    return parseTbtBytes(it, buf.cend(), opts, out);
+}
+
+
+Status parseMidiPackEntry(const tbt_pack &pack, size_t i, midi_file &out) {
+
+    auto e = pack.entry(i);
+
+    CHECK(e.kind == PACK_MIDI, "not a MIDI entry: %.*s", static_cast<int>(e.name.size()), e.name.data());
+
+    std::vector<uint8_t> buf(e.data.begin(), e.data.end());
+
+    auto it = buf.cbegin();
+
+    return parseMidiBytes(it, buf.cend(), out);
+}
+
+
+std::string
+tbtPackInfo(const tbt_pack &pack) {
+
+    std::string acc;
+
+    char buf[200];
+
+    std::snprintf(buf, sizeof(buf), "entries: %zu\n", pack.size());
+    acc += buf;
+
+    for (size_t i = 0; i < pack.size(); i++) {
+
+        auto e = pack.entry(i);
+
+        std::snprintf(buf, sizeof(buf), "%s %8zu %016" PRIx64 " %.*s", (e.kind == PACK_TBT) ? "tbt " : "midi", e.data.size(), e.hash, static_cast<int>(e.name.size()), e.name.data());
+        acc += buf;
+
+        if (pack.hasMetadata()) {
+
+            auto md = pack.metadata(i);
+
+            if (e.kind == PACK_TBT) {
+                std::snprintf(buf, sizeof(buf), " (0x%02x, %d tracks, %.2f s)", md.versionNumber, md.trackCount, static_cast<double>(md.durationMicros) / 1000000.0);
+            } else {
+                std::snprintf(buf, sizeof(buf), " (%d tracks, %.2f s)", md.trackCount, static_cast<double>(md.durationMicros) / 1000000.0);
+            }
+            acc += buf;
+        }
+
+        acc += "\n";
+    }
+
+    return acc;
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,699 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/playback.h"
+
+#include "tbt-parser/tbt-parser-util.h"
+
+#undef NDEBUG
+
+#include "common/check.h"
+#include "common/logging.h"
+
+#include <algorithm> // for clamp, min
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <variant> // for visit, get_if, holds_alternative
+#include <cmath> // for llround
+#include <cstring> // for strerror
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+#include "midi-constants.inl"
+
+
+#define TAG "playback"
+
+
+const double PLAYBACK_DEFAULT_MICROS_PER_BEAT = 500000.0;
+
+
+Status checkDivision(const midi_header &header) {
+
+    CHECK(header.division != 0, "division is 0");
+
+    CHECK((header.division & 0x8000) == 0, "SMPTE division is not supported: 0x%04x", header.division);
+
+    return OK;
+}
+
+
+//
+// merges the tracks of a midi_file or midi_program in time order, applying the tempo map as it goes
+//
+// events at the same tick keep their track order
+//
+// repeats are expanded lazily, so memory does not grow with played length
+//
+class midi_timed_stream {
+public:
+
+    midi_timed_stream(const midi_file &m) :
+        division(m.header.division), cursors(), pending(), pendingTick() {
+
+        for (const auto &track : m.tracks) {
+            cursors.emplace_back(track);
+        }
+
+        rewind();
+    }
+
+    midi_timed_stream(const midi_program &p) :
+        division(p.header.division), cursors(), pending(), pendingTick() {
+
+        for (const auto &track : p.tracks) {
+            cursors.emplace_back(track);
+        }
+
+        rewind();
+    }
+
+    void rewind() {
+
+        pending.assign(cursors.size(), nullptr);
+        pendingTick.assign(cursors.size(), 0);
+
+        for (size_t i = 0; i < cursors.size(); i++) {
+
+            cursors[i].rewind();
+
+            pull(i, 0);
+        }
+
+        microsPerTick = PLAYBACK_DEFAULT_MICROS_PER_BEAT / division;
+        micros = 0.0;
+        lastTick = 0;
+    }
+
+    //
+    // returns false at the end
+    //
+    bool peek(midi_timed_event &out) const {
+
+        size_t best = cursors.size();
+
+        for (size_t i = 0; i < cursors.size(); i++) {
+
+            if (pending[i] == nullptr) {
+                continue;
+            }
+
+            if (best == cursors.size() || pendingTick[i] < pendingTick[best]) {
+                best = i;
+            }
+        }
+
+        if (best == cursors.size()) {
+            return false;
+        }
+
+        auto tick = pendingTick[best];
+
+        out.micros = std::llround(micros + static_cast<double>(tick - lastTick) * microsPerTick);
+        out.tick = tick;
+        out.track = static_cast<uint16_t>(best);
+        out.event = pending[best];
+
+        return true;
+    }
+
+    //
+    // e must be what peek() returned
+    //
+    void pop(const midi_timed_event &e) {
+
+        micros += static_cast<double>(e.tick - lastTick) * microsPerTick;
+
+        lastTick = e.tick;
+
+        if (auto metaEvent = std::get_if<MetaEvent>(e.event)) {
+
+            if (metaEvent->type == M_SETTEMPO && metaEvent->data.size() == 3) {
+
+                auto it = metaEvent->data.cbegin();
+
+                microsPerTick = parseBE3(it) / static_cast<double>(division);
+            }
+        }
+
+        pull(e.track, e.tick);
+    }
+
+private:
+
+    void pull(size_t track, int64_t tick) {
+
+        auto e = cursors[track].next();
+
+        pending[track] = e;
+
+        if (e != nullptr) {
+            pendingTick[track] = tick + std::visit([](const auto &x) { return x.deltaTime; }, *e);
+        }
+    }
+
+    uint16_t division;
+
+    std::vector<midi_track_cursor> cursors;
+
+    std::vector<const midi_track_event *> pending;
+
+    std::vector<int64_t> pendingTick;
+
+    double microsPerTick;
+
+    double micros;
+
+    int64_t lastTick;
+};
+
+
+Status midiTimedEvents(const midi_file &m, std::vector<midi_timed_event> &out) {
+
+    Status ret = checkDivision(m.header);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    out.clear();
+
+    midi_timed_stream stream(m);
+
+    midi_timed_event e;
+
+    while (stream.peek(e)) {
+
+        out.push_back(e);
+
+        stream.pop(e);
+    }
+
+    return OK;
+}
+
+
+//
+// events that change channel state, and must be replayed when seeking
+//
+bool isChaseEvent(const midi_track_event &e) {
+    return std::holds_alternative<ProgramChangeEvent>(e) ||
+        std::holds_alternative<ControlChangeEvent>(e) ||
+        std::holds_alternative<PitchBendEvent>(e);
+}
+
+
+void raisePlaybackThreadPriority(std::thread &thread) {
+
+#if defined(_WIN32)
+
+    if (!SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        LOGW("cannot raise playback thread priority: %lu", GetLastError());
+    }
+
+#else
+
+    sched_param param{};
+
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+
+    int err = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+
+    if (err != 0) {
+        LOGW("cannot raise playback thread priority: %s", std::strerror(err));
+    }
+
+#endif // defined(_WIN32)
+}
+
+
+struct playback_engine::impl {
+
+    using clock = std::chrono::steady_clock;
+
+    playback_sink &sink;
+
+    const playback_opts opts;
+
+    //
+    // only used by the playback thread, once it is started
+    //
+    midi_timed_stream stream;
+
+    Status streamStatus;
+
+    int64_t duration;
+
+    mutable std::mutex mutex;
+
+    std::condition_variable cv;
+
+    std::thread thread;
+
+    //
+    // everything below is protected by mutex
+    //
+
+    bool running = false;
+    bool threadDone = false;
+    bool stopping = false;
+    bool isPaused = false;
+    bool isFinished = false;
+
+    //
+    // requests for the playback thread, so that the sink is only called from there
+    //
+    bool pendingAllNotesOff = false;
+    bool pendingSeek = false;
+    int64_t seekMicros = 0;
+
+    //
+    // the steady_clock time of song position 0
+    //
+    // only meaningful while running and not paused
+    //
+    clock::time_point epoch;
+
+    //
+    // the song position while not running or paused
+    //
+    int64_t heldPosition = 0;
+
+    template <typename T>
+    impl(const T &m, playback_sink &sink, const playback_opts &opts) :
+        sink(sink), opts(opts), stream(m), streamStatus(OK), duration(0) {
+
+        streamStatus = checkDivision(m.header);
+
+        if (streamStatus != OK) {
+            return;
+        }
+
+        //
+        // one pass to find the duration
+        //
+        midi_timed_event e;
+
+        while (stream.peek(e)) {
+
+            duration = e.micros;
+
+            stream.pop(e);
+        }
+
+        stream.rewind();
+    }
+
+    int64_t positionLocked() const {
+
+        if (!running || isPaused || threadDone) {
+            return heldPosition;
+        }
+
+        auto pos = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - epoch).count();
+
+        return std::clamp<int64_t>(pos, 0, duration);
+    }
+
+    bool looping(int64_t &loopStart, int64_t &loopEnd) const {
+
+        if (!opts.loop) {
+            return false;
+        }
+
+        loopStart = std::clamp<int64_t>(opts.loop_start_micros, 0, duration);
+
+        loopEnd = (opts.loop_end_micros < 0) ? duration : std::min(opts.loop_end_micros, duration);
+
+        return loopStart < loopEnd;
+    }
+
+    //
+    // move the stream to micros, and replay state events before it
+    //
+    void seek(std::unique_lock<std::mutex> &lock, int64_t micros) {
+
+        auto now = clock::now();
+
+        lock.unlock();
+
+        stream.rewind();
+
+        midi_timed_event e;
+
+        while (stream.peek(e) && e.micros < micros) {
+
+            if (isChaseEvent(*e.event)) {
+                sink.onEvent(playback_event{e, now});
+            }
+
+            stream.pop(e);
+        }
+
+        lock.lock();
+    }
+
+    void run() {
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        int64_t loopStart = 0;
+        int64_t loopEnd = 0;
+
+        bool isLooping = looping(loopStart, loopEnd);
+
+        while (!stopping) {
+
+            if (pendingAllNotesOff) {
+
+                pendingAllNotesOff = false;
+
+                lock.unlock();
+                sink.onAllNotesOff();
+                lock.lock();
+
+                continue;
+            }
+
+            if (pendingSeek) {
+
+                pendingSeek = false;
+
+                seek(lock, seekMicros);
+
+                continue;
+            }
+
+            if (isPaused) {
+                cv.wait(lock);
+                continue;
+            }
+
+            auto now = clock::now();
+
+            midi_timed_event e;
+
+            bool more = stream.peek(e);
+
+            bool atLoopEnd = isLooping && (!more || loopEnd <= e.micros);
+
+            if (atLoopEnd) {
+
+                //
+                // wait for the loop end itself, so every pass has exactly the same length
+                //
+                auto loopDeadline = epoch + std::chrono::microseconds(loopEnd);
+
+                if (now < loopDeadline) {
+                    cv.wait_until(lock, loopDeadline);
+                    continue;
+                }
+
+                epoch += std::chrono::microseconds(loopEnd - loopStart);
+
+                pendingAllNotesOff = true;
+                pendingSeek = true;
+                seekMicros = loopStart;
+
+                continue;
+            }
+
+            if (!more) {
+
+                isFinished = true;
+
+                heldPosition = duration;
+
+                break;
+            }
+
+            auto deadline = epoch + std::chrono::microseconds(e.micros);
+
+            auto dispatchAt = deadline - std::chrono::microseconds(opts.lookahead_micros);
+
+            if (now < dispatchAt - std::chrono::microseconds(opts.spin_micros)) {
+
+                //
+                // absolute deadline, so oversleeping once does not delay later events
+                //
+                cv.wait_until(lock, dispatchAt - std::chrono::microseconds(opts.spin_micros));
+
+                continue;
+            }
+
+            if (now < dispatchAt) {
+
+                lock.unlock();
+
+                while (clock::now() < dispatchAt) {
+                    std::this_thread::yield();
+                }
+
+                lock.lock();
+
+                continue;
+            }
+
+            stream.pop(e);
+
+            lock.unlock();
+            sink.onEvent(playback_event{e, deadline});
+            lock.lock();
+        }
+
+        if (stopping) {
+
+            heldPosition = positionLocked();
+
+            lock.unlock();
+            sink.onAllNotesOff();
+            lock.lock();
+        }
+
+        threadDone = true;
+
+        cv.notify_all();
+    }
+};
+
+
+playback_engine::playback_engine(const midi_file &m, playback_sink &sink, const playback_opts &opts) :
+    pimpl(std::make_unique<impl>(m, sink, opts)) {}
+
+
+playback_engine::playback_engine(const midi_program &p, playback_sink &sink, const playback_opts &opts) :
+    pimpl(std::make_unique<impl>(p, sink, opts)) {}
+
+
+playback_engine::~playback_engine() {
+    stop();
+}
+
+
+Status playback_engine::start() {
+
+    if (pimpl->streamStatus != OK) {
+        return pimpl->streamStatus;
+    }
+
+    std::unique_lock<std::mutex> lock(pimpl->mutex);
+
+    CHECK(!pimpl->running || pimpl->threadDone, "playback is already started");
+
+    if (pimpl->thread.joinable()) {
+
+        lock.unlock();
+        pimpl->thread.join();
+        lock.lock();
+    }
+
+    if (pimpl->isFinished) {
+
+        //
+        // start over
+        //
+        pimpl->isFinished = false;
+        pimpl->heldPosition = 0;
+    }
+
+    pimpl->epoch = impl::clock::now() - std::chrono::microseconds(pimpl->heldPosition);
+    pimpl->running = true;
+    pimpl->threadDone = false;
+    pimpl->stopping = false;
+    pimpl->isPaused = false;
+    pimpl->pendingSeek = true;
+    pimpl->seekMicros = pimpl->heldPosition;
+
+    pimpl->thread = std::thread([this]() { pimpl->run(); });
+
+    if (pimpl->opts.realtime_priority) {
+        raisePlaybackThreadPriority(pimpl->thread);
+    }
+
+    return OK;
+}
+
+
+void playback_engine::pause() {
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    if (pimpl->isPaused || !pimpl->running || pimpl->threadDone) {
+        return;
+    }
+
+    pimpl->heldPosition = pimpl->positionLocked();
+    pimpl->isPaused = true;
+    pimpl->pendingAllNotesOff = true;
+
+    pimpl->cv.notify_all();
+}
+
+
+void playback_engine::resume() {
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    if (!pimpl->isPaused) {
+        return;
+    }
+
+    pimpl->epoch = impl::clock::now() - std::chrono::microseconds(pimpl->heldPosition);
+    pimpl->isPaused = false;
+
+    pimpl->cv.notify_all();
+}
+
+
+void playback_engine::seek(int64_t micros) {
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    micros = std::clamp<int64_t>(micros, 0, pimpl->duration);
+
+    pimpl->isFinished = false;
+
+    if (pimpl->running && !pimpl->threadDone && !pimpl->isPaused) {
+        pimpl->epoch = impl::clock::now() - std::chrono::microseconds(micros);
+    }
+
+    pimpl->heldPosition = micros;
+
+    if (pimpl->running && !pimpl->threadDone) {
+        pimpl->pendingAllNotesOff = true;
+        pimpl->pendingSeek = true;
+        pimpl->seekMicros = micros;
+    }
+
+    pimpl->cv.notify_all();
+}
+
+
+void playback_engine::stop() {
+
+    {
+        std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+        if (!pimpl->running) {
+            return;
+        }
+
+        pimpl->stopping = true;
+
+        pimpl->cv.notify_all();
+    }
+
+    if (pimpl->thread.joinable()) {
+        pimpl->thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    pimpl->running = false;
+}
+
+
+void playback_engine::wait() {
+
+    std::unique_lock<std::mutex> lock(pimpl->mutex);
+
+    pimpl->cv.wait(lock, [this]() { return !pimpl->running || pimpl->threadDone; });
+}
+
+
+int64_t playback_engine::positionMicros() const {
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    return pimpl->positionLocked();
+}
+
+
+int64_t playback_engine::durationMicros() const {
+    return pimpl->duration;
+}
+
+
+bool playback_engine::paused() const {
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    return pimpl->isPaused;
+}
+
+
+bool playback_engine::finished() const {
+
+    std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+    return pimpl->isFinished;
+}
+
+
+void recording_sink::onEvent(const playback_event &e) {
+
+    auto now = std::chrono::steady_clock::now();
+
+    records.push_back(record{e.timed, e.deadline, now});
+}
+
+
+void recording_sink::onAllNotesOff() {
+    allNotesOffCount++;
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,766 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/preview.h"
+
+#include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/trace.h"
+
+#undef NDEBUG
+
+#include "common/check.h"
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <algorithm> // for stable_sort, min
+#include <variant> // for visit
+#include <cmath> // for exp, pow, floor, fabs, cos, sin, lround
+#include <cstring> // for memcpy
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PREVIEW_HAVE_SSE2 1
+#include <emmintrin.h>
+#else
+#define PREVIEW_HAVE_SSE2 0
+#endif
+
+
+#include "midi-constants.inl"
+
+
+#define TAG "preview"
+
+
+const uint8_t PREVIEW_DRUM_CHANNEL = 9;
+
+//
+// voices are mixed in blocks of this many frames
+//
+const size_t PREVIEW_BLOCK_FRAMES = 64;
+
+//
+// headroom for many voices playing at once
+//
+const float PREVIEW_MASTER_GAIN = 0.25f;
+
+//
+// a voice whose envelope falls below this is done
+//
+const float PREVIEW_SILENT = 1.0e-4f;
+
+//
+// envelope time constants, in seconds
+//
+const double PREVIEW_RELEASE_SECONDS = 0.05;
+const double PREVIEW_BRIGHT_SECONDS = 0.06;
+const double PREVIEW_CLICK_SECONDS = 0.03;
+
+//
+// how long to keep rendering after the last event, if voices are still ringing
+//
+const double PREVIEW_TAIL_SECONDS = 2.0;
+
+const double PREVIEW_DEFAULT_MICROS_PER_BEAT = 500000.0;
+
+const double PREVIEW_PI = 3.14159265358979323846;
+
+
+struct preview_channel {
+    
+    //
+    // MIDI default volume is 100
+    //
+    float volume = 100.0f / 127.0f;
+    
+    float pan = 64.0f / 127.0f;
+
+    //
+    // semitones, may be changed with RPN 0
+    //
+    float bendRange = 2.0f;
+
+    float bendRatio = 1.0f;
+
+    uint8_t rpnMSB = 0x7f;
+    uint8_t rpnLSB = 0x7f;
+};
+
+
+struct preview_voice {
+    
+    bool active;
+    bool released;
+    uint8_t channel;
+    uint8_t midiNote;
+
+    float velocity;
+
+    //
+    // in cycles, [0, 1)
+    //
+    float phase;
+
+    //
+    // cycles per frame, before and after pitch bend
+    //
+    float baseInc;
+    float inc;
+
+    //
+    // amplitude envelope, and how much of the bright (saw) wave is mixed in
+    //
+    float env;
+    float decay;
+    float bright;
+    float brightDecay;
+
+    float gainL;
+    float gainR;
+};
+
+
+bool previewSimdAvailable() {
+    return PREVIEW_HAVE_SSE2;
+}
+
+
+//
+// per-frame multiplier for an exponential decay with time constant seconds
+//
+float decayPerFrame(double seconds, uint32_t sampleRate) {
+    return static_cast<float>(std::exp(-1.0 / (seconds * sampleRate)));
+}
+
+
+//
+// mix frames [begin, end) of v into L and R
+//
+// env and bright are the envelope values at begin, and are updated to the values at end
+//
+void mixVoiceScalar(const preview_voice &v, float *L, float *R, size_t begin, size_t end, float &env, float &bright) {
+
+    for (size_t i = begin; i < end; i++) {
+
+        float p = v.phase + static_cast<float>(i) * v.inc;
+
+        float frac = p - std::floor(p);
+
+        float tri = 4.0f * std::fabs(frac - 0.5f) - 1.0f;
+
+        float saw = 2.0f * frac - 1.0f;
+
+        float s = env * (tri + bright * (saw - tri));
+
+        L[i] += s * v.gainL;
+        R[i] += s * v.gainR;
+
+        env *= v.decay;
+        bright *= v.brightDecay;
+    }
+}
+
+
+#if PREVIEW_HAVE_SSE2
+
+//
+// same as mixVoiceScalar, 4 frames at a time
+//
+// phase stays small within a block, so truncation is the same as floor
+//
+void mixVoiceSSE2(const preview_voice &v, float *L, float *R, size_t n, float &env, float &bright) {
+
+    size_t n4 = (n & ~static_cast<size_t>(3));
+
+    float d = v.decay;
+    float d2 = d * d;
+    float b = v.brightDecay;
+    float b2 = b * b;
+
+    __m128 envV = _mm_mul_ps(_mm_set1_ps(env), _mm_setr_ps(1.0f, d, d2, d2 * d));
+    __m128 brightV = _mm_mul_ps(_mm_set1_ps(bright), _mm_setr_ps(1.0f, b, b2, b2 * b));
+    __m128 envStep = _mm_set1_ps(d2 * d2);
+    __m128 brightStep = _mm_set1_ps(b2 * b2);
+
+    __m128 idx = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    __m128 phase = _mm_set1_ps(v.phase);
+    __m128 inc = _mm_set1_ps(v.inc);
+    __m128 gainL = _mm_set1_ps(v.gainL);
+    __m128 gainR = _mm_set1_ps(v.gainR);
+
+    for (size_t i = 0; i < n4; i += 4) {
+
+        __m128 p = _mm_add_ps(phase, _mm_mul_ps(idx, inc));
+
+        __m128 frac = _mm_sub_ps(p, _mm_cvtepi32_ps(_mm_cvttps_epi32(p)));
+
+        __m128 tri = _mm_sub_ps(_mm_mul_ps(four, _mm_and_ps(_mm_sub_ps(frac, half), absMask)), one);
+
+        __m128 saw = _mm_sub_ps(_mm_mul_ps(two, frac), one);
+
+        __m128 s = _mm_mul_ps(envV, _mm_add_ps(tri, _mm_mul_ps(brightV, _mm_sub_ps(saw, tri))));
+
+        _mm_storeu_ps(L + i, _mm_add_ps(_mm_loadu_ps(L + i), _mm_mul_ps(s, gainL)));
+        _mm_storeu_ps(R + i, _mm_add_ps(_mm_loadu_ps(R + i), _mm_mul_ps(s, gainR)));
+
+        idx = _mm_add_ps(idx, four);
+        envV = _mm_mul_ps(envV, envStep);
+        brightV = _mm_mul_ps(brightV, brightStep);
+    }
+
+    env = _mm_cvtss_f32(envV);
+    bright = _mm_cvtss_f32(brightV);
+
+    mixVoiceScalar(v, L, R, n4, n, env, bright);
+}
+
+#endif // PREVIEW_HAVE_SSE2
+
+
+class preview_renderer {
+public:
+
+    preview_renderer(const preview_render_opts &opts, pcm_buffer &out) :
+        opts(opts), out(out), frame(0), channels(), voices() {}
+
+    uint32_t sampleRate() const {
+        return opts.sample_rate;
+    }
+
+    size_t currentFrame() const {
+        return frame;
+    }
+
+    bool anyActive() const {
+
+        for (const auto &v : voices) {
+            if (v.active) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //
+    // render until frame == target
+    //
+    void renderTo(size_t target) {
+
+        while (frame < target) {
+
+            size_t n = std::min(PREVIEW_BLOCK_FRAMES, target - frame);
+
+            std::fill(mixL, mixL + n, 0.0f);
+            std::fill(mixR, mixR + n, 0.0f);
+
+            for (auto &v : voices) {
+
+                if (!v.active) {
+                    continue;
+                }
+
+                float env = v.env;
+                float bright = v.bright;
+
+#if PREVIEW_HAVE_SSE2
+                if (opts.simd) {
+                    mixVoiceSSE2(v, mixL, mixR, n, env, bright);
+                } else {
+                    mixVoiceScalar(v, mixL, mixR, 0, n, env, bright);
+                }
+#else
+                mixVoiceScalar(v, mixL, mixR, 0, n, env, bright);
+#endif // PREVIEW_HAVE_SSE2
+
+                double p = static_cast<double>(v.phase) + static_cast<double>(n) * v.inc;
+
+                v.phase = static_cast<float>(p - std::floor(p));
+                v.env = env;
+                v.bright = bright;
+
+                if (env < PREVIEW_SILENT) {
+                    v.active = false;
+                }
+            }
+
+            auto base = out.samples.size();
+
+            out.samples.resize(base + 2 * n);
+
+            float *dst = out.samples.data() + base;
+
+            for (size_t i = 0; i < n; i++) {
+                dst[2 * i + 0] = PREVIEW_MASTER_GAIN * mixL[i];
+                dst[2 * i + 1] = PREVIEW_MASTER_GAIN * mixR[i];
+            }
+
+            frame += n;
+        }
+    }
+
+    void noteOn(uint8_t channel, uint8_t midiNote, uint8_t velocity) {
+
+        if (velocity == 0) {
+            noteOff(channel, midiNote);
+            return;
+        }
+
+        preview_voice *v = allocateVoice();
+
+        if (v == nullptr) {
+            return;
+        }
+
+        auto sampleRate = opts.sample_rate;
+
+        double freq = 440.0 * std::pow(2.0, (midiNote - 69) / 12.0);
+
+        v->active = true;
+        v->released = false;
+        v->channel = channel;
+        v->midiNote = midiNote;
+        v->velocity = velocity / 127.0f;
+        v->phase = 0.0f;
+        v->baseInc = static_cast<float>(freq / sampleRate);
+        v->inc = v->baseInc * channels[channel & 0x0f].bendRatio;
+        v->env = 1.0f;
+        v->bright = 1.0f;
+
+        if (channel == PREVIEW_DRUM_CHANNEL) {
+
+            v->decay = decayPerFrame(PREVIEW_CLICK_SECONDS, sampleRate);
+            v->brightDecay = 1.0f;
+
+        } else {
+
+            //
+            // higher strings ring for less time
+            //
+            double seconds = std::clamp(1.2 * std::pow(2.0, (48 - midiNote) / 24.0), 0.15, 4.0);
+
+            v->decay = decayPerFrame(seconds, sampleRate);
+            v->brightDecay = decayPerFrame(PREVIEW_BRIGHT_SECONDS, sampleRate);
+        }
+
+        updateGains(*v);
+    }
+
+    void noteOff(uint8_t channel, uint8_t midiNote) {
+
+        auto releaseDecay = decayPerFrame(PREVIEW_RELEASE_SECONDS, opts.sample_rate);
+
+        for (auto &v : voices) {
+
+            if (!v.active || v.released || v.channel != channel || v.midiNote != midiNote) {
+                continue;
+            }
+
+            v.released = true;
+            v.decay = std::min(v.decay, releaseDecay);
+        }
+    }
+
+    void controlChange(uint8_t channel, uint8_t controller, uint8_t value) {
+
+        auto &c = channels[channel & 0x0f];
+
+        switch (controller) {
+        case C_VOLUME:
+            c.volume = value / 127.0f;
+            updateChannelGains(channel);
+            break;
+        case C_PAN:
+            c.pan = value / 127.0f;
+            updateChannelGains(channel);
+            break;
+        case C_RPNPARAM_MSB:
+            c.rpnMSB = value;
+            break;
+        case C_RPNPARAM_LSB:
+            c.rpnLSB = value;
+            break;
+        case C_DATAENTRY_MSB:
+            //
+            // RPN 0 is pitch bend range
+            //
+            if (c.rpnMSB == 0 && c.rpnLSB == 0) {
+                c.bendRange = value;
+            }
+            break;
+        case C_ALLNOTESOFF: {
+
+            auto releaseDecay = decayPerFrame(PREVIEW_RELEASE_SECONDS, opts.sample_rate);
+
+            for (auto &v : voices) {
+                if (v.active && v.channel == channel) {
+                    v.released = true;
+                    v.decay = std::min(v.decay, releaseDecay);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void pitchBend(uint8_t channel, int16_t pitchBend) {
+
+        auto &c = channels[channel & 0x0f];
+
+        double semitones = c.bendRange * (pitchBend - 8192) / 8192.0;
+
+        c.bendRatio = static_cast<float>(std::pow(2.0, semitones / 12.0));
+
+        for (auto &v : voices) {
+            if (v.active && v.channel == channel) {
+                v.inc = v.baseInc * c.bendRatio;
+            }
+        }
+    }
+
+private:
+
+    preview_voice *allocateVoice() {
+
+        for (auto &v : voices) {
+            if (!v.active) {
+                return &v;
+            }
+        }
+
+        if (voices.size() < opts.max_voices) {
+            voices.push_back(preview_voice{});
+            return &voices.back();
+        }
+
+        //
+        // steal the quietest voice
+        //
+        preview_voice *quietest = nullptr;
+
+        for (auto &v : voices) {
+            if (quietest == nullptr || v.env < quietest->env) {
+                quietest = &v;
+            }
+        }
+
+        return quietest;
+    }
+
+    void updateGains(preview_voice &v) {
+
+        const auto &c = channels[v.channel & 0x0f];
+
+        //
+        // volume is roughly in dB, so square it
+        //
+        double gain = v.velocity * c.volume * c.volume;
+
+        //
+        // equal-power pan
+        //
+        double angle = c.pan * PREVIEW_PI / 2.0;
+
+        v.gainL = static_cast<float>(gain * std::cos(angle));
+        v.gainR = static_cast<float>(gain * std::sin(angle));
+    }
+
+    void updateChannelGains(uint8_t channel) {
+
+        for (auto &v : voices) {
+            if (v.active && v.channel == channel) {
+                updateGains(v);
+            }
+        }
+    }
+
+    const preview_render_opts &opts;
+
+    pcm_buffer &out;
+
+    size_t frame;
+
+    preview_channel channels[16];
+
+    std::vector<preview_voice> voices;
+
+    alignas(16) float mixL[PREVIEW_BLOCK_FRAMES];
+    alignas(16) float mixR[PREVIEW_BLOCK_FRAMES];
+};
+
+
+struct PreviewEventVisitor {
+
+    preview_renderer &renderer;
+
+    const uint16_t division;
+
+    double &framesPerTick;
+
+    void operator()(const ProgramChangeEvent &) {}
+
+    void operator()(const PitchBendEvent &e) {
+        renderer.pitchBend(e.channel, e.pitchBend);
+    }
+
+    void operator()(const NoteOffEvent &e) {
+        renderer.noteOff(e.channel, e.midiNote);
+    }
+
+    void operator()(const NoteOnEvent &e) {
+        renderer.noteOn(e.channel, e.midiNote, e.velocity);
+    }
+
+    void operator()(const ControlChangeEvent &e) {
+        renderer.controlChange(e.channel, e.controller, e.value);
+    }
+
+    void operator()(const MetaEvent &e) {
+
+        if (e.type != M_SETTEMPO || e.data.size() != 3) {
+            return;
+        }
+
+        auto it = e.data.cbegin();
+
+        auto microsPerBeat = parseBE3(it);
+
+        framesPerTick = microsPerBeat / static_cast<double>(division) * renderer.sampleRate() / 1000000.0;
+    }
+
+    void operator()(const PolyphonicKeyPressureEvent &) {}
+
+    void operator()(const ChannelPressureEvent &) {}
+
+    void operator()(const SysExEvent &) {}
+};
+
+
+struct preview_timed_event {
+    int64_t tick;
+    const midi_track_event *event;
+};
+
+
+Status renderPreview(const midi_file &m, const preview_render_opts &opts, pcm_buffer &out) {
+
+    trace_span span("render preview");
+
+    CHECK(opts.sample_rate != 0, "sample rate is 0");
+
+    CHECK(m.header.division != 0, "division is 0");
+
+    CHECK((m.header.division & 0x8000) == 0, "SMPTE division is not supported: 0x%04x", m.header.division);
+
+    //
+    // merge all tracks into one list, ordered by tick
+    //
+    // events at the same tick keep their track order
+    //
+    std::vector<preview_timed_event> events;
+
+    for (const auto &track : m.tracks) {
+
+        int64_t tick = 0;
+
+        for (const auto &e : track) {
+
+            tick += std::visit([](const auto &x) { return x.deltaTime; }, e);
+
+            events.push_back(preview_timed_event{tick, &e});
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const preview_timed_event &a, const preview_timed_event &b) {
+        return a.tick < b.tick;
+    });
+
+    auto maxFrames = static_cast<size_t>(std::max(opts.max_seconds, 0.0) * opts.sample_rate);
+
+    out.sampleRate = opts.sample_rate;
+    out.samples.clear();
+
+    preview_renderer renderer(opts, out);
+
+    double framesPerTick = PREVIEW_DEFAULT_MICROS_PER_BEAT / m.header.division * opts.sample_rate / 1000000.0;
+
+    PreviewEventVisitor visitor{renderer, m.header.division, framesPerTick};
+
+    int64_t lastTick = 0;
+
+    double eventFrame = 0.0;
+
+    for (const auto &e : events) {
+
+        eventFrame += static_cast<double>(e.tick - lastTick) * framesPerTick;
+
+        lastTick = e.tick;
+
+        auto target = std::min(static_cast<size_t>(std::llround(eventFrame)), maxFrames);
+
+        renderer.renderTo(target);
+
+        if (renderer.currentFrame() == maxFrames) {
+            break;
+        }
+
+        std::visit(visitor, *e.event);
+    }
+
+    //
+    // let ringing voices finish
+    //
+    auto tailEnd = std::min(renderer.currentFrame() + static_cast<size_t>(PREVIEW_TAIL_SECONDS * opts.sample_rate), maxFrames);
+
+    while (renderer.currentFrame() < tailEnd && renderer.anyActive()) {
+        renderer.renderTo(std::min(renderer.currentFrame() + PREVIEW_BLOCK_FRAMES, tailEnd));
+    }
+
+    return OK;
+}
+
+
+void appendLE2(uint16_t value, std::vector<uint8_t> &out) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+
+void appendLE4(uint32_t value, std::vector<uint8_t> &out) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 24));
+}
+
+
+void appendTag(const char *tag, std::vector<uint8_t> &out) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>(tag[i]));
+    }
+}
+
+
+Status exportWavBytes(const pcm_buffer &pcm, wav_sample_format format, std::vector<uint8_t> &out) {
+
+    const uint16_t channelCount = 2;
+
+    CHECK(pcm.samples.size() % channelCount == 0, "sample count is not a multiple of channel count: %zu", pcm.samples.size());
+
+    uint16_t bytesPerSample = (format == WAV_FLOAT32) ? 4 : 2;
+
+    size_t dataSize = pcm.samples.size() * bytesPerSample;
+
+    CHECK(dataSize <= 0xffffff00, "too much data for WAV: %zu", dataSize);
+
+    auto frameCount = static_cast<uint32_t>(pcm.samples.size() / channelCount);
+
+    //
+    // non-PCM formats have an extension size in fmt and a fact chunk
+    //
+    uint32_t fmtSize = (format == WAV_FLOAT32) ? 18 : 16;
+
+    uint32_t factSize = (format == WAV_FLOAT32) ? (8 + 4) : 0;
+
+    uint32_t riffSize = 4 + (8 + fmtSize) + factSize + (8 + static_cast<uint32_t>(dataSize));
+
+    out.clear();
+    out.reserve(8 + riffSize);
+
+    appendTag("RIFF", out);
+    appendLE4(riffSize, out);
+    appendTag("WAVE", out);
+
+    appendTag("fmt ", out);
+    appendLE4(fmtSize, out);
+    appendLE2((format == WAV_FLOAT32) ? 3 : 1, out); // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+    appendLE2(channelCount, out);
+    appendLE4(pcm.sampleRate, out);
+    appendLE4(pcm.sampleRate * channelCount * bytesPerSample, out);
+    appendLE2(static_cast<uint16_t>(channelCount * bytesPerSample), out);
+    appendLE2(static_cast<uint16_t>(8 * bytesPerSample), out);
+
+    if (format == WAV_FLOAT32) {
+
+        appendLE2(0, out); // cbSize
+
+        appendTag("fact", out);
+        appendLE4(4, out);
+        appendLE4(frameCount, out);
+    }
+
+    appendTag("data", out);
+    appendLE4(static_cast<uint32_t>(dataSize), out);
+
+    if (format == WAV_FLOAT32) {
+
+        for (float s : pcm.samples) {
+
+            uint32_t bits;
+
+            std::memcpy(&bits, &s, sizeof(bits));
+
+            appendLE4(bits, out);
+        }
+
+    } else {
+
+        for (float s : pcm.samples) {
+
+            auto v = static_cast<int16_t>(std::lround(std::clamp(s, -1.0f, 1.0f) * 32767.0f));
+
+            appendLE2(static_cast<uint16_t>(v), out);
+        }
+    }
+
+    return OK;
+}
+
+
+Status exportWavFile(const pcm_buffer &pcm, wav_sample_format format, const char *path) {
+
+    std::vector<uint8_t> data;
+
+    Status ret = exportWavBytes(pcm, format, data);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    return saveFile(path, data);
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,783 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/song-context.h"
+
+#include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/tbt.h"
+#include "tbt-parser/trace.h"
+
+#include "rational/rational.h"
+
+#undef NDEBUG
+
+#include "common/abort.h"
+#include "common/assert.h"
+#include "common/logging.h"
+
+#include <algorithm> // for remove, lower_bound
+#include <variant> // for get
+
+
+#include "space-cursor.inl"
+#include "song-context.inl"
+
+
+#define TAG "song-context"
+
+
+//
+// collect a warning in diagnostics, or log it if diagnostics is null
+//
+template <typename ... Ts>
+void
+warnOrCollect(
+    tbt_diagnostics *diagnostics,
+    tbt_diagnostic_code code,
+    double space,
+    int track,
+    const char *format,
+    Ts ... args) {
+
+    if (diagnostics) {
+        addDiagnostic(*diagnostics, code, space, track);
+    } else {
+        LOGW(format, args...);
+    }
+}
+
+
+//
+// resolve all of the Automatically Assign -1 values to actual channels
+//
+template <uint8_t VERSION, typename tbt_file_t>
+void
+computeChannelMap(
+    const tbt_file_t &t,
+    std::map<uint8_t, uint8_t> &channelMap) {
+
+    channelMap.clear();
+
+    //
+    // Channel 9 is for drums and is not generally available
+    //
+    std::vector<uint8_t> availableChannels{ 0, 1, 2, 3, 4, 5, 6, 7, 8, /*9,*/ 10, 11, 12, 13, 14, 15 };
+
+    //
+    // first just treat any assigned channels as unavailable
+    //
+    if constexpr (0x6a <= VERSION) {
+        
+        for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+            if (t.metadata.tracks[track].midiChannel == -1) {
+                continue;
+            }
+
+            //
+            // https://en.wikipedia.org/wiki/Erase%E2%80%93remove_idiom
+            //
+            availableChannels.erase(
+                std::remove(
+                    availableChannels.begin(),
+                    availableChannels.end(),
+                    t.metadata.tracks[track].midiChannel
+                ),
+                availableChannels.end()
+            );
+
+            channelMap[track] = static_cast<uint8_t>(t.metadata.tracks[track].midiChannel);
+        }
+    }
+
+    //
+    // availableChannels now holds generally available channels
+    //
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        if constexpr (0x6a <= VERSION) {
+            if (t.metadata.tracks[track].midiChannel != -1) {
+                continue;
+            }
+        }
+
+        //
+        // Take first available channel
+        //
+
+        ASSERT(!availableChannels.empty());
+        
+        auto firstAvailableChannel = availableChannels[0];
+        availableChannels.erase(availableChannels.cbegin() + 0);
+
+        channelMap[track] = firstAvailableChannel;
+    }
+
+    //
+    // it's ok to have available channels left over
+    //
+//    if (!availableChannels.empty()) {
+//        LOGE("availableChannels is not empty");
+//        return TBT_ERR;
+//    }
+}
+
+
+void
+insertTempoMap_atActualSpace(
+    uint16_t newTempo,
+    const rational &actualSpace,
+    tbt_diagnostics *diagnostics,
+    std::vector<tempo_change> &tempoMap) {
+
+    auto flooredActualSpace = actualSpace.floor();
+
+    auto flooredActualSpaceI = flooredActualSpace.to_uint16();
+
+    auto spaceDiff = (actualSpace - flooredActualSpace);
+
+    ASSERT(spaceDiff.is_nonnegative());
+
+    if (spaceDiff.is_positive()) {
+        warnOrCollect(diagnostics, DIAG_TEMPO_CHANGE_AT_NON_INTEGRAL_SPACE, actualSpace.to_double(), -1, "tempo change at non-integral space: %f", actualSpace.to_double());
+    }
+
+    //
+    // tempo changes from all tracks are merged, so they may arrive out of order
+    //
+    auto it = std::lower_bound(tempoMap.begin(), tempoMap.end(), actualSpace, [](const tempo_change &a, const rational &b) { return a.actualSpace < b; });
+
+    if (it != tempoMap.end() && !(actualSpace < it->actualSpace)) {
+
+        auto &tempo = it->tempo;
+
+        if (tempo != newTempo) {
+            warnOrCollect(diagnostics, DIAG_CONFLICTING_TEMPO_CHANGES, actualSpace.to_double(), -1, "actualSpace %f has conflicting tempo changes: %d, %d", actualSpace.to_double(), tempo, newTempo);
+        }
+
+        tempo = newTempo;
+
+    } else {
+
+        tempoMap.insert(it, { flooredActualSpaceI, actualSpace, newTempo });
+    }
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, typename tbt_file_t, uint8_t STRINGS_PER_TRACK>
+void
+computeTempoMap(
+    const tbt_file_t &t,
+    tbt_diagnostics *diagnostics,
+    std::vector<tempo_change> &tempoMap) {
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        uint16_t trackSpaceCount;
+        if constexpr (0x70 <= VERSION) {
+            //
+            // stored as 32-bit int, so must be cast
+            //
+            trackSpaceCount = static_cast<uint16_t>(t.metadata.tracks[track].spaceCount);
+        } else if constexpr (VERSION == 0x6f) {
+            trackSpaceCount = t.header.spaceCount;
+        } else {
+            trackSpaceCount = 4000;
+        }
+
+        const auto &maps = t.body.mapsList[track];
+
+        space_cursor trackEffectChangesCursor(trackEffectChangesOf<VERSION>(maps));
+
+        rational actualSpace = 0;
+
+        for (uint16_t space = 0; space < trackSpaceCount;) {
+
+            if constexpr (VERSION == 0x72) {
+
+                for (const auto &change : trackEffectChangesCursor.at(space)) {
+
+                    if (change.effect == TE_TEMPO) {
+
+                        insertTempoMap_atActualSpace(change.value, actualSpace, diagnostics, tempoMap);
+
+                        break;
+                    }
+                }
+
+            } else {
+
+                const auto &it = maps.notesMap.find(space);
+                if (it != maps.notesMap.end()) {
+
+                    const auto &vsqs = it->second;
+
+                    const auto &trackEffect = vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 0];
+
+                    switch (trackEffect) {
+                    case 'T': {
+
+                        auto newTempo = static_cast<uint16_t>(vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 3]);
+
+                        insertTempoMap_atActualSpace(newTempo, actualSpace, diagnostics, tempoMap);
+
+                        break;
+                    }
+                    case 't': {
+
+                        auto newTempo = static_cast<uint16_t>(vsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + 3] + 250);
+
+                        insertTempoMap_atActualSpace(newTempo, actualSpace, diagnostics, tempoMap);
+
+                        break;
+                    }
+                    case '\0':
+                    case 'I':
+                    case 'V':
+                    case 'D':
+                    case 'U':
+                    case 'C':
+                    case 'P':
+                    case 'R': {
+                        //
+                        // skip
+                        //
+                        break;
+                    }
+                    default:
+                        ABORT("invalid trackEffect: %c (%d)", trackEffect, trackEffect);
+                    }
+                }
+            }
+
+            //
+            // Compute actual space
+            //
+            {
+                if constexpr (HASALTERNATETIMEREGIONS) {
+
+                    const auto &alternateTimeRegionsIt = maps.alternateTimeRegionsMap.find(space);
+                    if (alternateTimeRegionsIt != maps.alternateTimeRegionsMap.end()) {
+
+                        const auto &alternateTimeRegion = alternateTimeRegionsIt->second;
+
+                        auto atr = rational{ alternateTimeRegion[0], alternateTimeRegion[1] };
+
+                        space++;
+
+                        actualSpace += atr;
+
+                    } else {
+
+                        space++;
+
+                        ++actualSpace;
+                    }
+
+                } else {
+
+                    space++;
+
+                    actualSpace = space;
+                }
+            }
+        }
+
+    } // for track
+}
+
+
+template <uint8_t VERSION, typename tbt_file_t>
+void
+computeRepeats(
+    const tbt_file_t &t,
+    uint16_t barLinesSpaceCount,
+    tbt_diagnostics *diagnostics,
+    std::vector<std::set<uint16_t> > &openSpaceSets,
+    std::vector<std::map<uint16_t, repeat_close_struct> > &repeatCloseMaps) {
+
+    //
+    // Setup repeats
+    //
+
+    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+
+        repeatCloseMaps.push_back( {} );
+
+        openSpaceSets.push_back( {} );
+    }
+
+    uint16_t lastOpenSpace = 0;
+
+    bool currentlyOpen = false;
+    bool savedClose = false;
+    uint8_t savedRepeats = 0;
+
+    for (uint16_t space = 0; space < barLinesSpaceCount;) {
+
+        //
+        // Setup repeats:
+        // setup repeatCloseMap and openSpaceSet
+        //
+        if constexpr (0x70 <= VERSION) {
+
+            const auto &barLinesMapIt = t.body.barLinesMap.find(space);
+            if (barLinesMapIt != t.body.barLinesMap.end()) {
+
+                //
+                // typical bar line is at spaces: 0, 16, 32, etc.
+                //
+                auto barLine = barLinesMapIt->second;
+
+                if (savedClose) {
+
+                    //
+                    // every track has the same open spaces, so only report once
+                    //
+                    if (openSpaceSets[0].find(lastOpenSpace) == openSpaceSets[0].end()) {
+                        warnOrCollect(diagnostics, DIAG_NO_REPEAT_OPEN, lastOpenSpace, -1, "there was no repeat open at %d", lastOpenSpace);
+                    }
+
+                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+
+                        openSpaceSets[track].insert(lastOpenSpace);
+
+                        repeatCloseMaps[track][space] = { lastOpenSpace, savedRepeats, 0 };
+                    }
+
+                    savedClose = false;
+
+                    lastOpenSpace = space;
+                }
+
+                if ((barLine[0] & CLOSEREPEAT_MASK_GE70) == CLOSEREPEAT_MASK_GE70) {
+
+                    //
+                    // save for next bar line
+                    //
+
+                    savedClose = true;
+                    savedRepeats = barLine[1];
+
+                    currentlyOpen = false;
+                }
+
+                if ((barLine[0] & OPENREPEAT_MASK_GE70) == OPENREPEAT_MASK_GE70) {
+
+                    if (currentlyOpen) {
+
+                        warnOrCollect(diagnostics, DIAG_REPEAT_OPEN_IGNORED, lastOpenSpace, -1, "repeat open at space %d is ignored", lastOpenSpace);
+
+                    } else {
+
+                        currentlyOpen = true;
+                    }
+
+                    lastOpenSpace = space;
+
+                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+                        openSpaceSets[track].insert(lastOpenSpace);
+                    }
+                }
+            }
+
+        } else {
+
+            const auto &barLinesMapIt = t.body.barLinesMap.find(space);
+            if (barLinesMapIt != t.body.barLinesMap.end()) {
+
+                //
+                // typical CLOSE, SINGLE, DOUBLE is at spaces: 15, 31, etc.
+                // typical OPEN is at spaces: 0, 16, 32, etc.
+                //
+                auto barLine = barLinesMapIt->second;
+
+                auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
+
+                switch (change) {
+                case CLOSE: {
+                    
+                    auto repeats = static_cast<uint8_t>((barLine[0] & 0b11110000) >> 4);
+
+                    //
+                    // every track has the same open spaces, so only report once
+                    //
+                    if (openSpaceSets[0].find(lastOpenSpace) == openSpaceSets[0].end()) {
+                        warnOrCollect(diagnostics, DIAG_NO_REPEAT_OPEN, lastOpenSpace, -1, "there was no repeat open at %d", lastOpenSpace);
+                    }
+
+                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+
+                        openSpaceSets[track].insert(lastOpenSpace);
+
+                        repeatCloseMaps[track][space + 1] = { lastOpenSpace, repeats, 0 };
+                    }
+
+                    lastOpenSpace = space + 1;
+
+                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+                        openSpaceSets[track].insert(lastOpenSpace);
+                    }
+
+                    currentlyOpen = false;
+
+                    break;
+                }
+                case OPEN: {
+
+                    if (currentlyOpen) {
+
+                        warnOrCollect(diagnostics, DIAG_REPEAT_OPEN_IGNORED, lastOpenSpace, -1, "repeat open at space %d is ignored", lastOpenSpace);
+
+                    } else {
+
+                        currentlyOpen = true;
+                    }
+
+                    lastOpenSpace = space;
+
+                    for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+                        openSpaceSets[track].insert(lastOpenSpace);
+                    }
+
+                    break;
+                }
+                case SINGLE:
+                case DOUBLE:
+                    //
+                    // nothing to do
+                    //
+                    break;
+                default:
+                    ABORT("invalid change: %d", change);
+                }
+            }
+        }
+
+        space++;
+
+    } // for space
+
+    if constexpr (0x70 <= VERSION) {
+
+        //
+        // and make sure to handle close repeat at very end of song
+        //
+        if (savedClose) {
+
+            //
+            // every track has the same open spaces, so only report once
+            //
+            if (openSpaceSets[0].find(lastOpenSpace) == openSpaceSets[0].end()) {
+                warnOrCollect(diagnostics, DIAG_NO_REPEAT_OPEN, lastOpenSpace, -1, "there was no repeat open at %d", lastOpenSpace);
+            }
+
+            for (uint8_t track = 0; track < t.header.trackCount + 1; track++) { // track count, + 1 for tempo track
+
+                openSpaceSets[track].insert(lastOpenSpace);
+
+                repeatCloseMaps[track][barLinesSpaceCount] = { lastOpenSpace, savedRepeats, 0 };
+            }
+
+            savedClose = false;
+        }
+    }
+}
+
+
+template <uint8_t VERSION, typename tbt_file_t>
+void
+computeMidiNoteOffsetArrays(
+    const tbt_file_t &t,
+    std::vector<std::array<uint8_t, 8> > &midiNoteOffsetArrays) {
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        const auto &trackMetadata = t.metadata.tracks[track];
+
+        std::array<uint8_t, 8> midiNoteOffsetArray{};
+
+        for (uint8_t string = 0; string < trackMetadata.stringCount; string++) {
+
+            auto offset = -0x80;
+
+            offset += trackMetadata.tuning[string];
+
+            if constexpr (0x6e <= VERSION) {
+                offset += trackMetadata.transposeHalfSteps;
+            }
+
+            if constexpr (0x6b <= VERSION) {
+                offset += OPEN_STRING_TO_MIDI_NOTE[string];
+            } else {
+                offset += OPEN_STRING_TO_MIDI_NOTE_LE6A[string];
+            }
+
+            midiNoteOffsetArray[string] = static_cast<uint8_t>(offset);
+        }
+
+        midiNoteOffsetArrays.push_back(midiNoteOffsetArray);
+    }
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, uint8_t STRINGS_PER_TRACK, typename tbt_file_t>
+void
+TanalyzeTbtFile(
+    const tbt_file_t &t,
+    const tbt_analyze_opts &opts,
+    tbt_song_context::impl &ctx) {
+
+    ctx.barLinesSpaceCount = barLinesSpaceCountOf<VERSION>(t);
+
+    {
+        trace_span span("tempo map");
+
+        computeTempoMap<VERSION, HASALTERNATETIMEREGIONS, tbt_file_t, STRINGS_PER_TRACK>(t, opts.diagnostics, ctx.tempoMap);
+    }
+
+    computeChannelMap<VERSION>(t, ctx.channelMap);
+
+    {
+        trace_span span("repeats");
+
+        computeRepeats<VERSION, tbt_file_t>(t, ctx.barLinesSpaceCount, opts.diagnostics, ctx.openSpaceSets, ctx.repeatCloseMaps);
+    }
+
+    computeMidiNoteOffsetArrays<VERSION, tbt_file_t>(t, ctx.midiNoteOffsetArrays);
+
+    computeBarLineWidthMap<VERSION>(t, ctx.barLinesSpaceCount, ctx.barLineWidthMap);
+}
+
+
+Status
+analyzeTbtFile(
+    const tbt_file &t,
+    const tbt_analyze_opts &opts,
+    tbt_song_context &out) {
+
+    trace_span span("analyze");
+
+    auto pimpl = std::make_unique<tbt_song_context::impl>();
+
+    auto &ctx = *pimpl;
+
+    ctx.file = &t;
+
+    auto versionNumber = tbtFileVersionNumber(t);
+
+    ctx.versionNumber = versionNumber;
+
+    switch (versionNumber) {
+    case 0x72: {
+
+        const auto &t71 = std::get<tbt_file71>(t);
+        
+        if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            TanalyzeTbtFile<0x72, true, 8>(t71, opts, ctx);
+        } else {
+            TanalyzeTbtFile<0x72, false, 8>(t71, opts, ctx);
+        }
+
+        break;
+    }
+    case 0x71: {
+        
+        const auto &t71 = std::get<tbt_file71>(t);
+        
+        if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            TanalyzeTbtFile<0x71, true, 8>(t71, opts, ctx);
+        } else {
+            TanalyzeTbtFile<0x71, false, 8>(t71, opts, ctx);
+        }
+
+        break;
+    }
+    case 0x70: {
+        
+        const auto &t70 = std::get<tbt_file70>(t);
+        
+        if ((t70.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            TanalyzeTbtFile<0x70, true, 8>(t70, opts, ctx);
+        } else {
+            TanalyzeTbtFile<0x70, false, 8>(t70, opts, ctx);
+        }
+
+        break;
+    }
+    case 0x6f: {
+        
+        const auto &t6f = std::get<tbt_file6f>(t);
+        
+        TanalyzeTbtFile<0x6f, false, 8>(t6f, opts, ctx);
+
+        break;
+    }
+    case 0x6e: {
+        
+        const auto &t6e = std::get<tbt_file6e>(t);
+        
+        TanalyzeTbtFile<0x6e, false, 8>(t6e, opts, ctx);
+
+        break;
+    }
+    case 0x6b: {
+        
+        const auto &t6b = std::get<tbt_file6b>(t);
+        
+        TanalyzeTbtFile<0x6b, false, 8>(t6b, opts, ctx);
+
+        break;
+    }
+    case 0x6a: {
+        
+        const auto &t6a = std::get<tbt_file6a>(t);
+        
+        TanalyzeTbtFile<0x6a, false, 6>(t6a, opts, ctx);
+
+        break;
+    }
+    case 0x69: {
+        
+        const auto &t68 = std::get<tbt_file68>(t);
+        
+        TanalyzeTbtFile<0x69, false, 6>(t68, opts, ctx);
+
+        break;
+    }
+    case 0x68: {
+        
+        const auto &t68 = std::get<tbt_file68>(t);
+        
+        TanalyzeTbtFile<0x68, false, 6>(t68, opts, ctx);
+
+        break;
+    }
+    case 0x67: {
+        
+        const auto &t65 = std::get<tbt_file65>(t);
+        
+        TanalyzeTbtFile<0x67, false, 6>(t65, opts, ctx);
+
+        break;
+    }
+    case 0x66: {
+        
+        const auto &t65 = std::get<tbt_file65>(t);
+        
+        TanalyzeTbtFile<0x66, false, 6>(t65, opts, ctx);
+
+        break;
+    }
+    case 0x65: {
+        
+        const auto &t65 = std::get<tbt_file65>(t);
+        
+        TanalyzeTbtFile<0x65, false, 6>(t65, opts, ctx);
+
+        break;
+    }
+    default:
+        ABORT("invalid versionNumber: 0x%02x", versionNumber);
+    }
+
+    out.pimpl = std::move(pimpl);
+
+    return OK;
+}
+
+
+tbt_song_context::tbt_song_context() = default;
+
+tbt_song_context::~tbt_song_context() = default;
+
+tbt_song_context::tbt_song_context(tbt_song_context &&) noexcept = default;
+
+tbt_song_context &tbt_song_context::operator=(tbt_song_context &&) noexcept = default;
+
+const tbt_file &tbt_song_context::file() const {
+
+    ASSERT(pimpl);
+
+    return *pimpl->file;
+}
+
+uint8_t tbt_song_context::versionNumber() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->versionNumber;
+}
+
+const tbt_song_context::impl &tbt_song_context::internals() const {
+
+    ASSERT(pimpl);
+
+    return *pimpl;
+}
+
+
+Status
+renderSongOutputs(
+    const tbt_file &t,
+    const song_outputs_opts &opts,
+    song_outputs &out) {
+
+    tbt_song_context ctx;
+
+    Status ret = analyzeTbtFile(t, tbt_analyze_opts{ opts.midi_opts.diagnostics }, ctx);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    if (opts.info) {
+        out.info = tbtFileInfo(ctx);
+    }
+
+    if (opts.comment) {
+        out.comment = tbtFileComment(ctx);
+    }
+
+    if (opts.tablature) {
+        out.tablature = tbtFileTablature(ctx, opts.tablature_opts);
+    }
+
+    if (opts.midi) {
+
+        ret = convertToMidi(ctx, opts.midi_opts, out.midi);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    return OK;
+}
+
+
+
+
+
+
+
+
+
+
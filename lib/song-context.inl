@@ -0,0 +1,336 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/song-context.h"
+
+#include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/tbt.h"
+
+#include "rational/rational.h"
+
+#include "common/abort.h"
+#include "common/assert.h"
+
+#include <array>
+#include <map>
+#include <set>
+#include <vector>
+
+
+#define TAG "song-context"
+
+
+//
+// packed tempo change
+//
+struct tempo_change { // NOLINT(*-pro-type-member-init)
+    //
+    // floored actualSpace
+    //
+    uint16_t space;
+    rational actualSpace;
+    uint16_t tempo;
+};
+
+
+//
+// where the passes through a section start in the output is kept by the sink that converting writes to
+//
+struct repeat_close_struct {
+    uint16_t open;
+    uint8_t repeats;
+    int jump;
+};
+
+
+//
+// everything that is computed by walking the whole song, shared by all outputs
+//
+struct tbt_song_context::impl {
+
+    const tbt_file *file;
+
+    uint8_t versionNumber;
+
+    uint16_t barLinesSpaceCount;
+
+    //
+    // sorted by actualSpace
+    //
+    // there can be more than one tempo change with the same flooredActualSpace
+    //
+    std::vector<tempo_change> tempoMap;
+
+    //
+    // track -> channel, for all tracks
+    //
+    std::map<uint8_t, uint8_t> channelMap;
+
+    //
+    // for each track, including tempo track:
+    //   set of spaces that repeat opens occur
+    //
+    std::vector<std::set<uint16_t> > openSpaceSets;
+
+    //
+    // for each track, including tempo track:
+    //   actual space of close -> repeat_close_struct
+    //
+    std::vector<std::map<uint16_t, repeat_close_struct> > repeatCloseMaps;
+
+    //
+    // for each track:
+    //   string -> offset needed to obtain midi note
+    //
+    // only the first stringCount entries are used
+    //
+    std::vector<std::array<uint8_t, 8> > midiNoteOffsetArrays;
+
+    //
+    // space -> width of bar line
+    //
+    // if not present, then assume 1
+    //
+    std::map<uint16_t, uint8_t> barLineWidthMap;
+};
+
+
+//
+// defined in midi.cpp
+//
+// if emitTempoTrack is false, then track 0 is left out, e.g., when only other tracks need to be regenerated
+//
+Status
+convertToMidiProgramOrFile(
+    const tbt_song_context &ctx,
+    const midi_convert_opts &opts,
+    bool keepRepeats,
+    bool emitTempoTrack,
+    midi_program &out);
+
+
+template <uint8_t VERSION, typename tbt_file_t>
+uint16_t
+barLinesSpaceCountOf(const tbt_file_t &t) {
+    if constexpr (0x70 <= VERSION) {
+        return t.body.barLinesSpaceCount;
+    } else if constexpr (VERSION == 0x6f) {
+        return t.header.spaceCount;
+    } else {
+        (void)t;
+        return 4000;
+    }
+}
+
+
+//
+// only bar lines with widths other than 1 are added
+//
+template <uint8_t VERSION, typename tbt_file_t>
+void
+computeBarLineWidthMap(
+    const tbt_file_t &t,
+    uint16_t barLinesSpaceCount,
+    std::map<uint16_t, uint8_t> &barLineWidthMap) {
+
+    //
+    // make a copy to modify
+    //
+    auto barLinesMap = t.body.barLinesMap;
+
+
+    //
+    // setup last bar lines
+    //
+    if constexpr (0x70 <= VERSION) {
+
+        //
+        // setup last bar line
+        //
+
+        barLinesMap[barLinesSpaceCount] = { 0, 0 };
+
+    } else {
+
+        //
+        // setup last bar line
+        //
+
+        if (barLinesMap.find(barLinesSpaceCount - 1) == barLinesMap.end()) {
+            barLinesMap[barLinesSpaceCount - 1] = { 0b00000001 };
+        }
+    }
+
+
+    bool savedClose = false;
+    uint8_t savedRepeats = 0;
+
+
+    for (uint16_t space = 0; space < barLinesSpaceCount;) {
+
+        const auto &barLinesMapIt = barLinesMap.find(space);
+
+        //
+        // bar line
+        //
+        // both bar lines before notes and bar lines after notes are processed at the same time
+        //
+        if (barLinesMapIt != barLinesMap.end()) {
+
+            if constexpr (0x70 <= VERSION) {
+
+                auto barLine = barLinesMapIt->second;
+
+                if (savedClose) {
+
+                    auto w = width(savedRepeats);
+
+                    if (w != 1) {
+                        barLineWidthMap[space] = w;
+                    }
+
+                    savedClose = false;
+                }
+
+                if ((barLine[0] & CLOSEREPEAT_MASK_GE70) == CLOSEREPEAT_MASK_GE70) {
+
+                    //
+                    // save for next bar line
+                    //
+
+                    savedClose = true;
+                    savedRepeats = barLine[1];
+                }
+
+            } else {
+
+                auto barLine = barLinesMapIt->second;
+
+                auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
+
+                switch (change) {
+                case CLOSE: {
+
+                    auto repeats = static_cast<uint8_t>((barLine[0] & 0b11110000) >> 4);
+
+                    auto w = width(repeats);
+
+                    if (w != 1) {
+                        barLineWidthMap[space] = w;
+                    }
+
+                    break;
+                }
+                case OPEN:
+                case SINGLE:
+                case DOUBLE: {
+                    break;
+                }
+                default:
+                    ABORT("invalid change: %d", change);
+                }
+            }
+
+            barLinesMap.erase(barLinesMapIt);
+        }
+
+        space++;
+    }
+
+    //
+    // last bar line
+    //
+    {
+        const auto &barLinesMapIt = barLinesMap.find(barLinesSpaceCount);
+
+        if (barLinesMapIt != barLinesMap.end()) {
+
+            if constexpr (0x70 <= VERSION) {
+
+                auto barLine = barLinesMapIt->second;
+
+                if (savedClose) {
+
+                    auto w = width(savedRepeats);
+
+                    if (w != 1) {
+                        barLineWidthMap[barLinesSpaceCount] = w;
+                    }
+
+                    savedClose = false;
+                }
+
+                if ((barLine[0] & CLOSEREPEAT_MASK_GE70) == CLOSEREPEAT_MASK_GE70) {
+
+                    //
+                    // save for next bar line
+                    //
+
+                    savedClose = true;
+                    savedRepeats = barLine[1];
+                }
+
+            } else {
+
+                auto barLine = barLinesMapIt->second;
+
+                auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
+
+                switch (change) {
+                case CLOSE: {
+
+                    auto repeats = static_cast<uint8_t>((barLine[0] & 0b11110000) >> 4);
+
+                    auto w = width(repeats);
+
+                    if (w != 1) {
+                        barLineWidthMap[barLinesSpaceCount] = w;
+                    }
+
+                    break;
+                }
+                case OPEN:
+                case SINGLE:
+                case DOUBLE: {
+                    break;
+                }
+                default:
+                    ABORT("invalid change: %d", change);
+                }
+            }
+
+            barLinesMap.erase(barLinesMapIt);
+        }
+    }
+
+    ASSERT(barLinesMap.empty());
+}
+
+
+#undef TAG
+
+
+
+
+
+
+
+
+
+
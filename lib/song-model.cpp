@@ -0,0 +1,696 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/song-model.h"
+
+#include "tbt-parser/song-context.h"
+#include "tbt-parser/trace.h"
+
+#include "rational/rational.h"
+
+#undef NDEBUG
+
+#include "common/assert.h"
+#include "common/check.h"
+#include "common/logging.h"
+
+#include <algorithm> // for lower_bound
+#include <variant> // for get
+
+
+#include "song-context.inl"
+
+
+#define TAG "song-model"
+
+
+struct tbt_song_model::impl {
+
+    tbt_file file;
+
+    midi_convert_opts opts;
+
+    //
+    // kept until the tempo or the repeat structure changes
+    //
+    tbt_song_context ctx;
+
+    midi_file midi;
+
+    song_dirty_state dirty;
+
+    tbt_file71 &t() {
+        return std::get<tbt_file71>(file);
+    }
+};
+
+
+//
+// move every key >= from by delta
+//
+// there must not be any keys in the way
+//
+template <typename V>
+void
+shiftSpaces(
+    std::map<uint16_t, V> &m,
+    uint16_t from,
+    int delta) {
+
+    std::map<uint16_t, V> shifted;
+
+    for (auto it = m.lower_bound(from); it != m.end();) {
+
+        auto node = m.extract(it++);
+
+        node.key() = static_cast<uint16_t>(node.key() + delta);
+
+        shifted.insert(std::move(node));
+    }
+
+    m.merge(shifted);
+
+    ASSERT(shifted.empty());
+}
+
+
+//
+// bar line spaces are actual spaces, but the spaces of a track are stretched by its alternate time regions
+//
+Status
+trackSpaceAtActualSpace(
+    const maps71 &maps,
+    uint16_t actualSpace,
+    uint16_t &out) {
+
+    rational actual = 0;
+
+    uint16_t space = 0;
+
+    for (const auto &[atrSpace, atr] : maps.alternateTimeRegionsMap) {
+
+        //
+        // spaces before atrSpace are 1 actual space each
+        //
+        auto plain = rational(atrSpace - space);
+
+        if (!(actual + plain < actualSpace)) {
+            break;
+        }
+
+        actual += plain;
+
+        actual += rational{ atr[0], atr[1] };
+
+        space = static_cast<uint16_t>(atrSpace + 1);
+    }
+
+    auto diff = rational(actualSpace) - actual;
+
+    CHECK(diff.is_nonnegative() && diff == diff.floor(), "space %d is inside an alternate time region", actualSpace);
+
+    out = static_cast<uint16_t>(space + diff.to_uint16());
+
+    return OK;
+}
+
+
+void
+markTrack(
+    song_dirty_state &dirty,
+    uint8_t track,
+    uint16_t begin,
+    uint16_t end) {
+
+    auto &range = dirty.ranges[track];
+
+    if (dirty.tracks[track]) {
+
+        range.begin = std::min(range.begin, begin);
+        range.end = std::max(range.end, end);
+
+    } else {
+
+        dirty.tracks[track] = true;
+
+        range = { begin, end };
+    }
+}
+
+
+//
+// every track is affected from actualSpace to its end
+//
+void
+markStructure(
+    tbt_file71 &t,
+    song_dirty_state &dirty,
+    uint16_t actualSpace) {
+
+    dirty.structure = true;
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        uint16_t trackSpace;
+
+        if (trackSpaceAtActualSpace(t.body.mapsList[track], actualSpace, trackSpace) != OK) {
+            trackSpace = 0;
+        }
+
+        markTrack(dirty, track, trackSpace, static_cast<uint16_t>(t.metadata.tracks[track].spaceCount));
+    }
+}
+
+
+tbt_song_model::tbt_song_model() = default;
+
+tbt_song_model::~tbt_song_model() = default;
+
+tbt_song_model::tbt_song_model(tbt_song_model &&) noexcept = default;
+
+tbt_song_model &tbt_song_model::operator=(tbt_song_model &&) noexcept = default;
+
+
+Status
+tbt_song_model::open(
+    tbt_file file,
+    const midi_convert_opts &opts) {
+
+    auto versionNumber = tbtFileVersionNumber(file);
+
+    CHECK(versionNumber == 0x72, "only 0x72 files can be edited: 0x%02x", versionNumber);
+
+    auto p = std::make_unique<impl>();
+
+    p->file = std::move(file);
+
+    p->opts = opts;
+
+    p->opts.selected_tracks.clear();
+
+    auto trackCount = p->t().header.trackCount;
+
+    p->dirty.tracks.assign(trackCount, false);
+
+    p->dirty.ranges.assign(trackCount, tbt_space_range{ 0, 0 });
+
+    Status ret = analyzeTbtFile(p->file, tbt_analyze_opts{ p->opts.diagnostics }, p->ctx);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    ret = convertToMidi(p->ctx, p->opts, p->midi);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    pimpl = std::move(p);
+
+    return OK;
+}
+
+
+const tbt_file &tbt_song_model::file() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->file;
+}
+
+
+const midi_file &tbt_song_model::midi() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->midi;
+}
+
+
+const song_dirty_state &tbt_song_model::dirty() const {
+
+    ASSERT(pimpl);
+
+    return pimpl->dirty;
+}
+
+
+Status
+tbt_song_model::setNote(
+    uint8_t track,
+    uint16_t space,
+    uint8_t string,
+    uint8_t event) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    CHECK(track < t.header.trackCount, "invalid track: %d", track);
+
+    const auto &trackMetadata = t.metadata.tracks[track];
+
+    CHECK(space < trackMetadata.spaceCount, "invalid space: %d", space);
+
+    CHECK(string < trackMetadata.stringCount, "invalid string: %d", string);
+
+    CHECK(event == 0 || event == MUTED || event == STOPPED || 0x80 <= event, "invalid event: %d", event);
+
+    auto &notesMap = t.body.mapsList[track].notesMap;
+
+    auto it = notesMap.find(space);
+
+    if (it == notesMap.end()) {
+
+        if (event == 0) {
+            return OK;
+        }
+
+        it = notesMap.insert({ space, {} }).first;
+    }
+
+    auto &vsqs = it->second;
+
+    if (vsqs[string] == event) {
+        return OK;
+    }
+
+    vsqs[string] = event;
+
+    if (std::all_of(vsqs.cbegin(), vsqs.cend(), [](uint8_t b) { return b == 0; })) {
+        notesMap.erase(it);
+    }
+
+    markTrack(pimpl->dirty, track, space, static_cast<uint16_t>(space + 1));
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::setBarLine(
+    uint16_t space,
+    std::array<uint8_t, 2> barLine) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    CHECK(space < t.body.barLinesSpaceCount, "invalid space: %d", space);
+
+    auto it = t.body.barLinesMap.find(space);
+
+    if (it != t.body.barLinesMap.end() && it->second == barLine) {
+        return OK;
+    }
+
+    t.body.barLinesMap[space] = barLine;
+
+    t.header.barCount = static_cast<uint16_t>(t.body.barLinesMap.size());
+
+    markStructure(t, pimpl->dirty, space);
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::removeBarLine(uint16_t space) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    //
+    // the first bar always starts at space 0
+    //
+    CHECK(space != 0, "cannot remove bar line at space 0");
+
+    auto it = t.body.barLinesMap.find(space);
+
+    if (it == t.body.barLinesMap.end()) {
+        return OK;
+    }
+
+    t.body.barLinesMap.erase(it);
+
+    t.header.barCount = static_cast<uint16_t>(t.body.barLinesMap.size());
+
+    markStructure(t, pimpl->dirty, space);
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::setTrackEffect(
+    uint8_t track,
+    uint16_t space,
+    tbt_track_effect effect,
+    uint16_t value) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    CHECK(track < t.header.trackCount, "invalid track: %d", track);
+
+    CHECK(space < t.metadata.tracks[track].spaceCount, "invalid space: %d", space);
+
+    CHECK(effect <= TE_PITCH_BEND, "invalid effect: %d", effect);
+
+    auto &changes = t.body.mapsList[track].trackEffectChanges;
+
+    //
+    // sorted by space, then effect
+    //
+    auto it = std::lower_bound(changes.begin(), changes.end(), std::pair{ space, effect }, [](const tbt_track_effect_change &a, const std::pair<uint16_t, tbt_track_effect> &b) {
+        return a.space < b.first || (a.space == b.first && a.effect < b.second);
+    });
+
+    if (it != changes.end() && it->space == space && it->effect == effect) {
+
+        if (it->value == value) {
+            return OK;
+        }
+
+        it->value = value;
+
+    } else {
+
+        changes.insert(it, { space, effect, value });
+    }
+
+    //
+    // tempo changes only go in the tempo track
+    //
+    if (effect == TE_TEMPO) {
+        pimpl->dirty.tempo = true;
+    } else {
+        markTrack(pimpl->dirty, track, space, static_cast<uint16_t>(t.metadata.tracks[track].spaceCount));
+    }
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::removeTrackEffect(
+    uint8_t track,
+    uint16_t space,
+    tbt_track_effect effect) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    CHECK(track < t.header.trackCount, "invalid track: %d", track);
+
+    auto &changes = t.body.mapsList[track].trackEffectChanges;
+
+    auto it = std::find_if(changes.begin(), changes.end(), [&](const tbt_track_effect_change &c) { return c.space == space && c.effect == effect; });
+
+    if (it == changes.end()) {
+        return OK;
+    }
+
+    changes.erase(it);
+
+    if (effect == TE_TEMPO) {
+        pimpl->dirty.tempo = true;
+    } else {
+        markTrack(pimpl->dirty, track, space, static_cast<uint16_t>(t.metadata.tracks[track].spaceCount));
+    }
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::insertSpaces(
+    uint16_t space,
+    uint16_t count) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    CHECK(space <= t.body.barLinesSpaceCount, "invalid space: %d", space);
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+        CHECK(t.metadata.tracks[track].spaceCount + count <= UINT16_MAX, "too many spaces");
+    }
+
+    if (count == 0) {
+        return OK;
+    }
+
+    //
+    // map every track first, so nothing is changed if any track fails
+    //
+    std::vector<uint16_t> trackSpaces(t.header.trackCount);
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        Status ret = trackSpaceAtActualSpace(t.body.mapsList[track], space, trackSpaces[track]);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    //
+    // a bar line at space stays with the notes at space
+    //
+    shiftSpaces(t.body.barLinesMap, space, count);
+
+    if (space == 0) {
+        t.body.barLinesMap[0] = t.body.barLinesMap[count];
+        t.body.barLinesMap.erase(count);
+    }
+
+    t.body.barLinesSpaceCount = static_cast<uint16_t>(t.body.barLinesSpaceCount + count);
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        auto &maps = t.body.mapsList[track];
+
+        auto trackSpace = trackSpaces[track];
+
+        shiftSpaces(maps.notesMap, trackSpace, count);
+
+        shiftSpaces(maps.alternateTimeRegionsMap, trackSpace, count);
+
+        for (auto &change : maps.trackEffectChanges) {
+            if (trackSpace <= change.space) {
+                change.space = static_cast<uint16_t>(change.space + count);
+            }
+        }
+
+        t.metadata.tracks[track].spaceCount += count;
+    }
+
+    markStructure(t, pimpl->dirty, space);
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::removeSpaces(
+    uint16_t space,
+    uint16_t count) {
+
+    ASSERT(pimpl);
+
+    auto &t = pimpl->t();
+
+    CHECK(space + count <= t.body.barLinesSpaceCount, "invalid spaces: %d, %d", space, count);
+
+    CHECK(count < t.body.barLinesSpaceCount, "cannot remove every space");
+
+    if (count == 0) {
+        return OK;
+    }
+
+    auto end = static_cast<uint16_t>(space + count);
+
+    std::vector<uint16_t> trackSpaces(t.header.trackCount);
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        const auto &maps = t.body.mapsList[track];
+
+        Status ret = trackSpaceAtActualSpace(maps, space, trackSpaces[track]);
+
+        if (ret != OK) {
+            return ret;
+        }
+
+        auto it = maps.alternateTimeRegionsMap.lower_bound(trackSpaces[track]);
+
+        CHECK(it == maps.alternateTimeRegionsMap.end() || trackSpaces[track] + count <= it->first, "spaces %d to %d are in an alternate time region", space, end);
+    }
+
+    //
+    // a bar that starts in the removed spaces now starts at end, unless another bar already does
+    //
+    auto &barLinesMap = t.body.barLinesMap;
+
+    auto first = barLinesMap.lower_bound(space);
+
+    if (first != barLinesMap.end() && first->first < end && barLinesMap.find(end) == barLinesMap.end()) {
+        barLinesMap[end] = first->second;
+    }
+
+    barLinesMap.erase(barLinesMap.lower_bound(space), barLinesMap.lower_bound(end));
+
+    shiftSpaces(barLinesMap, end, -count);
+
+    t.body.barLinesSpaceCount = static_cast<uint16_t>(t.body.barLinesSpaceCount - count);
+
+    //
+    // a bar cannot be empty
+    //
+    barLinesMap.erase(t.body.barLinesSpaceCount);
+
+    t.header.barCount = static_cast<uint16_t>(barLinesMap.size());
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        auto &maps = t.body.mapsList[track];
+
+        auto trackSpace = trackSpaces[track];
+
+        auto trackEnd = static_cast<uint16_t>(trackSpace + count);
+
+        maps.notesMap.erase(maps.notesMap.lower_bound(trackSpace), maps.notesMap.lower_bound(trackEnd));
+
+        shiftSpaces(maps.notesMap, trackEnd, -count);
+
+        shiftSpaces(maps.alternateTimeRegionsMap, trackEnd, -count);
+
+        std::erase_if(maps.trackEffectChanges, [&](const tbt_track_effect_change &c) { return trackSpace <= c.space && c.space < trackEnd; });
+
+        for (auto &change : maps.trackEffectChanges) {
+            if (trackEnd <= change.space) {
+                change.space = static_cast<uint16_t>(change.space - count);
+            }
+        }
+
+        t.metadata.tracks[track].spaceCount -= count;
+    }
+
+    markStructure(t, pimpl->dirty, space);
+
+    return OK;
+}
+
+
+Status
+tbt_song_model::convert() {
+
+    ASSERT(pimpl);
+
+    auto &p = *pimpl;
+
+    auto &dirty = p.dirty;
+
+    auto anyTracks = std::any_of(dirty.tracks.cbegin(), dirty.tracks.cend(), [](bool b) { return b; });
+
+    if (!dirty.structure && !dirty.tempo && !anyTracks) {
+        return OK;
+    }
+
+    trace_span span("convert edits");
+
+    if (dirty.structure || dirty.tempo) {
+
+        Status ret = analyzeTbtFile(p.file, tbt_analyze_opts{ p.opts.diagnostics }, p.ctx);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    bool emitTempoTrack = (dirty.structure || dirty.tempo);
+
+    auto opts = p.opts;
+
+    //
+    // a structure change moves every track
+    //
+    if (dirty.structure) {
+        opts.selected_tracks.assign(dirty.tracks.size(), true);
+    } else {
+        opts.selected_tracks = dirty.tracks;
+    }
+
+    midi_program program;
+
+    Status ret = convertToMidiProgramOrFile(p.ctx, opts, false, emitTempoTrack, program);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    size_t i = 0;
+
+    if (emitTempoTrack) {
+        p.midi.tracks[0] = std::move(program.tracks[i++].events);
+    }
+
+    for (uint8_t track = 0; track < dirty.tracks.size(); track++) {
+
+        if (!opts.selected_tracks[track]) {
+            continue;
+        }
+
+        ASSERT(program.tracks[i].repeats.empty());
+
+        p.midi.tracks[track + 1] = std::move(program.tracks[i++].events);
+    }
+
+    ASSERT(i == program.tracks.size());
+
+    //
+    // tracks that were not converted again have already been through this, and are unchanged by it
+    //
+    if (opts.eliminate_redundant_events) {
+        eliminateRedundantMidiEvents(p.midi);
+    }
+
+    dirty.structure = false;
+    dirty.tempo = false;
+    dirty.tracks.assign(dirty.tracks.size(), false);
+
+    return OK;
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,98 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm> // for lower_bound
+#include <span>
+#include <vector>
+
+
+#define TAG "space_cursor"
+
+
+//
+// Moving cursor over a vector of records sorted by space
+//
+// T must have a uint16_t space member.
+//
+// Walking forward one space at a time is amortized O(1).
+// Walking backward (i.e., jumping to a repeat open) falls back to binary search.
+//
+template <typename T>
+class space_cursor {
+public:
+
+    explicit space_cursor(const std::vector<T> &records) : records(records), index(0) {}
+
+    //
+    // returns all records at space
+    //
+    std::span<const T> at(uint16_t space) {
+
+        if (index > 0 && space <= records[index - 1].space) {
+
+            index = static_cast<size_t>(std::lower_bound(records.cbegin(), records.cend(), space, [](const T &a, uint16_t b) { return a.space < b; }) - records.cbegin());
+
+        } else {
+
+            while (index < records.size() && records[index].space < space) {
+                index++;
+            }
+        }
+
+        auto last = index;
+
+        while (last < records.size() && records[last].space == space) {
+            last++;
+        }
+
+        return std::span<const T>(records.data() + index, last - index);
+    }
+
+private:
+    const std::vector<T> &records;
+    size_t index;
+};
+
+
+const std::vector<tbt_track_effect_change> NO_TRACK_EFFECT_CHANGES;
+
+//
+// only 0x72 has track effect changes
+//
+template <uint8_t VERSION, typename maps_t>
+const std::vector<tbt_track_effect_change> &trackEffectChangesOf(const maps_t &maps) {
+    if constexpr (VERSION == 0x72) {
+        return maps.trackEffectChanges;
+    } else {
+        (void)maps;
+        return NO_TRACK_EFFECT_CHANGES;
+    }
+}
+
+
+#undef TAG
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,139 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <bit> // for countr_zero
+#include <cstdint>
+
+
+#define TAG "string-lanes"
+
+
+//
+// The note events of all strings at a space, packed into one word, one byte (lane) per string
+//
+// STRINGS_PER_TRACK is at most 8, so per-string tests become a few word operations,
+// and the results are turned into bitmasks of strings that are walked with countr_zero.
+//
+// Tests return a word with the high bit of each matching lane set.
+//
+typedef uint64_t string_lanes;
+
+const string_lanes LANES_LOW7 = 0x7f7f7f7f7f7f7f7f;
+const string_lanes LANES_HIGH = 0x8080808080808080;
+const string_lanes LANES_ONES = 0x0101010101010101;
+
+
+template <uint8_t STRINGS_PER_TRACK>
+string_lanes loadLanes(const uint8_t *vsqs) {
+
+    static_assert(STRINGS_PER_TRACK <= 8);
+
+    string_lanes x = 0;
+
+    for (uint8_t string = 0; string < STRINGS_PER_TRACK; string++) {
+        x |= (static_cast<string_lanes>(vsqs[string]) << (8 * string));
+    }
+
+    return x;
+}
+
+
+inline uint8_t laneAt(string_lanes x, uint8_t string) {
+    return static_cast<uint8_t>(x >> (8 * string));
+}
+
+
+//
+// high bit of each lane that is less than stringCount
+//
+inline string_lanes stringLanesOf(uint8_t stringCount) {
+
+    ASSERT(stringCount <= 8);
+
+    if (stringCount == 8) {
+        return LANES_HIGH;
+    }
+
+    return LANES_HIGH & ((static_cast<string_lanes>(1) << (8 * stringCount)) - 1);
+}
+
+
+//
+// adding 0x7f to the low 7 bits carries into the high bit for anything but 0, and never carries out of the lane
+//
+inline string_lanes nonzeroLanes(string_lanes x) {
+    return (((x & LANES_LOW7) + LANES_LOW7) | x) & LANES_HIGH;
+}
+
+
+inline string_lanes equalLanes(string_lanes x, uint8_t b) {
+    return ~nonzeroLanes(x ^ (LANES_ONES * b)) & LANES_HIGH;
+}
+
+
+//
+// 0x80 and above
+//
+inline string_lanes highLanes(string_lanes x) {
+    return x & LANES_HIGH;
+}
+
+
+//
+// expand a test result to whole lanes, for selecting bytes
+//
+inline string_lanes laneMask(string_lanes test) {
+    return (test >> 7) * 0xff;
+}
+
+
+//
+// gather the high bit of lane i into bit i
+//
+// (test >> 7) has bits at 8i, and multiplying moves each one to 56 + i without any collisions
+//
+inline uint8_t laneBits(string_lanes test) {
+    return static_cast<uint8_t>(((test >> 7) * 0x0102040810204080) >> 56);
+}
+
+
+//
+// remove and return the lowest string in bits
+//
+inline uint8_t popString(uint8_t &bits) {
+
+    auto string = static_cast<uint8_t>(std::countr_zero(bits));
+
+    bits &= static_cast<uint8_t>(bits - 1);
+
+    return string;
+}
+
+
+#undef TAG
+
+
+
+
+
+
+
+
+
+
@@ -18,6 +18,7 @@
 
 #include "tbt-parser.h"
 
+#include "tbt-parser/song-context.h"
 #include "tbt-parser/tbt-parser-util.h"
 #include "tbt-parser/tbt.h"
 
@@ -33,6 +34,10 @@
 #include <map>
 
 
+#include "song-context.inl"
+#include "space-cursor.inl"
+
+
 #define TAG "tablature"
 
 
@@ -93,7 +98,7 @@ const std::map<char, std::string> EFFECT_AFTER = {
 };
 
 
-std::string trackEffectChangesString(const std::map<tbt_track_effect, uint16_t> &trackEffectChanges) {
+std::string trackEffectChangesString(std::span<const tbt_track_effect_change> trackEffectChanges) {
 
     ASSERT(!trackEffectChanges.empty());
 
@@ -101,9 +106,7 @@ std::string trackEffectChangesString(const std::map<tbt_track_effect, uint16_t>
         return "+";
     }
 
-    const auto &it = trackEffectChanges.begin();
-
-    auto effect = it->first;
+    auto effect = trackEffectChanges[0].effect;
 
     switch (effect) {
     case TE_STROKE_DOWN:
@@ -216,16 +219,12 @@ spaceWidthOfVsqs(const std::array<uint8_t, STRINGS_PER_TRACK + STRINGS_PER_TRACK
 
 template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, uint8_t STRINGS_PER_TRACK, typename tbt_file_t>
 std::string
-TtbtFileTablature(const tbt_file_t &t) {
-
-    uint16_t barLinesSpaceCount;
-    if constexpr (0x70 <= VERSION) {
-        barLinesSpaceCount = t.body.barLinesSpaceCount;
-    } else if constexpr (VERSION == 0x6f) {
-        barLinesSpaceCount = t.header.spaceCount;
-    } else {
-        barLinesSpaceCount = 4000;
-    }
+TtbtFileTablature(
+    const tbt_file_t &t,
+    const std::map<uint16_t, uint8_t> *precomputedBarLineWidthMap,
+    const tbt_tablature_opts &opts) {
+
+    const auto barLinesSpaceCount = barLinesSpaceCountOf<VERSION>(t);
 
     //
     // first compute widths
@@ -238,191 +237,20 @@ TtbtFileTablature(const tbt_file_t &t) {
     //
     // must check if present in barLinesMap first
     //
-    std::map<uint16_t, uint8_t> barLineWidthMap;
-
-    //
-    // if not present, then assume 1
+    // taken from the song context if it was already computed
     //
-    std::map<uint16_t, uint8_t> actualSpaceWidthMap;
+    std::map<uint16_t, uint8_t> computedBarLineWidthMap;
 
+    if (!precomputedBarLineWidthMap) {
+        computeBarLineWidthMap<VERSION>(t, barLinesSpaceCount, computedBarLineWidthMap);
+    }
+
+    const auto &barLineWidthMap = (precomputedBarLineWidthMap ? *precomputedBarLineWidthMap : computedBarLineWidthMap);
 
     //
-    // compute bar line widths
+    // if not present, then assume 1
     //
-    {
-        //
-        // make a copy to modify
-        //
-        auto barLinesMap = t.body.barLinesMap;
-
-
-        //
-        // setup last bar lines
-        //
-        if constexpr (0x70 <= VERSION) {
-
-            //
-            // setup last bar line
-            //
-
-            barLinesMap[barLinesSpaceCount] = { 0, 0 };
-
-        } else {
-
-            //
-            // setup last bar line
-            //
-
-            if (barLinesMap.find(barLinesSpaceCount - 1) == barLinesMap.end()) {
-                barLinesMap[barLinesSpaceCount - 1] = { 0b00000001 };
-            }
-        }
-
-
-        bool savedClose = false;
-        uint8_t savedRepeats = 0;
-
-
-        for (uint16_t space = 0; space < barLinesSpaceCount;) {
-
-            const auto &barLinesMapIt = barLinesMap.find(space);
-
-            //
-            // bar line
-            //
-            // both bar lines before notes and bar lines after notes are processed at the same time
-            //
-            if (barLinesMapIt != barLinesMap.end()) {
-
-                if constexpr (0x70 <= VERSION) {
-
-                    auto barLine = barLinesMapIt->second;
-
-                    if (savedClose) {
-
-                        auto w = width(savedRepeats);
-
-                        if (w != 1) {
-                            barLineWidthMap[space] = w;
-                        }
-
-                        savedClose = false;
-                    }
-
-                    if ((barLine[0] & CLOSEREPEAT_MASK_GE70) == CLOSEREPEAT_MASK_GE70) {
-
-                        //
-                        // save for next bar line
-                        //
-
-                        savedClose = true;
-                        savedRepeats = barLine[1];
-                    }
-
-                } else {
-
-                    auto barLine = barLinesMapIt->second;
-
-                    auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
-
-                    switch (change) {
-                    case CLOSE: {
-
-                        auto repeats = static_cast<uint8_t>((barLine[0] & 0b11110000) >> 4);
-
-                        auto w = width(repeats);
-
-                        if (w != 1) {
-                            barLineWidthMap[space] = w;
-                        }
-
-                        break;
-                    }
-                    case OPEN:
-                    case SINGLE:
-                    case DOUBLE: {
-                        break;
-                    }
-                    default:
-                        ABORT("invalid change: %d", change);
-                    }
-                }
-
-                barLinesMap.erase(barLinesMapIt);
-            }
-
-            space++;
-        }
-
-        //
-        // last bar line
-        //
-        {
-            const auto &barLinesMapIt = barLinesMap.find(barLinesSpaceCount);
-
-            if (barLinesMapIt != barLinesMap.end()) {
-
-                if constexpr (0x70 <= VERSION) {
-
-                    auto barLine = barLinesMapIt->second;
-
-                    if (savedClose) {
-
-                        auto w = width(savedRepeats);
-
-                        if (w != 1) {
-                            barLineWidthMap[barLinesSpaceCount] = w;
-                        }
-
-                        savedClose = false;
-                    }
-
-                    if ((barLine[0] & CLOSEREPEAT_MASK_GE70) == CLOSEREPEAT_MASK_GE70) {
-
-                        //
-                        // save for next bar line
-                        //
-
-                        savedClose = true;
-                        savedRepeats = barLine[1];
-                    }
-
-                } else {
-
-                    auto barLine = barLinesMapIt->second;
-
-                    auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
-
-                    switch (change) {
-                    case CLOSE: {
-
-                        auto repeats = static_cast<uint8_t>((barLine[0] & 0b11110000) >> 4);
-
-                        auto w = width(repeats);
-
-                        if (w != 1) {
-                            barLineWidthMap[barLinesSpaceCount] = w;
-                        }
-
-                        break;
-                    }
-                    case OPEN:
-                    case SINGLE:
-                    case DOUBLE: {
-                        break;
-                    }
-                    default:
-                        ABORT("invalid change: %d", change);
-                    }
-                }
-
-                barLinesMap.erase(barLinesMapIt);
-            }
-        }
-
-        ASSERT(barLinesMap.empty());
-
-    } // compute bar line widths
+    std::map<uint16_t, uint8_t> actualSpaceWidthMap;
 
 
     //
@@ -430,6 +258,10 @@ TtbtFileTablature(const tbt_file_t &t) {
     //
     for (uint8_t track = 0; track < t.header.trackCount; track++) {
 
+        if (!trackSelected(opts.selected_tracks, track)) {
+            continue;
+        }
+
         const auto &trackMetadata = t.metadata.tracks[track];
 
         const auto &maps = t.body.mapsList[track];
@@ -728,6 +560,10 @@ TtbtFileTablature(const tbt_file_t &t) {
     //
     for (uint8_t track = 0; track < t.header.trackCount; track++) {
 
+        if (!trackSelected(opts.selected_tracks, track)) {
+            continue;
+        }
+
         const auto &trackMetadata = t.metadata.tracks[track];
 
         //
@@ -977,6 +813,8 @@ TtbtFileTablature(const tbt_file_t &t) {
         bool savedClose = false;
         uint8_t savedRepeats = 0;
 
+        space_cursor trackEffectChangesCursor(trackEffectChangesOf<VERSION>(maps));
+
 
         for (uint16_t space = 0; space < trackSpaceCount;) {
 
@@ -1252,11 +1090,9 @@ TtbtFileTablature(const tbt_file_t &t) {
                 {
                     if constexpr (VERSION == 0x72) {
 
-                        const auto &trackEffectChangesIt = maps.trackEffectChangesMap.find(space);
-
-                        if (trackEffectChangesIt != maps.trackEffectChangesMap.end()) {
+                        auto changes = trackEffectChangesCursor.at(space);
 
-                            const auto &changes = trackEffectChangesIt->second;
+                        if (!changes.empty()) {
 
                             const auto &trackEffectChangesStr = trackEffectChangesString(changes);
 
@@ -2028,100 +1864,116 @@ TtbtFileTablature(const tbt_file_t &t) {
     return acc;
 }
 
-std::string tbtFileTablature(const tbt_file &t) {
+std::string
+tbtFileTablature(
+    const tbt_file &t,
+    const std::map<uint16_t, uint8_t> *barLineWidthMap,
+    const tbt_tablature_opts &opts) {
 
     auto versionNumber = tbtFileVersionNumber(t);
 
     switch (versionNumber) {
     case 0x72: {
 
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
 
         if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            return TtbtFileTablature<0x72, true, 8>(t71);
+            return TtbtFileTablature<0x72, true, 8>(t71, barLineWidthMap, opts);
         } else {
-            return TtbtFileTablature<0x72, false, 8>(t71);
+            return TtbtFileTablature<0x72, false, 8>(t71, barLineWidthMap, opts);
         }
     }
     case 0x71: {
 
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
 
         if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            return TtbtFileTablature<0x71, true, 8>(t71);
+            return TtbtFileTablature<0x71, true, 8>(t71, barLineWidthMap, opts);
         } else {
-            return TtbtFileTablature<0x71, false, 8>(t71);
+            return TtbtFileTablature<0x71, false, 8>(t71, barLineWidthMap, opts);
         }
     }
     case 0x70: {
 
-        auto t70 = std::get<tbt_file70>(t);
+        const auto &t70 = std::get<tbt_file70>(t);
 
         if ((t70.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            return TtbtFileTablature<0x70, true, 8>(t70);
+            return TtbtFileTablature<0x70, true, 8>(t70, barLineWidthMap, opts);
         } else {
-            return TtbtFileTablature<0x70, false, 8>(t70);
+            return TtbtFileTablature<0x70, false, 8>(t70, barLineWidthMap, opts);
         }
     }
     case 0x6f: {
 
-        auto t6f = std::get<tbt_file6f>(t);
+        const auto &t6f = std::get<tbt_file6f>(t);
 
-        return TtbtFileTablature<0x6f, false, 8>(t6f);
+        return TtbtFileTablature<0x6f, false, 8>(t6f, barLineWidthMap, opts);
     }
     case 0x6e: {
 
-        auto t6e = std::get<tbt_file6e>(t);
+        const auto &t6e = std::get<tbt_file6e>(t);
 
-        return TtbtFileTablature<0x6e, false, 8>(t6e);
+        return TtbtFileTablature<0x6e, false, 8>(t6e, barLineWidthMap, opts);
     }
     case 0x6b: {
 
-        auto t6b = std::get<tbt_file6b>(t);
+        const auto &t6b = std::get<tbt_file6b>(t);
 
-        return TtbtFileTablature<0x6b, false, 8>(t6b);
+        return TtbtFileTablature<0x6b, false, 8>(t6b, barLineWidthMap, opts);
     }
     case 0x6a: {
 
-        auto t6a = std::get<tbt_file6a>(t);
+        const auto &t6a = std::get<tbt_file6a>(t);
 
-        return TtbtFileTablature<0x6a, false, 6>(t6a);
+        return TtbtFileTablature<0x6a, false, 6>(t6a, barLineWidthMap, opts);
     }
     case 0x69: {
 
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
 
-        return TtbtFileTablature<0x69, false, 6>(t68);
+        return TtbtFileTablature<0x69, false, 6>(t68, barLineWidthMap, opts);
     }
     case 0x68: {
 
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
 
-        return TtbtFileTablature<0x68, false, 6>(t68);
+        return TtbtFileTablature<0x68, false, 6>(t68, barLineWidthMap, opts);
     }
     case 0x67: {
 
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
 
-        return TtbtFileTablature<0x67, false, 6>(t65);
+        return TtbtFileTablature<0x67, false, 6>(t65, barLineWidthMap, opts);
     }
     case 0x66: {
 
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
 
-        return TtbtFileTablature<0x66, false, 6>(t65);
+        return TtbtFileTablature<0x66, false, 6>(t65, barLineWidthMap, opts);
     }
     case 0x65: {
 
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
 
-        return TtbtFileTablature<0x65, false, 6>(t65);
+        return TtbtFileTablature<0x65, false, 6>(t65, barLineWidthMap, opts);
     }
     default:
         ABORT("invalid versionNumber: 0x%02x", versionNumber);
     }
 }
 
+std::string tbtFileTablature(const tbt_file &t) {
+    return tbtFileTablature(t, nullptr, tbt_tablature_opts{});
+}
+
+std::string tbtFileTablature(const tbt_file &t, const tbt_tablature_opts &opts) {
+    return tbtFileTablature(t, nullptr, opts);
+}
+
+std::string tbtFileTablature(const tbt_song_context &ctx, const tbt_tablature_opts &opts) {
+    return tbtFileTablature(ctx.file(), &ctx.internals().barLineWidthMap, opts);
+}
+
 
 
 
@@ -0,0 +1,1181 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/tbt-encode.h"
+
+#include "tbt-parser/tbt-parser-util.h"
+#include "tbt-parser/tbt.h"
+#include "tbt-parser/trace.h"
+
+#undef NDEBUG
+
+#include "common/abort.h"
+#include "common/assert.h"
+#include "common/check.h"
+#include "common/logging.h"
+
+#include <algorithm> // for min, max, any_of, is_permutation
+#include <cinttypes>
+#include <cstring> // for memcpy
+#include <set>
+#include <variant> // for get, visit
+
+
+#include "midi-constants.inl"
+
+
+#define TAG "tbt-encode"
+
+
+const uint8_t UPGRADE_VERSION = 0x72;
+
+//
+// written once and read many times, so spend the time
+//
+const int ENCODE_COMPRESSION_LEVEL = 9;
+
+const size_t DELTA_LIST_CHUNK_MAX_PAIRS = 0x1000;
+
+
+void encodeLE2(uint16_t value, std::vector<uint8_t> &out) {
+    out.push_back(static_cast<uint8_t>(value & 0xff));
+    out.push_back(static_cast<uint8_t>((value >> 8) & 0xff));
+}
+
+
+void encodeLE4(uint32_t value, std::vector<uint8_t> &out) {
+    out.push_back(static_cast<uint8_t>(value & 0xff));
+    out.push_back(static_cast<uint8_t>((value >> 8) & 0xff));
+    out.push_back(static_cast<uint8_t>((value >> 16) & 0xff));
+    out.push_back(static_cast<uint8_t>((value >> 24) & 0xff));
+}
+
+
+//
+// the inverse of expandDeltaList
+//
+// runs of equal units are written as { n, y }, or as { 0, n & 0xff }, { n >> 8, y } if n does not fit in a byte
+//
+// entries are never split across chunks
+//
+template <uint32_t S>
+void
+encodeDeltaList(
+    const std::map<uint16_t, std::array<uint8_t, S> > &map,
+    uint32_t unitCount,
+    uint8_t x,
+    std::vector<uint8_t> &out) {
+
+    std::vector<std::array<uint8_t, 2> > pairs;
+
+    //
+    // index into pairs of the start of each entry
+    //
+    std::vector<size_t> entries;
+
+    uint8_t runValue = x;
+    uint32_t runCount = 0;
+
+    auto emitRun = [&]() {
+
+        while (runCount > 0) {
+
+            auto n = std::min<uint32_t>(runCount, 0xffff);
+
+            entries.push_back(pairs.size());
+
+            if (n < 0x100) {
+
+                pairs.push_back({ static_cast<uint8_t>(n), runValue });
+
+            } else {
+
+                pairs.push_back({ 0, static_cast<uint8_t>(n & 0xff) });
+                pairs.push_back({ static_cast<uint8_t>(n >> 8), runValue });
+            }
+
+            runCount -= n;
+        }
+    };
+
+    auto feed = [&](uint8_t value, uint32_t count) {
+
+        if (count == 0) {
+            return;
+        }
+
+        if (value != runValue) {
+
+            emitRun();
+
+            runValue = value;
+        }
+
+        runCount += count;
+    };
+
+    uint32_t unit = 0;
+
+    for (const auto &[space, units] : map) {
+
+        auto spaceUnit = static_cast<uint32_t>(space) * S;
+
+        ASSERT(unit <= spaceUnit);
+        ASSERT(spaceUnit + S <= unitCount);
+
+        feed(x, spaceUnit - unit);
+
+        for (auto u : units) {
+            feed(u, 1);
+        }
+
+        unit = spaceUnit + S;
+    }
+
+    feed(x, unitCount - unit);
+
+    emitRun();
+
+    //
+    // write chunks, and always at least 1
+    //
+    size_t entry = 0;
+
+    do {
+
+        auto chunkBegin = (entry < entries.size()) ? entries[entry] : pairs.size();
+
+        auto chunkEnd = chunkBegin;
+
+        while (entry < entries.size()) {
+
+            auto entryEnd = (entry + 1 < entries.size()) ? entries[entry + 1] : pairs.size();
+
+            if (entryEnd - chunkBegin > DELTA_LIST_CHUNK_MAX_PAIRS) {
+                break;
+            }
+
+            chunkEnd = entryEnd;
+
+            entry++;
+        }
+
+        encodeLE2(static_cast<uint16_t>(chunkEnd - chunkBegin), out);
+
+        for (auto i = chunkBegin; i < chunkEnd; i++) {
+            out.push_back(pairs[i][0]);
+            out.push_back(pairs[i][1]);
+        }
+
+    } while (entry < entries.size());
+}
+
+
+template <uint8_t VERSION, typename tbt_file_t>
+void
+encodeMetadata(
+    const tbt_file_t &t,
+    std::vector<uint8_t> &out) {
+
+    static_assert(0x70 <= VERSION);
+
+    const auto &tracks = t.metadata.tracks;
+
+    for (const auto &track : tracks) {
+        encodeLE4(track.spaceCount, out);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.stringCount);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.cleanGuitar);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.mutedGuitar);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.volume);
+    }
+
+    if constexpr (0x71 <= VERSION) {
+
+        for (const auto &track : tracks) {
+            out.push_back(track.modulation);
+        }
+
+        for (const auto &track : tracks) {
+            encodeLE2(static_cast<uint16_t>(track.pitchBend), out);
+        }
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(static_cast<uint8_t>(track.transposeHalfSteps));
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.midiBank);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.reverb);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.chorus);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.pan);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.highestNote);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.displayMIDINoteNumbers);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(static_cast<uint8_t>(track.midiChannel));
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.topLineText);
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.bottomLineText);
+    }
+
+    for (const auto &track : tracks) {
+        for (auto tuning : track.tuning) {
+            out.push_back(static_cast<uint8_t>(tuning));
+        }
+    }
+
+    for (const auto &track : tracks) {
+        out.push_back(track.drums);
+    }
+
+    //
+    // Pascal2 strings are kept with their lengths
+    //
+    for (const auto *str : { &t.metadata.title, &t.metadata.artist, &t.metadata.album, &t.metadata.transcribedBy, &t.metadata.comment }) {
+        out.insert(out.end(), str->cbegin(), str->cend());
+    }
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, typename tbt_file_t>
+Status
+encodeBody(
+    const tbt_file_t &t,
+    std::vector<uint8_t> &out) {
+
+    static_assert(0x70 <= VERSION);
+
+    //
+    // bar lines: the number of spaces until the next bar line (or the end), then the bar line
+    //
+    const auto &barLinesMap = t.body.barLinesMap;
+
+    CHECK(!barLinesMap.empty() && barLinesMap.begin()->first == 0, "first bar line must be at space 0");
+
+    for (auto it = barLinesMap.cbegin(); it != barLinesMap.cend(); it++) {
+
+        auto next = std::next(it);
+
+        auto nextSpace = (next != barLinesMap.cend()) ? next->first : t.body.barLinesSpaceCount;
+
+        CHECK(it->first <= nextSpace, "bar line at space %d is past the end: %d", it->first, t.body.barLinesSpaceCount);
+
+        encodeLE4(static_cast<uint32_t>(nextSpace - it->first), out);
+
+        out.push_back(it->second[0]);
+        out.push_back(it->second[1]);
+    }
+
+    //
+    // notes
+    //
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        auto trackSpaceCount = static_cast<uint16_t>(t.metadata.tracks[track].spaceCount);
+
+        const auto &notesMap = t.body.mapsList[track].notesMap;
+
+        CHECK(notesMap.empty() || notesMap.crbegin()->first < trackSpaceCount, "track %d has notes past its end", track);
+
+        encodeDeltaList<20>(notesMap, 20u * trackSpaceCount, 0, out);
+    }
+
+    //
+    // alternate time regions
+    //
+    if constexpr (HASALTERNATETIMEREGIONS) {
+
+        for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+            auto trackSpaceCount = static_cast<uint16_t>(t.metadata.tracks[track].spaceCount);
+
+            const auto &alternateTimeRegionsMap = t.body.mapsList[track].alternateTimeRegionsMap;
+
+            CHECK(alternateTimeRegionsMap.empty() || alternateTimeRegionsMap.crbegin()->first < trackSpaceCount, "track %d has alternate time regions past its end", track);
+
+            encodeDeltaList<2>(alternateTimeRegionsMap, 2u * trackSpaceCount, 1, out);
+        }
+    }
+
+    //
+    // track effect changes
+    //
+    if constexpr (0x71 <= VERSION) {
+
+        for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+            const auto &trackEffectChanges = t.body.mapsList[track].trackEffectChanges;
+
+            encodeLE4(static_cast<uint32_t>(8 * trackEffectChanges.size()), out);
+
+            uint16_t space = 0;
+
+            for (const auto &change : trackEffectChanges) {
+
+                ASSERT(space <= change.space);
+
+                encodeLE2(static_cast<uint16_t>(change.space - space), out);
+                encodeLE2(change.effect, out);
+                encodeLE2(0x02, out);
+                encodeLE2(change.value, out);
+
+                space = change.space;
+            }
+        }
+    }
+
+    return OK;
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, typename tbt_file_t>
+Status
+TencodeTbtBytes(
+    const tbt_file_t &t,
+    std::vector<uint8_t> &out) {
+
+    CHECK(t.metadata.tracks.size() == t.header.trackCount, "metadata has %zu tracks, expected %d", t.metadata.tracks.size(), t.header.trackCount);
+    CHECK(t.body.mapsList.size() == t.header.trackCount, "body has %zu tracks, expected %d", t.body.mapsList.size(), t.header.trackCount);
+    CHECK(t.body.barLinesMap.size() <= 0xffff, "too many bar lines: %zu", t.body.barLinesMap.size());
+
+    std::vector<uint8_t> metadata;
+
+    encodeMetadata<VERSION>(t, metadata);
+
+    std::vector<uint8_t> body;
+
+    Status ret = encodeBody<VERSION, HASALTERNATETIMEREGIONS>(t, body);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    out.clear();
+
+    out.resize(TBT_HEADER_SIZE);
+
+    {
+        trace_span span("deflate metadata");
+
+        ret = zlib_deflate(metadata, ENCODE_COMPRESSION_LEVEL, out);
+    }
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    auto compressedMetadataLen = out.size() - TBT_HEADER_SIZE;
+
+    {
+        trace_span span("deflate body");
+
+        ret = zlib_deflate(body, ENCODE_COMPRESSION_LEVEL, out);
+    }
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    CHECK(out.size() <= INT32_MAX, "file is too large: %zu", out.size());
+
+    auto header = t.header;
+
+    header.barCount = static_cast<uint16_t>(t.body.barLinesMap.size());
+    header.compressedMetadataLen = static_cast<int32_t>(compressedMetadataLen);
+    header.totalByteCount = static_cast<int32_t>(out.size());
+
+    {
+        trace_span span("crc");
+
+        std::vector<uint8_t>::const_iterator restToCheck_it = out.cbegin() + TBT_HEADER_SIZE;
+
+        header.crc32Rest = crc32_checksum(restToCheck_it, out.cend());
+
+        std::memcpy(out.data(), &header, TBT_HEADER_SIZE);
+
+        std::vector<uint8_t>::const_iterator headerToCheck_it = out.cbegin();
+
+        header.crc32Header = crc32_checksum(headerToCheck_it, out.cbegin() + TBT_HEADER_SIZE - 4);
+
+        std::memcpy(out.data(), &header, TBT_HEADER_SIZE);
+    }
+
+    return OK;
+}
+
+
+Status encodeTbtBytes(const tbt_file &t, std::vector<uint8_t> &out) {
+
+    trace_span span("encode");
+
+    auto versionNumber = tbtFileVersionNumber(t);
+
+    switch (versionNumber) {
+    case 0x72: {
+
+        const auto &t71 = std::get<tbt_file71>(t);
+
+        if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            return TencodeTbtBytes<0x72, true>(t71, out);
+        } else {
+            return TencodeTbtBytes<0x72, false>(t71, out);
+        }
+    }
+    case 0x71: {
+
+        const auto &t71 = std::get<tbt_file71>(t);
+
+        if ((t71.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            return TencodeTbtBytes<0x71, true>(t71, out);
+        } else {
+            return TencodeTbtBytes<0x71, false>(t71, out);
+        }
+    }
+    case 0x70: {
+
+        const auto &t70 = std::get<tbt_file70>(t);
+
+        if ((t70.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            return TencodeTbtBytes<0x70, true>(t70, out);
+        } else {
+            return TencodeTbtBytes<0x70, false>(t70, out);
+        }
+    }
+    default: {
+        LOGE("encoding version 0x%02x is not supported; upgrade the file first", versionNumber);
+        return ERR;
+    }
+    }
+}
+
+
+std::vector<char> pascal1ToPascal2(const std::vector<char> &str) {
+
+    if (str.empty()) {
+        return { 0, 0 };
+    }
+
+    auto len = static_cast<uint8_t>(str[0]);
+
+    std::vector<char> out{ static_cast<char>(len), 0 };
+
+    out.insert(out.end(), str.cbegin() + 1, str.cend());
+
+    return out;
+}
+
+
+Status
+trackEffectChangeOfLetter(
+    uint16_t space,
+    uint8_t letter,
+    uint8_t value,
+    tbt_track_effect_change &out) {
+
+    switch (letter) {
+    case 'D':
+        out = { space, TE_STROKE_DOWN, value };
+        return OK;
+    case 'U':
+        out = { space, TE_STROKE_UP, value };
+        return OK;
+    case 'T':
+        out = { space, TE_TEMPO, value };
+        return OK;
+    case 't':
+        out = { space, TE_TEMPO, static_cast<uint16_t>(value + 250) };
+        return OK;
+    case 'I':
+        //
+        // no bank flag, same as before
+        //
+        out = { space, TE_INSTRUMENT, value };
+        return OK;
+    case 'V':
+        out = { space, TE_VOLUME, value };
+        return OK;
+    case 'P':
+        out = { space, TE_PAN, value };
+        return OK;
+    case 'C':
+        out = { space, TE_CHORUS, value };
+        return OK;
+    case 'R':
+        out = { space, TE_REVERB, value };
+        return OK;
+    default:
+        LOGE("invalid track effect at space %d: %c (%d)", space, letter, letter);
+        return ERR;
+    }
+}
+
+
+//
+// files before 0x70 have a bar line after the last space of a measure (or an open repeat at the first space),
+// and files since have a record at the first space of each measure
+//
+// also finds the exact space count: the end of the measure with the last note or repeat
+//
+template <typename bar_lines_map_t>
+void
+upgradeBarLines(
+    const bar_lines_map_t &barLinesMap,
+    uint16_t oldSpaceCount,
+    int lastContentSpace,
+    tbt_body71 &out) {
+
+    std::set<uint16_t> measureStarts{ 0 };
+
+    for (const auto &[space, barLine] : barLinesMap) {
+
+        auto change = static_cast<tbt_bar_line>(barLine[0] & 0b00001111);
+
+        switch (change) {
+        case OPEN:
+            measureStarts.insert(space);
+            lastContentSpace = std::max<int>(lastContentSpace, space);
+            break;
+        case CLOSE:
+            measureStarts.insert(static_cast<uint16_t>(space + 1));
+            lastContentSpace = std::max<int>(lastContentSpace, space);
+            break;
+        case SINGLE:
+        case DOUBLE:
+            measureStarts.insert(static_cast<uint16_t>(space + 1));
+            break;
+        default:
+            ABORT("invalid change: %d", change);
+        }
+    }
+
+    //
+    // an empty song still has 1 space
+    //
+    auto contentEnd = static_cast<uint16_t>(std::max(lastContentSpace + 1, 1));
+
+    auto endIt = measureStarts.lower_bound(contentEnd);
+
+    uint16_t spaceCount;
+    if (endIt != measureStarts.end() && *endIt <= oldSpaceCount) {
+        spaceCount = *endIt;
+    } else {
+        spaceCount = oldSpaceCount;
+    }
+
+    out.barLinesSpaceCount = spaceCount;
+
+    out.barLinesMap.clear();
+
+    for (auto it = measureStarts.cbegin(); it != measureStarts.cend() && *it < spaceCount; it++) {
+
+        auto start = *it;
+
+        auto next = std::next(it);
+
+        auto end = (next != measureStarts.cend() && *next < spaceCount) ? *next : spaceCount;
+
+        uint8_t flags = 0;
+        uint8_t repeats = 0;
+
+        const auto &openIt = barLinesMap.find(start);
+        if (openIt != barLinesMap.end() && static_cast<tbt_bar_line>(openIt->second[0] & 0b00001111) == OPEN) {
+            flags |= OPENREPEAT_MASK_GE70;
+        }
+
+        const auto &closeIt = barLinesMap.find(static_cast<uint16_t>(end - 1));
+        if (closeIt != barLinesMap.end()) {
+
+            auto change = static_cast<tbt_bar_line>(closeIt->second[0] & 0b00001111);
+
+            if (change == CLOSE) {
+
+                flags |= CLOSEREPEAT_MASK_GE70;
+
+                repeats = static_cast<uint8_t>((closeIt->second[0] & 0b11110000) >> 4);
+
+            } else if (change == DOUBLE) {
+
+                flags |= DOUBLEBAR_MASK_GE70;
+            }
+        }
+
+        out.barLinesMap[start] = { flags, repeats };
+    }
+}
+
+
+template <uint8_t VERSION, bool HASALTERNATETIMEREGIONS, size_t STRINGS_PER_TRACK, typename tbt_file_t>
+Status
+TupgradeTbtFile(
+    const tbt_file_t &t,
+    tbt_file71 &out) {
+
+    //
+    // header
+    //
+    {
+        tbt_header70 header{};
+
+        header.magic = { 'T', 'B', 'T' };
+        header.versionNumber = UPGRADE_VERSION;
+        header.trackCount = t.header.trackCount;
+        header.versionString = { 3, '2', '.', '0', 0 };
+
+        if constexpr (0x70 <= VERSION) {
+            header.featureBitfield = t.header.featureBitfield;
+            header.unused = t.header.unused;
+        } else {
+            header.featureBitfield = static_cast<uint8_t>(t.header.featureBitfield & ~HASALTERNATETIMEREGIONS_MASK);
+        }
+
+        if constexpr (0x6e <= VERSION) {
+
+            header.tempo1 = t.header.tempo1;
+            header.tempo2 = t.header.tempo2;
+
+        } else {
+
+            //
+            // tempo1 saturates at 250
+            //
+            header.tempo1 = std::min<uint8_t>(t.header.tempo1, 250);
+            header.tempo2 = t.header.tempo1;
+        }
+
+        out.header = header;
+    }
+
+    //
+    // bar lines and space counts
+    //
+    std::vector<uint32_t> trackSpaceCounts;
+
+    if constexpr (0x70 <= VERSION) {
+
+        out.body.barLinesMap = t.body.barLinesMap;
+        out.body.barLinesSpaceCount = t.body.barLinesSpaceCount;
+
+        for (const auto &track : t.metadata.tracks) {
+            trackSpaceCounts.push_back(track.spaceCount);
+        }
+
+    } else {
+
+        uint16_t oldSpaceCount;
+        if constexpr (VERSION == 0x6f) {
+            oldSpaceCount = t.header.spaceCount;
+        } else {
+            oldSpaceCount = 4000;
+        }
+
+        int lastContentSpace = -1;
+
+        if constexpr (VERSION == 0x6f) {
+
+            //
+            // 0x6f stores the length of the song, so keep it
+            //
+            lastContentSpace = oldSpaceCount - 1;
+
+        } else {
+
+            //
+            // before 0x6f, every song is padded to 4000 spaces, so trim it after the last content
+            //
+            for (const auto &maps : t.body.mapsList) {
+                if (!maps.notesMap.empty()) {
+                    lastContentSpace = std::max<int>(lastContentSpace, maps.notesMap.crbegin()->first);
+                }
+            }
+        }
+
+        upgradeBarLines(t.body.barLinesMap, oldSpaceCount, lastContentSpace, out.body);
+
+        trackSpaceCounts.assign(t.header.trackCount, out.body.barLinesSpaceCount);
+    }
+
+    //
+    // metadata
+    //
+    if constexpr (0x6e <= VERSION) {
+
+        out.metadata.title = t.metadata.title;
+        out.metadata.artist = t.metadata.artist;
+        out.metadata.album = t.metadata.album;
+        out.metadata.transcribedBy = t.metadata.transcribedBy;
+        out.metadata.comment = t.metadata.comment;
+
+    } else {
+
+        out.metadata.title = pascal1ToPascal2(t.metadata.title);
+        out.metadata.artist = pascal1ToPascal2(t.metadata.artist);
+        out.metadata.album = { 0, 0 };
+        out.metadata.transcribedBy = { 0, 0 };
+        out.metadata.comment = pascal1ToPascal2(t.metadata.comment);
+    }
+
+    out.metadata.tracks.clear();
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        const auto &old = t.metadata.tracks[track];
+
+        tbt_track_metadata71 m{};
+
+        m.spaceCount = trackSpaceCounts[track];
+        m.stringCount = old.stringCount;
+        m.cleanGuitar = old.cleanGuitar;
+        m.mutedGuitar = old.mutedGuitar;
+        m.volume = old.volume;
+
+        //
+        // the values that conversion assumes when these are missing
+        //
+        m.modulation = 0;
+        m.pitchBend = 0;
+        m.transposeHalfSteps = 0;
+        m.midiBank = 0;
+        m.reverb = 0;
+        m.chorus = 0;
+        m.pan = 0x40;
+        m.highestNote = 0;
+        m.displayMIDINoteNumbers = 0;
+        m.midiChannel = -1;
+
+        if constexpr (0x71 <= VERSION) {
+            m.modulation = old.modulation;
+            m.pitchBend = old.pitchBend;
+        }
+
+        if constexpr (0x6e <= VERSION) {
+            m.transposeHalfSteps = old.transposeHalfSteps;
+            m.midiBank = old.midiBank;
+            m.reverb = old.reverb;
+            m.chorus = old.chorus;
+        }
+
+        if constexpr (0x6b <= VERSION) {
+            m.pan = old.pan;
+            m.highestNote = old.highestNote;
+        }
+
+        if constexpr (0x6a <= VERSION) {
+            m.displayMIDINoteNumbers = old.displayMIDINoteNumbers;
+            m.midiChannel = old.midiChannel;
+        }
+
+        m.topLineText = old.topLineText;
+        m.bottomLineText = old.bottomLineText;
+
+        if constexpr (0x6b <= VERSION) {
+
+            m.tuning = old.tuning;
+
+        } else {
+
+            CHECK(old.stringCount <= 6, "track %d has %d strings", track, old.stringCount);
+
+            //
+            // strings were from highest to lowest, now from lowest to highest
+            //
+            for (uint8_t string = 0; string < old.stringCount; string++) {
+
+                auto newString = static_cast<uint8_t>(old.stringCount - 1 - string);
+
+                m.tuning[newString] = static_cast<int8_t>(old.tuning[string] + OPEN_STRING_TO_MIDI_NOTE_LE6A[string] - OPEN_STRING_TO_MIDI_NOTE[newString]);
+            }
+        }
+
+        m.drums = old.drums;
+
+        out.metadata.tracks.push_back(m);
+    }
+
+    //
+    // notes, alternate time regions, and track effect changes
+    //
+    out.body.mapsList.clear();
+
+    for (uint8_t track = 0; track < t.header.trackCount; track++) {
+
+        const auto &oldMaps = t.body.mapsList[track];
+
+        maps71 maps;
+
+        auto stringCount = t.metadata.tracks[track].stringCount;
+
+        for (const auto &[space, oldVsqs] : oldMaps.notesMap) {
+
+            std::array<uint8_t, 20> vsqs{};
+
+            if constexpr (STRINGS_PER_TRACK == 8) {
+
+                vsqs = oldVsqs;
+
+            } else {
+
+                for (uint8_t string = 0; string < STRINGS_PER_TRACK; string++) {
+
+                    auto newString = (string < stringCount) ? static_cast<uint8_t>(stringCount - 1 - string) : string;
+
+                    vsqs[newString] = oldVsqs[string];
+                    vsqs[8 + newString] = oldVsqs[STRINGS_PER_TRACK + string];
+                }
+
+                for (uint8_t i = 0; i < 4; i++) {
+                    vsqs[8 + 8 + i] = oldVsqs[STRINGS_PER_TRACK + STRINGS_PER_TRACK + i];
+                }
+            }
+
+            if constexpr (VERSION < 0x72) {
+
+                auto letter = vsqs[8 + 8 + 0];
+
+                if (letter != 0) {
+
+                    tbt_track_effect_change change;
+
+                    Status ret = trackEffectChangeOfLetter(space, letter, vsqs[8 + 8 + 3], change);
+
+                    if (ret != OK) {
+                        return ret;
+                    }
+
+                    maps.trackEffectChanges.push_back(change);
+
+                    std::memset(vsqs.data() + 8 + 8, 0, 4);
+                }
+            }
+
+            if (std::any_of(vsqs.cbegin(), vsqs.cend(), [](uint8_t v) { return v != 0; })) {
+                maps.notesMap.emplace_hint(maps.notesMap.end(), space, vsqs);
+            }
+        }
+
+        if constexpr (HASALTERNATETIMEREGIONS) {
+            maps.alternateTimeRegionsMap = oldMaps.alternateTimeRegionsMap;
+        }
+
+        if constexpr (VERSION == 0x72) {
+            maps.trackEffectChanges = oldMaps.trackEffectChanges;
+        }
+
+        out.body.mapsList.push_back(std::move(maps));
+    }
+
+    return OK;
+}
+
+
+Status upgradeTbtFile(const tbt_file &t, tbt_file &out) {
+
+    trace_span span("upgrade");
+
+    auto versionNumber = tbtFileVersionNumber(t);
+
+    tbt_file71 t71;
+
+    Status ret;
+
+    switch (versionNumber) {
+    case 0x72: {
+
+        const auto &t72 = std::get<tbt_file71>(t);
+
+        if ((t72.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            ret = TupgradeTbtFile<0x72, true, 8>(t72, t71);
+        } else {
+            ret = TupgradeTbtFile<0x72, false, 8>(t72, t71);
+        }
+
+        break;
+    }
+    case 0x71: {
+
+        const auto &t71Old = std::get<tbt_file71>(t);
+
+        if ((t71Old.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            ret = TupgradeTbtFile<0x71, true, 8>(t71Old, t71);
+        } else {
+            ret = TupgradeTbtFile<0x71, false, 8>(t71Old, t71);
+        }
+
+        break;
+    }
+    case 0x70: {
+
+        const auto &t70 = std::get<tbt_file70>(t);
+
+        if ((t70.header.featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
+            ret = TupgradeTbtFile<0x70, true, 8>(t70, t71);
+        } else {
+            ret = TupgradeTbtFile<0x70, false, 8>(t70, t71);
+        }
+
+        break;
+    }
+    case 0x6f: {
+
+        const auto &t6f = std::get<tbt_file6f>(t);
+
+        ret = TupgradeTbtFile<0x6f, false, 8>(t6f, t71);
+
+        break;
+    }
+    case 0x6e: {
+
+        const auto &t6e = std::get<tbt_file6e>(t);
+
+        ret = TupgradeTbtFile<0x6e, false, 8>(t6e, t71);
+
+        break;
+    }
+    case 0x6b: {
+
+        const auto &t6b = std::get<tbt_file6b>(t);
+
+        ret = TupgradeTbtFile<0x6b, false, 8>(t6b, t71);
+
+        break;
+    }
+    case 0x6a: {
+
+        const auto &t6a = std::get<tbt_file6a>(t);
+
+        ret = TupgradeTbtFile<0x6a, false, 6>(t6a, t71);
+
+        break;
+    }
+    case 0x69:
+    case 0x68: {
+
+        const auto &t68 = std::get<tbt_file68>(t);
+
+        ret = TupgradeTbtFile<0x68, false, 6>(t68, t71);
+
+        break;
+    }
+    case 0x67:
+    case 0x66:
+    case 0x65: {
+
+        const auto &t65 = std::get<tbt_file65>(t);
+
+        ret = TupgradeTbtFile<0x65, false, 6>(t65, t71);
+
+        break;
+    }
+    default: {
+        ABORT("invalid versionNumber: 0x%02x", versionNumber);
+    }
+    }
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    out = std::move(t71);
+
+    return OK;
+}
+
+
+int32_t deltaTimeOfEvent(const midi_track_event &e) {
+    return std::visit([](const auto &ev) { return ev.deltaTime; }, e);
+}
+
+
+bool isTrailingEvent(const midi_track_event &e) {
+
+    if (std::holds_alternative<NoteOffEvent>(e)) {
+        return true;
+    }
+
+    const auto *meta = std::get_if<MetaEvent>(&e);
+
+    return meta && meta->type == M_ENDOFTRACK;
+}
+
+
+//
+// if trimmed is true, then the padding at the end of the song was trimmed, and trailing events may come earlier
+//
+Status
+verifyUpgradedTrack(
+    size_t track,
+    bool trimmed,
+    const std::vector<midi_track_event> &original,
+    const std::vector<midi_track_event> &upgraded) {
+
+    CHECK(original.size() == upgraded.size(), "track %zu: event counts differ: %zu, %zu", track, original.size(), upgraded.size());
+
+    auto trailing = original.size();
+
+    while (trimmed && trailing > 0 && isTrailingEvent(original[trailing - 1])) {
+        trailing--;
+    }
+
+    int64_t originalTick = 0;
+    int64_t upgradedTick = 0;
+
+    for (size_t i = 0; i < trailing; i++) {
+
+        originalTick += deltaTimeOfEvent(original[i]);
+        upgradedTick += deltaTimeOfEvent(upgraded[i]);
+
+        auto a = original[i];
+        auto b = upgraded[i];
+
+        std::visit([](auto &ev) { ev.deltaTime = 0; }, a);
+        std::visit([](auto &ev) { ev.deltaTime = 0; }, b);
+
+        CHECK(a == b, "track %zu: event %zu differs", track, i);
+
+        CHECK(originalTick == upgradedTick, "track %zu: event %zu is at tick %" PRId64 ", expected %" PRId64, track, i, upgradedTick, originalTick);
+    }
+
+    //
+    // trailing Note Offs may move earlier, and Note Offs that now land on the same tick may come in a different order
+    //
+    auto lastTick = upgradedTick;
+
+    std::vector<midi_track_event> originalTrailing;
+    std::vector<midi_track_event> upgradedTrailing;
+
+    for (size_t i = trailing; i < original.size(); i++) {
+
+        originalTick += deltaTimeOfEvent(original[i]);
+        upgradedTick += deltaTimeOfEvent(upgraded[i]);
+
+        CHECK(lastTick <= upgradedTick && upgradedTick <= originalTick, "track %zu: trailing event %zu is at tick %" PRId64 ", expected between %" PRId64 " and %" PRId64, track, i, upgradedTick, lastTick, originalTick);
+
+        auto a = original[i];
+        auto b = upgraded[i];
+
+        std::visit([](auto &ev) { ev.deltaTime = 0; }, a);
+        std::visit([](auto &ev) { ev.deltaTime = 0; }, b);
+
+        originalTrailing.push_back(std::move(a));
+        upgradedTrailing.push_back(std::move(b));
+    }
+
+    CHECK(std::is_permutation(originalTrailing.cbegin(), originalTrailing.cend(), upgradedTrailing.cbegin(), upgradedTrailing.cend()), "track %zu: trailing events differ", track);
+
+    CHECK(originalTrailing.empty() || originalTrailing.back() == upgradedTrailing.back(), "track %zu: last event differs", track);
+
+    return OK;
+}
+
+
+Status verifyUpgradedTbtFile(const tbt_file &original, const tbt_file &upgraded) {
+
+    trace_span span("verify upgrade");
+
+    //
+    // warnings were already reported when the original was parsed, or will be when it is converted
+    //
+    tbt_diagnostics diagnostics;
+
+    midi_convert_opts opts;
+
+    opts.diagnostics = &diagnostics;
+
+    midi_file originalMidi;
+
+    Status ret = convertToMidi(original, opts, originalMidi);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    midi_file upgradedMidi;
+
+    ret = convertToMidi(upgraded, opts, upgradedMidi);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    CHECK(originalMidi.header.format == upgradedMidi.header.format &&
+        originalMidi.header.trackCount == upgradedMidi.header.trackCount &&
+        originalMidi.header.division == upgradedMidi.header.division, "MIDI headers differ");
+
+    CHECK(originalMidi.tracks.size() == upgradedMidi.tracks.size(), "MIDI track counts differ: %zu, %zu", originalMidi.tracks.size(), upgradedMidi.tracks.size());
+
+    //
+    // only files before 0x6f are padded to 4000 spaces
+    //
+    bool trimmed = (tbtFileVersionNumber(original) < 0x6f);
+
+    for (size_t track = 0; track < originalMidi.tracks.size(); track++) {
+
+        ret = verifyUpgradedTrack(track, trimmed, originalMidi.tracks[track], upgradedMidi.tracks[track]);
+
+        if (ret != OK) {
+            return ret;
+        }
+    }
+
+    return OK;
+}
+
+
+
+
+
+
+
+
+
+
+
+
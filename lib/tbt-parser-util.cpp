@@ -26,7 +26,9 @@
 
 #include "zlib.h"
 
+#include <algorithm> // for min
 #include <cstring>
+#include <cstdint> // for SIZE_MAX
 
 
 #include "partitioninto.inl"
@@ -256,7 +258,7 @@ parseChunk4(
 
 
 // clang-format off
-uint32_t table[256] = {
+const uint32_t table[256] = {
     0,          0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
     0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
     0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
@@ -342,10 +344,11 @@ Status
 zlib_inflate(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
+    size_t maxSize,
+    size_t sizeHint,
     std::vector<uint8_t> &acc) {
 
     int ret;
-    unsigned have;
     z_stream strm;
 
     /* allocate inflate state */
@@ -360,6 +363,10 @@ zlib_inflate(
         return ERR;
     }
 
+    auto base = acc.size();
+
+    acc.reserve(base + std::min(sizeHint, maxSize));
+
     /* decompress until deflate stream ends or end of file */
     do {
         
@@ -377,13 +384,33 @@ zlib_inflate(
         
         /* run inflate() on input until output buffer not full */
 
-        uint8_t out[CHUNK];
-
         do {
-            strm.avail_out = CHUNK;
-            strm.next_out = out;
+
+            auto written = acc.size() - base;
+
+            if (written > maxSize) {
+                inflateEnd(&strm);
+                LOGE("zlib_inflate: inflated size exceeds limit: %zu", maxSize);
+                return ERR;
+            }
+
+            //
+            // inflate directly into acc
+            //
+            // allow 1 byte past maxSize, to detect exceeding it
+            //
+            auto room = static_cast<uInt>(std::min<size_t>(CHUNK, maxSize - written) + ((maxSize - written < CHUNK) ? 1 : 0));
+
+            acc.resize(acc.size() + room);
+
+            strm.avail_out = room;
+            strm.next_out = acc.data() + acc.size() - room;
             ret = inflate(&strm, Z_NO_FLUSH);
+
+            acc.resize(acc.size() - strm.avail_out);
+
             if (ret == Z_STREAM_ERROR) {
+                inflateEnd(&strm);
                 LOGE("ret == Z_STREAM_ERROR");
                 return ERR;
             }
@@ -400,9 +427,6 @@ zlib_inflate(
                 break;
             }
 
-            have = CHUNK - strm.avail_out;
-            acc.insert(acc.end(), out, out + have);
-
         } while (strm.avail_out == 0);
         
         if (CHUNK < (end - it)) {
@@ -425,6 +449,48 @@ zlib_inflate(
     /* clean up and return */
     inflateEnd(&strm);
 
+    if (acc.size() - base > maxSize) {
+        LOGE("zlib_inflate: inflated size exceeds limit: %zu", maxSize);
+        return ERR;
+    }
+
+    return OK;
+}
+
+
+Status
+zlib_inflate(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    std::vector<uint8_t> &acc) {
+    return zlib_inflate(it, end, SIZE_MAX, 0, acc);
+}
+
+
+Status
+zlib_deflate(
+    const std::vector<uint8_t> &data,
+    int level,
+    std::vector<uint8_t> &acc) {
+
+    auto base = acc.size();
+
+    auto bound = compressBound(static_cast<uLong>(data.size()));
+
+    acc.resize(base + bound);
+
+    auto len = static_cast<uLongf>(bound);
+
+    int ret = compress2(acc.data() + base, &len, data.data(), static_cast<uLong>(data.size()), level);
+
+    if (ret != Z_OK) {
+        acc.resize(base);
+        zerr(ret);
+        return ERR;
+    }
+
+    acc.resize(base + len);
+
     return OK;
 }
 
@@ -18,8 +18,10 @@
 
 #include "tbt-parser.h"
 
+#include "tbt-parser/song-context.h"
 #include "tbt-parser/tbt-parser-util.h"
 #include "tbt-parser/tbt.h"
+#include "tbt-parser/trace.h"
 
 #include "rational/rational.h"
 
@@ -33,6 +35,7 @@
 
 #include <cinttypes>
 #include <cstring> // for memcpy, strrchr, strcmp
+#include <cstdlib> // for strtol
 #include <cmath> // for round in alternate-time-regions.inl, in body.inl
 
 
@@ -44,6 +47,7 @@
 #include "bar-lines.inl"
 #include "track-effect-changes.inl"
 #include "notes.inl"
+#include "lazy-tbt.inl"
 #include "body.inl"
 
 
@@ -55,6 +59,8 @@ Status
 TparseTbtBytes(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_lazy_body *lazy,
     tbt_file_t &out) {
 
     //
@@ -83,6 +89,8 @@ TparseTbtBytes(
         
         CHECK(out.header.totalByteCount == size, "file is corrupted. file byte counts do not match. expected: %" PRIi32 ", actual: %td", out.header.totalByteCount, size);
 
+        trace_span span("crc");
+
         auto restToCheck_it = it + TBT_HEADER_SIZE;
 
         auto crc32Rest = crc32_checksum(restToCheck_it, end);
@@ -184,7 +192,17 @@ TparseTbtBytes(
 
             std::vector<uint8_t> metadataToParse;
 
-            Status ret = zlib_inflate(metadataToInflate_it, metadataToInflate_end, metadataToParse);
+            //
+            // track metadata, followed by title, artist, album, transcribedBy, and comment
+            //
+            auto metadataSizeHint = static_cast<size_t>(metadataLen) + 5 * (2 + 32);
+
+            Status ret;
+            {
+                trace_span span("inflate metadata");
+
+                ret = zlib_inflate(metadataToInflate_it, metadataToInflate_end, opts.max_inflated_size, metadataSizeHint, metadataToParse);
+            }
 
             if (ret != OK) {
                 return ret;
@@ -333,7 +351,45 @@ TparseTbtBytes(
 
             std::vector<uint8_t> bodyToParse;
 
-            Status ret = zlib_inflate(it, end, bodyToParse);
+            //
+            // rough estimate of the inflated body size, only used to reserve the buffer
+            //
+            // most spaces are empty, and runs of empty spaces are encoded in a few bytes,
+            // so the notes of a track are much smaller than 1 byte per vsq
+            //
+            // in the test files, the inflated body is between about 1/80 and 1/6 of a byte per vsq, with a median near 1/16
+            //
+            // zlib_inflate still grows the buffer past the estimate when the body is larger
+            //
+            constexpr size_t STRINGS_PER_TRACK = (0x6b <= VERSION) ? 8 : 6;
+
+            constexpr size_t VSQS_PER_BYTE_ESTIMATE = 16;
+
+            size_t bodySizeHint = 0;
+
+            for (uint8_t track = 0; track < out.header.trackCount; track++) {
+
+                uint16_t trackSpaceCount;
+                if constexpr (0x70 <= VERSION) {
+                    //
+                    // stored as 32-bit int, so must be cast
+                    //
+                    trackSpaceCount = static_cast<uint16_t>(out.metadata.tracks[track].spaceCount);
+                } else if constexpr (VERSION == 0x6f) {
+                    trackSpaceCount = out.header.spaceCount;
+                } else {
+                    trackSpaceCount = 4000;
+                }
+
+                bodySizeHint += (STRINGS_PER_TRACK + STRINGS_PER_TRACK + 4) * trackSpaceCount / VSQS_PER_BYTE_ESTIMATE;
+            }
+
+            Status ret;
+            {
+                trace_span span("inflate body");
+
+                ret = zlib_inflate(it, end, opts.max_inflated_size, bodySizeHint, bodyToParse);
+            }
 
             if (ret != OK) {
                 return ret;
@@ -345,7 +401,11 @@ TparseTbtBytes(
 
             auto bodyToParse_end = bodyToParse.cend();
 
-            ret = parseBody<VERSION, HASALTERNATETIMEREGIONS, tbt_file_t>(bodyToParse_it, bodyToParse_end, out);
+            if (lazy) {
+                ret = parseBodyRanges<VERSION, HASALTERNATETIMEREGIONS, tbt_file_t>(bodyToParse.cbegin(), bodyToParse_it, bodyToParse_end, out, lazy->tracks);
+            } else {
+                ret = parseBody<VERSION, HASALTERNATETIMEREGIONS, tbt_file_t>(bodyToParse_it, bodyToParse_end, opts, out);
+            }
 
             if (ret != OK) {
                 return ret;
@@ -353,17 +413,36 @@ TparseTbtBytes(
 
             CHECK(bodyToParse_it == bodyToParse_end, "file is corrupted.");
 
+            if (lazy) {
+                //
+                // ranges are offsets, so they are still valid after moving
+                //
+                lazy->bytes = std::move(bodyToParse);
+            }
+
         } else {
 
             CHECK(it <= end, "unhandled");
 
-            Status ret = parseBody<VERSION, false, tbt_file_t>(it, end, out);
+            auto bodyToParse_begin = it;
+
+            Status ret;
+
+            if (lazy) {
+                ret = parseBodyRanges<VERSION, false, tbt_file_t>(bodyToParse_begin, it, end, out, lazy->tracks);
+            } else {
+                ret = parseBody<VERSION, false, tbt_file_t>(it, end, opts, out);
+            }
 
             if (ret != OK) {
                 return ret;
             }
 
             CHECK(it == end, "file is corrupted.");
+
+            if (lazy) {
+                lazy->bytes = std::vector<uint8_t>(bodyToParse_begin, end);
+            }
         }
     }
 
@@ -375,6 +454,15 @@ Status
 parseTbtFile(
     const char *path,
     tbt_file &out) {
+    return parseTbtFile(path, tbt_parse_opts{}, out);
+}
+
+
+Status
+parseTbtFile(
+    const char *path,
+    const tbt_parse_opts &opts,
+    tbt_file &out) {
     
     const char *dot = std::strrchr(path, '.');
     if (!(dot && std::strcmp(dot, ".tbt") == 0)) {
@@ -385,7 +473,11 @@ parseTbtFile(
 
     std::vector<uint8_t> buf;
 
-    ret = openFile(path, buf);
+    {
+        trace_span span("read", "path", path);
+
+        ret = openFile(path, buf);
+    }
 
     if (ret != OK) {
         return ret;
@@ -395,7 +487,7 @@ parseTbtFile(
 
     auto buf_end = buf.cend();
 
-    return parseTbtBytes(buf_it, buf_end, out);
+    return parseTbtBytes(buf_it, buf_end, opts, out);
 }
     
 
@@ -404,6 +496,29 @@ parseTbtBytes(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
     tbt_file &out) {
+    return parseTbtBytes(it, end, tbt_parse_opts{}, out);
+}
+
+
+Status
+parseTbtBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_file &out) {
+    return parseTbtBytes(it, end, opts, nullptr, out);
+}
+
+
+Status
+parseTbtBytes(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    const tbt_parse_opts &opts,
+    tbt_lazy_body *lazy,
+    tbt_file &out) {
+
+    trace_span span("parse");
 
     auto len = end - it;
 
@@ -427,9 +542,9 @@ parseTbtBytes(
         tbt_file71 t;
         
         if ((featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            ret = TparseTbtBytes<0x72, true>(it, end, t);
+            ret = TparseTbtBytes<0x72, true>(it, end, opts, lazy, t);
         } else {
-            ret = TparseTbtBytes<0x72, false>(it, end, t);
+            ret = TparseTbtBytes<0x72, false>(it, end, opts, lazy, t);
         }
 
         if (ret != OK) {
@@ -445,9 +560,9 @@ parseTbtBytes(
         tbt_file71 t;
 
         if ((featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            ret = TparseTbtBytes<0x71, true>(it, end, t);
+            ret = TparseTbtBytes<0x71, true>(it, end, opts, lazy, t);
         } else {
-            ret = TparseTbtBytes<0x71, false>(it, end, t);
+            ret = TparseTbtBytes<0x71, false>(it, end, opts, lazy, t);
         }
 
         if (ret != OK) {
@@ -463,9 +578,9 @@ parseTbtBytes(
         tbt_file70 t;
         
         if ((featureBitfield & HASALTERNATETIMEREGIONS_MASK) == HASALTERNATETIMEREGIONS_MASK) {
-            ret = TparseTbtBytes<0x70, true>(it, end, t);
+            ret = TparseTbtBytes<0x70, true>(it, end, opts, lazy, t);
         } else {
-            ret = TparseTbtBytes<0x70, false>(it, end, t);
+            ret = TparseTbtBytes<0x70, false>(it, end, opts, lazy, t);
         }
 
         if (ret != OK) {
@@ -479,7 +594,7 @@ parseTbtBytes(
     case 0x6f: {
 
         tbt_file6f t;
-        ret = TparseTbtBytes<0x6f, false>(it, end, t);
+        ret = TparseTbtBytes<0x6f, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -492,7 +607,7 @@ parseTbtBytes(
     case 0x6e: {
 
         tbt_file6e t;
-        ret = TparseTbtBytes<0x6e, false>(it, end, t);
+        ret = TparseTbtBytes<0x6e, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -505,7 +620,7 @@ parseTbtBytes(
     case 0x6b: {
 
         tbt_file6b t;
-        ret = TparseTbtBytes<0x6b, false>(it, end, t);
+        ret = TparseTbtBytes<0x6b, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -518,7 +633,7 @@ parseTbtBytes(
     case 0x6a: {
 
         tbt_file6a t;
-        ret = TparseTbtBytes<0x6a, false>(it, end, t);
+        ret = TparseTbtBytes<0x6a, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -531,7 +646,7 @@ parseTbtBytes(
     case 0x69: {
 
         tbt_file68 t;
-        ret = TparseTbtBytes<0x69, false>(it, end, t);
+        ret = TparseTbtBytes<0x69, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -544,7 +659,7 @@ parseTbtBytes(
     case 0x68: {
 
         tbt_file68 t;
-        ret = TparseTbtBytes<0x68, false>(it, end, t);
+        ret = TparseTbtBytes<0x68, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -557,7 +672,7 @@ parseTbtBytes(
     case 0x67: {
 
         tbt_file65 t;
-        ret = TparseTbtBytes<0x67, false>(it, end, t);
+        ret = TparseTbtBytes<0x67, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -570,7 +685,7 @@ parseTbtBytes(
     case 0x66: {
 
         tbt_file65 t;
-        ret = TparseTbtBytes<0x66, false>(it, end, t);
+        ret = TparseTbtBytes<0x66, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -583,7 +698,7 @@ parseTbtBytes(
     case 0x65: {
 
         tbt_file65 t;
-        ret = TparseTbtBytes<0x65, false>(it, end, t);
+        ret = TparseTbtBytes<0x65, false>(it, end, opts, lazy, t);
 
         if (ret != OK) {
             return ret;
@@ -604,6 +719,66 @@ parseTbtBytes(
 }
 
 
+Status parseLazyTrackNotes(tbt_lazy_file::impl &p, uint8_t track) {
+
+    switch (p.versionNumber) {
+    case 0x72:
+        return parseTrackNotes<0x72>(p.body, track, std::get<tbt_file71>(p.file));
+    case 0x71:
+        return parseTrackNotes<0x71>(p.body, track, std::get<tbt_file71>(p.file));
+    case 0x70:
+        return parseTrackNotes<0x70>(p.body, track, std::get<tbt_file70>(p.file));
+    case 0x6f:
+        return parseTrackNotes<0x6f>(p.body, track, std::get<tbt_file6f>(p.file));
+    case 0x6e:
+        return parseTrackNotes<0x6e>(p.body, track, std::get<tbt_file6e>(p.file));
+    case 0x6b:
+        return parseTrackNotes<0x6b>(p.body, track, std::get<tbt_file6b>(p.file));
+    case 0x6a:
+        return parseTrackNotes<0x6a>(p.body, track, std::get<tbt_file6a>(p.file));
+    case 0x69:
+        return parseTrackNotes<0x69>(p.body, track, std::get<tbt_file68>(p.file));
+    case 0x68:
+        return parseTrackNotes<0x68>(p.body, track, std::get<tbt_file68>(p.file));
+    case 0x67:
+        return parseTrackNotes<0x67>(p.body, track, std::get<tbt_file65>(p.file));
+    case 0x66:
+        return parseTrackNotes<0x66>(p.body, track, std::get<tbt_file65>(p.file));
+    case 0x65:
+        return parseTrackNotes<0x65>(p.body, track, std::get<tbt_file65>(p.file));
+    default:
+        ABORT("invalid versionNumber: 0x%02x", p.versionNumber);
+    }
+}
+
+
+Status parseLazyTrackTiming(tbt_lazy_file::impl &p, uint8_t track) {
+
+    //
+    // alternate time regions start at 0x70, and track effect changes at 0x71
+    //
+    switch (p.versionNumber) {
+    case 0x72:
+        if (p.hasAlternateTimeRegions) {
+            return parseTrackTiming<0x72, true>(p.body, track, std::get<tbt_file71>(p.file));
+        }
+        return parseTrackTiming<0x72, false>(p.body, track, std::get<tbt_file71>(p.file));
+    case 0x71:
+        if (p.hasAlternateTimeRegions) {
+            return parseTrackTiming<0x71, true>(p.body, track, std::get<tbt_file71>(p.file));
+        }
+        return parseTrackTiming<0x71, false>(p.body, track, std::get<tbt_file71>(p.file));
+    case 0x70:
+        if (p.hasAlternateTimeRegions) {
+            return parseTrackTiming<0x70, true>(p.body, track, std::get<tbt_file70>(p.file));
+        }
+        return OK;
+    default:
+        return OK;
+    }
+}
+
+
 uint8_t tbtFileVersionNumber(const tbt_file &t) {
     return std::visit([](auto&& t) -> uint8_t {
         return t.header.versionNumber;
@@ -618,6 +793,55 @@ std::string tbtFileVersionString(const tbt_file &t) {
 }
 
 
+bool trackSelected(const std::vector<bool> &selected_tracks, uint8_t track) {
+
+    if (selected_tracks.empty()) {
+        return true;
+    }
+
+    if (track < selected_tracks.size()) {
+        return selected_tracks[track];
+    }
+
+    return false;
+}
+
+
+Status parseTrackSelection(const char *str, std::vector<bool> &selected_tracks) {
+
+    selected_tracks.clear();
+
+    const char *p = str;
+
+    while (true) {
+
+        char *end;
+
+        auto track = std::strtol(p, &end, 10);
+
+        CHECK(end != p, "invalid track list: %s", str);
+
+        CHECK(0 <= track && track <= 0xff, "invalid track: %ld", track);
+
+        if (selected_tracks.size() <= static_cast<size_t>(track)) {
+            selected_tracks.resize(static_cast<size_t>(track) + 1);
+        }
+
+        selected_tracks[static_cast<size_t>(track)] = true;
+
+        if (*end == '\0') {
+            break;
+        }
+
+        CHECK(*end == ',', "invalid track list: %s", str);
+
+        p = end + 1;
+    }
+
+    return OK;
+}
+
+
 template <uint8_t VERSION, typename tbt_file_t>
 std::string
 TtbtFileInfo(const tbt_file_t &t) {
@@ -664,73 +888,73 @@ std::string tbtFileInfo(const tbt_file &t) {
     switch (versionNumber) {
     case 0x72: {
 
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
         
         return TtbtFileInfo<0x72>(t71);
     }
     case 0x71: {
         
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
         
         return TtbtFileInfo<0x71>(t71);
     }
     case 0x70: {
         
-        auto t70 = std::get<tbt_file70>(t);
+        const auto &t70 = std::get<tbt_file70>(t);
         
         return TtbtFileInfo<0x70>(t70);
     }
     case 0x6f: {
         
-        auto t6f = std::get<tbt_file6f>(t);
+        const auto &t6f = std::get<tbt_file6f>(t);
         
         return TtbtFileInfo<0x6f>(t6f);
     }
     case 0x6e: {
         
-        auto t6e = std::get<tbt_file6e>(t);
+        const auto &t6e = std::get<tbt_file6e>(t);
         
         return TtbtFileInfo<0x6e>(t6e);
     }
     case 0x6b: {
         
-        auto t6b = std::get<tbt_file6b>(t);
+        const auto &t6b = std::get<tbt_file6b>(t);
         
         return TtbtFileInfo<0x6b>(t6b);
     }
     case 0x6a: {
         
-        auto t6a = std::get<tbt_file6a>(t);
+        const auto &t6a = std::get<tbt_file6a>(t);
         
         return TtbtFileInfo<0x6a>(t6a);
     }
     case 0x69: {
         
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
         
         return TtbtFileInfo<0x69>(t68);
     }
     case 0x68: {
         
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
         
         return TtbtFileInfo<0x68>(t68);
     }
     case 0x67: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
         return TtbtFileInfo<0x67>(t65);
     }
     case 0x66: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
         return TtbtFileInfo<0x66>(t65);
     }
     case 0x65: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
         return TtbtFileInfo<0x65>(t65);
     }
@@ -740,6 +964,11 @@ std::string tbtFileInfo(const tbt_file &t) {
 }
 
 
+std::string tbtFileInfo(const tbt_song_context &ctx) {
+    return tbtFileInfo(ctx.file());
+}
+
+
 template <uint8_t VERSION, typename tbt_file_t>
 std::string
 TtbtFileComment(const tbt_file_t &t) {
@@ -761,73 +990,73 @@ std::string tbtFileComment(const tbt_file &t) {
     switch (versionNumber) {
     case 0x72: {
 
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
         
         return TtbtFileComment<0x72>(t71);
     }
     case 0x71: {
         
-        auto t71 = std::get<tbt_file71>(t);
+        const auto &t71 = std::get<tbt_file71>(t);
         
         return TtbtFileComment<0x71>(t71);
     }
     case 0x70: {
         
-        auto t70 = std::get<tbt_file70>(t);
+        const auto &t70 = std::get<tbt_file70>(t);
         
         return TtbtFileComment<0x70>(t70);
     }
     case 0x6f: {
         
-        auto t6f = std::get<tbt_file6f>(t);
+        const auto &t6f = std::get<tbt_file6f>(t);
         
         return TtbtFileComment<0x6f>(t6f);
     }
     case 0x6e: {
         
-        auto t6e = std::get<tbt_file6e>(t);
+        const auto &t6e = std::get<tbt_file6e>(t);
         
         return TtbtFileComment<0x6e>(t6e);
     }
     case 0x6b: {
         
-        auto t6b = std::get<tbt_file6b>(t);
+        const auto &t6b = std::get<tbt_file6b>(t);
         
         return TtbtFileComment<0x6b>(t6b);
     }
     case 0x6a: {
         
-        auto t6a = std::get<tbt_file6a>(t);
+        const auto &t6a = std::get<tbt_file6a>(t);
         
         return TtbtFileComment<0x6a>(t6a);
     }
     case 0x69: {
         
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
         
         return TtbtFileComment<0x69>(t68);
     }
     case 0x68: {
         
-        auto t68 = std::get<tbt_file68>(t);
+        const auto &t68 = std::get<tbt_file68>(t);
         
         return TtbtFileComment<0x68>(t68);
     }
     case 0x67: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
         return TtbtFileComment<0x67>(t65);
     }
     case 0x66: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
         return TtbtFileComment<0x66>(t65);
     }
     case 0x65: {
         
-        auto t65 = std::get<tbt_file65>(t);
+        const auto &t65 = std::get<tbt_file65>(t);
         
         return TtbtFileComment<0x65>(t65);
     }
@@ -836,6 +1065,10 @@ std::string tbtFileComment(const tbt_file &t) {
     }
 }
 
+std::string tbtFileComment(const tbt_song_context &ctx) {
+    return tbtFileComment(ctx.file());
+}
+
 
 
 
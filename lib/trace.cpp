@@ -0,0 +1,288 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/trace.h"
+
+#undef NDEBUG
+
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cinttypes>
+#include <cstdio> // for snprintf
+#include <cstring> // for strncpy
+
+
+#define TAG "trace"
+
+
+struct trace_event {
+    const char *name;
+    const char *argName;
+    int64_t argInt;
+    bool hasArgStr;
+    char argStr[64];
+    int64_t startNs;
+    int64_t durNs;
+};
+
+
+//
+// buffers are only appended to by their owning thread
+//
+// buffers are never freed, so that a buffer can outlive its thread and still be written out
+//
+struct trace_buffer {
+    uint32_t tid;
+    uint32_t generation;
+    std::vector<trace_event> events;
+    trace_buffer *next;
+};
+
+
+std::atomic<bool> traceEnabledFlag = false;
+
+//
+// incremented by every traceBegin(), so that buffers from previous traces are discarded lazily by their threads
+//
+std::atomic<uint32_t> traceGeneration = 0;
+
+std::atomic<trace_buffer *> traceBuffers = nullptr;
+
+std::atomic<uint32_t> nextTid = 1;
+
+std::chrono::steady_clock::time_point traceEpoch;
+
+thread_local trace_buffer *threadBuffer = nullptr;
+
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+
+trace_buffer *currentThreadBuffer() {
+
+    auto generation = traceGeneration.load(std::memory_order_relaxed);
+
+    if (threadBuffer == nullptr) {
+
+        threadBuffer = new trace_buffer{ nextTid.fetch_add(1), generation, {}, nullptr };
+
+        threadBuffer->events.reserve(1024);
+
+        //
+        // lock-free push onto the list of all buffers
+        //
+        auto head = traceBuffers.load(std::memory_order_relaxed);
+
+        do {
+            threadBuffer->next = head;
+        } while (!traceBuffers.compare_exchange_weak(head, threadBuffer, std::memory_order_release, std::memory_order_relaxed));
+
+    } else if (threadBuffer->generation != generation) {
+
+        threadBuffer->generation = generation;
+
+        threadBuffer->events.clear();
+    }
+
+    return threadBuffer;
+}
+
+
+void traceBegin() {
+
+    traceEpoch = std::chrono::steady_clock::now();
+
+    traceGeneration.fetch_add(1);
+
+    traceEnabledFlag.store(true);
+}
+
+
+bool traceEnabled() {
+    return traceEnabledFlag.load(std::memory_order_relaxed);
+}
+
+
+void appendJSONString(std::string &out, const char *str) {
+
+    out += '"';
+
+    for (const char *c = str; *c != '\0'; c++) {
+
+        switch (*c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default: {
+            if (static_cast<unsigned char>(*c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(*c));
+                out += buf;
+            } else {
+                out += *c;
+            }
+            break;
+        }
+        }
+    }
+
+    out += '"';
+}
+
+
+Status traceEnd(const char *path) {
+
+    traceEnabledFlag.store(false);
+
+    auto generation = traceGeneration.load();
+
+    std::string json = "{\"traceEvents\":[\n";
+
+    bool first = true;
+
+    char buf[128];
+
+    for (auto b = traceBuffers.load(std::memory_order_acquire); b != nullptr; b = b->next) {
+
+        if (b->generation != generation || b->events.empty()) {
+            continue;
+        }
+
+        if (!first) {
+            json += ",\n";
+        }
+        first = false;
+
+        std::snprintf(buf, sizeof(buf), "{\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"name\":\"thread_name\",\"args\":{\"name\":\"thread %" PRIu32 "\"}}", b->tid, b->tid);
+        json += buf;
+
+        for (const auto &e : b->events) {
+
+            json += ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":";
+            json += std::to_string(b->tid);
+            json += ",\"name\":";
+            appendJSONString(json, e.name);
+
+            //
+            // timestamps are in microseconds
+            //
+            std::snprintf(buf, sizeof(buf), ",\"ts\":%" PRId64 ".%03" PRId64 ",\"dur\":%" PRId64 ".%03" PRId64, e.startNs / 1000, e.startNs % 1000, e.durNs / 1000, e.durNs % 1000);
+            json += buf;
+
+            if (e.argName != nullptr) {
+
+                json += ",\"args\":{";
+                appendJSONString(json, e.argName);
+                json += ':';
+
+                if (e.hasArgStr) {
+                    appendJSONString(json, e.argStr);
+                } else {
+                    json += std::to_string(e.argInt);
+                }
+
+                json += '}';
+            }
+
+            json += '}';
+        }
+    }
+
+    json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    std::vector<uint8_t> data{ json.cbegin(), json.cend() };
+
+    Status ret = saveFile(path, data);
+
+    if (ret != OK) {
+        LOGE("cannot write trace file: %s", path);
+        return ret;
+    }
+
+    return OK;
+}
+
+
+trace_span::trace_span(const char *name) :
+    name(name), argName(nullptr), argInt(0), argStr(nullptr), startNs(-1) {
+
+    if (traceEnabled()) {
+        startNs = nowNs();
+    }
+}
+
+
+trace_span::trace_span(const char *name, const char *argName, int64_t argValue) :
+    name(name), argName(argName), argInt(argValue), argStr(nullptr), startNs(-1) {
+
+    if (traceEnabled()) {
+        startNs = nowNs();
+    }
+}
+
+
+trace_span::trace_span(const char *name, const char *argName, const char *argValue) :
+    name(name), argName(argName), argInt(0), argStr(argValue), startNs(-1) {
+
+    if (traceEnabled()) {
+        startNs = nowNs();
+    }
+}
+
+
+trace_span::~trace_span() {
+
+    if (startNs < 0) {
+        return;
+    }
+
+    auto endNs = nowNs();
+
+    auto b = currentThreadBuffer();
+
+    trace_event e{ name, argName, argInt, false, {}, startNs, endNs - startNs };
+
+    if (argStr != nullptr) {
+
+        e.hasArgStr = true;
+
+        std::strncpy(e.argStr, argStr, sizeof(e.argStr) - 1);
+    }
+
+    b->events.push_back(e);
+}
+
+
+
+
+
+
+
+
+
+
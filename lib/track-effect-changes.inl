@@ -25,49 +25,96 @@
 //
 
 
+//
+// parse the track effect changes of one track
+//
+// if expand is false, then the changes are only skipped over, to find where the next track starts
+//
 template <uint8_t VERSION, typename tbt_file_t>
 Status
-parseTrackEffectChangesMapList(
+parseTrackEffectChanges(
     std::vector<uint8_t>::const_iterator &it,
     const std::vector<uint8_t>::const_iterator &end,
+    uint8_t track,
+    bool expand,
     tbt_file_t &out) {
 
-    for (uint8_t track = 0; track < out.header.trackCount; track++) {
+    std::vector<uint8_t> arrayList;
 
-        std::vector<uint8_t> arrayList;
+    Status ret = parseChunk4(it, end, arrayList);
 
-        Status ret = parseChunk4(it, end, arrayList);
+    if (ret != OK) {
+        return ret;
+    }
 
-        if (ret != OK) {
-            return ret;
-        }
+    if (!expand) {
+        return OK;
+    }
 
-        std::vector<std::array<uint8_t, 8> > parts;
+    std::vector<std::array<uint8_t, 8> > parts;
 
-        ret = partitionInto<8>(arrayList, parts);
+    ret = partitionInto<8>(arrayList, parts);
 
-        if (ret != OK) {
-            return ret;
+    if (ret != OK) {
+        return ret;
+    }
+
+    uint16_t space = 0;
+
+    auto &trackEffectChanges = out.body.mapsList[track].trackEffectChanges;
+
+    trackEffectChanges.reserve(parts.size());
+
+    for (const auto &part : parts) {
+
+        auto s = parseLE2(part[0], part[1]);
+        auto e = static_cast<tbt_track_effect>(parseLE2(part[2], part[3]));
+        auto r = parseLE2(part[4], part[5]);
+        auto v = parseLE2(part[6], part[7]);
+
+        CHECK(r == 0x02, "unhandled");
+
+        space += s;
+
+        //
+        // spaces are non-decreasing, so only the changes at the current space need to be searched
+        //
+        auto changesIt = trackEffectChanges.end();
+
+        while (changesIt != trackEffectChanges.begin() && (changesIt - 1)->space == space && e < (changesIt - 1)->effect) {
+            changesIt--;
         }
 
-        uint16_t space = 0;
+        if (changesIt != trackEffectChanges.begin() && (changesIt - 1)->space == space && (changesIt - 1)->effect == e) {
 
-        auto &trackEffectChangesMap = out.body.mapsList[track].trackEffectChangesMap;
+            //
+            // later change for the same effect wins
+            //
+            (changesIt - 1)->value = v;
 
-        for (const auto &part : parts) {
+        } else {
+
+            trackEffectChanges.insert(changesIt, { space, e, v });
+        }
+    }
+
+    return OK;
+}
 
-            auto s = parseLE2(part[0], part[1]);
-            auto e = static_cast<tbt_track_effect>(parseLE2(part[2], part[3]));
-            auto r = parseLE2(part[4], part[5]);
-            auto v = parseLE2(part[6], part[7]);
 
-            CHECK(r == 0x02, "unhandled");
+template <uint8_t VERSION, typename tbt_file_t>
+Status
+parseTrackEffectChangesMapList(
+    std::vector<uint8_t>::const_iterator &it,
+    const std::vector<uint8_t>::const_iterator &end,
+    tbt_file_t &out) {
 
-            space += s;
+    for (uint8_t track = 0; track < out.header.trackCount; track++) {
 
-            auto &changes = trackEffectChangesMap[space];
+        Status ret = parseTrackEffectChanges<VERSION, tbt_file_t>(it, end, track, true, out);
 
-            changes[e] = v;
+        if (ret != OK) {
+            return ret;
         }
     }
 
@@ -0,0 +1,561 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/watch.h"
+
+#include "tbt-parser/trace.h"
+
+#include "common/file.h"
+#include "common/logging.h"
+
+#include <algorithm> // for min, max, sort
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility> // for move
+#include <cstring> // for strerror
+
+#if defined(__linux__) && __has_include(<sys/inotify.h>)
+#define TBTPARSER_HAVE_INOTIFY 1
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#define TBTPARSER_HAVE_INOTIFY 0
+#endif
+
+
+#define TAG "watch"
+
+
+using watch_clock = std::chrono::steady_clock;
+
+
+struct file_stamp {
+    std::filesystem::file_time_type time;
+    uintmax_t size;
+
+    bool operator==(const file_stamp &other) const {
+        return time == other.time && size == other.size;
+    }
+};
+
+
+struct directory_watcher::impl {
+
+    std::filesystem::path dir;
+
+    std::string extension;
+
+    watch_opts opts;
+
+    watch_backend backend = WATCH_POLL;
+
+    //
+    // path -> time of the last change
+    //
+    std::map<std::string, watch_clock::time_point> pending;
+
+    std::mutex mutex;
+
+    std::condition_variable stopCV;
+
+    bool stopped = false;
+
+    //
+    // for WATCH_POLL
+    //
+    std::map<std::string, file_stamp> stamps;
+
+#if TBTPARSER_HAVE_INOTIFY
+    int inotifyFd = -1;
+
+    //
+    // eventfd that wakes up poll() in next()
+    //
+    int stopFd = -1;
+#endif // TBTPARSER_HAVE_INOTIFY
+
+    ~impl() {
+
+#if TBTPARSER_HAVE_INOTIFY
+        if (inotifyFd != -1) {
+            close(inotifyFd);
+        }
+
+        if (stopFd != -1) {
+            close(stopFd);
+        }
+#endif // TBTPARSER_HAVE_INOTIFY
+    }
+
+    bool matches(const std::filesystem::path &path) const {
+        return path.extension() == extension;
+    }
+
+    //
+    // records every matching file, and marks the changed ones as pending
+    //
+    void scan(bool markChanges) {
+
+        std::error_code ec;
+
+        auto now = watch_clock::now();
+
+        for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+
+            if (!entry.is_regular_file(ec) || !matches(entry.path())) {
+                continue;
+            }
+
+            file_stamp stamp{ entry.last_write_time(ec), entry.file_size(ec) };
+
+            if (ec) {
+
+                //
+                // removed while scanning
+                //
+                ec.clear();
+
+                continue;
+            }
+
+            auto path = entry.path().string();
+
+            auto it = stamps.find(path);
+
+            if (it != stamps.end() && it->second == stamp) {
+                continue;
+            }
+
+            stamps[path] = stamp;
+
+            if (markChanges) {
+                pending[path] = now;
+            }
+        }
+    }
+
+    //
+    // moves files that have not changed for debounce_ms to out
+    //
+    bool takeSettled(std::vector<std::string> &out, watch_clock::time_point now) {
+
+        out.clear();
+
+        auto debounce = std::chrono::milliseconds(opts.debounce_ms);
+
+        for (auto it = pending.begin(); it != pending.end();) {
+
+            if (now - it->second >= debounce) {
+
+                out.push_back(it->first);
+
+                it = pending.erase(it);
+
+            } else {
+
+                ++it;
+            }
+        }
+
+        //
+        // pending is a map, so out is already sorted
+        //
+        return !out.empty();
+    }
+
+    //
+    // milliseconds until the next pending file settles, or -1 if nothing is pending
+    //
+    int settleTimeoutMs(watch_clock::time_point now) const {
+
+        if (pending.empty()) {
+            return -1;
+        }
+
+        auto earliest = pending.begin()->second;
+
+        for (const auto &p : pending) {
+            earliest = std::min(earliest, p.second);
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(earliest + std::chrono::milliseconds(opts.debounce_ms) - now).count();
+
+        //
+        // round up, so that the file has settled when woken up
+        //
+        return static_cast<int>(std::max<long long>(remaining, 0) + 1);
+    }
+
+#if TBTPARSER_HAVE_INOTIFY
+
+    //
+    // returns false if the directory can no longer be watched
+    //
+    bool readEvents() {
+
+        alignas(inotify_event) char buf[4096];
+
+        auto now = watch_clock::now();
+
+        while (true) {
+
+            auto n = read(inotifyFd, buf, sizeof(buf));
+
+            if (n < 0) {
+
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+
+                LOGE("cannot read inotify events: %s", std::strerror(errno));
+
+                return false;
+            }
+
+            for (char *p = buf; p < buf + n;) {
+
+                auto e = reinterpret_cast<const inotify_event *>(p);
+
+                p += sizeof(inotify_event) + e->len;
+
+                if ((e->mask & IN_Q_OVERFLOW) == IN_Q_OVERFLOW) {
+
+                    //
+                    // events were dropped, so treat every file as changed
+                    //
+                    LOGW("inotify queue overflowed, rescanning: %s", dir.string().c_str());
+
+                    stamps.clear();
+
+                    scan(true);
+
+                    continue;
+                }
+
+                if ((e->mask & IN_IGNORED) == IN_IGNORED) {
+
+                    LOGE("directory is no longer watched: %s", dir.string().c_str());
+
+                    return false;
+                }
+
+                if (e->len == 0) {
+                    continue;
+                }
+
+                auto path = dir / e->name;
+
+                if (!matches(path)) {
+                    continue;
+                }
+
+                pending[path.string()] = now;
+            }
+        }
+    }
+
+    bool inotifyNext(std::vector<std::string> &out) {
+
+        while (true) {
+
+            if (takeSettled(out, watch_clock::now())) {
+                return true;
+            }
+
+            pollfd fds[2] = {
+                { inotifyFd, POLLIN, 0 },
+                { stopFd, POLLIN, 0 },
+            };
+
+            auto n = poll(fds, 2, settleTimeoutMs(watch_clock::now()));
+
+            if (n < 0) {
+
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                LOGE("cannot poll: %s", std::strerror(errno));
+
+                return false;
+            }
+
+            if ((fds[1].revents & POLLIN) == POLLIN) {
+                return false;
+            }
+
+            if ((fds[0].revents & POLLIN) == POLLIN) {
+                if (!readEvents()) {
+                    return false;
+                }
+            }
+        }
+    }
+
+#endif // TBTPARSER_HAVE_INOTIFY
+
+    bool pollNext(std::vector<std::string> &out) {
+
+        while (true) {
+
+            if (takeSettled(out, watch_clock::now())) {
+                return true;
+            }
+
+            auto timeout = settleTimeoutMs(watch_clock::now());
+
+            if (timeout == -1 || timeout > opts.poll_ms) {
+                timeout = opts.poll_ms;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                if (stopCV.wait_for(lock, std::chrono::milliseconds(timeout), [&] { return stopped; })) {
+                    return false;
+                }
+            }
+
+            scan(true);
+        }
+    }
+};
+
+
+directory_watcher::directory_watcher() : pimpl(std::make_unique<impl>()) {}
+
+
+directory_watcher::~directory_watcher() = default;
+
+
+Status directory_watcher::open(const std::string &dir, const std::string &extension, const watch_opts &opts) {
+
+    pimpl = std::make_unique<impl>();
+
+    pimpl->dir = dir;
+    pimpl->extension = extension;
+    pimpl->opts = opts;
+
+    std::error_code ec;
+
+    if (!std::filesystem::is_directory(pimpl->dir, ec)) {
+        LOGE("not a directory: %s", dir.c_str());
+        return ERR;
+    }
+
+#if TBTPARSER_HAVE_INOTIFY
+
+    pimpl->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (pimpl->inotifyFd != -1) {
+
+        pimpl->stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        //
+        // IN_CLOSE_WRITE for files written in place, IN_MOVED_TO for files renamed into place
+        //
+        if (pimpl->stopFd != -1 && inotify_add_watch(pimpl->inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) != -1) {
+
+            pimpl->backend = WATCH_INOTIFY;
+
+            return OK;
+        }
+    }
+
+    LOGW("cannot use inotify, falling back to polling: %s", std::strerror(errno));
+
+#endif // TBTPARSER_HAVE_INOTIFY
+
+    pimpl->backend = WATCH_POLL;
+
+    pimpl->scan(false);
+
+    return OK;
+}
+
+
+bool directory_watcher::next(std::vector<std::string> &out) {
+
+#if TBTPARSER_HAVE_INOTIFY
+    if (pimpl->backend == WATCH_INOTIFY) {
+        return pimpl->inotifyNext(out);
+    }
+#endif // TBTPARSER_HAVE_INOTIFY
+
+    return pimpl->pollNext(out);
+}
+
+
+void directory_watcher::stop() {
+
+    {
+        std::lock_guard<std::mutex> lock(pimpl->mutex);
+
+        pimpl->stopped = true;
+    }
+
+    pimpl->stopCV.notify_all();
+
+#if TBTPARSER_HAVE_INOTIFY
+    if (pimpl->stopFd != -1) {
+
+        uint64_t one = 1;
+
+        auto n = write(pimpl->stopFd, &one, sizeof(one));
+
+        (void)n;
+    }
+#endif // TBTPARSER_HAVE_INOTIFY
+}
+
+
+//
+// run f(i) for i in [0, count) on all cores
+//
+template <typename F>
+void parallelFor(size_t count, F &&f) {
+
+    std::atomic<size_t> next = 0;
+
+    auto worker = [&]() {
+
+        for (size_t i = next++; i < count; i = next++) {
+            f(i);
+        }
+    };
+
+    auto n = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < n; i++) {
+        threads.emplace_back(worker);
+    }
+
+    for (auto &th : threads) {
+        th.join();
+    }
+}
+
+
+void directory_watcher::run(const std::string &outputExtension, const std::function<void (const std::string &path)> &process) {
+
+    auto processPaths = [&](const std::vector<std::string> &paths) {
+
+        trace_span span("batch");
+
+        parallelFor(paths.size(), [&](size_t i) {
+
+            const auto &path = paths[i];
+
+            trace_span fileSpan("file", "path", path.c_str());
+
+            process(path);
+        });
+    };
+
+    //
+    // first, bring outputs that are missing or older than their inputs up to date
+    //
+    std::vector<std::string> stale;
+
+    std::error_code ec;
+
+    for (const auto &entry : std::filesystem::directory_iterator(pimpl->dir, ec)) {
+
+        if (!entry.is_regular_file(ec) || !pimpl->matches(entry.path())) {
+            continue;
+        }
+
+        auto outPath = std::filesystem::path(entry.path()).replace_extension(outputExtension);
+
+        std::error_code ec2;
+
+        auto outTime = std::filesystem::last_write_time(outPath, ec2);
+
+        if (ec2 || outTime < entry.last_write_time(ec)) {
+            stale.push_back(entry.path().string());
+        }
+    }
+
+    std::sort(stale.begin(), stale.end());
+
+    processPaths(stale);
+
+    std::vector<std::string> changed;
+
+    while (next(changed)) {
+        processPaths(changed);
+    }
+}
+
+
+watch_backend directory_watcher::backend() const {
+    return pimpl->backend;
+}
+
+
+Status saveFileAtomically(const std::string &path, const std::vector<uint8_t> &data) {
+
+    auto tmp = path + ".tmp";
+
+    Status ret = saveFile(tmp.c_str(), data);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    std::error_code ec;
+
+    std::filesystem::rename(tmp, path, ec);
+
+    if (ec) {
+
+        LOGE("cannot rename: %s: %s", tmp.c_str(), ec.message().c_str());
+
+        std::filesystem::remove(tmp, ec);
+
+        return ERR;
+    }
+
+    return OK;
+}
+
+
+
+
+
+
+
+
+
+
+
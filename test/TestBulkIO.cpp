@@ -0,0 +1,176 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/bulk-io.h"
+
+#include "common/file.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <cstdio> // for remove
+
+
+class BulkIOTest : public ::testing::TestWithParam<bulk_io_backend> {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+
+const std::vector<std::string> BULK_IO_PATHS{
+    "data/twinkle.tbt",
+    "data/back.tbt",
+    "data/Closing Time.tbt",
+    "data/justice.tbt",
+    "data/The Arcane.tbt",
+    "data/does-not-exist.tbt",
+    "data/Classical Madness.tbt",
+};
+
+
+TEST_P(BulkIOTest, read) {
+
+    bulk_io_opts opts;
+    opts.backend = GetParam();
+    //
+    // smaller than the number of paths, to exercise backpressure
+    //
+    opts.max_in_flight = 2;
+
+    bulk_file_reader reader(BULK_IO_PATHS, opts);
+
+    if (GetParam() == BULK_IO_URING && !bulkIOUringAvailable()) {
+        EXPECT_EQ(reader.backend(), BULK_IO_THREADS);
+    } else {
+        EXPECT_EQ(reader.backend(), GetParam());
+    }
+
+    std::vector<bool> seen(BULK_IO_PATHS.size());
+
+    bulk_read_item item;
+
+    while (reader.next(item)) {
+
+        ASSERT_LT(item.index, BULK_IO_PATHS.size());
+        EXPECT_FALSE(seen[item.index]);
+        seen[item.index] = true;
+
+        EXPECT_EQ(item.path, BULK_IO_PATHS[item.index]);
+
+        std::vector<uint8_t> expected;
+
+        Status ret = openFile(item.path.c_str(), expected);
+
+        EXPECT_EQ(item.status, ret);
+
+        if (ret == OK) {
+            EXPECT_EQ(item.data, expected);
+        }
+    }
+
+    EXPECT_THAT(seen, testing::Each(true));
+}
+
+
+TEST_P(BulkIOTest, write) {
+
+    bulk_io_opts opts;
+    opts.backend = GetParam();
+    opts.max_in_flight = 2;
+
+    std::vector<std::string> paths;
+    std::vector<std::vector<uint8_t>> contents;
+
+    for (size_t i = 0; i < 5; i++) {
+
+        paths.push_back("bulk-io-test-" + std::to_string(i) + ".bin");
+
+        //
+        // include an empty file and one larger than a single read
+        //
+        std::vector<uint8_t> data(i * 20000);
+        for (size_t j = 0; j < data.size(); j++) {
+            data[j] = static_cast<uint8_t>(j * 7 + i);
+        }
+
+        contents.push_back(data);
+    }
+
+    {
+        bulk_file_writer writer(opts);
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            writer.submit(paths[i], contents[i]);
+        }
+
+        EXPECT_EQ(writer.finish(), OK);
+    }
+
+    bulk_file_reader reader(paths, opts);
+
+    bulk_read_item item;
+
+    size_t count = 0;
+
+    while (reader.next(item)) {
+
+        EXPECT_EQ(item.status, OK);
+        EXPECT_EQ(item.data, contents[item.index]);
+
+        count++;
+    }
+
+    EXPECT_EQ(count, paths.size());
+
+    for (const auto &p : paths) {
+        std::remove(p.c_str());
+    }
+}
+
+
+TEST_P(BulkIOTest, writeFailure) {
+
+    bulk_io_opts opts;
+    opts.backend = GetParam();
+
+    bulk_file_writer writer(opts);
+
+    writer.submit("does-not-exist/out.bin", { 1, 2, 3 });
+
+    EXPECT_EQ(writer.finish(), ERR);
+}
+
+
+INSTANTIATE_TEST_SUITE_P(Backends, BulkIOTest, testing::Values(BULK_IO_THREADS, BULK_IO_URING));
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,315 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+
+#include "tbt-parser/embedded-tbt.h"
+
+#include "tbt-parser.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <algorithm> // for sort, search
+#include <tuple>
+#include <variant> // for get_if, visit
+
+
+class EmbeddedTbtTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+//
+// data/twinkle.tbt, re-encoded as version 0x6b
+//
+// the shipped file is 0x6f, which has compressed metadata and body
+//
+static constexpr uint8_t TWINKLE_TBT[] = {
+    0x54, 0x42, 0x54, 0x6b, 0x78, 0x01, 0x03, 0x31, 0x2e, 0x35, 0x00, 0x0b,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x1d, 0x00, 0x00, 0x00, 0xfa, 0x6d, 0x55, 0xd1, 0x53, 0x01, 0x00, 0x00,
+    0x11, 0x39, 0xbc, 0xa4, 0x06, 0x1b, 0x1c, 0x60, 0x40, 0x18, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+    0x74, 0x77, 0x69, 0x6e, 0x6b, 0x6c, 0x65, 0x00, 0x00, 0x1a, 0x00, 0x0f,
+    0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f,
+    0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f,
+    0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f,
+    0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x0f, 0x00, 0x01, 0x01, 0x00,
+    0xe0, 0x0e, 0x00, 0x5f, 0x00, 0x01, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01,
+    0x83, 0x51, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01,
+    0x82, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01, 0x80, 0x9e, 0x00, 0x01,
+    0x83, 0x4f, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01,
+    0x82, 0x4f, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01, 0x80, 0x4e, 0x00, 0x01,
+    0x83, 0xa1, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01, 0x80, 0x4e, 0x00, 0x01,
+    0x83, 0x4f, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01,
+    0x82, 0x4f, 0x00, 0x01, 0x80, 0xa0, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01,
+    0x80, 0x4e, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01,
+    0x82, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01, 0x80, 0x9e, 0x00, 0x01,
+    0x83, 0x4f, 0x00, 0x01, 0x83, 0x51, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01,
+    0x80, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01,
+    0x80, 0x9e, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01, 0x83, 0x4f, 0x00, 0x01,
+    0x82, 0x4f, 0x00, 0x01, 0x82, 0x4f, 0x00, 0x01, 0x80, 0x4f, 0x00, 0x01,
+    0x80, 0x4e, 0x00, 0x01, 0x83, 0x9e, 0x00, 0x01, 0x12, 0x01, 0x12, 0x01,
+    0x12, 0x01, 0x12, 0x01, 0x12, 0x01, 0x12, 0x00, 0xff, 0xff, 0x00, 0x00,
+    0x7b, 0x29, 0x00
+};
+
+
+static constexpr auto TWINKLE_MID = embeddedMidiArray<TWINKLE_TBT>();
+
+static constexpr auto TWINKLE_MID_NO_CONTROLLERS = embeddedMidiArray<TWINKLE_TBT, embedded_midi_opts{ false, false, false }>();
+
+
+template <size_t N, size_t M>
+constexpr bool containsBytes(const std::array<uint8_t, N> &haystack, const std::array<uint8_t, M> &needle) {
+    return std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end()) != haystack.end();
+}
+
+
+//
+// MThd, format 1, 2 tracks (tempo track + 1), division 192
+//
+static_assert(containsBytes(TWINKLE_MID, std::array<uint8_t, 14>{ 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 0xc0 }));
+
+//
+// Set Tempo, 500000 micros per beat
+//
+static_assert(containsBytes(TWINKLE_MID, std::array<uint8_t, 6>{ 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20 }));
+
+//
+// 1 Program Change, 9 Control Changes, and 1 Pitch Bend, all at tick 0
+//
+static_assert(TWINKLE_MID.size() - TWINKLE_MID_NO_CONTROLLERS.size() == 3 + 9 * 4 + 4);
+
+//
+// the complete file, as produced by convertToMidi + exportMidiBytes at runtime
+//
+static constexpr std::array<uint8_t, 536> TWINKLE_MID_EXPECTED = {
+    0x4d, 0x54, 0x68, 0x64, 0x00, 0x00, 0x00, 0x06, 0x00, 0x01, 0x00, 0x02,
+    0x00, 0xc0, 0x4d, 0x54, 0x72, 0x6b, 0x00, 0x00, 0x00, 0x32, 0x00, 0xff,
+    0x03, 0x19, 0x74, 0x62, 0x74, 0x2d, 0x70, 0x61, 0x72, 0x73, 0x65, 0x72,
+    0x20, 0x4d, 0x49, 0x44, 0x49, 0x20, 0x2d, 0x20, 0x54, 0x72, 0x61, 0x63,
+    0x6b, 0x20, 0x30, 0x00, 0xff, 0x58, 0x04, 0x04, 0x02, 0x18, 0x08, 0x00,
+    0xff, 0x51, 0x03, 0x07, 0xa1, 0x20, 0x8b, 0xdc, 0x00, 0xff, 0x2f, 0x00,
+    0x4d, 0x54, 0x72, 0x6b, 0x00, 0x00, 0x01, 0xc8, 0x00, 0xff, 0x03, 0x19,
+    0x74, 0x62, 0x74, 0x2d, 0x70, 0x61, 0x72, 0x73, 0x65, 0x72, 0x20, 0x4d,
+    0x49, 0x44, 0x49, 0x20, 0x2d, 0x20, 0x54, 0x72, 0x61, 0x63, 0x6b, 0x20,
+    0x31, 0x00, 0xc0, 0x1b, 0x00, 0xb0, 0x07, 0x60, 0x00, 0xb0, 0x0a, 0x40,
+    0x00, 0xb0, 0x5b, 0x00, 0x00, 0xb0, 0x5d, 0x00, 0x00, 0xb0, 0x01, 0x00,
+    0x00, 0xb0, 0x65, 0x00, 0x00, 0xb0, 0x64, 0x00, 0x00, 0xb0, 0x06, 0x18,
+    0x00, 0xb0, 0x26, 0x00, 0x00, 0xe0, 0x00, 0x40, 0x00, 0x90, 0x30, 0x40,
+    0x81, 0x40, 0x80, 0x30, 0x00, 0x00, 0x90, 0x30, 0x40, 0x81, 0x40, 0x90,
+    0x37, 0x40, 0x81, 0x40, 0x80, 0x37, 0x00, 0x00, 0x90, 0x37, 0x40, 0x81,
+    0x40, 0x80, 0x37, 0x00, 0x00, 0x90, 0x39, 0x40, 0x81, 0x40, 0x80, 0x39,
+    0x00, 0x00, 0x90, 0x39, 0x40, 0x81, 0x40, 0x80, 0x39, 0x00, 0x00, 0x90,
+    0x37, 0x40, 0x83, 0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00,
+    0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00, 0x00, 0x90, 0x34,
+    0x40, 0x81, 0x40, 0x80, 0x34, 0x00, 0x00, 0x90, 0x34, 0x40, 0x81, 0x40,
+    0x80, 0x34, 0x00, 0x00, 0x90, 0x32, 0x40, 0x81, 0x40, 0x80, 0x32, 0x00,
+    0x00, 0x90, 0x32, 0x40, 0x81, 0x40, 0x80, 0x30, 0x00, 0x00, 0x90, 0x30,
+    0x40, 0x83, 0x00, 0x80, 0x37, 0x00, 0x00, 0x90, 0x37, 0x40, 0x81, 0x40,
+    0x80, 0x37, 0x00, 0x00, 0x90, 0x37, 0x40, 0x81, 0x40, 0x80, 0x32, 0x00,
+    0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00, 0x00, 0x90, 0x35,
+    0x40, 0x81, 0x40, 0x80, 0x35, 0x00, 0x00, 0x90, 0x34, 0x40, 0x81, 0x40,
+    0x80, 0x34, 0x00, 0x00, 0x90, 0x34, 0x40, 0x81, 0x40, 0x80, 0x34, 0x00,
+    0x00, 0x90, 0x32, 0x40, 0x83, 0x00, 0x80, 0x37, 0x00, 0x00, 0x90, 0x37,
+    0x40, 0x81, 0x40, 0x80, 0x37, 0x00, 0x00, 0x90, 0x37, 0x40, 0x81, 0x40,
+    0x80, 0x32, 0x00, 0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00,
+    0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00, 0x00, 0x90, 0x34,
+    0x40, 0x81, 0x40, 0x80, 0x34, 0x00, 0x00, 0x90, 0x34, 0x40, 0x81, 0x40,
+    0x80, 0x34, 0x00, 0x00, 0x90, 0x32, 0x40, 0x83, 0x00, 0x80, 0x30, 0x00,
+    0x00, 0x90, 0x30, 0x40, 0x81, 0x40, 0x80, 0x30, 0x00, 0x00, 0x90, 0x30,
+    0x40, 0x81, 0x40, 0x80, 0x37, 0x00, 0x00, 0x90, 0x37, 0x40, 0x81, 0x40,
+    0x80, 0x37, 0x00, 0x00, 0x90, 0x37, 0x40, 0x81, 0x40, 0x80, 0x37, 0x00,
+    0x00, 0x90, 0x39, 0x40, 0x81, 0x40, 0x80, 0x39, 0x00, 0x00, 0x90, 0x39,
+    0x40, 0x81, 0x40, 0x80, 0x39, 0x00, 0x00, 0x90, 0x37, 0x40, 0x83, 0x00,
+    0x80, 0x32, 0x00, 0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00,
+    0x00, 0x90, 0x35, 0x40, 0x81, 0x40, 0x80, 0x35, 0x00, 0x00, 0x90, 0x34,
+    0x40, 0x81, 0x40, 0x80, 0x34, 0x00, 0x00, 0x90, 0x34, 0x40, 0x81, 0x40,
+    0x80, 0x34, 0x00, 0x00, 0x90, 0x32, 0x40, 0x81, 0x40, 0x80, 0x32, 0x00,
+    0x00, 0x90, 0x32, 0x40, 0x81, 0x40, 0x80, 0x30, 0x00, 0x00, 0x90, 0x30,
+    0x40, 0x83, 0x00, 0x80, 0x30, 0x00, 0x00, 0x80, 0x32, 0x00, 0x00, 0x80,
+    0x37, 0x00, 0x8b, 0x94, 0x00, 0xff, 0x2f, 0x00
+};
+
+static_assert(TWINKLE_MID == TWINKLE_MID_EXPECTED);
+
+
+//
+// same bytes as the runtime conversion
+//
+TEST_F(EmbeddedTbtTest, MatchesConvertToMidi) {
+
+    std::vector<uint8_t> data(std::begin(TWINKLE_TBT), std::end(TWINKLE_TBT));
+
+    auto it = data.cbegin();
+
+    tbt_file t;
+
+    Status ret = parseTbtBytes(it, data.cend(), t);
+    ASSERT_EQ(ret, OK);
+
+    midi_file m;
+
+    ret = convertToMidi(t, midi_convert_opts{}, m);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> expected;
+
+    ret = exportMidiBytes(m, expected);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(std::vector<uint8_t>(TWINKLE_MID.begin(), TWINKLE_MID.end()), expected);
+
+    auto result = embeddedTbtToMidi(data, embedded_midi_opts{});
+
+    ASSERT_EQ(result.error, nullptr);
+
+    EXPECT_EQ(result.bytes, expected);
+}
+
+
+//
+// data/twinkle.mid was written by TabIt, which uses different velocities and controllers,
+// so only the timing of notes is compared
+//
+TEST_F(EmbeddedTbtTest, NoteTimes) {
+
+    auto notes = [](const midi_file &m) {
+
+        std::vector<std::tuple<int32_t, bool, uint8_t> > out;
+
+        int32_t tick = 0;
+
+        for (const auto &event : m.tracks[1]) {
+
+            if (const auto *on = std::get_if<NoteOnEvent>(&event)) {
+
+                tick += on->deltaTime;
+
+                out.emplace_back(tick, (on->velocity != 0), on->midiNote);
+
+            } else if (const auto *off = std::get_if<NoteOffEvent>(&event)) {
+
+                tick += off->deltaTime;
+
+                out.emplace_back(tick, false, off->midiNote);
+
+            } else {
+
+                tick += std::visit([](const auto &e) { return e.deltaTime; }, event);
+            }
+        }
+
+        //
+        // the order of events at the same tick is not significant
+        //
+        std::sort(out.begin(), out.end());
+
+        return out;
+    };
+
+    std::vector<uint8_t> bytes(TWINKLE_MID.begin(), TWINKLE_MID.end());
+
+    auto it = bytes.cbegin();
+
+    midi_file actual;
+
+    Status ret = parseMidiBytes(it, bytes.cend(), actual);
+    ASSERT_EQ(ret, OK);
+
+    midi_file expected;
+
+    ret = parseMidiFile("data/twinkle.mid", expected);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(actual.header.trackCount, expected.header.trackCount);
+    ASSERT_EQ(actual.header.division, expected.header.division);
+
+    EXPECT_EQ(notes(actual), notes(expected));
+}
+
+
+TEST_F(EmbeddedTbtTest, Corrupted) {
+
+    std::vector<uint8_t> data(std::begin(TWINKLE_TBT), std::end(TWINKLE_TBT));
+
+    {
+        auto truncated = data;
+        truncated.resize(truncated.size() - 1);
+
+        auto result = embeddedTbtToMidi(truncated, embedded_midi_opts{});
+
+        EXPECT_NE(result.error, nullptr);
+    }
+
+    {
+        //
+        // body CRC
+        //
+        auto flipped = data;
+        flipped.back() ^= 0x01;
+
+        auto result = embeddedTbtToMidi(flipped, embedded_midi_opts{});
+
+        EXPECT_NE(result.error, nullptr);
+    }
+
+    {
+        //
+        // 0x6f and later are not handled
+        //
+        auto later = data;
+        later[3] = 0x6f;
+
+        auto result = embeddedTbtToMidi(later, embedded_midi_opts{});
+
+        EXPECT_NE(result.error, nullptr);
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
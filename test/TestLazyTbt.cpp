@@ -0,0 +1,307 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser.h"
+#include "tbt-parser/lazy-tbt.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <variant> // for get
+
+
+class LazyTbtTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+const char *LAZY_PATHS[] = {
+    "data/twinkle.tbt",
+    "data/back.tbt",
+    "data/Closing Time.tbt",
+    "data/justice.tbt",
+    "data/The Arcane.tbt",
+    "data/Classical Madness!.tbt",
+    "data/[With Intent of Butchery] Decomposing Truth.tbt",
+    "data/Song Idea.tbt",
+    "data/black.tbt",
+};
+
+
+TEST_F(LazyTbtTest, SameAsEager) {
+
+    for (const char *path : LAZY_PATHS) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        tbt_lazy_file lazy;
+
+        ret = parseTbtFileLazy(path, tbt_parse_opts{}, lazy);
+        ASSERT_EQ(ret, OK);
+
+        ret = lazy.materializeTracks({});
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(tbtFileTablature(lazy.file()), tbtFileTablature(t)) << path;
+
+        midi_file expected;
+
+        ret = convertToMidi(t, midi_convert_opts{}, expected);
+        ASSERT_EQ(ret, OK);
+
+        midi_file actual;
+
+        ret = convertToMidi(lazy.file(), midi_convert_opts{}, actual);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(actual.tracks, expected.tracks) << path;
+    }
+}
+
+
+//
+// the overloads taking a tbt_lazy_file materialize what they read
+//
+TEST_F(LazyTbtTest, Overloads) {
+
+    for (const char *path : LAZY_PATHS) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        tbt_lazy_file lazy;
+
+        ret = parseTbtFileLazy(path, tbt_parse_opts{}, lazy);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(tbtFileInfo(lazy), tbtFileInfo(t)) << path;
+
+        std::string tab;
+
+        ret = tbtFileTablature(lazy, tbt_tablature_opts{}, tab);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(tab, tbtFileTablature(t)) << path;
+
+        note_table expected;
+
+        ret = buildNoteTable(t, expected);
+        ASSERT_EQ(ret, OK);
+
+        note_table actual;
+
+        ret = buildNoteTable(lazy, actual);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(actual.space, expected.space) << path;
+        EXPECT_EQ(actual.micros, expected.micros) << path;
+        EXPECT_EQ(actual.midi_pitch, expected.midi_pitch) << path;
+
+        tbt_song_context ctx;
+
+        ret = analyzeTbtFile(lazy, tbt_analyze_opts{}, ctx);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(tbtFileTablature(ctx, tbt_tablature_opts{}), tbtFileTablature(t)) << path;
+    }
+}
+
+
+TEST_F(LazyTbtTest, OnlyRequestedTrack) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/black.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_lazy_file lazy;
+
+    ret = parseTbtFileLazy("data/black.tbt", tbt_parse_opts{}, lazy);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_LE(2, lazy.trackCount());
+
+    for (uint8_t track = 0; track < lazy.trackCount(); track++) {
+        EXPECT_FALSE(lazy.trackMaterialized(track));
+    }
+
+    const auto &expected = std::get<tbt_file71>(t);
+
+    const auto &actual = std::get<tbt_file71>(lazy.file());
+
+    //
+    // bar lines are always parsed
+    //
+    EXPECT_EQ(actual.body.barLinesMap, expected.body.barLinesMap);
+
+    EXPECT_TRUE(actual.body.mapsList[1].notesMap.empty());
+
+    ret = lazy.materializeTrack(1);
+    ASSERT_EQ(ret, OK);
+
+    //
+    // materializing again does nothing
+    //
+    ret = lazy.materializeTrack(1);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_TRUE(lazy.trackMaterialized(1));
+    EXPECT_FALSE(lazy.trackMaterialized(0));
+
+    EXPECT_EQ(actual.body.mapsList[1].notesMap, expected.body.mapsList[1].notesMap);
+    EXPECT_EQ(actual.body.mapsList[1].trackEffectChanges.size(), expected.body.mapsList[1].trackEffectChanges.size());
+
+    EXPECT_TRUE(actual.body.mapsList[0].notesMap.empty());
+
+    EXPECT_NE(lazy.materializeTrack(lazy.trackCount()), OK);
+}
+
+
+TEST_F(LazyTbtTest, ConvertSelectedTracks) {
+
+    for (const char *path : LAZY_PATHS) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        tbt_lazy_file lazy;
+
+        ret = parseTbtFileLazy(path, tbt_parse_opts{}, lazy);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+
+        opts.selected_tracks = { false, true };
+
+        midi_file expected;
+
+        ret = convertToMidi(t, opts, expected);
+        ASSERT_EQ(ret, OK);
+
+        midi_file actual;
+
+        ret = convertToMidi(lazy, opts, actual);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(actual.tracks, expected.tracks) << path;
+
+        //
+        // tempo changes are stored with the notes before 0x72
+        //
+        if (lazy.versionNumber() == 0x72) {
+            EXPECT_TRUE(std::get<tbt_file71>(lazy.file()).body.mapsList[0].notesMap.empty()) << path;
+        }
+    }
+}
+
+
+TEST_F(LazyTbtTest, ManyThreads) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/justice.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_lazy_file lazy;
+
+    ret = parseTbtFileLazy("data/justice.tbt", tbt_parse_opts{}, lazy);
+    ASSERT_EQ(ret, OK);
+
+    const int THREAD_COUNT = 8;
+
+    std::vector<std::thread> threads;
+
+    std::vector<Status> results(THREAD_COUNT, OK);
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+
+        threads.emplace_back([&lazy, &results, i]() {
+
+            //
+            // start at different tracks, so threads race for the same tracks
+            //
+            for (uint8_t j = 0; j < lazy.trackCount(); j++) {
+
+                auto track = static_cast<uint8_t>((j + i) % lazy.trackCount());
+
+                Status ret = lazy.materializeTrack(track);
+
+                if (ret != OK) {
+                    results[static_cast<size_t>(i)] = ret;
+                }
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (auto result : results) {
+        EXPECT_EQ(result, OK);
+    }
+
+    midi_file expected;
+
+    ret = convertToMidi(t, midi_convert_opts{}, expected);
+    ASSERT_EQ(ret, OK);
+
+    midi_file actual;
+
+    ret = convertToMidi(lazy.file(), midi_convert_opts{}, actual);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(actual.tracks, expected.tracks);
+}
+
+
+
+
+
+
+
+
+
+
+
+
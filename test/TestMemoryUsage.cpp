@@ -0,0 +1,144 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/memory-usage.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+
+class MemoryUsageTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+TEST_F(MemoryUsageTest, Tbt) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/Closing Time.tbt",
+        "data/The Arcane.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        auto usage = tbtFileMemoryUsage(t);
+
+        auto trackCount = std::visit([](const auto &tXX) { return tXX.header.trackCount; }, t);
+
+        EXPECT_EQ(usage.notes.size(), trackCount) << path;
+
+        for (auto n : usage.notes) {
+            EXPECT_GT(n, 0u) << path;
+        }
+
+        EXPECT_GT(usage.trackMetadata, 0u) << path;
+        EXPECT_GT(usage.barLines, 0u) << path;
+
+        EXPECT_GT(usage.total(), usage.barLines + usage.trackMetadata) << path;
+
+        EXPECT_FALSE(tbtMemoryUsageInfo(usage).empty());
+    }
+
+    //
+    // has alternate time regions
+    //
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Song Idea.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_GT(tbtFileMemoryUsage(t).alternateTimeRegions, 0u);
+}
+
+
+TEST_F(MemoryUsageTest, Midi) {
+
+    midi_file m;
+
+    Status ret = parseMidiFile("data/black.mid", m);
+    ASSERT_EQ(ret, OK);
+
+    auto usage = midiFileMemoryUsage(m);
+
+    size_t eventCount = 0;
+    for (const auto &track : m.tracks) {
+        eventCount += track.size();
+    }
+
+    size_t usageEventCount = 0;
+    size_t usageEvents = 0;
+    for (size_t i = 0; i < MIDI_EVENT_TYPE_COUNT; i++) {
+        usageEventCount += usage.eventCounts[i];
+        usageEvents += usage.events[i];
+    }
+
+    EXPECT_EQ(usageEventCount, eventCount);
+    EXPECT_EQ(usageEvents, eventCount * sizeof(midi_track_event));
+
+    //
+    // track names, tempo, End Of Track
+    //
+    EXPECT_GT(usage.metaPayloads, 0u);
+
+    EXPECT_GE(usage.total(), usageEvents + usage.metaPayloads);
+
+    EXPECT_FALSE(midiMemoryUsageInfo(usage).empty());
+}
+
+
+TEST_F(MemoryUsageTest, PeakRSS) {
+    EXPECT_GT(peakResidentSetBytes(), 0u);
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -403,6 +403,504 @@ TEST_F(MidiTest, SongIdea) {
 }
 
 
+TEST_F(MidiTest, Diagnostics) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/[With Intent of Butchery] Decomposing Truth.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_diagnostics diagnostics;
+
+    midi_convert_opts opts;
+    opts.diagnostics = &diagnostics;
+
+    midi_file m1;
+
+    ret = convertToMidi(t, opts, m1);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(diagnostics.entries.size(), 2);
+
+    EXPECT_EQ(diagnostics.entries[0].code, DIAG_TEMPO_CHANGE_AT_NON_INTEGRAL_SPACE);
+    EXPECT_EQ(diagnostics.entries[0].count, 3);
+    EXPECT_EQ(diagnostics.entries[0].firstTrack, -1);
+
+    EXPECT_EQ(diagnostics.entries[1].code, DIAG_REPEAT_CLOSE_AT_NON_INTEGRAL_SPACE);
+    EXPECT_EQ(diagnostics.entries[1].count, 1);
+    EXPECT_EQ(diagnostics.entries[1].firstTrack, 9);
+
+    EXPECT_EQ(tbtDiagnosticsInfo(diagnostics),
+        "tempo change at non-integral space: 3 time(s), first at space 1606.666667\n"
+        "repeat CLOSE at non-integral space: 1 time(s), first at space 448.333333 in track 9\n");
+
+    //
+    // collecting diagnostics does not change the output
+    //
+    midi_file m2;
+
+    ret = convertToMidi(t, {}, m2);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> bytes1;
+
+    ret = exportMidiBytes(m1, bytes1);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> bytes2;
+
+    ret = exportMidiBytes(m2, bytes2);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(bytes1, bytes2);
+}
+
+
+TEST_F(MidiTest, DiagnosticsReportedOnce) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Classical Madness!.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_diagnostics diagnostics;
+
+    midi_convert_opts opts;
+    opts.diagnostics = &diagnostics;
+
+    midi_file m;
+
+    ret = convertToMidi(t, opts, m);
+    ASSERT_EQ(ret, OK);
+
+    //
+    // 2 repeat closes without an open, each reported once and not once per track
+    //
+    ASSERT_EQ(diagnostics.entries.size(), 1);
+
+    EXPECT_EQ(diagnostics.entries[0].code, DIAG_NO_REPEAT_OPEN);
+    EXPECT_EQ(diagnostics.entries[0].count, 2);
+    EXPECT_EQ(diagnostics.entries[0].firstTrack, -1);
+}
+
+
+TEST_F(MidiTest, Program) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/back.tbt",
+        "data/Closing Time.tbt",
+        "data/justice.tbt",
+        "data/The Arcane.tbt",
+        "data/Classical Madness!.tbt",
+        "data/[With Intent of Butchery] Decomposing Truth.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+    };
+
+    size_t totalEvents = 0;
+
+    size_t totalProgramEvents = 0;
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+
+        midi_file m;
+
+        ret = convertToMidi(t, opts, m);
+        ASSERT_EQ(ret, OK);
+
+        midi_program p;
+
+        ret = convertToMidiProgram(t, opts, p);
+        ASSERT_EQ(ret, OK);
+
+        //
+        // exporting the program gives the same bytes
+        //
+        std::vector<uint8_t> bytes1;
+
+        ret = exportMidiBytes(m, bytes1);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> bytes2;
+
+        ret = exportMidiProgramBytes(p, bytes2);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(bytes1, bytes2) << path;
+
+        //
+        // and so does expanding it
+        //
+        midi_file expanded;
+
+        expandMidiProgram(p, expanded);
+
+        std::vector<uint8_t> bytes3;
+
+        ret = exportMidiBytes(expanded, bytes3);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(bytes1, bytes3) << path;
+
+        for (size_t i = 0; i < m.tracks.size(); i++) {
+            totalEvents += m.tracks[i].size();
+            totalProgramEvents += p.tracks[i].events.size();
+            EXPECT_LE(p.tracks[i].events.size(), m.tracks[i].size());
+        }
+    }
+
+    //
+    // some of the test files have repeats
+    //
+    EXPECT_LT(totalProgramEvents, totalEvents);
+
+    {
+        tbt_file t;
+
+        Status ret = parseTbtFile("data/twinkle.tbt", t);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+        opts.eliminate_redundant_events = true;
+
+        midi_program p;
+
+        ret = convertToMidiProgram(t, opts, p);
+        EXPECT_EQ(ret, ERR);
+    }
+}
+
+
+TEST_F(MidiTest, Bytes) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/back.tbt",
+        "data/Closing Time.tbt",
+        "data/justice.tbt",
+        "data/The Arcane.tbt",
+        "data/Classical Madness!.tbt",
+        "data/[With Intent of Butchery] Decomposing Truth.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+
+        midi_file m;
+
+        ret = convertToMidi(t, opts, m);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> expected;
+
+        ret = exportMidiBytes(m, expected);
+        ASSERT_EQ(ret, OK);
+
+        midi_event_counts expectedCounts;
+
+        for (const auto &track : m.tracks) {
+            for (const auto &event : track) {
+                if (std::holds_alternative<NoteOnEvent>(event)) {
+                    expectedCounts.noteOn++;
+                } else if (std::holds_alternative<NoteOffEvent>(event)) {
+                    expectedCounts.noteOff++;
+                } else if (std::holds_alternative<ControlChangeEvent>(event)) {
+                    expectedCounts.controlChange++;
+                } else if (std::holds_alternative<ProgramChangeEvent>(event)) {
+                    expectedCounts.programChange++;
+                } else if (std::holds_alternative<PitchBendEvent>(event)) {
+                    expectedCounts.pitchBend++;
+                } else if (std::holds_alternative<MetaEvent>(event)) {
+                    expectedCounts.meta++;
+                }
+            }
+        }
+
+        std::vector<uint8_t> bytes;
+
+        ret = convertToMidiBytes(t, opts, bytes);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(bytes, expected) << path;
+
+        //
+        // bytes and counts from the same pass
+        //
+        midi_event_counts counts;
+
+        ret = convertToMidiBytes(t, opts, bytes, counts);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(bytes, expected) << path;
+
+        EXPECT_EQ(counts.noteOn, expectedCounts.noteOn) << path;
+        EXPECT_EQ(counts.noteOff, expectedCounts.noteOff) << path;
+        EXPECT_EQ(counts.controlChange, expectedCounts.controlChange) << path;
+        EXPECT_EQ(counts.programChange, expectedCounts.programChange) << path;
+        EXPECT_EQ(counts.pitchBend, expectedCounts.pitchBend) << path;
+        EXPECT_EQ(counts.meta, expectedCounts.meta) << path;
+    }
+
+    {
+        tbt_file t;
+
+        Status ret = parseTbtFile("data/twinkle.tbt", t);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+        opts.eliminate_redundant_events = true;
+
+        std::vector<uint8_t> bytes;
+
+        ret = convertToMidiBytes(t, opts, bytes);
+        EXPECT_EQ(ret, ERR);
+    }
+}
+
+
+TEST_F(MidiTest, Probe) {
+
+    const char *paths[] = {
+        "data/twinkle.mid",
+        "data/back.mid",
+        "data/Closing Time.mid",
+        "data/justice.mid",
+        "data/justice-no-tempo-changes.mid",
+        "data/The Arcane.mid",
+        "data/Classical Madness!.mid",
+        "data/[With Intent of Butchery] Decomposing Truth.mid",
+        "data/Song Idea.mid",
+        "data/black.mid",
+    };
+
+    for (const char *path : paths) {
+
+        midi_file m;
+
+        Status ret = parseMidiFile(path, m);
+        ASSERT_EQ(ret, OK);
+
+        midi_probe p;
+
+        ret = probeMidiFile(path, p);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(p.header.format, m.header.format) << path;
+        EXPECT_EQ(p.header.trackCount, m.header.trackCount) << path;
+        EXPECT_EQ(p.header.division, m.header.division) << path;
+
+        EXPECT_FALSE(p.tempoMap.empty()) << path;
+
+        auto times = midiFileTimes(m);
+
+        EXPECT_DOUBLE_EQ(p.times.lastNoteOnMicros, times.lastNoteOnMicros) << path;
+        EXPECT_DOUBLE_EQ(p.times.lastNoteOffMicros, times.lastNoteOffMicros) << path;
+        EXPECT_DOUBLE_EQ(p.times.lastEndOfTrackMicros, times.lastEndOfTrackMicros) << path;
+        EXPECT_EQ(p.times.lastNoteOnTick, times.lastNoteOnTick) << path;
+        EXPECT_EQ(p.times.lastNoteOffTick, times.lastNoteOffTick) << path;
+        EXPECT_EQ(p.times.lastEndOfTrackTick, times.lastEndOfTrackTick) << path;
+
+        size_t trackNames = 0;
+
+        for (const auto &track : m.tracks) {
+            for (const auto &e : track) {
+                if (auto meta = std::get_if<MetaEvent>(&e)) {
+                    if (meta->type == 0x03) {
+                        EXPECT_EQ(p.trackNames[trackNames], std::string(meta->data.cbegin(), meta->data.cend())) << path;
+                        trackNames++;
+                    }
+                }
+            }
+        }
+
+        EXPECT_EQ(p.trackNames.size(), trackNames) << path;
+    }
+}
+
+
+//
+// what a synth would see: the channel state at every note and pressure event, every other event, and the final state
+//
+// state is per track, because each track has its own channels
+//
+std::vector<std::vector<int64_t> > stateTimeline(const midi_file &m) {
+
+    std::vector<std::vector<int64_t> > timeline;
+
+    for (const auto &track : m.tracks) {
+
+        //
+        // program, pitch bend, then controllers
+        //
+        std::array<std::vector<int64_t>, 16> states;
+        for (auto &state : states) {
+            state.assign(2 + 128, -1);
+        }
+
+        int64_t tick = 0;
+
+        for (const auto &e : track) {
+
+            std::visit([&](const auto &ev) {
+
+                tick += ev.deltaTime;
+
+                using T = std::decay_t<decltype(ev)>;
+
+                if constexpr (std::is_same_v<T, ProgramChangeEvent>) {
+                    states[ev.channel][0] = ev.midiProgram;
+                } else if constexpr (std::is_same_v<T, PitchBendEvent>) {
+                    states[ev.channel][1] = ev.pitchBend;
+                } else if constexpr (std::is_same_v<T, ControlChangeEvent>) {
+                    states[ev.channel][2 + ev.controller] = ev.value;
+                } else if constexpr (std::is_same_v<T, MetaEvent>) {
+                    std::vector<int64_t> entry{ tick, -1, ev.type };
+                    entry.insert(entry.end(), ev.data.cbegin(), ev.data.cend());
+                    timeline.push_back(entry);
+                } else if constexpr (std::is_same_v<T, SysExEvent>) {
+                    std::vector<int64_t> entry{ tick, -2 };
+                    entry.insert(entry.end(), ev.data.cbegin(), ev.data.cend());
+                    timeline.push_back(entry);
+                } else {
+                    std::vector<int64_t> entry{ tick, static_cast<int64_t>(e.index()), ev.channel };
+                    if constexpr (std::is_same_v<T, NoteOnEvent> || std::is_same_v<T, NoteOffEvent>) {
+                        entry.push_back(ev.midiNote);
+                        entry.push_back(ev.velocity);
+                    }
+                    entry.insert(entry.end(), states[ev.channel].cbegin(), states[ev.channel].cend());
+                    timeline.push_back(entry);
+                }
+            }, e);
+        }
+
+        for (const auto &state : states) {
+            timeline.push_back(state);
+        }
+    }
+
+    return timeline;
+}
+
+
+TEST_F(MidiTest, EliminateRedundantEvents) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/back.tbt",
+        "data/Closing Time.tbt",
+        "data/justice.tbt",
+        "data/The Arcane.tbt",
+        "data/Classical Madness!.tbt",
+        "data/[With Intent of Butchery] Decomposing Truth.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+    };
+
+    size_t totalEvents = 0;
+    size_t totalOptimizedEvents = 0;
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        midi_file m;
+
+        ret = convertToMidi(t, midi_convert_opts{}, m);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+
+        opts.eliminate_redundant_events = true;
+
+        midi_file optimized;
+
+        ret = convertToMidi(t, opts, optimized);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(stateTimeline(optimized), stateTimeline(m)) << path;
+
+        for (size_t i = 0; i < m.tracks.size(); i++) {
+            totalEvents += m.tracks[i].size();
+            totalOptimizedEvents += optimized.tracks[i].size();
+        }
+
+        //
+        // running it again changes nothing
+        //
+        std::vector<uint8_t> bytes1;
+
+        ret = exportMidiBytes(optimized, bytes1);
+        ASSERT_EQ(ret, OK);
+
+        eliminateRedundantMidiEvents(optimized);
+
+        std::vector<uint8_t> bytes2;
+
+        ret = exportMidiBytes(optimized, bytes2);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(bytes1, bytes2) << path;
+    }
+
+    EXPECT_LT(totalOptimizedEvents, totalEvents);
+}
+
+
+TEST_F(MidiTest, EliminateRedundantEventsMerge) {
+
+    midi_file m;
+
+    m.header = { 1, 1, 192 };
+
+    m.tracks.push_back({
+        ControlChangeEvent{ 0, 0, 0x07, 100 },
+        ControlChangeEvent{ 0, 0, 0x07, 90 }, // replaces the previous one at the same tick
+        NoteOnEvent{ 0, 0, 60, 0x40 },
+        ControlChangeEvent{ 10, 0, 0x07, 90 }, // no change
+        ProgramChangeEvent{ 0, 0, 5 },
+        ControlChangeEvent{ 0, 0, 0x00, 1 }, // bank select, so the program change after it is kept
+        ProgramChangeEvent{ 0, 0, 5 },
+        NoteOffEvent{ 5, 0, 60, 0 },
+        MetaEvent{ 7, 0x2f, {} },
+    });
+
+    auto before = stateTimeline(m);
+
+    eliminateRedundantMidiEvents(m);
+
+    EXPECT_EQ(stateTimeline(m), before);
+
+    ASSERT_EQ(m.tracks[0].size(), 7u);
+
+    //
+    // delta time of the removed event moves to the next one
+    //
+    auto program = std::get_if<ProgramChangeEvent>(&m.tracks[0][2]);
+    ASSERT_NE(program, nullptr);
+    EXPECT_EQ(program->deltaTime, 10);
+}
+
+
+
 
 
 
@@ -0,0 +1,256 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/midi-handoff.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <algorithm> // for equal
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+class MidiHandoffTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+
+TEST_F(MidiHandoffTest, exportSize) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/Closing Time.tbt",
+        "data/The Arcane.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        midi_file m;
+
+        ret = convertToMidi(t, midi_convert_opts{}, m);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> expected;
+
+        ret = exportMidiBytes(m, expected);
+        ASSERT_EQ(ret, OK);
+
+        ASSERT_EQ(midiExportSize(m), expected.size());
+
+        std::vector<uint8_t> region(expected.size());
+
+        ret = exportMidiBytes(m, std::span<uint8_t>(region));
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(region, expected);
+
+        std::vector<uint8_t> tooSmall(expected.size() - 1);
+
+        ret = exportMidiBytes(m, std::span<uint8_t>(tooSmall));
+        EXPECT_EQ(ret, ERR);
+
+        auto it = expected.cbegin();
+
+        midi_probe probe;
+
+        ret = probeMidiBytes(it, expected.cend(), probe);
+        ASSERT_EQ(ret, OK);
+
+        auto tempoMap = midiFileTempoMap(m);
+
+        ASSERT_EQ(tempoMap.size(), probe.tempoMap.size());
+
+        for (size_t i = 0; i < tempoMap.size(); i++) {
+            EXPECT_EQ(tempoMap[i].tick, probe.tempoMap[i].tick);
+            EXPECT_EQ(tempoMap[i].microsPerBeat, probe.tempoMap[i].microsPerBeat);
+        }
+    }
+}
+
+
+TEST_F(MidiHandoffTest, descriptor) {
+
+    midi_handoff_descriptor d;
+    d.size = 12345;
+    d.header = { 1, 2, 192 };
+    d.tracks = { { 14 + 8, 100 }, { 14 + 8 + 100 + 8, 200 } };
+    d.tempoMap = { { 0, 500000 }, { 192, 400000 } };
+
+    std::vector<uint8_t> encoded;
+
+    encodeMidiHandoffDescriptor(d, encoded);
+
+    midi_handoff_descriptor decoded;
+
+    Status ret = decodeMidiHandoffDescriptor(encoded, decoded);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(decoded.size, d.size);
+    EXPECT_EQ(decoded.header.division, d.header.division);
+    ASSERT_EQ(decoded.tracks.size(), d.tracks.size());
+    EXPECT_EQ(decoded.tracks[1].offset, d.tracks[1].offset);
+    EXPECT_EQ(decoded.tracks[1].length, d.tracks[1].length);
+    ASSERT_EQ(decoded.tempoMap.size(), d.tempoMap.size());
+    EXPECT_EQ(decoded.tempoMap[1].microsPerBeat, d.tempoMap[1].microsPerBeat);
+
+    encoded.pop_back();
+
+    ret = decodeMidiHandoffDescriptor(encoded, decoded);
+    EXPECT_EQ(ret, ERR);
+}
+
+
+#if defined(__linux__)
+
+//
+// the child maps the memfd read-only and compares it with the bytes it inherited from the parent
+//
+int receiveAndCheck(int socket, const std::vector<uint8_t> &expected) {
+
+    int fd;
+
+    midi_handoff_descriptor d;
+
+    if (receiveMidiHandoff(socket, fd, d) != OK) {
+        return 1;
+    }
+
+    midi_handoff_mapping mapping;
+
+    Status ret = mapping.open(fd, d);
+
+    close(fd);
+
+    if (ret != OK) {
+        return 2;
+    }
+
+    auto bytes = mapping.bytes();
+
+    if (!std::equal(bytes.begin(), bytes.end(), expected.cbegin(), expected.cend())) {
+        return 3;
+    }
+
+    //
+    // the last track ends at the end of the file
+    //
+    if (d.tracks.empty() || d.tracks.back().offset + d.tracks.back().length != d.size) {
+        return 4;
+    }
+
+    return 0;
+}
+
+
+TEST_F(MidiHandoffTest, twoProcesses) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/twinkle.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_file m;
+
+    ret = convertToMidi(t, midi_convert_opts{}, m);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> expected;
+
+    ret = exportMidiBytes(m, expected);
+    ASSERT_EQ(ret, OK);
+
+    int fd;
+
+    midi_handoff_descriptor d;
+
+    ret = exportMidiHandoff(m, fd, d);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(d.size, expected.size());
+    EXPECT_EQ(d.tracks.size(), m.tracks.size());
+
+    int sockets[2];
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    auto pid = fork();
+
+    ASSERT_NE(pid, -1);
+
+    if (pid == 0) {
+
+        close(sockets[0]);
+
+        _exit(receiveAndCheck(sockets[1], expected));
+    }
+
+    close(sockets[1]);
+
+    ret = sendMidiHandoff(sockets[0], fd, d);
+    EXPECT_EQ(ret, OK);
+
+    close(sockets[0]);
+
+    //
+    // sealed, so the producer cannot change the bytes either
+    //
+    EXPECT_EQ(ftruncate(fd, 0), -1);
+
+    close(fd);
+
+    int status;
+
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+
+    ASSERT_TRUE(WIFEXITED(status));
+
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+}
+
+#endif // defined(__linux__)
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,256 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser.h"
+#include "tbt-parser/midi-transform.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <variant> // for get_if
+
+
+std::vector<uint8_t> midiBytes(const midi_file &m) {
+
+    std::vector<uint8_t> bytes;
+
+    Status ret = exportMidiBytes(m, bytes);
+    EXPECT_EQ(ret, OK);
+
+    return bytes;
+}
+
+
+class MidiTransformTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+midi_file transformTestFile() {
+
+    midi_file m;
+
+    m.header = { 1, 2, 192 };
+
+    m.tracks.push_back({
+        MetaEvent{ 0, 0x51, { 0x07, 0xa1, 0x20 } }, // 500000
+        MetaEvent{ 384, 0x2f, {} },
+    });
+
+    m.tracks.push_back({
+        ProgramChangeEvent{ 0, 1, 25 },
+        NoteOnEvent{ 0, 1, 60, 0x40 },
+        NoteOnEvent{ 0, 9, 36, 0x40 },
+        NoteOnEvent{ 0, 2, 126, 0x40 },
+        NoteOffEvent{ 192, 1, 60, 0 },
+        NoteOffEvent{ 0, 9, 36, 0 },
+        NoteOffEvent{ 0, 2, 126, 0 },
+        MetaEvent{ 192, 0x2f, {} },
+    });
+
+    return m;
+}
+
+
+TEST_F(MidiTransformTest, TransposeAndTempo) {
+
+    auto m = transformTestFile();
+
+    midi_transform xf;
+
+    xf.transpose = 3;
+    xf.tempo_scale = 2.0;
+
+    Status ret = applyMidiTransform(xf, m);
+    ASSERT_EQ(ret, OK);
+
+    auto tempo = std::get_if<MetaEvent>(&m.tracks[0][0]);
+    ASSERT_NE(tempo, nullptr);
+    EXPECT_EQ(tempo->data, (std::vector<uint8_t>{ 0x03, 0xd0, 0x90 })); // 250000
+
+    auto on1 = std::get_if<NoteOnEvent>(&m.tracks[1][1]);
+    auto on9 = std::get_if<NoteOnEvent>(&m.tracks[1][2]);
+    auto on2 = std::get_if<NoteOnEvent>(&m.tracks[1][3]);
+    auto off2 = std::get_if<NoteOffEvent>(&m.tracks[1][6]);
+    ASSERT_NE(on1, nullptr);
+    ASSERT_NE(on9, nullptr);
+    ASSERT_NE(on2, nullptr);
+    ASSERT_NE(off2, nullptr);
+
+    EXPECT_EQ(on1->midiNote, 63);
+    EXPECT_EQ(on9->midiNote, 36); // drums
+    EXPECT_EQ(on2->midiNote, 127); // clamped
+    EXPECT_EQ(off2->midiNote, 127);
+}
+
+
+TEST_F(MidiTransformTest, MuteSoloRemap) {
+
+    auto src = transformTestFile();
+
+    midi_transform xf;
+
+    xf.solo_channels = (1 << 1) | (1 << 2);
+    xf.muted_channels = (1 << 2);
+    xf.channel_map[1] = 4;
+
+    midi_file out;
+
+    Status ret = applyMidiTransform(src, xf, out);
+    ASSERT_EQ(ret, OK);
+
+    //
+    // src is untouched
+    //
+    EXPECT_EQ(src.tracks[1].size(), 8u);
+
+    //
+    // only channel 1 is left, as channel 4, and the program change is kept
+    //
+    ASSERT_EQ(out.tracks[1].size(), 4u);
+
+    auto program = std::get_if<ProgramChangeEvent>(&out.tracks[1][0]);
+    auto on = std::get_if<NoteOnEvent>(&out.tracks[1][1]);
+    auto off = std::get_if<NoteOffEvent>(&out.tracks[1][2]);
+    auto end = std::get_if<MetaEvent>(&out.tracks[1][3]);
+    ASSERT_NE(program, nullptr);
+    ASSERT_NE(on, nullptr);
+    ASSERT_NE(off, nullptr);
+    ASSERT_NE(end, nullptr);
+
+    EXPECT_EQ(program->channel, 4);
+    EXPECT_EQ(on->channel, 4);
+    EXPECT_EQ(off->deltaTime, 192);
+
+    //
+    // total length is unchanged
+    //
+    EXPECT_EQ(end->deltaTime, 192);
+
+    //
+    // in place gives the same result
+    //
+    ret = applyMidiTransform(xf, src);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(midiBytes(src), midiBytes(out));
+}
+
+
+TEST_F(MidiTransformTest, Identity) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/Closing Time.tbt",
+        "data/The Arcane.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        midi_file m;
+
+        ret = convertToMidi(t, midi_convert_opts{}, m);
+        ASSERT_EQ(ret, OK);
+
+        midi_file out;
+
+        midi_transform xf;
+
+        xf.transpose = 5;
+
+        ret = applyMidiTransform(m, xf, out);
+        ASSERT_EQ(ret, OK);
+
+        //
+        // reused storage, back to the original
+        //
+        ret = applyMidiTransform(m, midi_transform{}, out);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(midiBytes(out), midiBytes(m)) << path;
+    }
+}
+
+
+TEST_F(MidiTransformTest, BadTransform) {
+
+    auto m = transformTestFile();
+
+    auto bytes = midiBytes(m);
+
+    //
+    // a NoteOff on channel 0x10 would export as a NoteOn on channel 0
+    //
+    midi_transform xf;
+
+    xf.channel_map[1] = 16;
+
+    Status ret = applyMidiTransform(xf, m);
+    EXPECT_EQ(ret, ERR);
+
+    midi_file out;
+
+    ret = applyMidiTransform(m, xf, out);
+    EXPECT_EQ(ret, ERR);
+
+    xf = {};
+
+    xf.tempo_scale = 0.0;
+
+    ret = applyMidiTransform(xf, m);
+    EXPECT_EQ(ret, ERR);
+
+    //
+    // m is unchanged
+    //
+    EXPECT_EQ(midiBytes(m), bytes);
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,162 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/note-export.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <algorithm> // for count
+#include <fstream>
+#include <iterator>
+#include <cstring>
+
+
+class NoteExportTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+TEST_F(NoteExportTest, Table) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/back.tbt",
+        "data/Closing Time.tbt",
+        "data/justice.tbt",
+        "data/The Arcane.tbt",
+        "data/Classical Madness!.tbt",
+        "data/[With Intent of Butchery] Decomposing Truth.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        note_table notes;
+
+        ret = buildNoteTable(t, notes);
+        ASSERT_EQ(ret, OK);
+
+        ASSERT_GT(notes.size(), 0u) << path;
+
+        for (size_t i = 0; i < notes.size(); i++) {
+
+            EXPECT_GE(notes.duration[i], 0) << path;
+
+            if (notes.fret[i] != 0xff) {
+                EXPECT_LT(notes.midi_pitch[i], 128) << path;
+            }
+
+            if (0 < i && notes.track[i] == notes.track[i - 1]) {
+                EXPECT_LE(notes.space[i - 1], notes.space[i]) << path;
+                EXPECT_LE(notes.tick[i - 1], notes.tick[i]) << path;
+                EXPECT_LE(notes.micros[i - 1], notes.micros[i]) << path;
+            }
+        }
+
+        std::vector<uint8_t> csv;
+
+        ret = exportNoteTableBytes(notes, NOTE_EXPORT_CSV, csv);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(static_cast<size_t>(std::count(csv.begin(), csv.end(), '\n')), notes.size() + 1) << path;
+
+        std::vector<uint8_t> col;
+
+        ret = exportNoteTableBytes(notes, NOTE_EXPORT_COLUMNAR, col);
+        ASSERT_EQ(ret, OK);
+
+        ASSERT_GE(col.size(), 20u);
+
+        EXPECT_EQ(std::memcmp(col.data(), "TBTN", 4), 0);
+
+        uint64_t rows = 0;
+        for (int i = 0; i < 8; i++) {
+            rows |= static_cast<uint64_t>(col[static_cast<size_t>(8 + i)]) << (8 * i);
+        }
+
+        EXPECT_EQ(rows, notes.size()) << path;
+    }
+}
+
+
+TEST_F(NoteExportTest, FileSameAsBytes) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Song Idea.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    note_table notes;
+
+    ret = buildNoteTable(t, notes);
+    ASSERT_EQ(ret, OK);
+
+    for (auto format : { NOTE_EXPORT_CSV, NOTE_EXPORT_COLUMNAR }) {
+
+        std::vector<uint8_t> bytes;
+
+        ret = exportNoteTableBytes(notes, format, bytes);
+        ASSERT_EQ(ret, OK);
+
+        ret = exportNoteTableFile(notes, format, "note-export-test.out");
+        ASSERT_EQ(ret, OK);
+
+        std::ifstream file("note-export-test.out", std::ios::binary);
+
+        std::vector<uint8_t> fileBytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+        EXPECT_EQ(fileBytes, bytes);
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,300 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/pack.h"
+
+#include "common/file.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <cstdio> // for remove
+
+
+class PackTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+
+const std::vector<std::string> PACK_NAMES{
+    "twinkle.tbt",
+    "twinkle.mid",
+    "back.tbt",
+    "Closing Time.tbt",
+    "Closing Time.mid",
+    "justice.tbt",
+    "The Arcane.tbt",
+};
+
+
+std::vector<tbt_pack_input> packInputs() {
+
+    std::vector<tbt_pack_input> inputs;
+
+    for (const auto &name : PACK_NAMES) {
+
+        std::vector<uint8_t> data;
+
+        Status ret = openFile(("data/" + name).c_str(), data);
+        EXPECT_EQ(ret, OK);
+
+        inputs.push_back({ name, (name.ends_with(".mid") ? PACK_MIDI : PACK_TBT), data });
+    }
+
+    return inputs;
+}
+
+
+TEST_F(PackTest, roundTrip) {
+
+    auto inputs = packInputs();
+
+    std::vector<uint8_t> packBytes;
+
+    Status ret = writeTbtPackBytes(inputs, tbt_pack_write_opts{}, packBytes);
+    ASSERT_EQ(ret, OK);
+
+    tbt_pack pack;
+
+    ret = pack.openBytes(packBytes);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(pack.size(), inputs.size());
+    EXPECT_FALSE(pack.hasMetadata());
+
+    for (size_t i = 1; i < pack.size(); i++) {
+        EXPECT_LT(pack.entry(i - 1).name, pack.entry(i).name);
+    }
+
+    for (const auto &input : inputs) {
+
+        size_t i;
+
+        ASSERT_TRUE(pack.find(input.name, i));
+
+        auto e = pack.entry(i);
+
+        EXPECT_EQ(e.name, input.name);
+        EXPECT_EQ(e.kind, input.kind);
+        EXPECT_EQ(e.hash, tbtPackHash(input.data));
+        EXPECT_EQ(std::vector<uint8_t>(e.data.begin(), e.data.end()), input.data);
+
+        size_t j;
+
+        ASSERT_TRUE(pack.findHash(e.hash, j));
+        EXPECT_EQ(pack.entry(j).hash, e.hash);
+    }
+
+    size_t i;
+
+    EXPECT_FALSE(pack.find("does-not-exist.tbt", i));
+    EXPECT_FALSE(pack.find("", i));
+}
+
+
+TEST_F(PackTest, parseEntries) {
+
+    std::vector<uint8_t> packBytes;
+
+    Status ret = writeTbtPackBytes(packInputs(), tbt_pack_write_opts{}, packBytes);
+    ASSERT_EQ(ret, OK);
+
+    const char *path = "pack-test.tbtpack";
+
+    ret = saveFile(path, packBytes);
+    ASSERT_EQ(ret, OK);
+
+    {
+        tbt_pack pack;
+
+        ret = pack.open(path);
+        ASSERT_EQ(ret, OK);
+
+        size_t i;
+
+        ASSERT_TRUE(pack.find("Closing Time.tbt", i));
+
+        tbt_file fromPack;
+
+        ret = parseTbtPackEntry(pack, i, tbt_parse_opts{}, fromPack);
+        ASSERT_EQ(ret, OK);
+
+        tbt_file fromFile;
+
+        ret = parseTbtFile("data/Closing Time.tbt", fromFile);
+        ASSERT_EQ(ret, OK);
+
+        midi_file expected;
+
+        ret = convertToMidi(fromFile, midi_convert_opts{}, expected);
+        ASSERT_EQ(ret, OK);
+
+        midi_file actual;
+
+        ret = convertToMidi(fromPack, midi_convert_opts{}, actual);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(actual.tracks, expected.tracks);
+
+        ASSERT_TRUE(pack.find("Closing Time.mid", i));
+
+        midi_file midiFromPack;
+
+        ret = parseMidiPackEntry(pack, i, midiFromPack);
+        ASSERT_EQ(ret, OK);
+
+        midi_file midiFromFile;
+
+        ret = parseMidiFile("data/Closing Time.mid", midiFromFile);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(midiFromPack.tracks, midiFromFile.tracks);
+
+        //
+        // wrong kind
+        //
+        ASSERT_TRUE(pack.find("twinkle.tbt", i));
+
+        ret = parseMidiPackEntry(pack, i, midiFromPack);
+        EXPECT_EQ(ret, ERR);
+    }
+
+    std::remove(path);
+}
+
+
+TEST_F(PackTest, metadata) {
+
+    tbt_pack_write_opts opts;
+    opts.include_metadata = true;
+
+    std::vector<uint8_t> packBytes;
+
+    Status ret = writeTbtPackBytes(packInputs(), opts, packBytes);
+    ASSERT_EQ(ret, OK);
+
+    tbt_pack pack;
+
+    ret = pack.openBytes(packBytes);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_TRUE(pack.hasMetadata());
+
+    size_t i;
+
+    ASSERT_TRUE(pack.find("twinkle.tbt", i));
+
+    tbt_file t;
+
+    ret = parseTbtFile("data/twinkle.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_file m;
+
+    ret = convertToMidi(t, midi_convert_opts{}, m);
+    ASSERT_EQ(ret, OK);
+
+    auto md = pack.metadata(i);
+
+    EXPECT_EQ(md.versionNumber, tbtFileVersionNumber(t));
+    EXPECT_EQ(md.durationMicros, static_cast<uint64_t>(midiFileTimes(m).lastEndOfTrackMicros));
+    EXPECT_GT(md.trackCount, 0);
+
+    ASSERT_TRUE(pack.find("twinkle.mid", i));
+
+    md = pack.metadata(i);
+
+    EXPECT_EQ(md.versionNumber, 0);
+    EXPECT_GT(md.durationMicros, 0u);
+}
+
+
+TEST_F(PackTest, duplicateNames) {
+
+    auto inputs = packInputs();
+
+    inputs.push_back(inputs[0]);
+
+    std::vector<uint8_t> packBytes;
+
+    Status ret = writeTbtPackBytes(inputs, tbt_pack_write_opts{}, packBytes);
+    EXPECT_EQ(ret, ERR);
+}
+
+
+TEST_F(PackTest, corrupted) {
+
+    std::vector<uint8_t> packBytes;
+
+    Status ret = writeTbtPackBytes(packInputs(), tbt_pack_write_opts{}, packBytes);
+    ASSERT_EQ(ret, OK);
+
+    {
+        tbt_pack pack;
+
+        auto truncated = packBytes;
+        truncated.resize(truncated.size() / 2);
+
+        ret = pack.openBytes(truncated);
+        EXPECT_EQ(ret, ERR);
+    }
+
+    {
+        tbt_pack pack;
+
+        auto badMagic = packBytes;
+        badMagic[0] = 'X';
+
+        ret = pack.openBytes(badMagic);
+        EXPECT_EQ(ret, ERR);
+    }
+
+    {
+        tbt_pack pack;
+
+        //
+        // point the name index past the end
+        //
+        auto badIndex = packBytes;
+        badIndex[23] = 0xff;
+
+        ret = pack.openBytes(badIndex);
+        EXPECT_EQ(ret, ERR);
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,369 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/playback.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <algorithm> // for sort, count_if
+#include <chrono>
+#include <thread>
+#include <variant> // for holds_alternative
+
+
+class PlaybackTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+//
+// 1 tick = 1 ms
+//
+// 20 notes, one every 20 ms, and a ControlChange at 200 ms
+//
+midi_file makeTestSong() {
+
+    midi_file m;
+
+    m.header = midi_header{1, 1, 100};
+
+    std::vector<midi_track_event> track;
+
+    //
+    // 100000 micros per beat
+    //
+    track.push_back(MetaEvent{0, 0x51, {0x01, 0x86, 0xa0}});
+
+    track.push_back(ProgramChangeEvent{0, 0, 25});
+
+    for (int i = 0; i < 20; i++) {
+
+        if (i == 10) {
+            track.push_back(NoteOnEvent{10, 0, 60, 100});
+            track.push_back(ControlChangeEvent{0, 0, 0x07, 90});
+        } else {
+            track.push_back(NoteOnEvent{(i == 0) ? 0 : 10, 0, 60, 100});
+        }
+
+        track.push_back(NoteOffEvent{10, 0, 60, 0});
+    }
+
+    track.push_back(MetaEvent{0, 0x2f, {}});
+
+    m.tracks.push_back(track);
+
+    return m;
+}
+
+
+TEST_F(PlaybackTest, TimedEvents) {
+
+    auto m = makeTestSong();
+
+    std::vector<midi_timed_event> events;
+
+    Status ret = midiTimedEvents(m, events);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(events.size(), 2 + 40 + 1 + 1u);
+
+    EXPECT_EQ(events[2].micros, 0);
+    EXPECT_EQ(events[3].micros, 10000);
+    EXPECT_EQ(events[4].micros, 20000);
+    EXPECT_EQ(events.back().micros, 390000);
+}
+
+
+TEST_F(PlaybackTest, ProgramMatchesFile) {
+
+    //
+    // has repeats
+    //
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Song Idea.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_convert_opts opts;
+
+    midi_file m;
+
+    ret = convertToMidi(t, opts, m);
+    ASSERT_EQ(ret, OK);
+
+    midi_program p;
+
+    ret = convertToMidiProgram(t, opts, p);
+    ASSERT_EQ(ret, OK);
+
+    recording_sink sink1;
+    recording_sink sink2;
+
+    playback_engine engine1(m, sink1, {});
+    playback_engine engine2(p, sink2, {});
+
+    //
+    // the lazily expanded program has the same timing as the file
+    //
+    EXPECT_EQ(engine1.durationMicros(), engine2.durationMicros());
+
+    std::vector<midi_timed_event> events;
+
+    ret = midiTimedEvents(m, events);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(events.back().micros, engine1.durationMicros());
+}
+
+
+TEST_F(PlaybackTest, Timing) {
+
+    auto m = makeTestSong();
+
+    recording_sink sink;
+
+    playback_opts opts;
+
+    opts.realtime_priority = false;
+
+    playback_engine engine(m, sink, opts);
+
+    EXPECT_EQ(engine.durationMicros(), 390000);
+
+    Status ret = engine.start();
+    ASSERT_EQ(ret, OK);
+
+    engine.wait();
+
+    EXPECT_TRUE(engine.finished());
+
+    ASSERT_EQ(sink.records.size(), 44u);
+
+    std::vector<int64_t> lateness;
+
+    for (size_t i = 0; i < sink.records.size(); i++) {
+
+        const auto &r = sink.records[i];
+
+        if (i > 0) {
+            EXPECT_LE(sink.records[i - 1].timed.micros, r.timed.micros);
+        }
+
+        //
+        // never early
+        //
+        EXPECT_GE(r.dispatched, r.deadline);
+
+        lateness.push_back(std::chrono::duration_cast<std::chrono::microseconds>(r.dispatched - r.deadline).count());
+    }
+
+    std::sort(lateness.begin(), lateness.end());
+
+    //
+    // reported in the XML output, not asserted on
+    //
+    RecordProperty("lateness_median_us", static_cast<int>(lateness[lateness.size() / 2]));
+    RecordProperty("lateness_max_us", static_cast<int>(lateness.back()));
+
+    //
+    // loose bound, to not be flaky on loaded machines
+    //
+    EXPECT_LT(lateness.back(), 50000);
+}
+
+
+TEST_F(PlaybackTest, Lookahead) {
+
+    auto m = makeTestSong();
+
+    recording_sink sink;
+
+    playback_opts opts;
+
+    opts.realtime_priority = false;
+    opts.lookahead_micros = 5000;
+
+    playback_engine engine(m, sink, opts);
+
+    Status ret = engine.start();
+    ASSERT_EQ(ret, OK);
+
+    engine.wait();
+
+    ASSERT_EQ(sink.records.size(), 44u);
+
+    for (const auto &r : sink.records) {
+        EXPECT_GE(r.dispatched, r.deadline - std::chrono::microseconds(5000));
+    }
+}
+
+
+TEST_F(PlaybackTest, Seek) {
+
+    auto m = makeTestSong();
+
+    recording_sink sink;
+
+    playback_opts opts;
+
+    opts.realtime_priority = false;
+
+    playback_engine engine(m, sink, opts);
+
+    engine.seek(300000);
+
+    EXPECT_EQ(engine.positionMicros(), 300000);
+
+    Status ret = engine.start();
+    ASSERT_EQ(ret, OK);
+
+    engine.wait();
+
+    //
+    // ProgramChange and ControlChange are chased, and then everything from 300 ms
+    //
+    ASSERT_GE(sink.records.size(), 2u);
+
+    EXPECT_TRUE(std::holds_alternative<ProgramChangeEvent>(*sink.records[0].timed.event));
+    EXPECT_TRUE(std::holds_alternative<ControlChangeEvent>(*sink.records[1].timed.event));
+
+    for (size_t i = 2; i < sink.records.size(); i++) {
+        EXPECT_GE(sink.records[i].timed.micros, 300000);
+    }
+
+    EXPECT_EQ(sink.records.size(), 2 + 10 + 1u);
+}
+
+
+TEST_F(PlaybackTest, PauseResume) {
+
+    auto m = makeTestSong();
+
+    recording_sink sink;
+
+    playback_opts opts;
+
+    opts.realtime_priority = false;
+
+    playback_engine engine(m, sink, opts);
+
+    Status ret = engine.start();
+    ASSERT_EQ(ret, OK);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    engine.pause();
+
+    EXPECT_TRUE(engine.paused());
+
+    auto pausedAt = engine.positionMicros();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+
+    EXPECT_EQ(engine.positionMicros(), pausedAt);
+
+    engine.resume();
+
+    engine.wait();
+
+    ASSERT_EQ(sink.records.size(), 44u);
+
+    EXPECT_GE(sink.allNotesOffCount, 1u);
+
+    //
+    // every event is still played in order, with a gap for the pause
+    //
+    int64_t maxGap = 0;
+
+    for (size_t i = 1; i < sink.records.size(); i++) {
+        maxGap = std::max<int64_t>(maxGap, std::chrono::duration_cast<std::chrono::microseconds>(sink.records[i].dispatched - sink.records[i - 1].dispatched).count());
+    }
+
+    EXPECT_GE(maxGap, 140000);
+}
+
+
+TEST_F(PlaybackTest, Loop) {
+
+    auto m = makeTestSong();
+
+    recording_sink sink;
+
+    playback_opts opts;
+
+    opts.realtime_priority = false;
+    opts.loop = true;
+    opts.loop_end_micros = 100000;
+
+    playback_engine engine(m, sink, opts);
+
+    Status ret = engine.start();
+    ASSERT_EQ(ret, OK);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+
+    EXPECT_FALSE(engine.finished());
+
+    engine.stop();
+
+    for (const auto &r : sink.records) {
+        EXPECT_LT(r.timed.micros, 100000);
+    }
+
+    //
+    // the first note has played at least 3 times
+    //
+    auto firstNoteCount = std::count_if(sink.records.begin(), sink.records.end(), [](const recording_sink::record &r) {
+        return r.timed.micros == 0 && std::holds_alternative<NoteOnEvent>(*r.timed.event);
+    });
+
+    EXPECT_GE(firstNoteCount, 3);
+
+    EXPECT_GE(sink.allNotesOffCount, 3u);
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,232 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/preview.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cmath> // for fabs
+#include <cstring> // for memcmp
+
+
+class PreviewTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+TEST_F(PreviewTest, Twinkle) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/twinkle.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_convert_opts opts;
+
+    midi_file m;
+
+    ret = convertToMidi(t, opts, m);
+    ASSERT_EQ(ret, OK);
+
+    preview_render_opts previewOpts;
+
+    pcm_buffer pcm;
+
+    auto start = std::chrono::steady_clock::now();
+
+    ret = renderPreview(m, previewOpts, pcm);
+    ASSERT_EQ(ret, OK);
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ASSERT_EQ(pcm.sampleRate, 44100u);
+
+    //
+    // last note off is at 24 seconds, then voices ring out
+    //
+    auto frames = pcm.samples.size() / 2;
+
+    EXPECT_GE(frames, 24 * 44100u);
+    EXPECT_LE(frames, 26 * 44100u + 64);
+
+    float peak = 0;
+
+    for (float s : pcm.samples) {
+        peak = std::max(peak, std::fabs(s));
+    }
+
+    EXPECT_GT(peak, 0.01f);
+    EXPECT_LE(peak, 1.0f);
+
+    //
+    // reported in the XML output, not asserted on
+    //
+    RecordProperty("render_ms", static_cast<int>(elapsed * 1000));
+    RecordProperty("simd", previewSimdAvailable() ? 1 : 0);
+}
+
+
+TEST_F(PreviewTest, MaxSeconds) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/twinkle.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_convert_opts opts;
+
+    midi_file m;
+
+    ret = convertToMidi(t, opts, m);
+    ASSERT_EQ(ret, OK);
+
+    preview_render_opts previewOpts;
+
+    previewOpts.sample_rate = 22050;
+    previewOpts.max_seconds = 5.0;
+
+    pcm_buffer pcm;
+
+    ret = renderPreview(m, previewOpts, pcm);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(pcm.samples.size(), 2 * 5 * 22050u);
+}
+
+
+TEST_F(PreviewTest, SimdMatchesScalar) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/black.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_convert_opts opts;
+
+    midi_file m;
+
+    ret = convertToMidi(t, opts, m);
+    ASSERT_EQ(ret, OK);
+
+    preview_render_opts previewOpts;
+
+    previewOpts.max_seconds = 10.0;
+
+    pcm_buffer simd;
+
+    ret = renderPreview(m, previewOpts, simd);
+    ASSERT_EQ(ret, OK);
+
+    previewOpts.simd = false;
+
+    pcm_buffer scalar;
+
+    ret = renderPreview(m, previewOpts, scalar);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(simd.samples.size(), scalar.samples.size());
+
+    float maxDiff = 0;
+
+    for (size_t i = 0; i < simd.samples.size(); i++) {
+        maxDiff = std::max(maxDiff, std::fabs(simd.samples[i] - scalar.samples[i]));
+    }
+
+    //
+    // envelopes are stepped differently, so allow for rounding
+    //
+    EXPECT_LT(maxDiff, 1.0e-3f);
+}
+
+
+TEST_F(PreviewTest, WavHeader) {
+
+    pcm_buffer pcm;
+
+    pcm.sampleRate = 8000;
+    pcm.samples = { 0.0f, 1.0f, -1.0f, 0.5f };
+
+    std::vector<uint8_t> wav;
+
+    Status ret = exportWavBytes(pcm, WAV_PCM16, wav);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(wav.size(), 44u + 4 * 2);
+
+    EXPECT_EQ(std::memcmp(wav.data(), "RIFF", 4), 0);
+    EXPECT_EQ(std::memcmp(wav.data() + 8, "WAVEfmt ", 8), 0);
+    EXPECT_EQ(std::memcmp(wav.data() + 36, "data", 4), 0);
+
+    //
+    // 1.0 -> 32767, -1.0 -> -32767
+    //
+    EXPECT_EQ(wav[46], 0xff);
+    EXPECT_EQ(wav[47], 0x7f);
+    EXPECT_EQ(wav[48], 0x01);
+    EXPECT_EQ(wav[49], 0x80);
+
+    ret = exportWavBytes(pcm, WAV_FLOAT32, wav);
+    ASSERT_EQ(ret, OK);
+
+    //
+    // extended fmt chunk and fact chunk
+    //
+    ASSERT_EQ(wav.size(), 58u + 4 * 4);
+
+    EXPECT_EQ(wav[20], 3); // WAVE_FORMAT_IEEE_FLOAT
+    EXPECT_EQ(std::memcmp(wav.data() + 38, "fact", 4), 0);
+    EXPECT_EQ(std::memcmp(wav.data() + 50, "data", 4), 0);
+
+    float f;
+
+    std::memcpy(&f, wav.data() + 58 + 4, 4);
+
+    EXPECT_EQ(f, 1.0f);
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,190 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/song-context.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+
+class SongContextTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+TEST_F(SongContextTest, SameAsSeparateCalls) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/back.tbt",
+        "data/Closing Time.tbt",
+        "data/justice.tbt",
+        "data/The Arcane.tbt",
+        "data/Classical Madness!.tbt",
+        "data/[With Intent of Butchery] Decomposing Truth.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        song_outputs_opts opts;
+
+        song_outputs out;
+
+        ret = renderSongOutputs(t, opts, out);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(out.info, tbtFileInfo(t)) << path;
+
+        EXPECT_EQ(out.comment, tbtFileComment(t)) << path;
+
+        EXPECT_EQ(out.tablature, tbtFileTablature(t)) << path;
+
+        midi_file m;
+
+        ret = convertToMidi(t, opts.midi_opts, m);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> bytes1;
+
+        ret = exportMidiBytes(m, bytes1);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> bytes2;
+
+        ret = exportMidiBytes(out.midi, bytes2);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(bytes1, bytes2) << path;
+    }
+}
+
+
+TEST_F(SongContextTest, Reuse) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Song Idea.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_diagnostics diagnostics;
+
+    tbt_song_context ctx;
+
+    ret = analyzeTbtFile(t, tbt_analyze_opts{ &diagnostics }, ctx);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(&ctx.file(), &t);
+
+    EXPECT_EQ(ctx.versionNumber(), tbtFileVersionNumber(t));
+
+    //
+    // converting from the same context more than once gives the same bytes,
+    // so repeat structures in the context are not consumed
+    //
+    midi_convert_opts opts;
+
+    std::vector<uint8_t> bytes[2];
+
+    for (auto &b : bytes) {
+
+        midi_file m;
+
+        ret = convertToMidi(ctx, opts, m);
+        ASSERT_EQ(ret, OK);
+
+        ret = exportMidiBytes(m, b);
+        ASSERT_EQ(ret, OK);
+    }
+
+    EXPECT_EQ(bytes[0], bytes[1]);
+
+    midi_program p;
+
+    ret = convertToMidiProgram(ctx, opts, p);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> programBytes;
+
+    ret = exportMidiProgramBytes(p, programBytes);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(programBytes, bytes[0]);
+
+    //
+    // track selection still applies
+    //
+    opts.selected_tracks = { false, true };
+
+    midi_file m;
+
+    ret = convertToMidi(ctx, opts, m);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(m.tracks.size(), 2u);
+
+    tbt_tablature_opts tabOpts;
+
+    tabOpts.selected_tracks = { false, true };
+
+    EXPECT_EQ(tbtFileTablature(ctx, tabOpts), tbtFileTablature(t, tabOpts));
+
+    //
+    // moving keeps the analysis
+    //
+    tbt_song_context moved = std::move(ctx);
+
+    EXPECT_EQ(&moved.file(), &t);
+}
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,277 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/song-model.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+
+class SongModelTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+//
+// the incremental conversion must give the same bytes as a full conversion of the edited file
+//
+void expectSameAsFullConversion(const tbt_song_model &model) {
+
+    midi_file m;
+
+    Status ret = convertToMidi(model.file(), midi_convert_opts{}, m);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> bytes1;
+
+    ret = exportMidiBytes(m, bytes1);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> bytes2;
+
+    ret = exportMidiBytes(model.midi(), bytes2);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(bytes1, bytes2);
+}
+
+
+std::vector<uint8_t> trackBytes(const tbt_song_model &model, size_t track) {
+
+    midi_file m{ model.midi().header, { model.midi().tracks[track] } };
+
+    m.header.trackCount = 1;
+
+    std::vector<uint8_t> bytes;
+
+    Status ret = exportMidiBytes(m, bytes);
+    EXPECT_EQ(ret, OK);
+
+    return bytes;
+}
+
+
+TEST_F(SongModelTest, Edits) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Song Idea.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_song_model model;
+
+    ret = model.open(std::move(t), midi_convert_opts{});
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    //
+    // a note only dirties its own track
+    //
+    ret = model.setNote(1, 5, 2, 0x80 + 3);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_FALSE(model.dirty().structure);
+    EXPECT_FALSE(model.dirty().tempo);
+    EXPECT_FALSE(model.dirty().tracks[0]);
+    EXPECT_TRUE(model.dirty().tracks[1]);
+    EXPECT_EQ(model.dirty().ranges[1].begin, 5);
+    EXPECT_EQ(model.dirty().ranges[1].end, 6);
+
+    auto tempoTrack = trackBytes(model, 0);
+
+    auto track0 = trackBytes(model, 1);
+
+    auto track1 = trackBytes(model, 2);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_FALSE(model.dirty().tracks[1]);
+
+    EXPECT_EQ(trackBytes(model, 0), tempoTrack);
+    EXPECT_EQ(trackBytes(model, 1), track0);
+    EXPECT_NE(trackBytes(model, 2), track1);
+
+    expectSameAsFullConversion(model);
+
+    //
+    // tempo only dirties the tempo track
+    //
+    ret = model.setTrackEffect(0, 32, TE_TEMPO, 90);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_TRUE(model.dirty().tempo);
+    EXPECT_FALSE(model.dirty().tracks[0]);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_NE(trackBytes(model, 0), tempoTrack);
+
+    expectSameAsFullConversion(model);
+
+    ret = model.setTrackEffect(0, 40, TE_VOLUME, 64);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_TRUE(model.dirty().tracks[0]);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    ret = model.removeTrackEffect(0, 32, TE_TEMPO);
+    ASSERT_EQ(ret, OK);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    //
+    // structure changes dirty everything
+    //
+    const auto &t71 = std::get<tbt_file71>(model.file());
+
+    uint16_t newBarLine = 1;
+
+    while (t71.body.barLinesMap.find(newBarLine) != t71.body.barLinesMap.end()) {
+        newBarLine++;
+    }
+
+    ret = model.setBarLine(newBarLine, { 0, 0 });
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_TRUE(model.dirty().structure);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    ret = model.removeBarLine(newBarLine);
+    ASSERT_EQ(ret, OK);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    auto spaceCount = t71.body.barLinesSpaceCount;
+
+    ret = model.insertSpaces(16, 4);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(t71.body.barLinesSpaceCount, spaceCount + 4);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    ret = model.removeSpaces(16, 4);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(t71.body.barLinesSpaceCount, spaceCount);
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+
+    //
+    // removing spaces that start a bar keeps the bar
+    //
+    ret = model.removeSpaces(0, 2);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(t71.body.barLinesMap.begin()->first, 0);
+
+    EXPECT_EQ(t71.header.barCount, t71.body.barLinesMap.size());
+
+    ret = model.convert();
+    ASSERT_EQ(ret, OK);
+
+    expectSameAsFullConversion(model);
+}
+
+
+TEST_F(SongModelTest, BadEdits) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/Song Idea.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_song_model model;
+
+    ret = model.open(std::move(t), midi_convert_opts{});
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_NE(model.setNote(100, 0, 0, 0x80), OK);
+
+    EXPECT_NE(model.setNote(0, 0, 0, 0x13), OK);
+
+    EXPECT_NE(model.removeBarLine(0), OK);
+
+    EXPECT_NE(model.removeSpaces(0, 0xffff), OK);
+
+    EXPECT_FALSE(model.dirty().structure);
+
+    //
+    // only 0x72 can be edited
+    //
+    ret = parseTbtFile("data/back.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_song_model old;
+
+    EXPECT_NE(old.open(std::move(t), midi_convert_opts{}), OK);
+}
+
+
+
+
+
+
+
+
+
+
+
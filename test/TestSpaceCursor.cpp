@@ -0,0 +1,111 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+
+#include "space-cursor.inl"
+
+
+class SpaceCursorTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+TEST_F(SpaceCursorTest, forward) {
+
+    std::vector<tbt_track_effect_change> v{
+        { 0, TE_TEMPO, 120 },
+        { 2, TE_INSTRUMENT, 1 },
+        { 2, TE_VOLUME, 2 },
+        { 5, TE_PAN, 3 },
+    };
+
+    space_cursor c(v);
+
+    EXPECT_EQ(c.at(0).size(), 1);
+    EXPECT_EQ(c.at(1).size(), 0);
+
+    auto changes = c.at(2);
+    ASSERT_EQ(changes.size(), 2);
+    EXPECT_EQ(changes[0].effect, TE_INSTRUMENT);
+    EXPECT_EQ(changes[1].effect, TE_VOLUME);
+
+    EXPECT_EQ(c.at(3).size(), 0);
+    EXPECT_EQ(c.at(4).size(), 0);
+
+    changes = c.at(5);
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_EQ(changes[0].value, 3);
+
+    EXPECT_EQ(c.at(6).size(), 0);
+}
+
+TEST_F(SpaceCursorTest, backward) {
+
+    std::vector<tbt_track_effect_change> v{
+        { 0, TE_TEMPO, 120 },
+        { 2, TE_INSTRUMENT, 1 },
+        { 2, TE_VOLUME, 2 },
+        { 5, TE_PAN, 3 },
+    };
+
+    space_cursor c(v);
+
+    EXPECT_EQ(c.at(5).size(), 1);
+
+    //
+    // jump back to a repeat open
+    //
+    EXPECT_EQ(c.at(2).size(), 2);
+    EXPECT_EQ(c.at(2).size(), 2);
+    EXPECT_EQ(c.at(0).size(), 1);
+    EXPECT_EQ(c.at(5).size(), 1);
+}
+
+TEST_F(SpaceCursorTest, empty) {
+
+    std::vector<tbt_track_effect_change> v;
+
+    space_cursor c(v);
+
+    EXPECT_EQ(c.at(0).size(), 0);
+    EXPECT_EQ(c.at(100).size(), 0);
+    EXPECT_EQ(c.at(0).size(), 0);
+}
+
+
+
+
+
+
+
+
+
+
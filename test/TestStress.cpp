@@ -0,0 +1,240 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib> // for getenv, strtoul
+
+
+//
+// Parse, convert, export, and print every test file concurrently from many threads,
+// and check that the results are identical to the serial results
+//
+// Build with -DTBTPARSER_ENABLE_TSAN=ON to run under ThreadSanitizer
+//
+// Set TBTPARSER_STRESS_THREADS to change the number of threads (default: 8)
+//
+
+
+const std::vector<std::string> TBT_FILES{
+    "data/Classical Madness!.tbt",
+    "data/Closing Time.tbt",
+    "data/Song Idea.tbt",
+    "data/The Arcane.tbt",
+    "data/[With Intent of Butchery] Decomposing Truth.tbt",
+    "data/back.tbt",
+    "data/black.tbt",
+    "data/justice-no-tempo-changes.tbt",
+    "data/justice.tbt",
+    "data/twinkle.tbt",
+};
+
+
+struct file_results {
+    std::vector<uint8_t> midiBytes;
+    std::string tablature;
+    std::string info;
+    std::string midiInfo;
+};
+
+
+Status processFile(const std::string &path, file_results &out) {
+
+    tbt_file t;
+
+    Status ret = parseTbtFile(path.c_str(), t);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    //
+    // use a sink to keep conversion from logging
+    //
+    tbt_diagnostics diagnostics;
+
+    midi_convert_opts opts;
+    opts.diagnostics = &diagnostics;
+
+    midi_file m;
+
+    ret = convertToMidi(t, opts, m);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    ret = exportMidiBytes(m, out.midiBytes);
+
+    if (ret != OK) {
+        return ret;
+    }
+
+    out.tablature = tbtFileTablature(t);
+
+    out.info = tbtFileInfo(t);
+
+    out.midiInfo = midiFileInfo(m);
+
+    return OK;
+}
+
+
+class StressTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+
+TEST_F(StressTest, allFilesConcurrently) {
+
+    size_t threadCount = 8;
+
+    if (const char *env = std::getenv("TBTPARSER_STRESS_THREADS")) {
+        threadCount = std::strtoul(env, nullptr, 10);
+    }
+
+    ASSERT_GT(threadCount, 0);
+
+    std::vector<file_results> serial(TBT_FILES.size());
+
+    for (size_t i = 0; i < TBT_FILES.size(); i++) {
+        Status ret = processFile(TBT_FILES[i], serial[i]);
+        ASSERT_EQ(ret, OK) << TBT_FILES[i];
+    }
+
+    //
+    // results[thread][file]
+    //
+    std::vector<std::vector<file_results> > results(threadCount, std::vector<file_results>(TBT_FILES.size()));
+
+    std::vector<std::vector<Status> > statuses(threadCount, std::vector<Status>(TBT_FILES.size(), ERR));
+
+    std::vector<std::thread> threads;
+
+    for (size_t th = 0; th < threadCount; th++) {
+
+        threads.emplace_back([&, th]() {
+
+            //
+            // start each thread at a different file, so that different files overlap
+            //
+            for (size_t j = 0; j < TBT_FILES.size(); j++) {
+
+                auto i = (th + j) % TBT_FILES.size();
+
+                statuses[th][i] = processFile(TBT_FILES[i], results[th][i]);
+            }
+        });
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (size_t th = 0; th < threadCount; th++) {
+        for (size_t i = 0; i < TBT_FILES.size(); i++) {
+
+            ASSERT_EQ(statuses[th][i], OK) << TBT_FILES[i];
+
+            EXPECT_EQ(results[th][i].midiBytes, serial[i].midiBytes) << TBT_FILES[i];
+            EXPECT_EQ(results[th][i].tablature, serial[i].tablature) << TBT_FILES[i];
+            EXPECT_EQ(results[th][i].info, serial[i].info) << TBT_FILES[i];
+            EXPECT_EQ(results[th][i].midiInfo, serial[i].midiInfo) << TBT_FILES[i];
+        }
+    }
+}
+
+
+TEST_F(StressTest, sharedTbtFile) {
+
+    //
+    // many threads converting the same parsed file
+    //
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/black.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    midi_convert_opts opts;
+
+    midi_file serialMidi;
+
+    ret = convertToMidi(t, opts, serialMidi);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> serial;
+
+    ret = exportMidiBytes(serialMidi, serial);
+    ASSERT_EQ(ret, OK);
+
+    const size_t threadCount = 8;
+
+    std::vector<std::vector<uint8_t> > results(threadCount);
+
+    std::vector<std::thread> threads;
+
+    for (size_t th = 0; th < threadCount; th++) {
+
+        threads.emplace_back([&, th]() {
+
+            tbt_diagnostics diagnostics;
+
+            midi_convert_opts threadOpts;
+            threadOpts.diagnostics = &diagnostics;
+
+            midi_file m;
+
+            if (convertToMidi(t, threadOpts, m) != OK) {
+                return;
+            }
+
+            exportMidiBytes(m, results[th]);
+        });
+    }
+
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    for (const auto &r : results) {
+        EXPECT_EQ(r, serial);
+    }
+}
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,106 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser.h"
+#include "tbt-parser/tbt.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <array>
+
+#undef NDEBUG
+
+#include "common/assert.h"
+
+
+#include "string-lanes.inl"
+
+
+class StringLanesTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+TEST_F(StringLanesTest, everyByte) {
+
+    //
+    // put each byte value in each lane, next to other values
+    //
+    for (int v = 0; v < 256; v++) {
+
+        for (uint8_t lane = 0; lane < 8; lane++) {
+
+            std::array<uint8_t, 8> bytes{ 0, MUTED, 0x80, STOPPED, 0xff, 0x7f, 0x01, 0x11 };
+
+            bytes[lane] = static_cast<uint8_t>(v);
+
+            auto x = loadLanes<8>(bytes.data());
+
+            uint8_t nonzero = 0;
+            uint8_t muted = 0;
+            uint8_t high = 0;
+            for (uint8_t i = 0; i < 8; i++) {
+                EXPECT_EQ(laneAt(x, i), bytes[i]);
+                nonzero |= static_cast<uint8_t>((bytes[i] != 0) << i);
+                muted |= static_cast<uint8_t>((bytes[i] == MUTED) << i);
+                high |= static_cast<uint8_t>((bytes[i] >= 0x80) << i);
+            }
+
+            EXPECT_EQ(laneBits(nonzeroLanes(x)), nonzero);
+            EXPECT_EQ(laneBits(equalLanes(x, MUTED)), muted);
+            EXPECT_EQ(laneBits(highLanes(x)), high);
+
+            EXPECT_EQ(x & laneMask(nonzeroLanes(x)), x);
+            EXPECT_EQ(x & ~laneMask(nonzeroLanes(x)), 0u);
+        }
+    }
+}
+
+TEST_F(StringLanesTest, strings) {
+
+    EXPECT_EQ(laneBits(stringLanesOf(0)), 0x00);
+    EXPECT_EQ(laneBits(stringLanesOf(4)), 0x0f);
+    EXPECT_EQ(laneBits(stringLanesOf(6)), 0x3f);
+    EXPECT_EQ(laneBits(stringLanesOf(8)), 0xff);
+
+    uint8_t bits = 0b10100100;
+
+    EXPECT_EQ(popString(bits), 2);
+    EXPECT_EQ(popString(bits), 5);
+    EXPECT_EQ(popString(bits), 7);
+    EXPECT_EQ(bits, 0);
+}
+
+
+
+
+
+
+
+
+
+
+
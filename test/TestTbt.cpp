@@ -179,3 +179,170 @@ TEST_F(TbtTest, twinkle1) {
 
 
 
+
+TEST_F(TbtTest, SelectedTracks) {
+
+    tbt_file t1;
+
+    Status ret = parseTbtFile("data/black.tbt", t1);
+    ASSERT_EQ(ret, OK);
+
+    tbt_parse_opts parseOpts;
+
+    ret = parseTrackSelection("2", parseOpts.selected_tracks);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(parseOpts.selected_tracks, (std::vector<bool>{false, false, true}));
+
+    tbt_file t2;
+
+    ret = parseTbtFile("data/black.tbt", parseOpts, t2);
+    ASSERT_EQ(ret, OK);
+
+    const auto &full = std::get<tbt_file71>(t1);
+    const auto &selected = std::get<tbt_file71>(t2);
+
+    ASSERT_EQ(full.header.trackCount, selected.header.trackCount);
+
+    for (uint8_t track = 0; track < full.header.trackCount; track++) {
+
+        if (track == 2) {
+            EXPECT_EQ(selected.body.mapsList[track].notesMap, full.body.mapsList[track].notesMap);
+        } else {
+
+            //
+            // before 0x72, only the tempo changes of unselected tracks are kept
+            //
+            for (const auto &p : selected.body.mapsList[track].notesMap) {
+                EXPECT_TRUE(p.second[16] == 'T' || p.second[16] == 't');
+            }
+        }
+    }
+
+    //
+    // converting only track 2 gives the tempo track and track 2 of the full conversion
+    //
+    midi_convert_opts convertOpts;
+
+    convertOpts.selected_tracks = parseOpts.selected_tracks;
+
+    midi_file m1;
+
+    ret = convertToMidi(t1, {}, m1);
+    ASSERT_EQ(ret, OK);
+
+    midi_file m2;
+
+    ret = convertToMidi(t2, convertOpts, m2);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(m2.header.trackCount, 2);
+    ASSERT_EQ(m2.tracks.size(), 2u);
+
+    midi_file expected;
+
+    expected.header = m1.header;
+    expected.header.trackCount = 2;
+    expected.tracks = { m1.tracks[0], m1.tracks[3] };
+
+    std::vector<uint8_t> bytes1;
+
+    ret = exportMidiBytes(expected, bytes1);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> bytes2;
+
+    ret = exportMidiBytes(m2, bytes2);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(bytes1, bytes2);
+
+    //
+    // printing only track 2
+    //
+    tbt_tablature_opts tabOpts;
+
+    tabOpts.selected_tracks = parseOpts.selected_tracks;
+
+    auto tab1 = tbtFileTablature(t1);
+
+    auto tab2 = tbtFileTablature(t2, tabOpts);
+
+    EXPECT_FALSE(tab2.empty());
+    EXPECT_LT(tab2.size(), tab1.size());
+
+    //
+    // bad selections
+    //
+    std::vector<bool> bad;
+
+    EXPECT_NE(parseTrackSelection("", bad), OK);
+    EXPECT_NE(parseTrackSelection("1,", bad), OK);
+    EXPECT_NE(parseTrackSelection("1;2", bad), OK);
+    EXPECT_NE(parseTrackSelection("256", bad), OK);
+}
+
+
+TEST_F(TbtTest, SelectedTracksTempoChanges) {
+
+    //
+    // before 0x72, tempo changes are stored with the notes of every track
+    //
+    tbt_file t1;
+
+    Status ret = parseTbtFile("data/back.tbt", t1);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(tbtFileVersionNumber(t1), 0x6f);
+
+    tbt_parse_opts parseOpts;
+
+    ret = parseTrackSelection("0", parseOpts.selected_tracks);
+    ASSERT_EQ(ret, OK);
+
+    tbt_file t2;
+
+    ret = parseTbtFile("data/back.tbt", parseOpts, t2);
+    ASSERT_EQ(ret, OK);
+
+    midi_convert_opts convertOpts;
+
+    convertOpts.selected_tracks = parseOpts.selected_tracks;
+
+    midi_file m1;
+
+    ret = convertToMidi(t1, {}, m1);
+    ASSERT_EQ(ret, OK);
+
+    midi_file m2;
+
+    ret = convertToMidi(t2, convertOpts, m2);
+    ASSERT_EQ(ret, OK);
+
+    ASSERT_EQ(m2.tracks.size(), 2u);
+
+    //
+    // the tempo track is unchanged, and so is track 0
+    //
+    EXPECT_EQ(m2.tracks[0].size(), m1.tracks[0].size());
+
+    midi_file expected;
+
+    expected.header = m1.header;
+    expected.header.trackCount = 2;
+    expected.tracks = { m1.tracks[0], m1.tracks[1] };
+
+    std::vector<uint8_t> bytes1;
+
+    ret = exportMidiBytes(expected, bytes1);
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> bytes2;
+
+    ret = exportMidiBytes(m2, bytes2);
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_EQ(bytes1, bytes2);
+}
+
+
@@ -0,0 +1,269 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser.h"
+#include "tbt-parser/tbt-encode.h"
+#include "tbt-parser/tbt.h"
+
+#include "common/file.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <variant> // for get
+
+
+class TbtEncodeTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+    }
+
+    void TearDown() override {
+
+    }
+};
+
+
+//
+// the encoder is the inverse of the parser, down to the bytes
+//
+TEST_F(TbtEncodeTest, RoundTrip) {
+
+    const char *paths[] = {
+        "data/Classical Madness!.tbt",
+        "data/The Arcane.tbt",
+        "data/[With Intent of Butchery] Decomposing Truth.tbt",
+        "data/Song Idea.tbt",
+        "data/black.tbt",
+        "data/justice.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        std::vector<uint8_t> data;
+
+        Status ret = openFile(path, data);
+        ASSERT_EQ(ret, OK);
+
+        tbt_file t;
+
+        auto it = data.cbegin();
+
+        ret = parseTbtBytes(it, data.cend(), t);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> encoded;
+
+        ret = encodeTbtBytes(t, encoded);
+        ASSERT_EQ(ret, OK);
+
+        EXPECT_EQ(encoded, data) << path;
+    }
+}
+
+
+TEST_F(TbtEncodeTest, Upgrade) {
+
+    const char *paths[] = {
+        "data/twinkle.tbt",
+        "data/back.tbt",
+        "data/Closing Time.tbt",
+        "data/Classical Madness!.tbt",
+        "data/The Arcane.tbt",
+        "data/black.tbt",
+        "data/justice.tbt",
+    };
+
+    for (const char *path : paths) {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile(path, t);
+        ASSERT_EQ(ret, OK);
+
+        tbt_file upgraded;
+
+        ret = upgradeTbtFile(t, upgraded);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> encoded;
+
+        ret = encodeTbtBytes(upgraded, encoded);
+        ASSERT_EQ(ret, OK);
+
+        tbt_file reparsed;
+
+        auto it = encoded.cbegin();
+
+        ret = parseTbtBytes(it, encoded.cend(), reparsed);
+        ASSERT_EQ(ret, OK) << path;
+
+        EXPECT_EQ(tbtFileVersionNumber(reparsed), 0x72) << path;
+
+        ret = verifyUpgradedTbtFile(t, reparsed);
+        EXPECT_EQ(ret, OK) << path;
+    }
+
+    //
+    // 0x6f stores the length of the song, and it is kept
+    //
+    tbt_file t;
+
+    Status ret = parseTbtFile("data/back.tbt", t);
+    ASSERT_EQ(ret, OK);
+
+    tbt_file upgraded;
+
+    ret = upgradeTbtFile(t, upgraded);
+    ASSERT_EQ(ret, OK);
+
+    const auto &t6f = std::get<tbt_file6f>(t);
+    const auto &t71 = std::get<tbt_file71>(upgraded);
+
+    EXPECT_EQ(t71.body.barLinesSpaceCount, t6f.header.spaceCount);
+    EXPECT_EQ(t71.metadata.tracks[0].spaceCount, t71.body.barLinesSpaceCount);
+}
+
+
+//
+// no test file is older than 0x6f, so make one
+//
+TEST_F(TbtEncodeTest, UpgradeOldVersion) {
+
+    tbt_file65 t65{};
+
+    t65.header.magic = { 'T', 'B', 'T' };
+    t65.header.versionNumber = 0x65;
+    t65.header.tempo1 = 120;
+    t65.header.trackCount = 1;
+    t65.header.versionString = { 3, '1', '.', '0', 0 };
+
+    tbt_track_metadata65 track{};
+
+    track.stringCount = 6;
+    track.cleanGuitar = 25;
+    track.volume = 100;
+    track.tuning = { 0, 0, 0, 0, 0, -2 }; // drop D, and strings are from highest to lowest
+
+    t65.metadata.tracks.push_back(track);
+    t65.metadata.title = { 3, 'a', 'b', 'c' };
+    t65.metadata.artist = { 0 };
+    t65.metadata.comment = { 0 };
+
+    t65.body.barLinesMap[15] = { SINGLE };
+    t65.body.barLinesMap[16] = { OPEN };
+    t65.body.barLinesMap[31] = { static_cast<uint8_t>(CLOSE | (3 << 4)) };
+    t65.body.barLinesMap[47] = { SINGLE };
+
+    maps65 maps;
+
+    std::array<uint8_t, 16> vsqs{};
+
+    vsqs[5] = 0x80 + 0; // low string, open
+    vsqs[6 + 6 + 0] = 'T';
+    vsqs[6 + 6 + 3] = 90;
+
+    maps.notesMap[0] = vsqs;
+
+    vsqs = {};
+
+    vsqs[0] = 0x80 + 3; // high string, 3rd fret
+
+    maps.notesMap[20] = vsqs;
+
+    t65.body.mapsList.push_back(maps);
+
+    tbt_file t = t65;
+
+    tbt_file upgraded;
+
+    Status ret = upgradeTbtFile(t, upgraded);
+    ASSERT_EQ(ret, OK);
+
+    const auto &t71 = std::get<tbt_file71>(upgraded);
+
+    //
+    // ends after the close repeat, not at 4000
+    //
+    EXPECT_EQ(t71.body.barLinesSpaceCount, 32);
+
+    ASSERT_EQ(t71.body.barLinesMap.size(), 2u);
+    EXPECT_EQ(t71.body.barLinesMap.at(0), (std::array<uint8_t, 2>{ 0, 0 }));
+    EXPECT_EQ(t71.body.barLinesMap.at(16), (std::array<uint8_t, 2>{ OPENREPEAT_MASK_GE70 | CLOSEREPEAT_MASK_GE70, 3 }));
+
+    EXPECT_EQ(t71.metadata.title, (std::vector<char>{ 3, 0, 'a', 'b', 'c' }));
+
+    //
+    // the low string is now string 0, with the same pitch
+    //
+    EXPECT_EQ(t71.metadata.tracks[0].tuning[0], -2);
+    EXPECT_EQ(t71.body.mapsList[0].notesMap.at(0)[0], 0x80);
+    EXPECT_EQ(t71.body.mapsList[0].notesMap.at(20)[5], 0x83);
+
+    //
+    // the tempo change moved out of the notes
+    //
+    ASSERT_EQ(t71.body.mapsList[0].trackEffectChanges.size(), 1u);
+    EXPECT_EQ(t71.body.mapsList[0].trackEffectChanges[0].effect, TE_TEMPO);
+    EXPECT_EQ(t71.body.mapsList[0].trackEffectChanges[0].value, 90);
+    EXPECT_EQ(t71.body.mapsList[0].notesMap.at(0)[16], 0);
+
+    std::vector<uint8_t> encoded;
+
+    ret = encodeTbtBytes(upgraded, encoded);
+    ASSERT_EQ(ret, OK);
+
+    tbt_file reparsed;
+
+    auto it = encoded.cbegin();
+
+    ret = parseTbtBytes(it, encoded.cend(), reparsed);
+    ASSERT_EQ(ret, OK);
+
+    ret = verifyUpgradedTbtFile(t, reparsed);
+    EXPECT_EQ(ret, OK);
+
+    //
+    // old versions cannot be encoded directly
+    //
+    ret = encodeTbtBytes(t, encoded);
+    EXPECT_NE(ret, OK);
+}
+
+
+
+
+
+
+
+
+
+
+
+
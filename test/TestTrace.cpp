@@ -0,0 +1,139 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tbt-parser/trace.h"
+
+#include "tbt-parser.h"
+
+#include "common/file.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <thread>
+#include <cstdio> // for remove
+
+
+class TraceTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {}
+
+    static void TearDownTestSuite() {}
+
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+
+TEST_F(TraceTest, disabled) {
+
+    EXPECT_FALSE(traceEnabled());
+
+    {
+        trace_span span("not recorded");
+    }
+
+    traceBegin();
+
+    EXPECT_TRUE(traceEnabled());
+
+    Status ret = traceEnd("trace-test-disabled.json");
+    ASSERT_EQ(ret, OK);
+
+    EXPECT_FALSE(traceEnabled());
+
+    std::vector<uint8_t> data;
+
+    ret = openFile("trace-test-disabled.json", data);
+    ASSERT_EQ(ret, OK);
+
+    auto json = std::string(data.cbegin(), data.cend());
+
+    EXPECT_EQ(json.find("not recorded"), std::string::npos);
+
+    std::remove("trace-test-disabled.json");
+}
+
+
+TEST_F(TraceTest, stages) {
+
+    traceBegin();
+
+    //
+    // convert on another thread to check that every thread's buffer is written out
+    //
+    std::thread th([]() {
+
+        tbt_file t;
+
+        Status ret = parseTbtFile("data/twinkle.tbt", t);
+        ASSERT_EQ(ret, OK);
+
+        midi_convert_opts opts;
+
+        midi_file m;
+
+        ret = convertToMidi(t, opts, m);
+        ASSERT_EQ(ret, OK);
+
+        std::vector<uint8_t> out;
+
+        ret = exportMidiBytes(m, out);
+        ASSERT_EQ(ret, OK);
+    });
+
+    th.join();
+
+    {
+        trace_span span("main \"thread\"", "path", "C:\\tabs");
+    }
+
+    Status ret = traceEnd("trace-test-stages.json");
+    ASSERT_EQ(ret, OK);
+
+    std::vector<uint8_t> data;
+
+    ret = openFile("trace-test-stages.json", data);
+    ASSERT_EQ(ret, OK);
+
+    auto json = std::string(data.cbegin(), data.cend());
+
+    EXPECT_THAT(json, testing::StartsWith("{\"traceEvents\":["));
+
+    for (const auto *name : { "\"read\"", "\"crc\"", "\"inflate body\"", "\"expand notes\"", "\"tempo map\"", "\"repeats\"", "\"track events\"", "\"export\"" }) {
+        EXPECT_THAT(json, testing::HasSubstr(name));
+    }
+
+    EXPECT_THAT(json, testing::HasSubstr("\"path\":\"data/twinkle.tbt\""));
+    EXPECT_THAT(json, testing::HasSubstr("\"main \\\"thread\\\"\""));
+    EXPECT_THAT(json, testing::HasSubstr("\"C:\\\\tabs\""));
+
+    std::remove("trace-test-stages.json");
+}
+
+
+
+
+
+
+
+
+
+
@@ -103,6 +103,39 @@ TEST_F(UtilTest, zlib_inflate1) {
   ASSERT_EQ(inflated, test);
 }
 
+TEST_F(UtilTest, zlib_inflate_bounded) {
+
+  std::vector<uint8_t> data{0x78, 0xda, 0x63, 0x93, 0x96, 0x49, 0x60,
+                            0x00, 0x02, 0x07, 0x09, 0x86, 0xff, 0x0c,
+                            0xd8, 0x00, 0x00, 0x31, 0x55, 0x01, 0xf5};
+
+  //
+  // inflates to 33 bytes
+  //
+
+  auto it = data.cbegin();
+
+  auto end = data.cend();
+
+  std::vector<uint8_t> inflated;
+
+  Status ret = zlib_inflate(it, end, 33, 64, inflated);
+
+  ASSERT_EQ(ret, OK);
+
+  ASSERT_EQ(inflated.size(), 33);
+
+  ASSERT_GE(inflated.capacity(), 33);
+
+  it = data.cbegin();
+
+  inflated.clear();
+
+  ret = zlib_inflate(it, end, 32, 0, inflated);
+
+  ASSERT_EQ(ret, ERR);
+}
+
 TEST_F(UtilTest, splitAt1) {
 
   std::vector<std::vector<uint8_t> > pairs{{1, 2}, {0, 1}, {2, 0}, {2, 2},
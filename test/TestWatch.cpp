@@ -0,0 +1,219 @@
+// Copyright (C) 2024 by Brenton Bostick
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "tbt-parser/watch.h"
+
+#include "common/file.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <algorithm> // for find, sort
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+
+class WatchTest : public ::testing::Test {
+protected:
+
+    static void SetUpTestSuite() {
+
+    }
+
+    static void TearDownTestSuite() {
+
+        
+    }
+
+    void SetUp() override {
+
+        dir = std::filesystem::temp_directory_path() / "tbt-watch-test";
+
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+
+        std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+};
+
+
+TEST_F(WatchTest, Changes) {
+
+    directory_watcher watcher;
+
+    watch_opts opts;
+
+    opts.debounce_ms = 50;
+    opts.poll_ms = 20;
+
+    Status ret = watcher.open(dir.string(), ".tbt", opts);
+    ASSERT_EQ(ret, OK);
+
+    std::thread writer([&]() {
+
+        //
+        // a burst of writes to the same file, and a file that is not watched
+        //
+        for (int i = 0; i < 3; i++) {
+
+            std::vector<uint8_t> data(static_cast<size_t>(10 + i), 0);
+
+            ASSERT_EQ(saveFile((dir / "a.tbt").string().c_str(), data), OK);
+
+            ASSERT_EQ(saveFile((dir / "a.mid").string().c_str(), data), OK);
+        }
+
+        ASSERT_EQ(saveFileAtomically((dir / "b.tbt").string(), { 1, 2, 3 }), OK);
+    });
+
+    std::vector<std::string> seen;
+
+    while (seen.size() < 2) {
+
+        std::vector<std::string> changed;
+
+        ASSERT_TRUE(watcher.next(changed));
+
+        for (const auto &path : changed) {
+            if (std::find(seen.begin(), seen.end(), path) == seen.end()) {
+                seen.push_back(path);
+            }
+        }
+    }
+
+    writer.join();
+
+    std::sort(seen.begin(), seen.end());
+
+    EXPECT_EQ(seen, (std::vector<std::string>{ (dir / "a.tbt").string(), (dir / "b.tbt").string() }));
+
+    EXPECT_FALSE(std::filesystem::exists(dir / "b.tbt.tmp"));
+}
+
+
+TEST_F(WatchTest, Stop) {
+
+    directory_watcher watcher;
+
+    Status ret = watcher.open(dir.string(), ".tbt", watch_opts{});
+    ASSERT_EQ(ret, OK);
+
+    std::thread stopper([&]() {
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        watcher.stop();
+    });
+
+    std::vector<std::string> changed;
+
+    EXPECT_FALSE(watcher.next(changed));
+
+    stopper.join();
+}
+
+
+TEST_F(WatchTest, Run) {
+
+    //
+    // a.tbt has no output, and b.tbt has an output that is up to date
+    //
+    ASSERT_EQ(saveFile((dir / "a.tbt").string().c_str(), { 1 }), OK);
+    ASSERT_EQ(saveFile((dir / "b.tbt").string().c_str(), { 2 }), OK);
+    ASSERT_EQ(saveFile((dir / "b.out").string().c_str(), { 2 }), OK);
+
+    directory_watcher watcher;
+
+    watch_opts opts;
+
+    opts.debounce_ms = 50;
+    opts.poll_ms = 20;
+
+    Status ret = watcher.open(dir.string(), ".tbt", opts);
+    ASSERT_EQ(ret, OK);
+
+    std::mutex mutex;
+
+    std::vector<std::string> processed;
+
+    std::thread runner([&]() {
+
+        watcher.run(".out", [&](const std::string &path) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            processed.push_back(path);
+        });
+    });
+
+    auto waitFor = [&](size_t count) {
+
+        for (int i = 0; i < 200; i++) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (processed.size() >= count) {
+                    return;
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    };
+
+    waitFor(1);
+
+    ASSERT_EQ(saveFileAtomically((dir / "c.tbt").string(), { 3 }), OK);
+
+    waitFor(2);
+
+    watcher.stop();
+
+    runner.join();
+
+    EXPECT_EQ(processed, (std::vector<std::string>{ (dir / "a.tbt").string(), (dir / "c.tbt").string() }));
+}
+
+
+TEST_F(WatchTest, BadDirectory) {
+
+    directory_watcher watcher;
+
+    Status ret = watcher.open((dir / "does-not-exist").string(), ".tbt", watch_opts{});
+
+    EXPECT_NE(ret, OK);
+}
+
+
+
+
+
+
+
+
+
+
+